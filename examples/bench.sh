@@ -0,0 +1,60 @@
+#!/usr/bin/env bash
+
+# Builds every example with x64 and c backends and times both executables.
+# Third build is x64 with a profile, written by running example in
+# interpreter for at most $steps opcodes with the same input.
+# Most examples animate forever, so run is cut after first N bytes of output
+# or after time limit, whichever comes first.
+#
+# usage: ./bench.sh [bytes of output, default 200000] [runs, default 3] [limit, default 10 s]
+
+slm=${SLM:-"../bin/slm-r"}
+bytes=${1:-200000}
+runs=${2:-3}
+limit=${3:-10}
+steps=20000000
+bin_dir="bin/bench"
+input=$'5\n7\n12\n3+4*2\n'
+
+rm -rf "$bin_dir"
+mkdir -p "$bin_dir"
+
+# best of $runs, seconds
+measure() {
+    local best=""
+    for ((i = 0; i < runs; i++)); do
+        local start=$(date +%s.%N)
+        printf '%s' "$input" | timeout "$limit" "$1" 2>/dev/null | head -c "$bytes" > "$1.out"
+        local end=$(date +%s.%N)
+        best=$(echo "$start $end $best" | awk '{ t = $2 - $1; if ($3 != "" && $3 < t) t = $3; printf "%.3f", t }')
+    done
+    echo "$best"
+}
+
+printf "%-24s %10s %10s %8s %10s\n" "example" "x64, s" "c, s" "speedup" "x64+pgo, s"
+
+for file in *.slm; do
+    name="${file%.*}"
+
+    $slm "$file" --no-ansi --backend=x64 --output "$bin_dir/${name}_x64" > "$bin_dir/${name}_x64.log" 2>&1
+    $slm "$file" --no-ansi --backend=c   --output "$bin_dir/${name}_c"   > "$bin_dir/${name}_c.log"   2>&1
+
+    printf '%s' "$input" | $slm "$file" --no-ansi --interp-step-limit $steps --profile-generate="$bin_dir/${name}.prof" > /dev/null 2>&1
+    $slm "$file" --no-ansi --backend=x64 --profile-use="$bin_dir/${name}.prof" --output "$bin_dir/${name}_pgo" > "$bin_dir/${name}_pgo.log" 2>&1
+
+    if [ ! -x "$bin_dir/${name}_x64" ] || [ ! -x "$bin_dir/${name}_c" ] || [ ! -x "$bin_dir/${name}_pgo" ]; then
+        printf "%-24s %s\n" "$name" "build failed, see $bin_dir/${name}_*.log"
+        continue
+    fi
+
+    x64=$(measure "$bin_dir/${name}_x64")
+    c=$(measure "$bin_dir/${name}_c")
+    pgo=$(measure "$bin_dir/${name}_pgo")
+
+    if ! cmp -s "$bin_dir/${name}_x64.out" "$bin_dir/${name}_c.out" || ! cmp -s "$bin_dir/${name}_x64.out" "$bin_dir/${name}_pgo.out"; then
+        printf "%-24s %s\n" "$name" "outputs differ"
+        continue
+    fi
+
+    printf "%-24s %10s %10s %8s %10s\n" "$name" "$x64" "$c" "$(echo "$x64 $c" | awk '{ if ($2 > 0) printf "%.2fx", $1 / $2; else print "-" }')" "$pgo"
+done
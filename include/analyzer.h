@@ -39,6 +39,7 @@ struct type_info_t {
     u32 offset;        // struct offset
     u32 size;          // var size
     u32 pointer_depth;
+    u32 lanes;         // vector types: type is the lane type, size is 16 or 32
     string_t type_name;
 };
 
@@ -74,6 +75,7 @@ struct scope_entry_t {
 
     s64 offset;
     b32 on_stack;
+    b32 reachable; // ENTRY_FUNC, see deadcode.h
 };
 
 enum entry_type_t {
@@ -86,8 +88,29 @@ enum entry_type_t {
 b32 analyzer_preload_all_files(compiler_t *compiler);
 b32 analyze(compiler_t *compiler);
 
-b32 load_and_process_file(compiler_t *compiler, string_t filename);
+b32 load_and_process_file(compiler_t *compiler, string_t filename, b32 is_module);
 void set_std_info(u64 token_type, type_info_t *info);
 b32 compare_std_info(type_info_t lhs, type_info_t rhs);
+b32 is_vector_info(type_info_t info);
+
+// intrinsics are not keywords, a call by one of their names is an intrinsic
+// when nothing with that name is declared where call is
+enum intrinsic_t {
+    INTRINSIC_NONE,
+
+    INTRINSIC_MEM_FILL,
+    INTRINSIC_MEM_COPY,
+    INTRINSIC_MEM_MOVE,
+
+    INTRINSIC_POPCOUNT,
+    INTRINSIC_CLZ,
+    INTRINSIC_CTZ,
+    INTRINSIC_BSWAP,
+    INTRINSIC_ROTL,
+    INTRINSIC_ROTR,
+};
+
+u64 get_intrinsic(string_t name);
+u64 get_intrinsic_params(u64 intrinsic);
 
 #endif // ANALYZER_H
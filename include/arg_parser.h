@@ -12,6 +12,20 @@ enum argument_types_t {
     ARG_VERBOSE,
     ARG_SHOW_LINK_TIME,
     ARG_OUTPUT_FILE_NAME,
+    ARG_EMIT_BYTECODE,
+    ARG_STRIP_DEBUG,
+    ARG_COMPTIME_CACHE,
+    ARG_INTERP_PROFILE,
+    ARG_INTERP_PROFILE_JSON,
+    ARG_INTERP_STEP_LIMIT,
+    ARG_DEBUG_INFO,
+    ARG_BACKEND,
+    ARG_TARGET,
+    ARG_EMIT_OBJECT,
+    ARG_RUN,
+    ARG_JOBS,
+    ARG_PROFILE_GENERATE,
+    ARG_PROFILE_USE,
 };
 
 struct argument_t {
@@ -20,4 +34,5 @@ struct argument_t {
 };
 
 argument_t parse_argument(string_t input);
+b32        parse_argument_number(string_t input, u64 *output);
 #endif
@@ -8,12 +8,137 @@
 #include "allocator.h"
 #include "ir.h"
 
-struct backend_t {
-    b32         is_valid;
-    allocator_t alloc;
-    list_t<u8>  code;
+struct sink_t;
+
+// text is written through output as functions are generated
+b32 nasm_compile_program(ir_t *state, sink_t *output);
+
+// portable C99, meant to be built by an optimizing C compiler
+b32 c_compile_program(ir_t *state, sink_t *output);
+
+//
+// Address selection of native backends. Element access is lowered as
+// base; index; PUSH_SIGN size; MUL; ADD, member offsets as PUSH_SIGN offset; ADD
+// and then comes LOAD*, STORE* or NOP of ^. Base and index are single pushes
+// or values already on exec stack, all of it becomes one x86 memory operand
+// [base + index * scale + disp], used directly or by lea.
+//
+
+enum backend_address_part_t {
+    BACKEND_ADDRESS_NONE,
+    BACKEND_ADDRESS_STACK,        // value on exec stack
+    BACKEND_ADDRESS_LOCAL,        // value of slot (operand)
+    BACKEND_ADDRESS_GLOBAL,       // value of global (operand)
+    BACKEND_ADDRESS_LOCAL_EA,     // address of slot, base only
+    BACKEND_ADDRESS_GLOBAL_EA,    // address of global, base only
+};
+
+struct backend_address_t {
+    u32 base;
+    u64 base_operand;
+    u32 index;
+    u64 index_operand;
+    u64 scale;   // 1, 2, 4 or 8
+    s64 disp;    // constant indices and member offsets, slot and global offsets aren't in it
+    u64 stack;   // exec stack entries taken, base is below index
+    u64 access;  // LOAD*, STORE*, IR_NOP when only address is pushed
+    u64 count;   // opcodes, access included
+};
+
+// sequence starting at i that nothing jumps into, after its first opcode
+b32 backend_match_address(ir_function_t *func, b8 *jump_targets, u64 i, backend_address_t *address);
+
+//
+// Instruction selection of vector opcodes for native backends. Left operand
+// is in xmm0 and right one in xmm1, dst = dst op src leaves the result in dst.
+// 256 bit vectors use the same instruction on ymm registers with VEX, or on
+// both halves. Integer multiplication, 64 bit compares and equality of 64 bit
+// lanes need SSE4.1/4.2 (pmulld, pcmpeqq, pcmpgtq), everything else is SSE2.
+//
+
+struct backend_vector_op_t {
+    const char *name;   // SSE mnemonic, VEX one is v<name> dst, dst, src
+    u32 flags;          // BACKEND_VECTOR_66
+    u32 opcode;         // 0x0Fxx or 0x0F38xx
+    u8  dst;            // xmm register number
+    u8  src;
+    s32 imm;            // predicate of cmpps/cmppd, -1 for none
+    u64 bias;           // unsigned compares: xor-ed into both operands first, per 64 bits
+    b32 invert;         // result is negated at the end
+};
+
+#define BACKEND_VECTOR_66 0x1 // operand size prefix
+
+// false when there is no instruction for this lane type, ir.cpp doesn't emit those
+b32 backend_select_vector(u64 operation, u64 vector, backend_vector_op_t *select);
+
+// value zero extended to lane size times this fills every lane of 64 bits
+u64 backend_splat_multiplier(u64 lane);
+
+//
+// Machine code backend, IR goes straight to x86-64 without assembler.
+// Every reference from .text to a symbol is a rel32 relocation, so the
+// same module can be written as ELF object, executable or loaded in memory.
+//
+
+enum x64_section_t {
+    X64_SECTION_NONE, // undefined, resolved by linker
+    X64_SECTION_TEXT,
+    X64_SECTION_DATA,
+    X64_SECTION_BSS,
+
+    X64_SECTION_COUNT,
+};
+
+enum x64_runtime_t {
+    X64_RUNTIME_NONE,  // putchar, getchar and debug_break stay undefined
+    X64_RUNTIME_LINUX, // _start and externals on raw syscalls
+    X64_RUNTIME_HOST,  // externals call through __jit_host_functions, see jit.h, divisor 0 gives 0
+};
+
+// filled by whoever loads X64_RUNTIME_HOST module
+enum x64_host_function_t {
+    X64_HOST_PUTCHAR,
+    X64_HOST_GETCHAR,
+    X64_HOST_DEBUG_BREAK,
+
+    X64_HOST_FUNCTION_COUNT,
+};
+
+struct x64_symbol_t {
+    string_t name;
+    u64      section;
+    u64      offset;
+    b32      is_global;
 };
 
-backend_t nasm_compile_program(ir_t *state);
+// value at offset in .text is S + addend - P, 32 bits
+struct x64_relocation_t {
+    u64 offset;
+    u64 symbol;
+    s64 addend;
+    b32 is_call;
+};
+
+struct x64_module_t {
+    b32 is_valid;
+
+    list_t<u8> text;
+    list_t<u8> data;
+    u64        bss_size;
+
+    list_t<x64_symbol_t>     symbols;
+    list_t<x64_relocation_t> relocations;
+    hashmap_t<string_t, u64> symbol_index;
+};
+
+x64_module_t x64_compile_program(ir_t *state, u64 runtime);
+void         x64_module_delete(x64_module_t *module);
+
+// patches relocations in text copy, addresses are where each section is loaded
+b32 x64_link(x64_module_t *module, u8 *text, u64 addresses[X64_SECTION_COUNT]);
+
+b32 elf_write_object(x64_module_t *module, string_t filename);
+b32 elf_write_executable(x64_module_t *module, string_t filename);
 
 #endif // BACKEND_H
@@ -0,0 +1,89 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include "stddefines.h"
+#include "ir.h"
+
+//
+// Binary IR module (.slmbc)
+//
+// [header] [function table] [code] [globals] [debug] [string pool]
+//
+// Every reference inside of the file is an offset from the start of
+// the file or an index into a section, so it can be mapped anywhere.
+// Bump the version when ir_codes_t or any of these layouts change.
+//
+// Loading maps the file read only, but code is not run from the mapping:
+// names and strings point into it, opcodes are copied into ir_t, since
+// interpreter decodes its own stream from ir_function_t on first call.
+// Load stays O(module) anyway, every jump and call target is validated
+// before anything runs.
+//
+
+#define BYTECODE_MAGIC   0x424D4C53 // "SLMB"
+#define BYTECODE_VERSION 8
+
+#define BYTECODE_EXTENSION "slmbc"
+
+enum {
+    BYTECODE_FUNC_EXTERNAL = 0x1,
+};
+
+struct bytecode_header_t {
+    u32 magic;
+    u32 version;
+    u64 file_size;
+
+    u64 functions_offset;
+    u64 functions_count;
+
+    u64 code_offset;
+    u64 code_count;
+
+    u64 globals_offset;
+    u64 globals_count;
+
+    u64 debug_offset; // optional, count is 0 or code_count
+    u64 debug_count;
+
+    u64 strings_offset;
+    u64 strings_size;
+};
+
+struct bytecode_string_t {
+    u32 offset; // into string pool
+    u32 size;
+};
+
+struct bytecode_function_t {
+    bytecode_string_t name;
+    u64 code_start; // index of first opcode in code section
+    u64 code_count;
+    u64 flags;
+    u32 register_args;
+    u32 register_returns;
+};
+
+struct bytecode_opcode_t {
+    u32 operation;
+    u32 reserved;
+    u64 operand;
+    bytecode_string_t string;
+};
+
+struct bytecode_debug_t {
+    bytecode_string_t filename;
+    u32 line;
+    u32 column;
+};
+
+struct bytecode_module_t {
+    string_t mapping;
+    ir_t     ir;
+};
+
+b32  bytecode_write(ir_t *ir, string_t filename, b32 with_debug);
+b32  bytecode_load(string_t filename, bytecode_module_t *module);
+void bytecode_unload(bytecode_module_t *module);
+
+#endif // BYTECODE_H
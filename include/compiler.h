@@ -9,6 +9,7 @@
 #include "logger.h"
 
 #include "analyzer.h"
+#include "deadcode.h"
 
 #define STRING_ALLOCATOR_INIT_SIZE 4096
 #define INIT_NODES_SIZE 2048
@@ -19,10 +20,14 @@ struct ast_node_t;
 struct source_file_t {
     scanner_t          *scanner;
     list_t<ast_node_t*> parsed_roots;
+    b32                 is_module; // found by use: in modules path, or used by such file
 };
 
 struct compiler_t {
     b32 valid;
+    s64 exit_code; // result of main with --run
+
+    deadcode_stats_t deadcode;
 
     allocator_t *strings;
     allocator_t *nodes;
@@ -35,6 +40,12 @@ struct compiler_t {
 
 source_file_t create_source_file(allocator_t *alloc);
 compiler_t create_compiler_instance(allocator_t *alloc);
-void compile(compiler_t *state);
+b32  compile(compiler_t *state);
+
+// target from config with TARGET_HOST resolved
+u64 compiler_target(void);
+
+// loads .slmbc module and interprets its main
+b32  run_bytecode(string_t filename, s64 *exit_code);
 
 #endif
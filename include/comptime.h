@@ -0,0 +1,42 @@
+#ifndef COMPTIME_H
+#define COMPTIME_H
+
+#include "stddefines.h"
+#include "ir.h"
+
+//
+// comptime f(args) is compiled into a placeholder PUSH_SIGN,
+// after the whole program is in IR we run every call in interpreter
+// and write the result into that placeholder.
+//
+// Calls that global initialisers run are evaluated before them and can't
+// read globals. The rest are evaluated after, they see initialised globals,
+// which are restored after every call.
+//
+// Results are memoised by callee and argument values. When cache file is
+// given, they are also stored there under the hash of all IR reachable from
+// the callee, and of globals when that IR reads them, so changed code or
+// initial values are recomputed and untouched code is not.
+// Calls that reach external functions are never stored on disk.
+//
+
+#define COMPTIME_CACHE_MAGIC     0x43544C53 // "SLTC"
+#define COMPTIME_CACHE_VERSION   2
+#define COMPTIME_CACHE_EXTENSION "slmcache"
+
+struct comptime_cache_header_t {
+    u32 magic;
+    u32 version;
+    u64 count;
+};
+
+struct comptime_cache_entry_t {
+    u64 hash;
+    s64 value;
+};
+
+// called twice: before global initialisers with globals_ready false, then after them,
+// cache_filename can be empty, then nothing is read or written
+b32 comptime_evaluate(ir_t *ir, string_t cache_filename, b32 globals_ready);
+
+#endif // COMPTIME_H
@@ -0,0 +1,37 @@
+#ifndef DEADCODE_H
+#define DEADCODE_H
+
+#include "stddefines.h"
+
+//
+// Dead function elimination, in two steps.
+//
+// deadcode_mark runs between global and code analysis. It walks AST from
+// main and from initialisers of globals and sets reachable on every
+// function that can be called. Any identifier with a name of global
+// function counts as a call, so shadowing locals only make it
+// conservative. Unreachable functions that come from modules are not
+// analysed, no unreachable function gets IR.
+//
+// deadcode_sweep runs on IR after compile time code is done, now only
+// from main, so functions used only by comptime calls and global
+// initialisers don't reach backend.
+//
+
+struct compiler_t;
+struct scope_entry_t;
+struct ir_t;
+
+struct deadcode_stats_t {
+    u64 functions;     // all functions of the program
+    u64 unreachable;   // never got IR
+    u64 source_bytes;  // of their definitions
+    u64 compile_time;  // had IR, dropped by sweep
+    u64 ir_bytes;      // of their code
+};
+
+void deadcode_mark(compiler_t *compiler);
+b32  deadcode_can_skip_analysis(compiler_t *compiler, scope_entry_t *entry);
+void deadcode_sweep(compiler_t *compiler, ir_t *ir);
+
+#endif // DEADCODE_H
@@ -4,6 +4,69 @@
 #include "stddefines.h"
 #include "ir.h"
 
+//
+// Before running a function interpreter decodes its IR into own stream,
+// where jumps are absolute and frequent opcode sequences are fused
+// into a single dispatch. Sequences were picked by counting adjacent
+// opcode pairs over examples and modules/core. IR itself is untouched.
+//
+
+// bytes for locals and ALLOC, an allocation past it stops the interpreter,
+// modules asking for more in one opcode are rejected on load
+#define INTEROP_DATA_STACK_SIZE (256ull * 1024 * 1024)
+
+enum interop_fused_codes_t {
+    INTEROP_PUSH_SIGN_STACK = IR_INVALID + 1, // PUSH_SIGN, PUSH_STACK        (argument lists, binary ops)
+    INTEROP_IMM_OP,                           // PUSH_SIGN, binop             (imm op top)
+    INTEROP_STACK_IMM_OP,                     // PUSH_SIGN, PUSH_STACK, binop (local op imm)
+    INTEROP_LOAD_STACK,                       // PUSH_SEA, LOAD
+    INTEROP_STORE_STACK,                      // PUSH_SEA, STORE
+    INTEROP_CMP_JUMP_IF_NOT,                  // CMP_xx, JUMP_IF_NOT          (while and if conditions)
+    INTEROP_STACK_IMM_CMP_JUMP_IF_NOT,        // PUSH_SIGN, PUSH_STACK, CMP_xx, JUMP_IF_NOT
+    INTEROP_JUMP_IF_NOT_OR_POP,               // CLONE, JUMP_IF_NOT, POP      (&&)
+    INTEROP_JUMP_IF_OR_POP,                   // CLONE, JUMP_IF, POP          (||)
+
+    INTEROP_OPCODE_COUNT,
+};
+
+const char *interop_code_to_string(u64 operation);
+
+struct interop_function_profile_t {
+    string_t name;
+    u64 code_count;
+
+    u64 calls;
+    u64 steps;      // IR opcodes executed inside of this function
+    u64 active;     // recursion depth, inclusive time is taken only by outermost call
+    f64 inclusive;
+    f64 self;
+
+    u64 *hits;      // executions of each opcode, for source lines
+    u64 *taken;     // times each conditional jump went to its target
+};
+
+struct interop_profile_t {
+    b32 collect;    // without it only the step limit is checked
+    u64 step_limit; // 0 means no limit
+
+    u64 steps;      // IR opcodes, fused ones count every opcode they cover
+    u64 dispatches; // decoded opcodes, fused ones count once
+    u64 opcodes[INTEROP_OPCODE_COUNT];
+
+    list_t<interop_function_profile_t> functions;
+    hashmap_t<string_t, u64>           function_index;
+};
+
 b32 interop_func(ir_t *state, string_t func_name);
 
+// runs function with arguments and returns top of the exec stack in result, if there is one
+b32 interop_call(ir_t *state, string_t func_name, s64 *args, u64 arg_count, s64 *result);
+
+// every next interop call is counted into the profile, NULL turns it off
+void interop_set_profile(interop_profile_t *profile);
+
+void interop_profile_print(ir_t *ir, interop_profile_t *profile);
+b32  interop_profile_write_json(ir_t *ir, interop_profile_t *profile, string_t filename);
+void interop_profile_delete(interop_profile_t *profile);
+
 #endif
@@ -42,7 +42,7 @@ enum ir_codes_t {
     
     // ------- second stack memory!
     
-    IR_STACK_FRAME_PUSH,
+    IR_STACK_FRAME_PUSH, // Push frame and reserve slots for all locals (slots)
     IR_STACK_FRAME_POP,
 
     IR_ALLOC,       // Allocate memory   (amount)
@@ -50,6 +50,19 @@ enum ir_codes_t {
     IR_LOAD,        // Load from address [address]
     IR_STORE,       // Store to address  [address] [value]
 
+    // Sized memory access, loads extend to 64 bits
+    IR_LOAD8S,      // Load  s8  [address]
+    IR_LOAD8U,      // Load  u8  [address]
+    IR_LOAD16S,     // Load  s16 [address]
+    IR_LOAD16U,     // Load  u16 [address]
+    IR_LOAD32S,     // Load  s32 [address]
+    IR_LOAD32U,     // Load  u32 [address]
+    IR_STORE8,      // Store low 8  bits [address] [value]
+    IR_STORE16,     // Store low 16 bits [address] [value]
+    IR_STORE32,     // Store low 32 bits [address] [value]
+    IR_LOADF32,     // Load  f32 widened to f64 [address]
+    IR_STOREF32,    // Store f64 rounded to f32 [address] [value]
+
     // math [left] [right]
     IR_ADD,
     IR_SUB,
@@ -77,6 +90,61 @@ enum ir_codes_t {
     // Logical operations
     IR_LOG_NOT,    
 
+    // Floating point, values on the stack are f64 bits [left] [right]
+    IR_FADD,
+    IR_FSUB,
+    IR_FMUL,
+    IR_FDIV,
+    IR_FNEG,
+
+    // Floating point comparisons (push 1/0), false when unordered except NEQ
+    IR_FCMP_EQ,
+    IR_FCMP_NEQ,
+    IR_FCMP_LT,
+    IR_FCMP_GT,
+    IR_FCMP_LTE,
+    IR_FCMP_GTE,
+
+    IR_INT_TO_FLOAT, // s64 to f64
+    IR_FLOAT_TO_INT, // f64 to s64, truncated, out of range gives INT64_MIN like cvttsd2si
+    IR_ROUND_F32,    // f64 rounded to f32 and widened back, like STOREF32 and LOADF32 do
+
+    // Vectors take 2 or 4 entries of the stack, lane 0 is in the deepest
+    // one, so entries have the layout of memory. Operand is IR_VECTOR(lane, size)
+    IR_VLOAD,        // Load vector  [address]
+    IR_VSTORE,       // Store vector [address] [vector]
+    IR_VSPLAT,       // Vector with every lane set to [value], f32 lanes take f64 bits
+
+    // Lane-wise math [left] [right], VDIV only for float lanes
+    IR_VADD,
+    IR_VSUB,
+    IR_VMUL,
+    IR_VDIV,
+    IR_VAND,
+    IR_VOR,
+    IR_VXOR,
+
+    // Lane-wise comparisons, mask with all bits of a lane set or cleared
+    IR_VCMP_EQ,
+    IR_VCMP_NEQ,
+    IR_VCMP_LT,
+    IR_VCMP_GT,
+    IR_VCMP_LTE,
+    IR_VCMP_GTE,
+
+    // Bulk memory, element type of MEM_FILL is ir_lane_t operand, f32 takes f64 bits
+    IR_MEM_FILL,     // Set elements to value [address] [value] [count]
+    IR_MEM_COPY,     // Copy bytes [destination] [source] [size], ranges don't overlap
+    IR_MEM_MOVE,     // Same as MEM_COPY, ranges can overlap
+
+    // Bit operations on the low bytes of [value], operand is its ir_lane_t
+    IR_POPCOUNT,
+    IR_CLZ,          // width of the lane for 0
+    IR_CTZ,          // width of the lane for 0
+    IR_BSWAP,        // extended like a load of the lane
+    IR_ROTL,         // [value] [count], extended like a load of the lane
+    IR_ROTR,
+
     // Control flow (offset)
     IR_JUMP,       // Unconditional jump (offset operand)
     IR_JUMP_IF,    // Jump if top != 0 ()
@@ -86,6 +154,8 @@ enum ir_codes_t {
     // Function calls
     IR_CALL,       // Call function (address on stack)
 
+    IR_ALIGN,      // Code of next opcode starts at multiple of (bytes), hint for native backends
+
     // System
     IR_BRK,        // Breakpoint
     IR_INVALID,        // Invalid instruction
@@ -105,22 +175,77 @@ struct ir_opcode_t {
     string_t string;
 };
 
+// Internal calling convention, leading scalar parameters and a single
+// return value go through registers in native code, the rest and every
+// external call through the exec stack. Interpreter keeps all of them on
+// its exec stack, which is the same order: first parameter on top.
+#define IR_REGISTER_ARGS 3
+
 struct ir_function_t {
     b32 is_external;
     u64 stack_index;
+    u64 frame_size;     // in slots, biggest stack_index of the function
+    u64 register_args;    // first parameters, at most IR_REGISTER_ARGS
+    u64 register_returns; // 0 or 1
     u64 global_index;
     scope_entry_t *entry;
     array_t<ir_opcode_t> code;
 };
 
+// comptime call that waits for the whole program to be compiled,
+// result is written into operand of placeholder PUSH_SIGN
+struct ir_comptime_call_t {
+    ir_opcode_t *op;
+    string_t     function; // where placeholder is
+    string_t     callee;
+    u64          arg_count;
+    s64          args[MAX_COUNT_OF_PARAMS];
+};
+
 struct ir_t {
     b32 is_valid;
 
     allocator_t code;
     hashmap_t<string_t, ir_function_t> functions;
     array_t<s64>                       globals;
+    list_t<ir_comptime_call_t>         comptime_calls;
+    list_t<allocator_t>                worker_code; // arenas of extra IR generation workers, first one uses code
 };
 
+enum ir_lane_t {
+    IR_LANE_U8,
+    IR_LANE_S8,
+    IR_LANE_U16,
+    IR_LANE_S16,
+    IR_LANE_U32,
+    IR_LANE_S32,
+    IR_LANE_U64,
+    IR_LANE_S64,
+    IR_LANE_F32,
+    IR_LANE_F64,
+};
+
+#define IR_VECTOR(lane, size) ((u64)(lane) | ((u64)(size) << 8))
+#define IR_VECTOR_LANE(operand)  ((operand) & 0xFF)
+#define IR_VECTOR_SIZE(operand)  (((operand) >> 8) & 0xFF)
+
+static inline u64 ir_lane_size(u64 lane) {
+    return lane == IR_LANE_F32 ? 4 : lane == IR_LANE_F64 ? 8 : 1ull << (lane / 2);
+}
+
+static inline b32 ir_lane_is_signed(u64 lane) {
+    return lane < IR_LANE_F32 && (lane & 1);
+}
+
+// stack entries of a vector
+static inline u64 ir_vector_entries(u64 operand) {
+    return IR_VECTOR_SIZE(operand) / 8;
+}
+
+b32 ir_is_load(u64 operation);
+u64 ir_load_to_store(u64 operation);
+
+const char *ir_code_to_string(u64 code);
 string_t get_ir_opcode_info(ir_opcode_t op);
 void print_ir_opcode(ir_opcode_t op);
 ir_t compile_program(compiler_t *compiler);
@@ -0,0 +1,21 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "stddefines.h"
+#include "ir.h"
+
+//
+// Runs IR as native code inside of the compiler. Whole program is
+// encoded by x64 backend with X64_RUNTIME_HOST, copied into fresh pages
+// which become read-execute only after linking. putchar, getchar and
+// debug_break go back to the host through __jit_host_functions.
+// Globals are written back into ir->globals after the call.
+//
+
+#define JIT_EXEC_STACK_SIZE (64 * 1024)
+
+// generated code follows System V convention
+b32 jit_is_supported(void);
+b32 jit_call(ir_t *ir, string_t func_name, s64 *result);
+
+#endif // JIT_H
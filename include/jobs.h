@@ -0,0 +1,24 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include "stddefines.h"
+
+//
+// Parallel for over independent jobs. Calling thread takes part as
+// worker 0, other workers live only for one jobs_run. Jobs are handed
+// out by index in any order, so results have to be stored by index
+// and merged afterwards to stay deterministic.
+//
+// Every worker thread has its own temporary memory and profiler,
+// profiling is done only on the calling thread.
+//
+
+#define JOBS_MAX_WORKERS 64
+
+typedef void job_proc_t(void *data, u64 job, u64 worker);
+
+// compiler_config.jobs or count of processors, never more than jobs
+u64  jobs_worker_count(u64 job_count);
+void jobs_run(u64 job_count, u64 worker_count, job_proc_t *proc, void *data);
+
+#endif // JOBS_H
@@ -0,0 +1,35 @@
+#ifndef LOOPS_H
+#define LOOPS_H
+
+#include "stddefines.h"
+#include "ir.h"
+
+//
+// Loop optimisation on IR, after dead code and profile passes.
+//
+// Basic blocks come from jumps, natural loops from back edges to a block
+// that dominates their source. Innermost loops go first. For every loop:
+//
+//   - pure expressions that don't change inside of it (constants, locals
+//     that are neither written there nor have their address taken, globals
+//     no store or call in the loop can write) are computed once in front of
+//     the loop header into a new local,
+//   - expressions that are linear in the loop counter, i = i + c written
+//     once per loop, like element address of array[i], get their own local
+//     that starts in front of the loop and grows by scale * c next to i.
+//
+// Hoisted code runs even when loop body doesn't, so only opcodes that can't
+// trap are moved: no memory loads except globals, division only by constant.
+//
+
+#define LOOPS_MAX_SLOTS 8 // new locals per loop
+
+struct loops_stats_t {
+    u64 loops;
+    u64 hoisted;  // expressions
+    u64 reduced;  // linear expressions turned into increments
+};
+
+void loops_optimize(ir_t *ir, loops_stats_t *stats);
+
+#endif // LOOPS_H
@@ -45,6 +45,7 @@ enum ast_types_t {
     AST_UNARY_NEGATE,
     AST_UNARY_NOT,
     AST_UNARY_INVERT,
+    AST_UNARY_COMPTIME, // l = function call, evaluated by interpreter while compiling
     AST_NAMED_MODULE,
 
     AST_ENUM_DECL, 
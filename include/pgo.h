@@ -0,0 +1,84 @@
+#ifndef PGO_H
+#define PGO_H
+
+#include "stddefines.h"
+#include "ir.h"
+#include "list.h"
+#include "hashmap.h"
+
+//
+// Profile guided optimization, in two builds.
+//
+// --profile-generate runs main in interpreter on the final IR and writes
+// how many times every opcode was executed and how many times every
+// conditional jump went to its target. Executions of CALL are the per call
+// site counts. Functions are keyed by name and hash of their IR, so a
+// profile of changed code is ignored function by function.
+//
+// --profile-use reads it back and, before any backend:
+//   - inlines hot call sites of small leaf functions,
+//   - moves blocks that branches almost never fall into to the end of
+//     their function, so hot path is straight line code,
+//   - puts IR_ALIGN in front of heads of hot loops.
+//
+
+#define PGO_MAGIC     0x4F47504C // "LPGO"
+#define PGO_VERSION   1
+#define PGO_EXTENSION "slmprof"
+
+#define PGO_HOT_COUNT    1024 // executions of a call site or back edge to care about it
+#define PGO_COLD_RATIO   16   // fall through at most this many times rarer than the jump
+#define PGO_LOOP_TRIPS   8    // average iterations per entry of an aligned loop
+#define PGO_LOOP_ALIGN   16
+
+#define PGO_INLINE_SIZE  64   // opcodes of callee
+#define PGO_INLINE_FRAME 32   // slots of callee
+#define PGO_INLINE_GROWTH 512 // opcodes one caller can get from inlining
+
+struct pgo_file_header_t {
+    u32 magic;
+    u32 version;
+    u64 count; // functions
+};
+
+// followed by name and code_count of pgo_counter_t
+struct pgo_file_function_t {
+    u64 hash;
+    u64 name_size;
+    u64 code_count;
+};
+
+struct pgo_counter_t {
+    u64 executions;
+    u64 taken;
+};
+
+struct pgo_function_t {
+    string_t name;
+    u64 hash;
+    u64 code_count;
+    pgo_counter_t *counters;
+};
+
+struct pgo_profile_t {
+    list_t<pgo_function_t>   functions;
+    hashmap_t<string_t, u64> function_index;
+};
+
+struct pgo_stats_t {
+    u64 profiled;  // functions with matching profile
+    u64 stale;     // profile doesn't match IR anymore
+    u64 inlined;   // call sites
+    u64 cold;      // blocks moved to the end
+    u64 aligned;   // loop heads
+    u64 removed;   // functions inlined at every call site
+};
+
+// file is written even when main stops at --interp-step-limit
+b32  pgo_generate(ir_t *ir, string_t filename);
+
+b32  pgo_load(ir_t *ir, string_t filename, pgo_profile_t *profile, pgo_stats_t *stats);
+void pgo_apply(ir_t *ir, pgo_profile_t *profile, pgo_stats_t *stats);
+void pgo_delete(pgo_profile_t *profile);
+
+#endif // PGO_H
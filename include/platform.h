@@ -9,13 +9,48 @@ void debug_break(void);
 string_t platform_get_current_directory(allocator_t *alloc);
 b32      platform_file_exists(string_t name);
 b32      platform_write_file(string_t name, string_t content);
+b32      platform_set_executable(string_t name); // no-op where files have no mode
 b32      platform_read_file_into_string(string_t filename, allocator_t *alloc, string_t *output);
 
+// read only view of a whole file, stays valid until unmapped
+b32      platform_map_file(string_t filename, string_t *output);
+void     platform_unmap_file(string_t mapping);
+
+// raw file descriptor or HANDLE, written without stdio buffering, see sink.h
+#define PLATFORM_INVALID_HANDLE ((u64)-1)
+
+u64      platform_open_file_for_writing(string_t name);
+b32      platform_write_handle(u64 handle, u8 *data, u64 size);
+void     platform_close_handle(u64 handle);
+
+// pages for generated code, allocated writable and then switched to read-execute
+void    *platform_alloc_pages(u64 size);
+b32      platform_protect_executable(void *memory, u64 size);
+void     platform_free_pages(void *memory, u64 size);
+
+// runs generated code, returns number of the signal that stopped it with
+// bad memory access, arithmetic or illegal instruction fault, 0 when it returned
+u32      platform_run_guarded(void (*proc)(void *data), void *data);
+
+// worker threads, see jobs.h
+typedef void platform_thread_proc_t(void *data);
+
+u64      platform_thread_start(platform_thread_proc_t *proc, void *data); // 0 on failure
+void     platform_thread_join(u64 thread);
+u64      platform_processor_count(void);
+u64      platform_atomic_increment(volatile u64 *value); // returns value before increment
+
 enum {
     PROC_ERROR,
     PROC_FINISHED,
 };
 
-u32 platform_run_process(string_t exec_name, string_t args);
+// returned instead of exit code, the same numbers shells use
+#define PLATFORM_PROCESS_FAILED   127 // couldn't be started or waited for
+#define PLATFORM_PROCESS_SIGNALED 128 // + number of the signal that killed it
+
+// waits for the process and returns its exit code,
+// every argument is passed as one, without splitting or quoting by caller
+u32 platform_run_process(string_t exec_name, string_t *args, u64 arg_count);
 
 #endif // PLATFORM_H
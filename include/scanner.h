@@ -88,6 +88,30 @@ enum token_type_t {
     TOK_BOOL8,
     TOK_BOOL32,
 
+    // 128 bit vectors
+    TOK_V16U8,
+    TOK_V16S8,
+    TOK_V8U16,
+    TOK_V8S16,
+    TOK_V4U32,
+    TOK_V4S32,
+    TOK_V2U64,
+    TOK_V2S64,
+    TOK_V4F32,
+    TOK_V2F64,
+
+    // 256 bit vectors
+    TOK_V32U8,
+    TOK_V32S8,
+    TOK_V16U16,
+    TOK_V16S16,
+    TOK_V8U32,
+    TOK_V8S32,
+    TOK_V4U64,
+    TOK_V4S64,
+    TOK_V8F32,
+    TOK_V4F64,
+
     TOK_CAST,
 
     TOK_IF,
@@ -104,6 +128,7 @@ enum token_type_t {
     TOK_AS,
 
     TOK_USE,
+    TOK_COMPTIME,
 
     _KW_STOP,
 
@@ -123,6 +148,9 @@ u8 keywords [_KW_STOP - _KW_START - 1][KEYWORDS_MAX_SIZE] = {
 
     "b8", "b32", 
 
+    "v16u8", "v16s8", "v8u16", "v8s16", "v4u32", "v4s32", "v2u64", "v2s64", "v4f32", "v2f64",
+    "v32u8", "v32s8", "v16u16", "v16s16", "v8u32", "v8s32", "v4u64", "v4s64", "v8f32", "v4f64",
+
     "cast",
 
     "if", "else", "while", "for", "return",
@@ -131,7 +159,7 @@ u8 keywords [_KW_STOP - _KW_START - 1][KEYWORDS_MAX_SIZE] = {
 
     "external", "it", "as",
 
-    "use"
+    "use", "comptime"
 };
 #endif
 
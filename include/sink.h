@@ -0,0 +1,36 @@
+#ifndef SINK_H
+#define SINK_H
+
+#include "stddefines.h"
+#include "list.h"
+
+//
+// Buffered writer over platform handle. Memory use stays at one buffer
+// no matter how much is written, everything past it goes to the file
+// while producer is still running. Memory sinks collect output of
+// parallel workers, which is then written in fixed order.
+//
+
+#define SINK_BUFFER_SIZE (64 * 1024)
+
+struct sink_t {
+    u64 handle;
+    list_t<u8> *memory; // used instead of handle when set
+    u8 *buffer;
+    u64 count;
+    u64 written; // bytes that already reached handle
+    b32 failed;  // sticky, set by first failed write
+};
+
+b32  sink_open(sink_t *sink, string_t filename);
+void sink_open_handle(sink_t *sink, u64 handle);
+void sink_open_memory(sink_t *sink, list_t<u8> *memory);
+
+void sink_write(sink_t *sink, u8 *data, u64 size);
+void sink_fill(sink_t *sink, u8 value, u64 size);
+b32  sink_flush(sink_t *sink);
+
+// flushes and closes handle, false if anything was lost
+b32  sink_close(sink_t *sink);
+
+#endif // SINK_H
@@ -49,11 +49,44 @@ struct string_t {
     }
 };
 
+enum debug_info_level_t {
+    DEBUG_INFO_LINES, // source line directive when line changes, default
+    DEBUG_INFO_NONE,
+    DEBUG_INFO_FULL,  // also label and IR comment on every opcode
+};
+
+enum backend_kind_t {
+    BACKEND_NASM, // assembly for target, nasm and system linker
+    BACKEND_X64,  // machine code, linux executable or ELF object
+    BACKEND_C,    // C99 source, built by system C compiler
+};
+
+enum target_kind_t {
+    TARGET_HOST,  // whatever compiler itself is built for
+    TARGET_WIN64, // console api, nasm -f win64 and lld-link
+    TARGET_LINUX, // System V, raw syscalls, nasm -f elf64 and ld
+};
+
 struct compiler_configuration_t {
     string_t filename;
     b32      verbose;
     b32      no_ansi_codes;
     b32      show_link_time;
+    b32      emit_bytecode;
+    b32      strip_debug;
+    b32      comptime_cache;
+    u64      debug_info;
+    u64      backend;
+    u64      target;              // see compiler_target
+    b32      emit_object;
+    b32      run;
+    u64      jobs;                // worker threads, 0 means one per processor
+    string_t profile_generate;    // run main in interpreter and write branch and call counts here, see pgo.h
+    string_t profile_use;         // counts that drive inlining, block layout and loop alignment
+
+    b32      interp_profile;      // table of interpreter counters after compile time code
+    string_t interp_profile_json;
+    u64      interp_step_limit;   // 0 means no limit
 };
 
 struct allocator_t;
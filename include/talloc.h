@@ -12,6 +12,10 @@
 void * temp_allocate(u64 size);
 void   temp_reset(void);
 
+// gives calling thread its own temporary memory until temp_thread_end
+void   temp_thread_begin(void);
+void   temp_thread_end(void);
+
 void   temp_tests(void);
 
 allocator_t *get_temporary_allocator(void);
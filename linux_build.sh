@@ -69,8 +69,8 @@ done
 echo
 echo "Linking:"
 
-echo "$cc -o"$name" $obj_files $arch"
-$cc -o"$name" $obj_files $arch
+echo "$cc -o"$name" $obj_files $arch -pthread"
+$cc -o"$name" $obj_files $arch -pthread
 
 echo
 echo "Done!"
@@ -0,0 +1,134 @@
+#include "backend.h"
+
+// bigger displacements stay in the generic code, slot offsets are added later
+#define ADDRESS_MAX_DISP (1ll << 30)
+
+struct address_cursor_t {
+    ir_function_t *func;
+    b8            *jump_targets;
+    u64            start;
+};
+
+static inline b32 is_store(u64 operation) {
+    return operation == IR_STORE || operation == IR_STORE8 || operation == IR_STORE16 || operation == IR_STORE32 || operation == IR_STOREF32;
+}
+
+static inline b32 is_constant(u64 operation) {
+    return operation == IR_PUSH_SIGN || operation == IR_PUSH_UNSIGN;
+}
+
+static inline b32 is_base(u64 operation) {
+    return operation == IR_PUSH_STACK || operation == IR_PUSH_GLOBAL || operation == IR_PUSH_SEA || operation == IR_PUSH_GEA;
+}
+
+static inline b32 is_index(u64 operation) {
+    return operation == IR_PUSH_STACK || operation == IR_PUSH_GLOBAL || is_constant(operation);
+}
+
+// opcode is a part of the sequence only when nothing jumps to it
+static u64 operation_at(address_cursor_t *cursor, u64 j) {
+    if (j >= cursor->func->code.count) return IR_INVALID;
+    if (j != cursor->start && cursor->jump_targets[j]) return IR_INVALID;
+
+    return cursor->func->code[j].operation;
+}
+
+// PUSH_SIGN size; MUL; ADD with size x86 can scale by
+static b32 match_scale(address_cursor_t *cursor, u64 j, u64 *scale) {
+    if (!is_constant(operation_at(cursor, j))) return false;
+    if (operation_at(cursor, j + 1) != IR_MUL || operation_at(cursor, j + 2) != IR_ADD) return false;
+
+    u64 size = cursor->func->code[j].u_operand;
+    if (size != 1 && size != 2 && size != 4 && size != 8) return false;
+
+    *scale = size;
+    return true;
+}
+
+static void set_base(backend_address_t *address, ir_opcode_t op) {
+    switch (op.operation) {
+        case IR_PUSH_STACK:  address->base = BACKEND_ADDRESS_LOCAL;     break;
+        case IR_PUSH_GLOBAL: address->base = BACKEND_ADDRESS_GLOBAL;    break;
+        case IR_PUSH_SEA:    address->base = BACKEND_ADDRESS_LOCAL_EA;  break;
+        case IR_PUSH_GEA:    address->base = BACKEND_ADDRESS_GLOBAL_EA; break;
+    }
+
+    address->base_operand = op.u_operand;
+}
+
+// constant index goes to displacement
+static b32 set_index(backend_address_t *address, ir_opcode_t op, u64 scale) {
+    if (is_constant(op.operation)) {
+        if (op.s_operand <= -ADDRESS_MAX_DISP || op.s_operand >= ADDRESS_MAX_DISP) return false;
+
+        address->disp += op.s_operand * (s64)scale;
+        return true;
+    }
+
+    address->index         = op.operation == IR_PUSH_STACK ? BACKEND_ADDRESS_LOCAL : BACKEND_ADDRESS_GLOBAL;
+    address->index_operand = op.u_operand;
+    address->scale         = scale;
+    return true;
+}
+
+b32 backend_match_address(ir_function_t *func, b8 *jump_targets, u64 i, backend_address_t *address) {
+    address_cursor_t cursor = { func, jump_targets, i };
+
+    *address = {};
+    address->scale = 1;
+
+    u64 first  = operation_at(&cursor, i);
+    u64 second = operation_at(&cursor, i + 1);
+    u64 scale  = 0;
+    u64 j      = i;
+
+    if (is_base(first) && is_index(second) && match_scale(&cursor, i + 2, &scale)) {
+        set_base(address, func->code[i]);
+        if (!set_index(address, func->code[i + 1], scale)) return false;
+        j = i + 5;
+    } else if (is_index(first) && match_scale(&cursor, i + 1, &scale)) {
+        address->base  = BACKEND_ADDRESS_STACK;
+        address->stack = 1;
+        if (!set_index(address, func->code[i], scale)) return false;
+        j = i + 4;
+    } else if (match_scale(&cursor, i, &scale)) {
+        address->base  = BACKEND_ADDRESS_STACK;
+        address->index = BACKEND_ADDRESS_STACK;
+        address->scale = scale;
+        address->stack = 2;
+        j = i + 3;
+    } else if (is_base(first)) {
+        set_base(address, func->code[i]);
+        j = i + 1;
+    } else {
+        address->base  = BACKEND_ADDRESS_STACK;
+        address->stack = 1;
+    }
+
+    // member offsets
+    u64 offsets = 0;
+
+    while (is_constant(operation_at(&cursor, j)) && operation_at(&cursor, j + 1) == IR_ADD) {
+        s64 offset = func->code[j].s_operand;
+        if (offset <= -ADDRESS_MAX_DISP || offset >= ADDRESS_MAX_DISP) break;
+
+        address->disp += offset;
+        offsets++;
+        j += 2;
+    }
+
+    if (address->disp <= -ADDRESS_MAX_DISP || address->disp >= ADDRESS_MAX_DISP) return false;
+
+    u64 access = operation_at(&cursor, j);
+    b32 has_access = ir_is_load(access) || is_store(access) || access == IR_NOP;
+
+    address->access = has_access ? access : IR_NOP;
+    address->count  = j - i + (has_access ? 1 : 0);
+
+    if (scale) return true;
+
+    // plain x + c is not worth it, neither are direct local accesses backends fold already
+    if (offsets) return address->base != BACKEND_ADDRESS_STACK || has_access;
+
+    return has_access && access != IR_NOP && (address->base == BACKEND_ADDRESS_LOCAL || address->base == BACKEND_ADDRESS_GLOBAL);
+}
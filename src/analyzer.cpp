@@ -300,9 +300,80 @@ b32 compare_std_info(type_info_t lhs, type_info_t rhs) {
     return string_compare(lhs.type_name, rhs.type_name) == 0;
 }
 
+b32 is_vector_info(type_info_t info) {
+    return info.lanes > 0 && info.pointer_depth == 0 && !info.is_array;
+}
+
+// in the order of intrinsic_t, after INTRINSIC_NONE
+static const char *intrinsic_names[] = {
+    "mem_fill", "mem_copy", "mem_move",
+    "popcount", "clz", "ctz", "bswap", "rotl", "rotr",
+};
+
+u64 get_intrinsic(string_t name) {
+    for (u64 i = 0; i < sizeof(intrinsic_names) / sizeof(intrinsic_names[0]); i++) {
+        if (string_compare(name, STRING(intrinsic_names[i])) == 0) return i + 1;
+    }
+
+    return INTRINSIC_NONE;
+}
+
+// amount of arguments, 0 for INTRINSIC_NONE
+u64 get_intrinsic_params(u64 intrinsic) {
+    switch (intrinsic) {
+        case INTRINSIC_MEM_FILL:
+        case INTRINSIC_MEM_COPY:
+        case INTRINSIC_MEM_MOVE: return 3;
+
+        case INTRINSIC_POPCOUNT:
+        case INTRINSIC_CLZ:
+        case INTRINSIC_CTZ:
+        case INTRINSIC_BSWAP:    return 1;
+
+        case INTRINSIC_ROTL:
+        case INTRINSIC_ROTR:     return 2;
+    }
+
+    return 0;
+}
+
+// user declarations of the same name win, so old programs keep working
+static u64 get_intrinsic_call(analyzer_state_t *state, ast_node_t *call) {
+    if (call->left->type != AST_PRIMARY || call->left->token.type != TOKEN_IDENT) return INTRINSIC_NONE;
+
+    string_t name      = call->left->token.data.string;
+    u64      intrinsic = get_intrinsic(name);
+
+    if (intrinsic == INTRINSIC_NONE) return INTRINSIC_NONE;
+
+    for (u64 i = 0; i < state->current_search_stack.index; i++) {
+        if (hashmap_contains(state->current_search_stack.data[i], name)) return INTRINSIC_NONE;
+    }
+
+    return intrinsic;
+}
+
+// lane tokens in the order of vector tokens, first ten are 128 bit
+static const u64 vector_lane_tokens[] = {
+    TOK_U8, TOK_S8, TOK_U16, TOK_S16, TOK_U32, TOK_S32, TOK_U64, TOK_S64, TOK_F32, TOK_F64,
+};
+
 void set_std_info(u64 token_type, type_info_t *info) {
     assert(info != NULL);
 
+    info->lanes = 0;
+
+    if (token_type >= TOK_V16U8 && token_type <= TOK_V4F64) {
+        u64 index = token_type - TOK_V16U8;
+        u64 bytes = index < 10 ? 16 : 32;
+
+        set_std_info(vector_lane_tokens[index % 10], info);
+
+        info->lanes = (u32)(bytes / info->size);
+        info->size  = (u32)bytes;
+        return;
+    }
+
     switch (token_type) {
         case TOK_S8:  info->type = TYPE_s8;  info->size = 1; break;
         case TOK_S16: info->type = TYPE_s16; info->size = 2; break;
@@ -426,6 +497,17 @@ b32 analyze_expression(analyzer_state_t *state, s64 expected_count_of_expression
             result = analyze_expression(state, expected_count_of_expressions, depend_on, expr->left);
             break;
 
+        case AST_UNARY_COMPTIME:
+            if (expr->left->type != AST_FUNC_CALL || expr->left->left->type != AST_PRIMARY || expr->left->left->token.type != TOKEN_IDENT
+                    || get_intrinsic_call(state, expr->left) != INTRINSIC_NONE) {
+                log_error_token("comptime expects a call of named function", expr->token);
+                result = false;
+                break;
+            }
+
+            result = analyze_expression(state, expected_count_of_expressions, depend_on, expr->left);
+            break;
+
 
         case AST_BIN_CAST:
             if (!analyze_expression(state, expected_count_of_expressions, depend_on, expr->right)) {
@@ -461,10 +543,19 @@ b32 analyze_expression(analyzer_state_t *state, s64 expected_count_of_expression
             break;
         case AST_FUNC_CALL:
             {
-            u64 index = state->current_search_stack.index;
+            u64 index     = state->current_search_stack.index;
+            u64 intrinsic = get_intrinsic_call(state, expr);
 
-            // @todo, analyze amount of arguments and parameters
-            if (!analyze_expression(state, expected_count_of_expressions, depend_on, expr->left)) {
+            // types of intrinsic arguments are checked in IR generation
+            if (intrinsic != INTRINSIC_NONE) {
+                u64 count = expr->right->type == AST_EMPTY ? 0 : expr->right->type == AST_SEPARATION ? expr->right->child_count : 1;
+
+                if (count != get_intrinsic_params(intrinsic)) {
+                    log_error_token("Wrong amount of arguments of intrinsic", expr->left->token);
+                    result = false;
+                }
+            } else if (!analyze_expression(state, expected_count_of_expressions, depend_on, expr->left)) {
+                // @todo, analyze amount of arguments and parameters
                 result = false;
             }
 
@@ -779,6 +870,14 @@ b32 analyze_definition(analyzer_state_t *state, b32 can_do_func, ast_node_t *nod
             case AST_STD_TYPE:
                 entry->type = ENTRY_VAR;
                 set_std_info(type->token.type, &entry->info);
+
+                if (name->type == AST_PARAM_DEF && is_vector_info(entry->info)) {
+                    log_error_token("Vectors can't be passed by value, use a pointer.", type->token);
+                    entry->type = ENTRY_ERROR;
+                    entry->node->analyzed = true;
+                    profiler_func_end();
+                    return false;
+                }
                 break;
 
             case AST_MUL_AUTO:
@@ -952,6 +1051,12 @@ b32 analyze_function(analyzer_state_t *state, scope_entry_t *entry, b32 *should_
                     }
                 case AST_STD_TYPE:
                     set_std_info(curr->token.type, &info);
+
+                    if (is_vector_info(info)) {
+                        log_error_token("Vectors can't be returned by value, use a pointer.", curr->token);
+                        entry->type = ENTRY_ERROR;
+                        result = false;
+                    }
                     break;
 
 
@@ -1585,11 +1690,12 @@ inline string_t construct_module_name(string_t path, string_t name, allocator_t
     return string_swap(string_concat(path, string_concat(name, STRING("/module.slm"), alloc), alloc), SWAP_SLASH, (u8)HOST_SYSTEM_SLASH, alloc);
 }
 
-b32 load_and_process_file(compiler_t *compiler, string_t filename) {
+b32 load_and_process_file(compiler_t *compiler, string_t filename, b32 is_module) {
     profiler_func_start();
     assert(compiler != NULL);
 
     source_file_t file = create_source_file(NULL);
+    file.is_module = is_module;
 
     string_t source;
 
@@ -1618,7 +1724,7 @@ b32 load_and_process_file(compiler_t *compiler, string_t filename) {
     return true;
 }
 
-b32 add_file_if_exists(compiler_t *compiler, b32 *valid_file, string_t file) {
+b32 add_file_if_exists(compiler_t *compiler, b32 *valid_file, string_t file, b32 is_module) {
     profiler_func_start();
     assert(compiler != NULL);
     assert(valid_file != NULL);
@@ -1627,7 +1733,7 @@ b32 add_file_if_exists(compiler_t *compiler, b32 *valid_file, string_t file) {
         profiler_func_end();
         return false;
     } else { 
-        *valid_file = load_and_process_file(compiler, string_copy(file, compiler->strings));
+        *valid_file = load_and_process_file(compiler, string_copy(file, compiler->strings), is_module);
     }
 
     profiler_func_end();
@@ -1656,27 +1762,31 @@ b32 find_and_add_file(compiler_t *compiler, ast_node_t *node) {
         directory = string_substring(from_file, 0, slash + 1, talloc);
     }
 
+    // files next to a module are parts of it
+    source_file_t *from = hashmap_get(&compiler->files, from_file);
+    b32 from_module     = from != NULL && from->is_module;
+
     b32 valid_file;
 
-    if (add_file_if_exists(compiler, &valid_file, construct_source_name(directory, name, talloc))) {
+    if (add_file_if_exists(compiler, &valid_file, construct_source_name(directory, name, talloc), from_module)) {
         node->analyzed = true;
         profiler_func_end();
         return valid_file;
     }
 
-    if (add_file_if_exists(compiler, &valid_file, construct_module_name(directory, name, talloc))) {
+    if (add_file_if_exists(compiler, &valid_file, construct_module_name(directory, name, talloc), from_module)) {
         node->analyzed = true;
         profiler_func_end();
         return valid_file;
     }
 
-    if (add_file_if_exists(compiler, &valid_file, construct_source_name(compiler->modules_path, name, talloc))) {
+    if (add_file_if_exists(compiler, &valid_file, construct_source_name(compiler->modules_path, name, talloc), true)) {
         node->analyzed = true;
         profiler_func_end();
         return valid_file;
     }
 
-    if (add_file_if_exists(compiler, &valid_file, construct_module_name(compiler->modules_path, name, talloc))) {
+    if (add_file_if_exists(compiler, &valid_file, construct_module_name(compiler->modules_path, name, talloc), true)) {
         node->analyzed = true;
         profiler_func_end();
         return valid_file;
@@ -2131,6 +2241,7 @@ b32 analyze_code(analyzer_state_t *state, compiler_t *compiler) {
 
         if (!pair->occupied)      continue;
         if (pair->deleted)        continue;
+        if (deadcode_can_skip_analysis(compiler, &pair->value)) continue;
         profiler_push("Code analyze step");
 
         string_t key = pair->value.node->token.data.string;
@@ -2185,6 +2296,8 @@ b32 analyze(compiler_t *compiler) {
         state.internal_deps.index = 0;
         assert(state.current_search_stack.index == 1);
 
+        deadcode_mark(compiler);
+
         profiler_push("Code analysis");
         state.state = STATE_CODE_ANALYSIS;
         result = analyze_code(&state, compiler);
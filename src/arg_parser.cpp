@@ -11,12 +11,51 @@ argument_t parse_argument(string_t input) {
 
     input = { input.size - 2, input.data + 2 };
 
+    // --name=value, content is the value
+    s64 equals = string_index_of(input, '=');
+
+    if (equals > 0) {
+        string_t name  = { (u64)equals, input.data };
+        string_t value = { input.size - (u64)equals - 1, input.data + equals + 1 };
+
+        if (string_compare(STRING("debug-info"), name) == 0) return { ARG_DEBUG_INFO, value };
+        if (string_compare(STRING("backend"),    name) == 0) return { ARG_BACKEND,    value };
+        if (string_compare(STRING("target"),     name) == 0) return { ARG_TARGET,     value };
+        if (string_compare(STRING("jobs"),       name) == 0) return { ARG_JOBS,       value };
+        if (string_compare(STRING("profile-generate"), name) == 0) return { ARG_PROFILE_GENERATE, value };
+        if (string_compare(STRING("profile-use"),      name) == 0) return { ARG_PROFILE_USE,      value };
+
+        return { ARG_ERROR, input };
+    }
+
     if (string_compare(STRING("help"),      input) == 0)  return { ARG_HELP,             input };
     if (string_compare(STRING("no-ansi"),   input) == 0)  return { ARG_NO_ANSI,          input };
     if (string_compare(STRING("verbose"),   input) == 0)  return { ARG_VERBOSE,          input };
     if (string_compare(STRING("version"),   input) == 0)  return { ARG_VERSION,          input };
     if (string_compare(STRING("output"),    input) == 0)  return { ARG_OUTPUT_FILE_NAME, input };
     if (string_compare(STRING("link-time"), input) == 0)  return { ARG_SHOW_LINK_TIME,   input };
+    if (string_compare(STRING("emit-bytecode"), input) == 0)  return { ARG_EMIT_BYTECODE, input };
+    if (string_compare(STRING("strip-debug"),   input) == 0)  return { ARG_STRIP_DEBUG,   input };
+    if (string_compare(STRING("emit-object"),   input) == 0)  return { ARG_EMIT_OBJECT,   input };
+    if (string_compare(STRING("run"),           input) == 0)  return { ARG_RUN,           input };
+    if (string_compare(STRING("comptime-cache"), input) == 0) return { ARG_COMPTIME_CACHE, input };
+    if (string_compare(STRING("interp-profile"), input) == 0) return { ARG_INTERP_PROFILE, input };
+    if (string_compare(STRING("interp-profile-json"), input) == 0) return { ARG_INTERP_PROFILE_JSON, input };
+    if (string_compare(STRING("interp-step-limit"),   input) == 0) return { ARG_INTERP_STEP_LIMIT,   input };
 
     return { ARG_ERROR, input };
 }
+
+b32 parse_argument_number(string_t input, u64 *output) {
+    if (input.size == 0) return false;
+
+    u64 value = 0;
+
+    for (u64 i = 0; i < input.size; i++) {
+        if (input[i] < '0' || input[i] > '9') return false;
+        value = value * 10 + (input[i] - '0');
+    }
+
+    *output = value;
+    return true;
+}
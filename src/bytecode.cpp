@@ -0,0 +1,412 @@
+#include "bytecode.h"
+
+#include "ir.h"
+#include "interop.h"
+#include "list.h"
+#include "array.h"
+#include "hashmap.h"
+#include "scanner.h"
+
+#include "allocator.h"
+#include "arena.h"
+#include "talloc.h"
+#include "strings.h"
+#include "profiler.h"
+#include "platform.h"
+
+struct bytecode_writer_t {
+    list_t<bytecode_function_t> functions;
+    list_t<bytecode_opcode_t>   code;
+    list_t<bytecode_debug_t>    debug;
+    list_t<u8>                  strings;
+
+    hashmap_t<string_t, bytecode_string_t> string_map;
+};
+
+static bytecode_string_t add_string(bytecode_writer_t *writer, string_t string) {
+    if (string.data == NULL || string.size == 0) {
+        return {};
+    }
+
+    bytecode_string_t *found = hashmap_get(&writer->string_map, string);
+
+    if (found) {
+        return *found;
+    }
+
+    bytecode_string_t result = { (u32)writer->strings.count, (u32)string.size };
+
+    u64 index = 0;
+    list_allocate(&writer->strings, string.size, &index);
+    list_fill(&writer->strings, string.data, string.size, index);
+
+    hashmap_add(&writer->string_map, string, &result);
+    return result;
+}
+
+static void add_section(list_t<u8> *output, void *data, u64 size) {
+    if (size == 0) return;
+
+    u64 index = 0;
+    list_allocate(output, size, &index);
+    list_fill(output, (u8*)data, size, index);
+}
+
+b32 bytecode_write(ir_t *ir, string_t filename, b32 with_debug) {
+    profiler_func_start();
+    assert(ir != NULL);
+
+    bytecode_writer_t writer = {};
+    hashmap_create(&writer.string_map, 64, NULL, NULL);
+
+    for (u64 i = 0; i < ir->functions.capacity; i++) {
+        kv_pair_t<string_t, ir_function_t> *pair = ir->functions.entries + i;
+
+        if (!pair->occupied) continue;
+        if (pair->deleted)   continue;
+
+        bytecode_function_t func = {};
+        func.name       = add_string(&writer, pair->key);
+        func.code_start = writer.code.count;
+        func.code_count = pair->value.code.count;
+        func.flags      = pair->value.is_external ? BYTECODE_FUNC_EXTERNAL : 0;
+        func.register_args    = (u32)pair->value.register_args;
+        func.register_returns = (u32)pair->value.register_returns;
+
+        for (u64 j = 0; j < pair->value.code.count; j++) {
+            ir_opcode_t op = pair->value.code[j];
+
+            bytecode_opcode_t code = {};
+            code.operation = (u32)op.operation;
+            code.operand   = op.u_operand;
+            code.string    = add_string(&writer, op.string);
+            list_add(&writer.code, &code);
+
+            if (!with_debug) continue;
+
+            bytecode_debug_t debug = {};
+            debug.line   = op.info.l0;
+            debug.column = op.info.c0;
+
+            if (op.info.from) {
+                debug.filename = add_string(&writer, op.info.from->filename);
+            }
+
+            list_add(&writer.debug, &debug);
+        }
+
+        list_add(&writer.functions, &func);
+    }
+
+    bytecode_header_t header = {};
+    header.magic   = BYTECODE_MAGIC;
+    header.version = BYTECODE_VERSION;
+
+    header.functions_offset = sizeof(bytecode_header_t);
+    header.functions_count  = writer.functions.count;
+
+    header.code_offset = header.functions_offset + header.functions_count * sizeof(bytecode_function_t);
+    header.code_count  = writer.code.count;
+
+    header.globals_offset = header.code_offset + header.code_count * sizeof(bytecode_opcode_t);
+    header.globals_count  = ir->globals.count;
+
+    header.debug_offset = header.globals_offset + header.globals_count * sizeof(s64);
+    header.debug_count  = writer.debug.count;
+
+    header.strings_offset = header.debug_offset + header.debug_count * sizeof(bytecode_debug_t);
+    header.strings_size   = writer.strings.count;
+
+    header.file_size = header.strings_offset + header.strings_size;
+
+    list_t<u8> output = {};
+    list_create(&output, header.file_size + 1, *default_allocator);
+
+    add_section(&output, &header, sizeof(bytecode_header_t));
+    add_section(&output, writer.functions.data, writer.functions.count * sizeof(bytecode_function_t));
+    add_section(&output, writer.code.data,      writer.code.count      * sizeof(bytecode_opcode_t));
+
+    for (u64 i = 0; i < ir->globals.count; i++) {
+        s64 value = ir->globals[i];
+        add_section(&output, &value, sizeof(s64));
+    }
+
+    add_section(&output, writer.debug.data,   writer.debug.count * sizeof(bytecode_debug_t));
+    add_section(&output, writer.strings.data, writer.strings.count);
+
+    assert(output.count == header.file_size);
+
+    b32 result = platform_write_file(filename, { output.count, output.data });
+
+    list_delete(&output);
+    if (writer.functions.data) list_delete(&writer.functions);
+    if (writer.code.data)      list_delete(&writer.code);
+    if (writer.debug.data)     list_delete(&writer.debug);
+    if (writer.strings.data)   list_delete(&writer.strings);
+    hashmap_delete(&writer.string_map);
+
+    profiler_func_end();
+    return result;
+}
+
+// ------ loading
+
+static b32 section_fits(bytecode_header_t *header, u64 offset, u64 count, u64 element_size) {
+    if (offset > header->file_size) return false;
+    if (element_size != 0 && count > (header->file_size - offset) / element_size) return false;
+    return true;
+}
+
+static b32 get_string(bytecode_header_t *header, bytecode_string_t string, string_t *output) {
+    if ((u64)string.offset + string.size > header->strings_size) {
+        return false;
+    }
+
+    *output = {};
+
+    if (string.size > 0) {
+        output->size = string.size;
+        output->data = (u8*)header + header->strings_offset + string.offset;
+    }
+
+    return true;
+}
+
+static scanner_t *get_source_stub(bytecode_module_t *module, hashmap_t<string_t, scanner_t*> *sources, string_t filename) {
+    scanner_t **found = hashmap_get(sources, filename);
+
+    if (found) {
+        return *found;
+    }
+
+    // we dont ship sources, so errors will point only to file and line
+    scanner_t *stub = (scanner_t*)mem_alloc(&module->ir.code, sizeof(scanner_t));
+    stub->filename  = filename;
+
+    hashmap_add(sources, filename, &stub);
+    return stub;
+}
+
+static b32 bytecode_error(bytecode_module_t *module, string_t filename, const char *reason) {
+    log_error(string_format(get_temporary_allocator(), STRING("Bad bytecode module '%s': %s"), filename, STRING(reason)));
+    bytecode_unload(module);
+    return false;
+}
+
+b32 bytecode_load(string_t filename, bytecode_module_t *module) {
+    profiler_func_start();
+    assert(module != NULL);
+
+    *module = {};
+
+    if (!platform_map_file(filename, &module->mapping)) {
+        profiler_func_end();
+        return false;
+    }
+
+    if (module->mapping.size < sizeof(bytecode_header_t)) {
+        profiler_func_end();
+        return bytecode_error(module, filename, "file is too small");
+    }
+
+    bytecode_header_t *header = (bytecode_header_t*)module->mapping.data;
+
+    if (header->magic != BYTECODE_MAGIC) {
+        profiler_func_end();
+        return bytecode_error(module, filename, "not a solum module");
+    }
+
+    if (header->version != BYTECODE_VERSION) {
+        profiler_func_end();
+        return bytecode_error(module, filename, "unsupported version, recompile the module");
+    }
+
+    if (header->file_size != module->mapping.size
+            || !section_fits(header, header->functions_offset, header->functions_count, sizeof(bytecode_function_t))
+            || !section_fits(header, header->code_offset,      header->code_count,      sizeof(bytecode_opcode_t))
+            || !section_fits(header, header->globals_offset,   header->globals_count,   sizeof(s64))
+            || !section_fits(header, header->debug_offset,     header->debug_count,     sizeof(bytecode_debug_t))
+            || !section_fits(header, header->strings_offset,   header->strings_size,    1)
+            || (header->debug_count != 0 && header->debug_count != header->code_count)) {
+        profiler_func_end();
+        return bytecode_error(module, filename, "corrupted section table");
+    }
+
+    bytecode_function_t *functions = (bytecode_function_t*)(module->mapping.data + header->functions_offset);
+    bytecode_opcode_t   *code      = (bytecode_opcode_t*)  (module->mapping.data + header->code_offset);
+    s64                 *globals   = (s64*)                (module->mapping.data + header->globals_offset);
+    bytecode_debug_t    *debug     = (bytecode_debug_t*)   (module->mapping.data + header->debug_offset);
+
+    module->ir.code     = create_arena_allocator(1024 * sizeof(ir_opcode_t));
+    module->ir.is_valid = true;
+    hashmap_create(&module->ir.functions, 16, NULL, NULL);
+
+    hashmap_t<string_t, scanner_t*> sources = {};
+    hashmap_create(&sources, 16, NULL, NULL);
+
+    scanner_t *module_source = get_source_stub(module, &sources, filename);
+
+    b32 valid = true;
+
+    for (u64 i = 0; valid && i < header->functions_count; i++) {
+        bytecode_function_t *desc = functions + i;
+        string_t name = {};
+
+        if (!get_string(header, desc->name, &name) || name.size == 0
+                || desc->code_start > header->code_count
+                || desc->code_count > header->code_count - desc->code_start) {
+            valid = false;
+            break;
+        }
+
+        {
+            ir_function_t func = {};
+            hashmap_add(&module->ir.functions, name, &func);
+        }
+
+        ir_function_t *func = hashmap_get(&module->ir.functions, name);
+        func->is_external = (desc->flags & BYTECODE_FUNC_EXTERNAL) != 0;
+        func->register_args    = desc->register_args    <= IR_REGISTER_ARGS ? desc->register_args : 0;
+        func->register_returns = desc->register_returns <= 1 ? desc->register_returns : 0;
+
+        if (func->is_external) continue;
+
+        array_create(&func->code, desc->code_count > 8 ? desc->code_count : 8, module->ir.code);
+
+        for (u64 j = 0; j < desc->code_count; j++) {
+            bytecode_opcode_t *code_op = code + desc->code_start + j;
+
+            ir_opcode_t op = {};
+            op.operation = code_op->operation;
+            op.u_operand = code_op->operand;
+            op.index     = j;
+            op.info.from = module_source;
+
+            if (op.operation > IR_INVALID || !get_string(header, code_op->string, &op.string)) {
+                valid = false;
+                break;
+            }
+
+            switch (op.operation) {
+                case IR_JUMP:
+                case IR_JUMP_IF:
+                case IR_JUMP_IF_NOT: {
+                    s64 target = (s64)j + 1 + op.s_operand;
+
+                    if (target < 0 || (u64)target >= desc->code_count) {
+                        valid = false;
+                    }
+                } break;
+
+                // slots, one allocation can't be bigger than interpreter data stack
+                case IR_STACK_FRAME_PUSH:
+                case IR_ALLOC:
+                case IR_FREE: {
+                    if (op.u_operand > INTEROP_DATA_STACK_SIZE / sizeof(s64)) {
+                        valid = false;
+                    }
+                } break;
+
+                // interpreter keeps vectors in fixed buffers of 4 entries
+                case IR_VLOAD:
+                case IR_VSTORE:
+                case IR_VSPLAT:
+                case IR_VADD:
+                case IR_VSUB:
+                case IR_VMUL:
+                case IR_VDIV:
+                case IR_VAND:
+                case IR_VOR:
+                case IR_VXOR:
+                case IR_VCMP_EQ:
+                case IR_VCMP_NEQ:
+                case IR_VCMP_LT:
+                case IR_VCMP_GT:
+                case IR_VCMP_LTE:
+                case IR_VCMP_GTE: {
+                    u64 size = IR_VECTOR_SIZE(op.u_operand);
+
+                    if (op.u_operand != IR_VECTOR(IR_VECTOR_LANE(op.u_operand), size)
+                            || IR_VECTOR_LANE(op.u_operand) > IR_LANE_F64
+                            || (size != 16 && size != 32)) {
+                        valid = false;
+                    }
+                } break;
+
+                // width of the lane is used for shifts and sizes
+                case IR_MEM_FILL:
+                case IR_POPCOUNT:
+                case IR_CLZ:
+                case IR_CTZ:
+                case IR_BSWAP:
+                case IR_ROTL:
+                case IR_ROTR: {
+                    if (op.u_operand > IR_LANE_F64) {
+                        valid = false;
+                    }
+                } break;
+
+                default: break;
+            }
+
+            if (header->debug_count) {
+                bytecode_debug_t *info = debug + desc->code_start + j;
+                string_t source = {};
+
+                if (!get_string(header, info->filename, &source)) {
+                    valid = false;
+                    break;
+                }
+
+                if (source.size) {
+                    op.info.from = get_source_stub(module, &sources, source);
+                }
+
+                op.info.l0 = op.info.l1 = info->line;
+                op.info.c0 = op.info.c1 = info->column;
+            }
+
+            array_add(&func->code, op);
+        }
+    }
+
+    hashmap_delete(&sources);
+
+    // every call should land in this module
+    for (u64 i = 0; valid && i < module->ir.functions.capacity; i++) {
+        kv_pair_t<string_t, ir_function_t> *pair = module->ir.functions.entries + i;
+
+        if (!pair->occupied) continue;
+        if (pair->deleted)   continue;
+
+        for (u64 j = 0; j < pair->value.code.count; j++) {
+            ir_opcode_t op = pair->value.code[j];
+
+            if (op.operation == IR_CALL && !hashmap_contains(&module->ir.functions, op.string)) {
+                valid = false;
+                break;
+            }
+        }
+    }
+
+    if (!valid) {
+        profiler_func_end();
+        return bytecode_error(module, filename, "corrupted function table or code");
+    }
+
+    for (u64 i = 0; i < header->globals_count; i++) {
+        array_add(&module->ir.globals, globals[i]);
+    }
+
+    profiler_func_end();
+    return true;
+}
+
+void bytecode_unload(bytecode_module_t *module) {
+    if (module->ir.functions.entries) hashmap_delete(&module->ir.functions);
+    if (module->ir.globals.entries.data) array_delete(&module->ir.globals);
+    if (module->ir.code.data) delete_arena_allocator(module->ir.code);
+
+    platform_unmap_file(module->mapping);
+    *module = {};
+}
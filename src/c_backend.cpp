@@ -0,0 +1,957 @@
+#include "backend.h"
+#include "talloc.h"
+#include "strings.h"
+#include "profiler.h"
+#include "sorter.h"
+#include "sink.h"
+
+// IR is a stack machine, but depth of the exec stack is known before every
+// opcode, so entry d of the function's own part of the stack is C local s<d>
+// and C compiler sees plain data flow. Entries under the function, its stack
+// arguments and results, are base[-1], base[-2]... where base is the shared
+// exec stack at the moment of the call, see c_compile_call.
+// Register arguments are C parameters, register return is C return value.
+//
+// Scalar locals that never have their address taken are C locals l<slot>,
+// the rest live in frame array with the same layout as native frame.
+
+#define C_EXEC_STACK_SIZE (1 << 20)
+
+struct c_state_t {
+    ir_t          *ir;
+    sink_t        *output;
+    ir_function_t *func;
+    string_t       name;
+
+    b8  *targets;
+    b8  *known;
+    s64 *depths;
+
+    u64 slot_count;
+    b8 *direct_slots;
+    b32 uses_frame;
+    s64 max_depth;
+};
+
+struct c_signature_t {
+    u64 register_args;
+    u64 stack_args;
+    u64 stack_returns;
+    u64 register_returns;
+};
+
+struct c_external_t {
+    const char *name;
+    u64 args;
+    u64 returns;
+};
+
+// runtime functions below, every external goes through the exec stack
+static const c_external_t c_externals[] = {
+    { "putchar",     1, 0 },
+    { "getchar",     0, 1 },
+    { "debug_break", 0, 0 },
+};
+
+static const char *c_runtime[] = {
+    "#include <stdint.h>",
+    "#include <stdio.h>",
+    "#include <stdlib.h>",
+    "#include <string.h>",
+    "#include <signal.h>",
+    "",
+    "typedef int64_t  s64;",
+    "typedef uint64_t u64;",
+    "",
+    "static s64 load64(s64 address)  { s64      value; memcpy(&value, (void*)(intptr_t)address, 8); return value; }",
+    "static s64 load8s(s64 address)  { int8_t   value; memcpy(&value, (void*)(intptr_t)address, 1); return value; }",
+    "static s64 load8u(s64 address)  { uint8_t  value; memcpy(&value, (void*)(intptr_t)address, 1); return value; }",
+    "static s64 load16s(s64 address) { int16_t  value; memcpy(&value, (void*)(intptr_t)address, 2); return value; }",
+    "static s64 load16u(s64 address) { uint16_t value; memcpy(&value, (void*)(intptr_t)address, 2); return value; }",
+    "static s64 load32s(s64 address) { int32_t  value; memcpy(&value, (void*)(intptr_t)address, 4); return value; }",
+    "static s64 load32u(s64 address) { uint32_t value; memcpy(&value, (void*)(intptr_t)address, 4); return value; }",
+    "",
+    "static void store64(s64 address, s64 value) {                        memcpy((void*)(intptr_t)address, &value, 8); }",
+    "static void store8(s64 address, s64 value)  { uint8_t  v = (uint8_t)value;  memcpy((void*)(intptr_t)address, &v, 1); }",
+    "static void store16(s64 address, s64 value) { uint16_t v = (uint16_t)value; memcpy((void*)(intptr_t)address, &v, 2); }",
+    "static void store32(s64 address, s64 value) { uint32_t v = (uint32_t)value; memcpy((void*)(intptr_t)address, &v, 4); }",
+    "",
+    "static double f64_of(s64 bits)    { double value; memcpy(&value, &bits, 8); return value; }",
+    "static s64    bits_of(double value) { s64 bits; memcpy(&bits, &value, 8); return bits; }",
+    "",
+    "static s64  loadf32(s64 address)              { float value; memcpy(&value, (void*)(intptr_t)address, 4); return bits_of(value); }",
+    "static void storef32(s64 address, s64 value)  { float v = (float)f64_of(value); memcpy((void*)(intptr_t)address, &v, 4); }",
+    "",
+    "/* vectors are copied into arrays of entries, a is the left operand, result goes to b */",
+    "#define VECTOR_LANES(T, M, W) { \\",
+    "    T x[32], y[32]; M m[32]; int i, count = size / (int)sizeof(T); \\",
+    "    memcpy(x, a, size); memcpy(y, b, size); \\",
+    "    for (i = 0; i < count; i++) switch (operation) { \\",
+    "        case 0:  y[i] = (T)((W)x[i] + (W)y[i]); break; \\",
+    "        case 1:  y[i] = (T)((W)x[i] - (W)y[i]); break; \\",
+    "        case 2:  y[i] = (T)((W)x[i] * (W)y[i]); break; \\",
+    "        case 3:  y[i] = (T)((W)x[i] / (W)y[i]); break; \\",
+    "        case 7:  m[i] = x[i] == y[i] ? (M)~(M)0 : 0; break; \\",
+    "        case 8:  m[i] = x[i] != y[i] ? (M)~(M)0 : 0; break; \\",
+    "        case 9:  m[i] = x[i] <  y[i] ? (M)~(M)0 : 0; break; \\",
+    "        case 10: m[i] = x[i] >  y[i] ? (M)~(M)0 : 0; break; \\",
+    "        case 11: m[i] = x[i] <= y[i] ? (M)~(M)0 : 0; break; \\",
+    "        case 12: m[i] = x[i] >= y[i] ? (M)~(M)0 : 0; break; \\",
+    "    } \\",
+    "    memcpy(b, operation >= 7 ? (void*)m : (void*)y, size); \\",
+    "}",
+    "",
+    "static void vector_binary(int operation, int lane, int size, const s64 *a, s64 *b) {",
+    "    int i;",
+    "    for (i = 0; i < size / 8 && operation >= 4 && operation <= 6; i++) {",
+    "        b[i] = operation == 4 ? (a[i] & b[i]) : operation == 5 ? (a[i] | b[i]) : (a[i] ^ b[i]);",
+    "    }",
+    "    switch (operation >= 4 && operation <= 6 ? -1 : lane) {",
+    "        case 0: VECTOR_LANES(uint8_t,  uint8_t,  u64)    break;",
+    "        case 1: VECTOR_LANES(int8_t,   uint8_t,  u64)    break;",
+    "        case 2: VECTOR_LANES(uint16_t, uint16_t, u64)    break;",
+    "        case 3: VECTOR_LANES(int16_t,  uint16_t, u64)    break;",
+    "        case 4: VECTOR_LANES(uint32_t, uint32_t, u64)    break;",
+    "        case 5: VECTOR_LANES(int32_t,  uint32_t, u64)    break;",
+    "        case 6: VECTOR_LANES(uint64_t, uint64_t, u64)    break;",
+    "        case 7: VECTOR_LANES(int64_t,  uint64_t, u64)    break;",
+    "        case 8: VECTOR_LANES(float,    uint32_t, float)  break;",
+    "        case 9: VECTOR_LANES(double,   uint64_t, double) break;",
+    "    }",
+    "}",
+    "",
+    "static void vector_splat(int lane, int size, s64 value, s64 *out) {",
+    "    int i, width = lane == 8 ? 4 : lane == 9 ? 8 : 1 << (lane / 2);",
+    "    if (lane == 8) { float narrow = (float)f64_of(value); uint32_t bits; memcpy(&bits, &narrow, 4); value = bits; }",
+    "    for (i = 0; i < size; i += width) memcpy((char*)out + i, &value, width);",
+    "}",
+    "",
+    "/* intrinsics, lanes are numbered like in vector_splat, results of bit operations are extended like loads */",
+    "static void runtime_fill(s64 address, s64 value, s64 count, int lane) {",
+    "    char *to = (char*)(intptr_t)address;",
+    "    int width = lane == 8 ? 4 : lane == 9 ? 8 : 1 << (lane / 2);",
+    "    if (lane == 8) { float narrow = (float)f64_of(value); uint32_t bits; memcpy(&bits, &narrow, 4); value = bits; }",
+    "    for (; count > 0; count--, to += width) memcpy(to, &value, width);",
+    "}",
+    "",
+    "static s64 extend_lane(u64 value, int lane) {",
+    "    switch (lane) {",
+    "        case 0: return (uint8_t)value;",
+    "        case 1: return (int8_t)value;",
+    "        case 2: return (uint16_t)value;",
+    "        case 3: return (int16_t)value;",
+    "        case 4: return (uint32_t)value;",
+    "        case 5: return (int32_t)value;",
+    "    }",
+    "    return (s64)value;",
+    "}",
+    "",
+    "static s64 bit_operation(int operation, int lane, u64 value, s64 amount) {",
+    "    int bits = 8 << (lane / 2), count = 0;",
+    "    u64 mask = bits == 64 ? ~(u64)0 : ((u64)1 << bits) - 1, result = 0;",
+    "    value &= mask;",
+    "    switch (operation) {",
+    "        case 0: for (; value; value &= value - 1) count++; return count;",
+    "        case 1: while (count < bits && !((value >> (bits - 1 - count)) & 1)) count++; return count;",
+    "        case 2: while (count < bits && !((value >> count) & 1)) count++; return count;",
+    "        case 3: for (; count < bits; count += 8) result |= ((value >> count) & 0xFF) << (bits - 8 - count); return extend_lane(result, lane);",
+    "    }",
+    "    amount &= bits - 1;",
+    "    if (operation == 5) amount = (bits - amount) & (bits - 1);",
+    "    result = amount ? (value << amount) | (value >> (bits - amount)) : value;",
+    "    return extend_lane(result & mask, lane);",
+    "}",
+    "",
+    "static s64 f64_to_s64(s64 bits) {",
+    "    double value = f64_of(bits);",
+    "    if (!(value >= -9223372036854775808.0 && value < 9223372036854775808.0)) return INT64_MIN;",
+    "    return (s64)value;",
+    "}",
+    "",
+    "static void runtime_break(void) {",
+    "#if defined(_MSC_VER)",
+    "    __debugbreak();",
+    "#elif defined(SIGTRAP)",
+    "    raise(SIGTRAP);",
+    "#else",
+    "    abort();",
+    "#endif",
+    "}",
+    "",
+    "static void slm_putchar(s64 *base) {",
+    "    putchar((int)base[-1]);",
+    "}",
+    "",
+    "static void slm_getchar(s64 *base) {",
+    "    fflush(stdout);",
+    "    base[0] = getchar();",
+    "}",
+    "",
+    "static void slm_debug_break(s64 *base) {",
+    "    (void)base;",
+    "    runtime_break();",
+    "}",
+    "",
+};
+
+static void c_add_line(c_state_t *state, string_t data, u64 tab = 1) {
+    sink_fill(state->output, ' ', tab * 4);
+    sink_write(state->output, data.data, data.size);
+    sink_write(state->output, (u8*)"\n", 1);
+}
+
+static const c_external_t *c_find_external(string_t name) {
+    for (u64 i = 0; i < sizeof(c_externals) / sizeof(*c_externals); i++) {
+        if (string_compare(name, STRING(c_externals[i].name)) == 0) return c_externals + i;
+    }
+
+    return NULL;
+}
+
+// stack parameters are the ones after register arguments, see compile_function
+static b32 c_get_signature(ir_t *ir, string_t name, c_signature_t *signature) {
+    ir_function_t *func = hashmap_get(&ir->functions, name);
+    *signature = {};
+
+    if (func == NULL) return false;
+
+    if (func->is_external) {
+        const c_external_t *external = c_find_external(name);
+        if (external == NULL) return false;
+
+        signature->stack_args    = external->args;
+        signature->stack_returns = external->returns;
+        return true;
+    }
+
+    if (func->entry == NULL) return false;
+
+    //                           def -> type -> params
+    u64 params  = func->entry->node->left->left->child_count;
+    u64 returns = func->entry->return_typenames.count;
+
+    signature->register_args    = func->register_args;
+    signature->register_returns = func->register_returns;
+    signature->stack_args       = params  - func->register_args;
+    signature->stack_returns    = returns - func->register_returns;
+    return true;
+}
+
+static inline b32 is_jump(u64 operation) {
+    return operation == IR_JUMP || operation == IR_JUMP_IF || operation == IR_JUMP_IF_NOT;
+}
+
+static inline b32 is_binary(u64 operation) {
+    return (operation >= IR_ADD && operation <= IR_MOD)
+        || (operation >= IR_BIT_AND && operation <= IR_BIT_XOR)
+        || operation == IR_SHIFT_LEFT || operation == IR_SHIFT_RIGHT
+        || (operation >= IR_CMP_EQ && operation <= IR_CMP_GTE)
+        || (operation >= IR_FADD && operation <= IR_FDIV)
+        || (operation >= IR_FCMP_EQ && operation <= IR_FCMP_GTE);
+}
+
+static inline b32 is_vector_binary(u64 operation) {
+    return operation >= IR_VADD && operation <= IR_VCMP_GTE;
+}
+
+static string_t c_exec(s64 depth) {
+    if (depth >= 0) return string_format(get_temporary_allocator(), STRING("s%u"), (u64)depth);
+    return string_format(get_temporary_allocator(), STRING("base[%d]"), depth);
+}
+
+static string_t c_local(c_state_t *state, u64 slot) {
+    if (slot < state->slot_count && state->direct_slots[slot]) {
+        return string_format(get_temporary_allocator(), STRING("l%u"), slot);
+    }
+
+    return string_format(get_temporary_allocator(), STRING("frame[%u]"), state->func->frame_size - slot);
+}
+
+static string_t c_constant(s64 value) {
+    if (value == INT64_MIN) return STRING("(-9223372036854775807 - 1)");
+    return string_format(get_temporary_allocator(), STRING("%d"), value);
+}
+
+static inline b32 is_direct_access(c_state_t *state, u64 i) {
+    if (i + 1 >= state->func->code.count || state->targets[i + 1]) return false;
+
+    u64 next = state->func->code[i + 1].operation;
+    return next == IR_LOAD || next == IR_STORE;
+}
+
+static void c_find_direct_slots(c_state_t *state) {
+    ir_function_t *func = state->func;
+
+    state->slot_count = 0;
+    state->uses_frame = false;
+
+    for (u64 i = 0; i < func->code.count; i++) {
+        ir_opcode_t op = func->code[i];
+
+        if (op.operation == IR_PUSH_STACK || op.operation == IR_PUSH_SEA) {
+            state->slot_count = MAX(state->slot_count, op.u_operand + 1);
+        }
+    }
+
+    state->direct_slots = (b8*)mem_alloc(default_allocator, state->slot_count + 1);
+    mem_set((u8*)state->direct_slots, 0, state->slot_count + 1);
+
+    for (u64 i = 0; i < func->code.count; i++) {
+        ir_opcode_t op = func->code[i];
+        if (op.operation == IR_PUSH_STACK || op.operation == IR_PUSH_SEA) state->direct_slots[op.u_operand] = true;
+    }
+
+    for (u64 i = 0; i < func->code.count; i++) {
+        ir_opcode_t op = func->code[i];
+
+        if (op.operation == IR_PUSH_SEA && !is_direct_access(state, i)) {
+            state->direct_slots[op.u_operand] = false;
+            state->uses_frame = true;
+        }
+    }
+}
+
+// depth before every opcode relative to the function entry, the same on every path
+static b32 c_compute_depths(c_state_t *state) {
+    ir_function_t *func = state->func;
+    u64 count = func->code.count;
+
+    state->max_depth = (s64)func->register_args;
+    state->known[0]  = true;
+    state->depths[0] = (s64)func->register_args;
+
+    b32 changed = true;
+    while (changed) {
+        changed = false;
+
+        for (u64 i = 0; i < count; i++) {
+            if (!state->known[i]) continue;
+
+            ir_opcode_t op = func->code[i];
+            s64 depth = state->depths[i];
+            s64 next  = depth;
+
+            b32 falls = true;
+            s64 target = -1;
+
+            switch (op.operation) {
+                case IR_PUSH_SIGN:
+                case IR_PUSH_UNSIGN:
+                case IR_PUSH_STACK:
+                case IR_PUSH_GLOBAL:
+                case IR_PUSH_GEA:
+                case IR_PUSH_SEA:
+                case IR_CLONE:
+                    next = depth + 1;
+                    break;
+
+                case IR_POP:
+                case IR_SETUP_GLOBAL:
+                    next = depth - 1;
+                    break;
+
+                case IR_STORE:
+                case IR_STORE8:
+                case IR_STORE16:
+                case IR_STORE32:
+                case IR_STOREF32:
+                    next = depth - 2;
+                    break;
+
+                case IR_VLOAD:
+                case IR_VSPLAT:
+                    next = depth + (s64)ir_vector_entries(op.u_operand) - 1;
+                    break;
+
+                case IR_VSTORE:
+                    next = depth - (s64)ir_vector_entries(op.u_operand) - 1;
+                    break;
+
+                case IR_MEM_FILL:
+                case IR_MEM_COPY:
+                case IR_MEM_MOVE:
+                    next = depth - 3;
+                    break;
+
+                case IR_ROTL:
+                case IR_ROTR:
+                    next = depth - 1;
+                    break;
+
+                case IR_JUMP:
+                    falls  = false;
+                    target = (s64)i + 1 + op.s_operand;
+                    break;
+
+                case IR_JUMP_IF:
+                case IR_JUMP_IF_NOT:
+                    next   = depth - 1;
+                    target = (s64)i + 1 + op.s_operand;
+                    break;
+
+                case IR_RET:
+                case IR_INVALID:
+                    falls = false;
+                    break;
+
+                case IR_CALL: {
+                    c_signature_t callee = {};
+
+                    if (!c_get_signature(state->ir, op.string, &callee)) {
+                        log_error(string_format(get_temporary_allocator(), STRING("C backend: no function '%s' called from '%s'"), op.string, state->name));
+                        return false;
+                    }
+
+                    next = depth - (s64)(callee.register_args + callee.stack_args)
+                                 + (s64)(callee.stack_returns + callee.register_returns);
+                } break;
+
+                case IR_ALLOC:
+                case IR_FREE:
+                    log_error(string_format(get_temporary_allocator(), STRING("C backend: '%s' uses %s, it is not supported"), state->name, STRING(ir_code_to_string(op.operation))));
+                    return false;
+
+                default:
+                    if (is_binary(op.operation))        next = depth - 1;
+                    if (is_vector_binary(op.operation)) next = depth - (s64)ir_vector_entries(op.u_operand);
+                    break;
+            }
+
+            state->max_depth = MAX(state->max_depth, next);
+
+            s64 successors[2] = { falls ? (s64)i + 1 : -1, target };
+
+            for (u64 s = 0; s < 2; s++) {
+                s64 to = successors[s];
+                if (to < 0) continue;
+
+                if (to > (s64)count) {
+                    log_error(string_format(get_temporary_allocator(), STRING("C backend: jump out of '%s'"), state->name));
+                    return false;
+                }
+
+                if (!state->known[to]) {
+                    state->known[to]  = true;
+                    state->depths[to] = next;
+                    changed = true;
+                } else if (state->depths[to] != next) {
+                    log_error(string_format(get_temporary_allocator(), STRING("C backend: exec stack depth differs between paths in '%s'"), state->name));
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+static void c_compile_prototype(c_state_t *state, string_t name, ir_function_t *func, b32 declaration) {
+    allocator_t *talloc = get_temporary_allocator();
+
+    string_t line = string_format(talloc, STRING("static %s slm_%s(s64 *base"), STRING(func->register_returns ? "s64" : "void"), name);
+
+    for (u64 i = 0; i < func->register_args; i++) {
+        line = string_format(talloc, STRING("%s, s64 p%u"), line, i);
+    }
+
+    c_add_line(state, string_format(talloc, STRING("%s)%s"), line, STRING(declaration ? ";" : " {")), 0);
+}
+
+// callee gets base just above its stack arguments, values of ours that are
+// going to be its arguments are written there first and results read back
+static b32 c_compile_call(c_state_t *state, ir_opcode_t op, s64 depth) {
+    allocator_t *talloc = get_temporary_allocator();
+    c_signature_t callee = {};
+
+    c_get_signature(state->ir, op.string, &callee);
+
+    s64 args  = (s64)callee.register_args;
+    s64 first = depth - args - (s64)callee.stack_args;
+
+    for (s64 e = MAX(first, 0); e < depth - args; e++) {
+        c_add_line(state, string_format(talloc, STRING("base[%u] = s%u;"), (u64)e, (u64)e));
+    }
+
+    string_t call = string_format(talloc, STRING("slm_%s(base + %d"), op.string, depth - args);
+
+    for (s64 i = 0; i < args; i++) {
+        call = string_format(talloc, STRING("%s, %s"), call, c_exec(depth - args + i));
+    }
+
+    s64 returns = (s64)callee.stack_returns;
+
+    if (callee.register_returns) {
+        c_add_line(state, string_format(talloc, STRING("%s = %s);"), c_exec(first + returns), call));
+    } else {
+        c_add_line(state, string_format(talloc, STRING("%s);"), call));
+    }
+
+    for (s64 e = MAX(first, 0); e < first + returns; e++) {
+        c_add_line(state, string_format(talloc, STRING("s%u = base[%u];"), (u64)e, (u64)e));
+    }
+
+    return true;
+}
+
+static b32 c_compile_ret(c_state_t *state, s64 depth) {
+    allocator_t *talloc = get_temporary_allocator();
+    c_signature_t signature = {};
+
+    c_get_signature(state->ir, state->name, &signature);
+
+    s64 results = (s64)signature.stack_returns - (s64)signature.stack_args;
+
+    if (depth - (s64)signature.register_returns != results) {
+        log_error(string_format(get_temporary_allocator(), STRING("C backend: exec stack at return of '%s' doesn't match its signature"), state->name));
+        return false;
+    }
+
+    for (s64 e = 0; e < results; e++) {
+        c_add_line(state, string_format(talloc, STRING("base[%u] = s%u;"), (u64)e, (u64)e));
+    }
+
+    if (signature.register_returns) {
+        c_add_line(state, string_format(talloc, STRING("return %s;"), c_exec(depth - 1)));
+    } else {
+        c_add_line(state, STRING("return;"));
+    }
+
+    return true;
+}
+
+// entries first..first + count - 1 as C array initializer
+static string_t c_vector_entries(s64 first, u64 count) {
+    string_t list = c_exec(first);
+
+    for (u64 e = 1; e < count; e++) {
+        list = string_format(get_temporary_allocator(), STRING("%s, %s"), list, c_exec(first + (s64)e));
+    }
+
+    return list;
+}
+
+// vector of entries first.. is written back from array
+static void c_vector_result(c_state_t *state, s64 first, u64 count, const char *array) {
+    for (u64 e = 0; e < count; e++) {
+        c_add_line(state, string_format(get_temporary_allocator(), STRING("%s = %s[%u];"), c_exec(first + (s64)e), STRING(array), e), 2);
+    }
+}
+
+static void c_compile_vector(c_state_t *state, ir_opcode_t op, s64 depth) {
+    allocator_t *talloc = get_temporary_allocator();
+
+    u64 entries = ir_vector_entries(op.u_operand);
+    u64 lane    = IR_VECTOR_LANE(op.u_operand);
+    u64 size    = IR_VECTOR_SIZE(op.u_operand);
+    s64 count   = (s64)entries;
+
+    c_add_line(state, STRING("{"));
+
+    switch (op.operation) {
+        case IR_VLOAD:
+            c_add_line(state, string_format(talloc, STRING("s64 address = %s;"), c_exec(depth - 1)), 2);
+
+            for (s64 e = 0; e < count; e++) {
+                c_add_line(state, string_format(talloc, STRING("%s = load64(address + %u);"), c_exec(depth - 1 + e), (u64)e * 8), 2);
+            }
+            break;
+
+        case IR_VSTORE:
+            for (s64 e = 0; e < count; e++) {
+                c_add_line(state, string_format(talloc, STRING("store64(%s + %u, %s);"), c_exec(depth - 1), (u64)e * 8, c_exec(depth - 1 - count + e)), 2);
+            }
+            break;
+
+        case IR_VSPLAT:
+            c_add_line(state, string_format(talloc, STRING("s64 v[%u];"), entries), 2);
+            c_add_line(state, string_format(talloc, STRING("vector_splat(%u, %u, %s, v);"), lane, size, c_exec(depth - 1)), 2);
+            c_vector_result(state, depth - 1, entries, "v");
+            break;
+
+        default:
+            c_add_line(state, string_format(talloc, STRING("s64 a[%u] = { %s };"), entries, c_vector_entries(depth - count, entries)), 2);
+            c_add_line(state, string_format(talloc, STRING("s64 b[%u] = { %s };"), entries, c_vector_entries(depth - count * 2, entries)), 2);
+            c_add_line(state, string_format(talloc, STRING("vector_binary(%u, %u, %u, a, b);"), op.operation - IR_VADD, lane, size), 2);
+            c_vector_result(state, depth - count * 2, entries, "b");
+            break;
+    }
+
+    c_add_line(state, STRING("}"));
+}
+
+static b32 c_compile_opcode(c_state_t *state, u64 i) {
+    allocator_t *talloc = get_temporary_allocator();
+
+    ir_opcode_t op = state->func->code[i];
+    s64 depth = state->depths[i];
+
+    string_t top   = c_exec(depth - 1);
+    string_t below = c_exec(depth - 2);
+    string_t push  = c_exec(depth);
+
+    switch (op.operation) {
+        case IR_NOP:
+        case IR_ALIGN:
+        case IR_STACK_FRAME_PUSH:
+        case IR_STACK_FRAME_POP:
+        case IR_POP:
+            break;
+
+        case IR_PUSH_SIGN:
+        case IR_PUSH_UNSIGN:
+            c_add_line(state, string_format(talloc, STRING("%s = %s;"), push, c_constant(op.s_operand)));
+            break;
+
+        case IR_PUSH_STACK:
+            c_add_line(state, string_format(talloc, STRING("%s = %s;"), push, c_local(state, op.u_operand)));
+            break;
+        case IR_PUSH_SEA:
+            c_add_line(state, string_format(talloc, STRING("%s = (s64)(intptr_t)&%s;"), push, c_local(state, op.u_operand)));
+            break;
+        case IR_PUSH_GLOBAL:
+            c_add_line(state, string_format(talloc, STRING("%s = global_variables[%u];"), push, op.u_operand));
+            break;
+        case IR_PUSH_GEA:
+            c_add_line(state, string_format(talloc, STRING("%s = (s64)(intptr_t)&global_variables[%u];"), push, op.u_operand));
+            break;
+
+        case IR_SETUP_GLOBAL:
+            c_add_line(state, string_format(talloc, STRING("global_variables[%u] = %s;"), op.u_operand, top));
+            break;
+
+        case IR_CLONE:
+            c_add_line(state, string_format(talloc, STRING("%s = %s;"), push, top));
+            break;
+
+        case IR_LOAD:
+        case IR_LOAD8S:
+        case IR_LOAD8U:
+        case IR_LOAD16S:
+        case IR_LOAD16U:
+        case IR_LOAD32S:
+        case IR_LOAD32U: {
+            static const char *loads[] = { "load8s", "load8u", "load16s", "load16u", "load32s", "load32u" };
+            const char *load = op.operation == IR_LOAD ? "load64" : loads[op.operation - IR_LOAD8S];
+
+            c_add_line(state, string_format(talloc, STRING("%s = %s(%s);"), top, STRING(load), top));
+        } break;
+
+        // address is on top, value under it
+        case IR_STORE:   c_add_line(state, string_format(talloc, STRING("store64(%s, %s);"), top, below)); break;
+        case IR_STORE8:  c_add_line(state, string_format(talloc, STRING("store8(%s, %s);"),  top, below)); break;
+        case IR_STORE16: c_add_line(state, string_format(talloc, STRING("store16(%s, %s);"), top, below)); break;
+        case IR_STORE32: c_add_line(state, string_format(talloc, STRING("store32(%s, %s);"), top, below)); break;
+
+        case IR_LOADF32:  c_add_line(state, string_format(talloc, STRING("%s = loadf32(%s);"), top, top)); break;
+        case IR_STOREF32: c_add_line(state, string_format(talloc, STRING("storef32(%s, %s);"), top, below)); break;
+
+        // left operand is on top, result goes in place of right one,
+        // wrapping arithmetic is done on unsigned to stay defined
+        case IR_ADD: c_add_line(state, string_format(talloc, STRING("%s = (s64)((u64)%s + (u64)%s);"), below, top, below)); break;
+        case IR_SUB: c_add_line(state, string_format(talloc, STRING("%s = (s64)((u64)%s - (u64)%s);"), below, top, below)); break;
+        case IR_MUL: c_add_line(state, string_format(talloc, STRING("%s = (s64)((u64)%s * (u64)%s);"), below, top, below)); break;
+        case IR_DIV: c_add_line(state, string_format(talloc, STRING("%s = %s / %s;"), below, top, below)); break;
+        case IR_MOD: c_add_line(state, string_format(talloc, STRING("%s = %s %% %s;"), below, top, below)); break;
+
+        case IR_BIT_AND: c_add_line(state, string_format(talloc, STRING("%s = %s & %s;"), below, top, below)); break;
+        case IR_BIT_OR:  c_add_line(state, string_format(talloc, STRING("%s = %s | %s;"), below, top, below)); break;
+        case IR_BIT_XOR: c_add_line(state, string_format(talloc, STRING("%s = %s ^ %s;"), below, top, below)); break;
+
+        // count is masked like x86 does
+        case IR_SHIFT_LEFT:  c_add_line(state, string_format(talloc, STRING("%s = (s64)((u64)%s << (%s & 63));"), below, top, below)); break;
+        case IR_SHIFT_RIGHT: c_add_line(state, string_format(talloc, STRING("%s = %s >> (%s & 63);"), below, top, below)); break;
+
+        case IR_CMP_EQ:  c_add_line(state, string_format(talloc, STRING("%s = %s == %s;"), below, top, below)); break;
+        case IR_CMP_NEQ: c_add_line(state, string_format(talloc, STRING("%s = %s != %s;"), below, top, below)); break;
+        case IR_CMP_LT:  c_add_line(state, string_format(talloc, STRING("%s = %s < %s;"),  below, top, below)); break;
+        case IR_CMP_GT:  c_add_line(state, string_format(talloc, STRING("%s = %s > %s;"),  below, top, below)); break;
+        case IR_CMP_LTE: c_add_line(state, string_format(talloc, STRING("%s = %s <= %s;"), below, top, below)); break;
+        case IR_CMP_GTE: c_add_line(state, string_format(talloc, STRING("%s = %s >= %s;"), below, top, below)); break;
+
+        case IR_NEG:     c_add_line(state, string_format(talloc, STRING("%s = (s64)(0 - (u64)%s);"), top, top)); break;
+        case IR_BIT_NOT: c_add_line(state, string_format(talloc, STRING("%s = ~%s;"), top, top)); break;
+        case IR_LOG_NOT: c_add_line(state, string_format(talloc, STRING("%s = !%s;"), top, top)); break;
+
+        // floats live as their bits in s64 slots
+        case IR_FADD: c_add_line(state, string_format(talloc, STRING("%s = bits_of(f64_of(%s) + f64_of(%s));"), below, top, below)); break;
+        case IR_FSUB: c_add_line(state, string_format(talloc, STRING("%s = bits_of(f64_of(%s) - f64_of(%s));"), below, top, below)); break;
+        case IR_FMUL: c_add_line(state, string_format(talloc, STRING("%s = bits_of(f64_of(%s) * f64_of(%s));"), below, top, below)); break;
+        case IR_FDIV: c_add_line(state, string_format(talloc, STRING("%s = bits_of(f64_of(%s) / f64_of(%s));"), below, top, below)); break;
+        case IR_FNEG: c_add_line(state, string_format(talloc, STRING("%s = bits_of(-f64_of(%s));"), top, top)); break;
+
+        case IR_FCMP_EQ:  c_add_line(state, string_format(talloc, STRING("%s = f64_of(%s) == f64_of(%s);"), below, top, below)); break;
+        case IR_FCMP_NEQ: c_add_line(state, string_format(talloc, STRING("%s = f64_of(%s) != f64_of(%s);"), below, top, below)); break;
+        case IR_FCMP_LT:  c_add_line(state, string_format(talloc, STRING("%s = f64_of(%s) < f64_of(%s);"),  below, top, below)); break;
+        case IR_FCMP_GT:  c_add_line(state, string_format(talloc, STRING("%s = f64_of(%s) > f64_of(%s);"),  below, top, below)); break;
+        case IR_FCMP_LTE: c_add_line(state, string_format(talloc, STRING("%s = f64_of(%s) <= f64_of(%s);"), below, top, below)); break;
+        case IR_FCMP_GTE: c_add_line(state, string_format(talloc, STRING("%s = f64_of(%s) >= f64_of(%s);"), below, top, below)); break;
+
+        case IR_INT_TO_FLOAT: c_add_line(state, string_format(talloc, STRING("%s = bits_of((double)%s);"), top, top)); break;
+        case IR_FLOAT_TO_INT: c_add_line(state, string_format(talloc, STRING("%s = f64_to_s64(%s);"), top, top)); break;
+        case IR_ROUND_F32:    c_add_line(state, string_format(talloc, STRING("%s = bits_of((double)(float)f64_of(%s));"), top, top)); break;
+
+        case IR_VLOAD:
+        case IR_VSTORE:
+        case IR_VSPLAT:
+        case IR_VADD:
+        case IR_VSUB:
+        case IR_VMUL:
+        case IR_VDIV:
+        case IR_VAND:
+        case IR_VOR:
+        case IR_VXOR:
+        case IR_VCMP_EQ:
+        case IR_VCMP_NEQ:
+        case IR_VCMP_LT:
+        case IR_VCMP_GT:
+        case IR_VCMP_LTE:
+        case IR_VCMP_GTE:
+            c_compile_vector(state, op, depth);
+            break;
+
+        // address is on top, then value or source, then count or size
+        case IR_MEM_FILL:
+            c_add_line(state, string_format(talloc, STRING("runtime_fill(%s, %s, %s, %u);"), top, below, c_exec(depth - 3), op.u_operand));
+            break;
+        case IR_MEM_COPY:
+        case IR_MEM_MOVE:
+            c_add_line(state, string_format(talloc, STRING("if (%s > 0) %s((void*)(intptr_t)%s, (void*)(intptr_t)%s, (size_t)%s);"), c_exec(depth - 3),
+                STRING(op.operation == IR_MEM_COPY ? "memcpy" : "memmove"), top, below, c_exec(depth - 3)));
+            break;
+
+        case IR_POPCOUNT:
+        case IR_CLZ:
+        case IR_CTZ:
+        case IR_BSWAP:
+            c_add_line(state, string_format(talloc, STRING("%s = bit_operation(%u, %u, (u64)%s, 0);"), top, op.operation - IR_POPCOUNT, op.u_operand, top));
+            break;
+        case IR_ROTL:
+        case IR_ROTR:
+            c_add_line(state, string_format(talloc, STRING("%s = bit_operation(%u, %u, (u64)%s, %s);"), below, op.operation - IR_POPCOUNT, op.u_operand, top, below));
+            break;
+
+        case IR_JUMP:
+            c_add_line(state, string_format(talloc, STRING("goto L%u;"), (u64)((s64)i + 1 + op.s_operand)));
+            break;
+        case IR_JUMP_IF:
+            c_add_line(state, string_format(talloc, STRING("if (%s) goto L%u;"), top, (u64)((s64)i + 1 + op.s_operand)));
+            break;
+        case IR_JUMP_IF_NOT:
+            c_add_line(state, string_format(talloc, STRING("if (!%s) goto L%u;"), top, (u64)((s64)i + 1 + op.s_operand)));
+            break;
+
+        case IR_CALL:
+            return c_compile_call(state, op, depth);
+        case IR_RET:
+            return c_compile_ret(state, depth);
+
+        case IR_BRK:
+            c_add_line(state, STRING("runtime_break();"));
+            break;
+
+        case IR_INVALID:
+            c_add_line(state, STRING("abort();"));
+            break;
+
+        default:
+            assert(false);
+            c_add_line(state, STRING("abort();"));
+            break;
+    }
+
+    return true;
+}
+
+static b32 c_compile_func(c_state_t *state) {
+    profiler_func_start();
+
+    allocator_t *talloc = get_temporary_allocator();
+    ir_function_t *func = state->func;
+    u64 count = func->code.count;
+
+    state->targets = (b8*)mem_alloc(default_allocator, count + 1);
+    state->known   = (b8*)mem_alloc(default_allocator, count + 1);
+    state->depths  = (s64*)mem_alloc(default_allocator, (count + 1) * sizeof(s64));
+
+    mem_set((u8*)state->targets, 0, count + 1);
+    mem_set((u8*)state->known,   0, count + 1);
+
+    for (u64 i = 0; i < count; i++) {
+        ir_opcode_t op = func->code[i];
+        if (!is_jump(op.operation)) continue;
+
+        s64 target = (s64)i + 1 + op.s_operand;
+        if (target >= 0 && target <= (s64)count) state->targets[target] = true;
+    }
+
+    c_find_direct_slots(state);
+
+    b32 valid = c_compute_depths(state);
+
+    if (valid) {
+        c_compile_prototype(state, state->name, func, false);
+
+        if (state->uses_frame) {
+            c_add_line(state, string_format(talloc, STRING("s64 frame[%u];"), func->frame_size + 1));
+        }
+
+        for (u64 slot = 0; slot < state->slot_count; slot++) {
+            if (!state->direct_slots[slot]) continue;
+            c_add_line(state, string_format(talloc, STRING("s64 l%u = 0;"), slot));
+        }
+
+        for (s64 d = 0; d < state->max_depth; d++) {
+            if (d < (s64)func->register_args) {
+                c_add_line(state, string_format(talloc, STRING("s64 s%u = p%u;"), (u64)d, (u64)d));
+            } else {
+                c_add_line(state, string_format(talloc, STRING("s64 s%u = 0;"), (u64)d));
+            }
+        }
+
+        c_add_line(state, STRING(""), 0);
+
+        for (u64 i = 0; i < count && valid; i++) {
+            if (!state->known[i]) continue;
+
+            ir_opcode_t op = func->code[i];
+
+            if (state->targets[i]) {
+                c_add_line(state, string_format(talloc, STRING("L%u:;"), i), 0);
+            }
+
+            // reads and writes of a local that lives in C local
+            if (op.operation == IR_PUSH_SEA && op.u_operand < state->slot_count && state->direct_slots[op.u_operand]) {
+                s64      depth = state->depths[i];
+                string_t local = c_local(state, op.u_operand);
+
+                if (func->code[i + 1].operation == IR_LOAD) {
+                    c_add_line(state, string_format(talloc, STRING("%s = %s;"), c_exec(depth), local));
+                } else {
+                    c_add_line(state, string_format(talloc, STRING("%s = %s;"), local, c_exec(depth - 1)));
+                }
+
+                i++;
+                continue;
+            }
+
+            valid = c_compile_opcode(state, i);
+        }
+
+        // nothing should fall off the end, native code would run into the next function
+        if (state->known[count]) {
+            if (state->targets[count]) c_add_line(state, string_format(talloc, STRING("L%u:;"), count), 0);
+            c_add_line(state, STRING("abort();"));
+        }
+
+        c_add_line(state, STRING("}"), 0);
+        c_add_line(state, STRING(""), 0);
+    }
+
+    mem_free(default_allocator, (u8*)state->direct_slots);
+    mem_free(default_allocator, (u8*)state->depths);
+    mem_free(default_allocator, (u8*)state->known);
+    mem_free(default_allocator, (u8*)state->targets);
+
+    profiler_func_end();
+    return valid;
+}
+
+struct c_function_t {
+    string_t       name;
+    ir_function_t *func;
+};
+
+static COMP_PROC(compare_c_functions) {
+    UNUSED(size);
+    return string_compare(((c_function_t*)a)->name, ((c_function_t*)b)->name);
+}
+
+b32 c_compile_program(ir_t *state, sink_t *output) {
+    profiler_func_start();
+
+    c_state_t c = {};
+    c.ir     = state;
+    c.output = output;
+
+    c_add_line(&c, STRING("/* solum-compiler auto generated code, c99 */"), 0);
+    c_add_line(&c, STRING(""), 0);
+
+    for (u64 i = 0; i < sizeof(c_runtime) / sizeof(*c_runtime); i++) {
+        c_add_line(&c, STRING(c_runtime[i]), 0);
+    }
+
+    c_add_line(&c, string_format(get_temporary_allocator(), STRING("static s64 exec_stack[%u];"), (u64)C_EXEC_STACK_SIZE), 0);
+    c_add_line(&c, string_format(get_temporary_allocator(), STRING("static s64 global_variables[%u] = {"), MAX(state->globals.count, (u64)1)), 0);
+
+    for (u64 i = 0; i < state->globals.count; i++) {
+        c_add_line(&c, string_format(get_temporary_allocator(), STRING("%s,"), c_constant(state->globals[i])));
+    }
+
+    c_add_line(&c, STRING("};"), 0);
+    c_add_line(&c, STRING(""), 0);
+
+    b32 valid = true;
+
+    list_t<c_function_t> functions = {};
+    list_create(&functions, 64, *default_allocator);
+
+    for (u64 i = 0; i < state->functions.capacity; i++) {
+        kv_pair_t<string_t, ir_function_t> *pair = state->functions.entries + i;
+
+        if (!pair->occupied) continue;
+        if (pair->deleted)   continue;
+
+        if (pair->value.is_external) {
+            if (c_find_external(pair->key) == NULL) {
+                log_error(string_format(get_temporary_allocator(), STRING("C backend: no runtime function for external '%s'"), pair->key));
+                valid = false;
+            }
+            continue;
+        }
+
+        c_function_t function = { pair->key, &pair->value };
+        list_add(&functions, &function);
+    }
+
+    if (functions.count) sort_array(functions.data, functions.count, compare_c_functions);
+
+    for (u64 i = 0; i < functions.count; i++) {
+        c_function_t *function = list_get(&functions, i);
+        c_compile_prototype(&c, function->name, function->func, true);
+    }
+
+    c_add_line(&c, STRING(""), 0);
+
+    for (u64 i = 0; i < functions.count && valid; i++) {
+        c_function_t *function = list_get(&functions, i);
+
+        c.func = function->func;
+        c.name = function->name;
+
+        valid = c_compile_func(&c);
+    }
+
+    list_delete(&functions);
+
+    ir_function_t *main = hashmap_get(&state->functions, STRING("main"));
+
+    if (main == NULL || main->is_external) {
+        log_error("Couldn't find main in code.");
+        profiler_func_end();
+        return false;
+    }
+
+    c_add_line(&c, STRING("int main(void) {"), 0);
+
+    if (main->register_returns) {
+        c_add_line(&c, STRING("return (int)slm_main(exec_stack);"));
+    } else {
+        c_add_line(&c, STRING("slm_main(exec_stack);"));
+        c_add_line(&c, STRING("return (int)exec_stack[0];"));
+    }
+
+    c_add_line(&c, STRING("}"), 0);
+
+    profiler_func_end();
+    return valid;
+}
@@ -13,6 +13,12 @@
 
 #include "ir.h"
 #include "interop.h"
+#include "bytecode.h"
+#include "comptime.h"
+#include "sink.h"
+#include "jit.h"
+#include "pgo.h"
+#include "loops.h"
 
 #include "strings.h"
 #include "profiler.h"
@@ -23,6 +29,16 @@
 
 compiler_configuration_t compiler_config = {};
 
+u64 compiler_target(void) {
+    if (compiler_config.target != TARGET_HOST) return compiler_config.target;
+
+#ifdef _WIN32
+    return TARGET_WIN64;
+#else
+    return TARGET_LINUX;
+#endif
+}
+
 string_t get_global_modules_search_path(void) {
     assert(default_allocator != NULL);
 
@@ -74,19 +90,42 @@ compiler_t create_compiler_instance(allocator_t *alloc) {
     return compiler;
 }
 
-void compile(compiler_t *state) {
+// called once interpreter is done with compile time code,
+// but before __internal_compile_globals is removed, lines of it are still needed
+static void finish_interpreter_profile(ir_t *ir, interop_profile_t *profile) {
+    interop_set_profile(NULL);
+
+    if (profile->collect) {
+        if (compiler_config.interp_profile) {
+            interop_profile_print(ir, profile);
+        }
+
+        if (compiler_config.interp_profile_json.data) {
+            if (!interop_profile_write_json(ir, profile, compiler_config.interp_profile_json)) {
+                log_error(string_format(get_temporary_allocator(), STRING("Couldn't write interpreter profile '%s'"), compiler_config.interp_profile_json));
+            }
+        }
+    }
+
+    interop_profile_delete(profile);
+}
+
+// every block pushed here is popped on the way out, errors included
+b32 compile(compiler_t *state) {
     profiler_push("Internal");
     profiler_push("Preload all files");
     if (!analyzer_preload_all_files(state)) {
         profiler_pop("Preload all files");
-        return;
+        profiler_pop("Internal");
+        return false;
     }
     profiler_pop("Preload all files");
 
     profiler_push("Analyze");
     if (!analyze(state)) {
         profiler_pop("Analyze");
-        return;
+        profiler_pop("Internal");
+        return false;
     }
     profiler_pop("Analyze");
 
@@ -94,6 +133,32 @@ void compile(compiler_t *state) {
     ir_t result = compile_program(state);
     profiler_pop("IR gen");
 
+    interop_profile_t profile = {};
+    profile.collect    = compiler_config.interp_profile || compiler_config.interp_profile_json.data != NULL;
+    profile.step_limit = compiler_config.interp_step_limit;
+
+    interop_set_profile(&profile);
+
+    string_t comptime_cache = {};
+
+    if (compiler_config.comptime_cache) {
+        string_t output = compiler_config.filename.data ? compiler_config.filename : STRING("output");
+        comptime_cache  = string_format(get_temporary_allocator(), STRING("%s.%s"), output, STRING(COMPTIME_CACHE_EXTENSION));
+    }
+
+    // calls global initialisers need go first, rest see initialised globals
+    if (result.is_valid) {
+        profiler_push("Comptime");
+        result.is_valid = comptime_evaluate(&result, comptime_cache, false);
+        profiler_pop("Comptime");
+
+        if (!result.is_valid) {
+            finish_interpreter_profile(&result, &profile);
+        }
+    } else {
+        interop_set_profile(NULL);
+    }
+
     if (result.is_valid) {
         string_t key = STRING("__internal_compile_globals");
 
@@ -104,7 +169,20 @@ void compile(compiler_t *state) {
 
             assert(func);
 
-            interp_state = interop_func(&result, key);
+            // interpreter is kept when its counters or step limit are asked for
+            if (jit_is_supported() && !profile.collect && !profile.step_limit) {
+                interp_state = jit_call(&result, key, NULL);
+            } else {
+                interp_state = interop_func(&result, key);
+            }
+
+            if (interp_state) {
+                profiler_push("Comptime");
+                result.is_valid = comptime_evaluate(&result, comptime_cache, true);
+                profiler_pop("Comptime");
+            }
+
+            finish_interpreter_profile(&result, &profile);
 
             if (hashmap_remove(&result.functions, STRING("__internal_compile_globals"))) {
                 array_delete(&func->code);
@@ -114,45 +192,302 @@ void compile(compiler_t *state) {
 
         if (!interp_state) {
             log_error("Error interpreting code!");
-            return;
+        }
+
+        if (!interp_state || !result.is_valid) {
+            profiler_pop("Internal");
+            return false;
+        }
+
+        profiler_push("Dead code");
+        deadcode_sweep(state, &result);
+        profiler_pop("Dead code");
+
+        if (compiler_config.verbose) {
+            deadcode_stats_t stats = state->deadcode;
+
+            log_info(string_format(get_temporary_allocator(), STRING("dead code: %u of %u functions unreachable, %u bytes of source not compiled"),
+                        stats.unreachable, stats.functions, stats.source_bytes));
+            log_info(string_format(get_temporary_allocator(), STRING("dead code: %u functions used only at compile time, %u bytes of IR dropped"),
+                        stats.compile_time, stats.ir_bytes));
+        }
+
+        if (compiler_config.profile_generate.data) {
+            profiler_push("Profile generate");
+            pgo_generate(&result, compiler_config.profile_generate);
+            profiler_pop("Profile generate");
+
+            profiler_pop("Internal");
+            return true;
+        }
+
+        if (compiler_config.profile_use.data) {
+            profiler_push("Profile use");
+
+            pgo_profile_t pgo   = {};
+            pgo_stats_t   stats = {};
+
+            if (pgo_load(&result, compiler_config.profile_use, &pgo, &stats)) {
+                pgo_apply(&result, &pgo, &stats);
+                pgo_delete(&pgo);
+
+                // leaf functions inlined at every call site aren't reached anymore,
+                // they are not counted as compile time ones
+                deadcode_stats_t deadcode = state->deadcode;
+                deadcode_sweep(state, &result);
+
+                stats.removed   = state->deadcode.compile_time - deadcode.compile_time;
+                state->deadcode = deadcode;
+            }
+
+            if (compiler_config.verbose) {
+                log_info(string_format(get_temporary_allocator(), STRING("pgo: %u functions profiled, %u stale, %u calls inlined, %u functions removed"),
+                            stats.profiled, stats.stale, stats.inlined, stats.removed));
+                log_info(string_format(get_temporary_allocator(), STRING("pgo: %u cold blocks moved, %u loops aligned"),
+                            stats.cold, stats.aligned));
+            }
+
+            profiler_pop("Profile use");
+        }
+
+        {
+            profiler_push("Loops");
+
+            loops_stats_t stats = {};
+            loops_optimize(&result, &stats);
+
+            if (compiler_config.verbose) {
+                log_info(string_format(get_temporary_allocator(), STRING("loops: %u loops, %u expressions hoisted, %u strength reduced"),
+                            stats.loops, stats.hoisted, stats.reduced));
+            }
+
+            profiler_pop("Loops");
+        }
+
+        if (compiler_config.emit_bytecode) {
+            string_t filename = compiler_config.filename.data ? compiler_config.filename : STRING("output");
+            string_t module   = string_format(get_temporary_allocator(), STRING("%s.%s"), filename, STRING(BYTECODE_EXTENSION));
+
+            profiler_push("Bytecode");
+            b32 written = bytecode_write(&result, module, !compiler_config.strip_debug);
+
+            if (!written) {
+                log_error(string_format(get_temporary_allocator(), STRING("Couldn't write module '%s'"), module));
+            }
+            profiler_pop("Bytecode");
+
+            profiler_pop("Internal");
+            return written;
         }
 
         profiler_pop("Internal");
+
+        if (compiler_config.run) {
+            if (!jit_is_supported()) {
+                log_error("--run needs x86-64 System V host");
+                return false;
+            }
+
+            profiler_push("Run");
+            b32 ran = jit_call(&result, STRING("main"), &state->exit_code);
+            if (!ran) state->exit_code = -1;
+            profiler_pop("Run");
+            return ran;
+        }
+
+        if (compiler_config.backend == BACKEND_X64) {
+            if (compiler_config.target == TARGET_WIN64) {
+                log_error("x64 backend writes only linux executables, use --backend=nasm for win64");
+                return false;
+            }
+
+            string_t filename = compiler_config.filename.data ? compiler_config.filename : STRING("output");
+
+            profiler_push("X64 backend generation");
+            x64_module_t module = x64_compile_program(&result, X64_RUNTIME_LINUX);
+            profiler_pop("X64 backend generation");
+
+            b32 written = module.is_valid;
+
+            if (written) {
+                profiler_push("Writing ELF");
+                if (compiler_config.emit_object) {
+                    written = elf_write_object(&module, string_format(get_temporary_allocator(), STRING("%s.o"), filename));
+                } else {
+                    written = elf_write_executable(&module, filename);
+                }
+                profiler_pop("Writing ELF");
+            }
+
+            x64_module_delete(&module);
+            return written;
+        }
+
+        if (compiler_config.backend == BACKEND_C) {
+            string_t filename = compiler_config.filename.data ? compiler_config.filename : STRING("output");
+            string_t source   = string_format(get_temporary_allocator(), STRING("%s.c"), filename);
+
+            profiler_push("External");
+
+            profiler_push("C backend generation");
+            {
+                sink_t output = {};
+
+                b32 valid = sink_open(&output, source);
+                if (valid) valid = c_compile_program(&result, &output);
+
+                if (!sink_close(&output) && valid) {
+                    log_error(string_format(get_temporary_allocator(), STRING("Couldn't write '%s'"), source));
+                    valid = false;
+                }
+
+                if (!valid) {
+                    profiler_pop("C backend generation");
+                    profiler_pop("External");
+                    return false;
+                }
+            }
+            profiler_pop("C backend generation");
+
+#ifdef _WIN32
+            string_t cc     = STRING("clang.exe");
+            string_t binary = string_format(get_temporary_allocator(), STRING("%s.exe"), filename);
+#else
+            string_t cc     = STRING("cc");
+            string_t binary = filename;
+#endif
+
+            string_t cc_args[] = { STRING("-O2"), STRING("-std=c99"), source, STRING("-o"), binary };
+
+            profiler_push("Compiling C");
+            if (platform_run_process(cc, cc_args, sizeof(cc_args) / sizeof(cc_args[0])) != 0) { profiler_pop("Compiling C"); profiler_pop("External"); return false; }
+            profiler_pop("Compiling C");
+
+            profiler_pop("External");
+            return true;
+        }
+
         profiler_push("External");
 
+        string_t filename = compiler_config.filename.data ? compiler_config.filename : STRING("output");
+
+        string_t backend_config = string_format(get_temporary_allocator(), STRING("%s.nasm"), filename);
+
         profiler_push("Nasm backend generation");
-        backend_t backend = nasm_compile_program(&result);
+        {
+            sink_t output = {};
+
+            b32 valid = sink_open(&output, backend_config);
+            if (valid) valid = nasm_compile_program(&result, &output);
+
+            if (!sink_close(&output) && valid) {
+                log_error(string_format(get_temporary_allocator(), STRING("Couldn't write '%s'"), backend_config));
+                valid = false;
+            }
+
+            if (!valid) {
+                profiler_pop("Nasm backend generation");
+                profiler_pop("External");
+                return false;
+            }
+        }
         profiler_pop("Nasm backend generation");
 
+        // every argument goes to the process as it is, file names can have spaces
+        string_t nasm   = {};
+        string_t linker = {};
+        string_t object = {};
 
+        string_t nasm_args[8]  = {};
+        string_t link_args[16] = {};
+        u64 nasm_count = 0;
+        u64 link_count = 0;
 
-        string_t content = { c_string_length((char*)backend.code.data), backend.code.data };
+        if (compiler_target() == TARGET_LINUX) {
+            nasm   = STRING("nasm");
+            object = string_format(get_temporary_allocator(), STRING("%s.o"), filename);
 
-        string_t filename = compiler_config.filename.data ? compiler_config.filename : STRING("output");
+            nasm_args[nasm_count++] = STRING("-g");
+            nasm_args[nasm_count++] = STRING("-f");
+            nasm_args[nasm_count++] = STRING("elf64");
 
-        string_t backend_config = string_format(get_temporary_allocator(), STRING("%s.nasm"), filename);
+            linker = STRING("ld");
+
+            link_args[link_count++] = STRING("-o");
+            link_args[link_count++] = filename;
+            link_args[link_count++] = object;
+
+            if (compiler_config.show_link_time) link_args[link_count++] = STRING("--stats");
+        } else {
+            nasm   = STRING("nasm.exe");
+            object = string_format(get_temporary_allocator(), STRING("%s.obj"), filename);
+
+            nasm_args[nasm_count++] = STRING("-g");
+            nasm_args[nasm_count++] = STRING("-f");
+            nasm_args[nasm_count++] = STRING("win64");
 
-        string_t nasm_config = string_format(get_temporary_allocator(), STRING("-g -f win64 %s.nasm -o %s.obj"), filename, filename);
+            linker = STRING("lld-link.exe");
 
-        string_t link_config = STRING("/MACHINE:X64 /DYNAMICBASE /SUBSYSTEM:CONSOLE /DEBUG:FULL /ENTRY:mainCRTStartup kernel32.lib");
+            link_args[link_count++] = STRING("/MACHINE:X64");
+            link_args[link_count++] = STRING("/DYNAMICBASE");
+            link_args[link_count++] = STRING("/SUBSYSTEM:CONSOLE");
+            link_args[link_count++] = STRING("/DEBUG:FULL");
+            link_args[link_count++] = STRING("/ENTRY:mainCRTStartup");
+            link_args[link_count++] = STRING("kernel32.lib");
+            link_args[link_count++] = string_format(get_temporary_allocator(), STRING("/OUT:%s.exe"), filename);
+            link_args[link_count++] = object;
 
-        link_config          = string_format(get_temporary_allocator(), 
-                                    STRING("%s /OUT:%s.exe %s.obj %s"), 
-                                    link_config, filename, filename,
-                                    compiler_config.show_link_time ? STRING("/TIME") : STRING(" "));
+            if (compiler_config.show_link_time) link_args[link_count++] = STRING("/TIME");
+        }
+
+        nasm_args[nasm_count++] = backend_config;
+        nasm_args[nasm_count++] = STRING("-o");
+        nasm_args[nasm_count++] = object;
 
         profiler_push("Assembling");
-        platform_write_file(backend_config, content);
-        if (platform_run_process(STRING("nasm.exe"),     nasm_config) != 0) { profiler_pop("Assembling"); return; }
+        if (platform_run_process(nasm,   nasm_args, nasm_count) != 0) { profiler_pop("Assembling"); profiler_pop("External"); return false; }
         profiler_pop("Assembling");
 
         profiler_push("Linking");
-        if (platform_run_process(STRING("lld-link.exe"), link_config) != 0) { profiler_pop("Linking"); return; }
+        if (platform_run_process(linker, link_args, link_count) != 0) { profiler_pop("Linking"); profiler_pop("External"); return false; }
         profiler_pop("Linking");
 
         profiler_pop("External");
+        return true;
     } else {
         log_error(STRING("Compilation error"));
+        profiler_pop("Internal");
+        return false;
     }
 }
 
+
+b32 run_bytecode(string_t filename, s64 *exit_code) {
+    profiler_func_start();
+    bytecode_module_t module = {};
+
+    if (!bytecode_load(filename, &module)) {
+        profiler_func_end();
+        return false;
+    }
+
+    b32 result = true;
+
+    interop_profile_t profile = {};
+    profile.collect    = compiler_config.interp_profile || compiler_config.interp_profile_json.data != NULL;
+    profile.step_limit = compiler_config.interp_step_limit;
+
+    if (!hashmap_contains(&module.ir.functions, STRING("main"))) {
+        log_error(string_format(get_temporary_allocator(), STRING("Module '%s' has no main function"), filename));
+        result = false;
+    } else {
+        interop_set_profile(&profile);
+        result = interop_call(&module.ir, STRING("main"), NULL, 0, exit_code);
+        finish_interpreter_profile(&module.ir, &profile);
+    }
+
+    bytecode_unload(&module);
+
+    profiler_func_end();
+    return result;
+}
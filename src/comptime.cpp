@@ -0,0 +1,402 @@
+#include "comptime.h"
+
+#include "ir.h"
+#include "interop.h"
+#include "scanner.h"
+
+#include "list.h"
+#include "stack.h"
+#include "array.h"
+#include "hashmap.h"
+
+#include "allocator.h"
+#include "arena.h"
+#include "talloc.h"
+#include "strings.h"
+#include "profiler.h"
+#include "platform.h"
+
+enum comptime_status_t {
+    COMPTIME_PENDING,
+    COMPTIME_RUNNING,
+    COMPTIME_DONE,
+};
+
+struct comptime_state_t {
+    ir_t *ir;
+    allocator_t strings;
+    b32 globals_ready;
+
+    list_t<u8>               status;
+    hashmap_t<string_t, s64> memo;
+
+    b32 use_cache;
+    b32 cache_dirty;
+    hashmap_t<u64, s64> cache;
+
+    u64 evaluated;
+    u64 memoised;
+    u64 cached;
+};
+
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME  0x100000001b3ull
+
+static u64 hash_bytes(u64 hash, void *data, u64 size) {
+    u8 *bytes = (u8*)data;
+
+    for (u64 i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+// every function that can be reached from callee, in the order of first call
+static void collect_callees(ir_t *ir, string_t callee, hashmap_t<string_t, b32> *visited, list_t<string_t> *order) {
+    stack_t<string_t> work = {};
+    stack_push(&work, callee);
+
+    while (work.index > 0) {
+        string_t name = stack_pop(&work);
+
+        if (hashmap_contains(visited, name)) continue;
+
+        b32 value = true;
+        hashmap_add(visited, name, &value);
+        list_add(order, &name);
+
+        ir_function_t *func = hashmap_get(&ir->functions, name);
+
+        if (func == NULL || func->is_external) continue;
+
+        for (u64 i = func->code.count; i > 0; i--) {
+            ir_opcode_t op = func->code[i - 1];
+
+            if (op.operation == IR_CALL && !hashmap_contains(visited, op.string)) {
+                stack_push(&work, op.string);
+            }
+        }
+    }
+
+    if (work.data) stack_delete(&work);
+}
+
+static b32 reads_globals(ir_t *ir, list_t<string_t> *order) {
+    for (u64 i = 0; i < order->count; i++) {
+        ir_function_t *func = hashmap_get(&ir->functions, *list_get(order, i));
+
+        if (func == NULL || func->is_external) continue;
+
+        for (u64 j = 0; j < func->code.count; j++) {
+            u64 operation = func->code[j].operation;
+
+            if (operation == IR_PUSH_GLOBAL || operation == IR_PUSH_GEA) return true;
+        }
+    }
+
+    return false;
+}
+
+static u64 hash_globals(ir_t *ir, u64 hash) {
+    for (u64 i = 0; i < ir->globals.count; i++) {
+        hash = hash_bytes(hash, array_get(&ir->globals, i), sizeof(s64));
+    }
+
+    return hash;
+}
+
+static u64 hash_callees(ir_t *ir, list_t<string_t> *order, b32 *reaches_external) {
+    u64 hash = FNV_OFFSET;
+    *reaches_external = false;
+
+    u32 version = COMPTIME_CACHE_VERSION;
+    hash = hash_bytes(hash, &version, sizeof(version));
+
+    for (u64 i = 0; i < order->count; i++) {
+        string_t name = *list_get(order, i);
+        ir_function_t *func = hashmap_get(&ir->functions, name);
+
+        hash = hash_bytes(hash, name.data, name.size);
+
+        if (func == NULL || func->is_external) {
+            *reaches_external = true;
+            continue;
+        }
+
+        hash = hash_bytes(hash, &func->code.count, sizeof(u64));
+
+        for (u64 j = 0; j < func->code.count; j++) {
+            ir_opcode_t op = func->code[j];
+
+            hash = hash_bytes(hash, &op.operation, sizeof(u64));
+            hash = hash_bytes(hash, &op.u_operand, sizeof(u64));
+
+            if (op.string.size) {
+                hash = hash_bytes(hash, op.string.data, op.string.size);
+            }
+        }
+    }
+
+    return hash;
+}
+
+static b32 run_call(comptime_state_t *state, ir_comptime_call_t *call, s64 *result) {
+    ir_t *ir = state->ir;
+
+    // comptime code sees globals as initialisers left them, and cant change them
+    list_t<s64> snapshot = {};
+    list_create(&snapshot, ir->globals.count + 1, *default_allocator);
+
+    for (u64 i = 0; i < ir->globals.count; i++) {
+        s64 value = *array_get(&ir->globals, i);
+        list_add(&snapshot, &value);
+    }
+
+    b32 status = interop_call(ir, call->callee, call->args, call->arg_count, result);
+
+    for (u64 i = 0; i < ir->globals.count; i++) {
+        *array_get(&ir->globals, i) = snapshot[i];
+    }
+
+    list_delete(&snapshot);
+    return status;
+}
+
+static b32 resolve_call(comptime_state_t *state, u64 index) {
+    ir_t *ir = state->ir;
+    ir_comptime_call_t *call = list_get(&ir->comptime_calls, index);
+
+    switch (state->status[index]) {
+        case COMPTIME_DONE:    return true;
+        case COMPTIME_RUNNING:
+            log_error_token("comptime call depends on its own result", call->op->info);
+            return false;
+        default: break;
+    }
+
+    state->status[index] = COMPTIME_RUNNING;
+
+    hashmap_t<string_t, b32> visited = {};
+    hashmap_create(&visited, 16, NULL, NULL);
+    list_t<string_t> order = {};
+    list_create(&order, 16, *default_allocator);
+
+    collect_callees(ir, call->callee, &visited, &order);
+
+    b32 result = true;
+
+    // placeholders inside of reachable code should be filled before we run or hash it
+    for (u64 i = 0; result && i < ir->comptime_calls.count; i++) {
+        ir_comptime_call_t *other = list_get(&ir->comptime_calls, i);
+
+        if (i == index || !hashmap_contains(&visited, other->function)) continue;
+
+        result = resolve_call(state, i);
+    }
+
+    string_t key = string_copy(call->callee, &state->strings);
+
+    for (u64 i = 0; i < call->arg_count; i++) {
+        key = string_concat(key, string_format(get_temporary_allocator(), STRING(",%d"), call->args[i]), &state->strings);
+    }
+
+    s64 value = 0;
+    b32 uses_globals = reads_globals(ir, &order);
+
+    if (!result) {
+        // error was reported by dependency
+    } else if (uses_globals && !state->globals_ready) {
+        log_error_token("comptime call needed by global initialisers can't read globals", call->op->info);
+        result = false;
+    } else if (hashmap_contains(&state->memo, key)) {
+        value = *hashmap_get(&state->memo, key);
+        state->memoised++;
+    } else {
+        b32 reaches_external = false;
+        u64 hash = hash_callees(ir, &order, &reaches_external);
+        hash = hash_bytes(hash, call->args, call->arg_count * sizeof(s64));
+
+        if (uses_globals) hash = hash_globals(ir, hash);
+
+        b32 can_cache = state->use_cache && !reaches_external;
+
+        if (can_cache && hashmap_contains(&state->cache, hash)) {
+            value = *hashmap_get(&state->cache, hash);
+            state->cached++;
+        } else if (run_call(state, call, &value)) {
+            state->evaluated++;
+
+            if (can_cache) {
+                hashmap_add(&state->cache, hash, &value);
+                state->cache_dirty = true;
+            }
+        } else {
+            log_error_token("Error while evaluating comptime call", call->op->info);
+            result = false;
+        }
+
+        if (result) {
+            hashmap_add(&state->memo, key, &value);
+        }
+    }
+
+    if (result) {
+        call->op->s_operand  = value;
+        state->status[index] = COMPTIME_DONE;
+    }
+
+    hashmap_delete(&visited);
+    list_delete(&order);
+    return result;
+}
+
+static void load_cache(comptime_state_t *state, string_t filename) {
+    if (!platform_file_exists(filename)) return;
+
+    string_t content = {};
+
+    if (!platform_read_file_into_string(filename, default_allocator, &content)) return;
+
+    comptime_cache_header_t *header = (comptime_cache_header_t*)content.data;
+
+    b32 valid = content.size >= sizeof(comptime_cache_header_t)
+             && header->magic   == COMPTIME_CACHE_MAGIC
+             && header->version == COMPTIME_CACHE_VERSION
+             && header->count   == (content.size - sizeof(comptime_cache_header_t)) / sizeof(comptime_cache_entry_t);
+
+    if (valid) {
+        comptime_cache_entry_t *entries = (comptime_cache_entry_t*)(header + 1);
+
+        for (u64 i = 0; i < header->count; i++) {
+            hashmap_add(&state->cache, entries[i].hash, &entries[i].value);
+        }
+    } else {
+        log_warning(string_format(get_temporary_allocator(), STRING("Ignoring old or broken comptime cache '%s'"), filename));
+    }
+
+    mem_free(default_allocator, content.data);
+}
+
+static void save_cache(comptime_state_t *state, string_t filename) {
+    list_t<u8> output = {};
+    list_create(&output, 256, *default_allocator);
+
+    comptime_cache_header_t header = {};
+    header.magic   = COMPTIME_CACHE_MAGIC;
+    header.version = COMPTIME_CACHE_VERSION;
+    header.count   = state->cache.load;
+
+    u64 index = 0;
+    list_allocate(&output, sizeof(header), &index);
+    list_fill(&output, (u8*)&header, sizeof(header), index);
+
+    for (u64 i = 0; i < state->cache.capacity; i++) {
+        kv_pair_t<u64, s64> *pair = state->cache.entries + i;
+
+        if (!pair->occupied) continue;
+        if (pair->deleted)   continue;
+
+        comptime_cache_entry_t entry = { pair->key, pair->value };
+
+        list_allocate(&output, sizeof(entry), &index);
+        list_fill(&output, (u8*)&entry, sizeof(entry), index);
+    }
+
+    platform_write_file(filename, { output.count, output.data });
+    list_delete(&output);
+}
+
+b32 comptime_evaluate(ir_t *ir, string_t cache_filename, b32 globals_ready) {
+    profiler_func_start();
+    assert(ir != NULL);
+
+    if (ir->comptime_calls.count == 0) {
+        if (globals_ready && ir->comptime_calls.data) list_delete(&ir->comptime_calls);
+
+        profiler_func_end();
+        return true;
+    }
+
+    comptime_state_t state = {};
+    state.ir        = ir;
+    state.strings   = create_arena_allocator(1024);
+    state.use_cache = cache_filename.size > 0;
+    state.globals_ready = globals_ready;
+
+    hashmap_create(&state.memo,  16, NULL, NULL);
+    hashmap_create(&state.cache, 16, NULL, NULL);
+
+    list_create(&state.status, ir->comptime_calls.count, *default_allocator);
+
+    u64 index = 0;
+    list_allocate(&state.status, ir->comptime_calls.count, &index);
+
+    for (u64 i = 0; i < state.status.count; i++) {
+        state.status[i] = COMPTIME_PENDING;
+    }
+
+    if (state.use_cache) {
+        load_cache(&state, cache_filename);
+    }
+
+    // before globals are initialised only calls in code their initialisers run are needed
+    hashmap_t<string_t, b32> init = {};
+    hashmap_create(&init, 16, NULL, NULL);
+
+    if (!globals_ready) {
+        list_t<string_t> order = {};
+        list_create(&order, 16, *default_allocator);
+
+        collect_callees(ir, STRING("__internal_compile_globals"), &init, &order);
+        list_delete(&order);
+    }
+
+    b32 result = true;
+
+    for (u64 i = 0; result && i < ir->comptime_calls.count; i++) {
+        if (!globals_ready && !hashmap_contains(&init, list_get(&ir->comptime_calls, i)->function)) continue;
+
+        result = resolve_call(&state, i);
+    }
+
+    if (result && state.cache_dirty) {
+        save_cache(&state, cache_filename);
+    }
+
+    if (compiler_config.verbose) {
+        u64 resolved = 0;
+
+        for (u64 i = 0; i < state.status.count; i++) {
+            if (state.status[i] == COMPTIME_DONE) resolved++;
+        }
+
+        log_info(string_format(get_temporary_allocator(), STRING("comptime (%s globals): %u calls, %u evaluated, %u memoised, %u from cache"),
+                    globals_ready ? STRING("after") : STRING("before"), resolved, state.evaluated, state.memoised, state.cached));
+    }
+
+    hashmap_delete(&state.memo);
+    hashmap_delete(&state.cache);
+    delete_arena_allocator(state.strings);
+    hashmap_delete(&init);
+
+    if (globals_ready) {
+        list_delete(&ir->comptime_calls);
+    } else {
+        // pending calls wait for the second run
+        u64 count = 0;
+
+        for (u64 i = 0; i < ir->comptime_calls.count; i++) {
+            if (state.status[i] == COMPTIME_DONE) continue;
+            *list_get(&ir->comptime_calls, count++) = *list_get(&ir->comptime_calls, i);
+        }
+
+        ir->comptime_calls.count = count;
+    }
+
+    list_delete(&state.status);
+
+    profiler_func_end();
+    return result;
+}
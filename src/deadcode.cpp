@@ -0,0 +1,207 @@
+#include "deadcode.h"
+
+#include "compiler.h"
+#include "analyzer.h"
+#include "parser.h"
+#include "scanner.h"
+#include "ir.h"
+
+#include "stack.h"
+#include "hashmap.h"
+#include "array.h"
+
+#include "memctl.h"
+#include "strings.h"
+#include "profiler.h"
+#include "talloc.h"
+
+typedef hashmap_t<string_t, scope_entry_t> scope_t;
+
+static void mark_references(scope_t *scope, ast_node_t *node, stack_t<scope_entry_t*> *work) {
+    if (node == NULL) return;
+
+    if (node->type == AST_PRIMARY && node->token.type == TOKEN_IDENT) {
+        scope_entry_t *entry = hashmap_get(scope, node->token.data.string);
+
+        if (entry != NULL && entry->type == ENTRY_FUNC && !entry->reachable) {
+            entry->reachable = true;
+            stack_push(work, entry);
+        }
+    }
+
+    mark_references(scope, node->left,   work);
+    mark_references(scope, node->center, work);
+    mark_references(scope, node->right,  work);
+
+    ast_node_t *next = node->list_start;
+
+    for (u64 i = 0; next != NULL && i < node->child_count; i++) {
+        mark_references(scope, next, work);
+        next = next->list_next;
+    }
+}
+
+// tokens keep line and column, lines of scanner know where they start
+static u64 file_offset(scanner_t *from, u64 line, u64 column) {
+    if (line >= from->lines.count) return from->file.size;
+    return list_get(&from->lines, line)->start + column;
+}
+
+// end of the last token of definition in the same file
+static void measure_definition(ast_node_t *node, scanner_t *from, u64 *end) {
+    if (node == NULL) return;
+
+    if (node->token.from == from) {
+        *end = MAX(*end, file_offset(from, node->token.l1, node->token.c1));
+    }
+
+    measure_definition(node->left,   from, end);
+    measure_definition(node->center, from, end);
+    measure_definition(node->right,  from, end);
+
+    ast_node_t *next = node->list_start;
+
+    for (u64 i = 0; next != NULL && i < node->child_count; i++) {
+        measure_definition(next, from, end);
+        next = next->list_next;
+    }
+}
+
+void deadcode_mark(compiler_t *compiler) {
+    profiler_func_start();
+    scope_t *scope = array_get(&compiler->scopes, 0);
+
+    stack_t<scope_entry_t*> work = {};
+
+    scope_entry_t *main = hashmap_get(scope, STRING("main"));
+
+    if (main != NULL && main->type == ENTRY_FUNC) {
+        main->reachable = true;
+        stack_push(&work, main);
+    }
+
+    for (u64 i = 0; i < scope->capacity; i++) {
+        kv_pair_t<string_t, scope_entry_t> *pair = scope->entries + i;
+
+        if (!pair->occupied) continue;
+        if (pair->deleted)   continue;
+        if (pair->value.type == ENTRY_FUNC) continue;
+
+        mark_references(scope, pair->value.expr, &work);
+        if (pair->value.stmt != pair->value.expr) mark_references(scope, pair->value.stmt, &work);
+    }
+
+    while (work.index > 0) {
+        scope_entry_t *entry = stack_pop(&work);
+        mark_references(scope, entry->expr, &work);
+    }
+
+    deadcode_stats_t *stats = &compiler->deadcode;
+
+    for (u64 i = 0; i < scope->capacity; i++) {
+        kv_pair_t<string_t, scope_entry_t> *pair = scope->entries + i;
+
+        if (!pair->occupied) continue;
+        if (pair->deleted)   continue;
+        if (pair->value.type != ENTRY_FUNC) continue;
+
+        stats->functions++;
+
+        if (pair->value.reachable) continue;
+
+        token_t token = pair->value.node->token;
+        u64     start = 0;
+        u64     end   = 0;
+
+        if (token.from != NULL) {
+            start = file_offset(token.from, token.l0, token.c0);
+            end   = start;
+            measure_definition(pair->value.expr, token.from, &end);
+        }
+
+        stats->unreachable++;
+        stats->source_bytes += end - start;
+    }
+
+    if (work.data) stack_delete(&work);
+    profiler_func_end();
+}
+
+// errors in unused code of the program itself are still reported
+b32 deadcode_can_skip_analysis(compiler_t *compiler, scope_entry_t *entry) {
+    if (entry->type != ENTRY_FUNC || entry->reachable) return false;
+
+    scanner_t *from = entry->node->token.from;
+
+    if (from == NULL) return false;
+
+    // decided by how file was loaded, files from command line are always analysed
+    source_file_t *file = hashmap_get(&compiler->files, from->filename);
+
+    return file != NULL && file->is_module;
+}
+
+void deadcode_sweep(compiler_t *compiler, ir_t *ir) {
+    profiler_func_start();
+
+    hashmap_t<string_t, b32> reached = {};
+    hashmap_create(&reached, 64, NULL, NULL);
+
+    stack_t<string_t> work = {};
+
+    if (hashmap_contains(&ir->functions, STRING("main"))) {
+        stack_push(&work, STRING("main"));
+    }
+
+    while (work.index > 0) {
+        string_t name = stack_pop(&work);
+
+        if (hashmap_contains(&reached, name)) continue;
+
+        b32 value = true;
+        hashmap_add(&reached, name, &value);
+
+        ir_function_t *func = hashmap_get(&ir->functions, name);
+
+        if (func == NULL || func->is_external) continue;
+
+        for (u64 i = 0; i < func->code.count; i++) {
+            ir_opcode_t op = func->code[i];
+
+            if (op.operation == IR_CALL && !hashmap_contains(&reached, op.string)) {
+                stack_push(&work, op.string);
+            }
+        }
+    }
+
+    // nothing to run from, module is used only for its compile time results
+    if (reached.load == 0) {
+        hashmap_delete(&reached);
+        if (work.data) stack_delete(&work);
+        profiler_func_end();
+        return;
+    }
+
+    deadcode_stats_t *stats = &compiler->deadcode;
+
+    for (u64 i = 0; i < ir->functions.capacity; i++) {
+        kv_pair_t<string_t, ir_function_t> *pair = ir->functions.entries + i;
+
+        if (!pair->occupied) continue;
+        if (pair->deleted)   continue;
+        if (hashmap_contains(&reached, pair->key)) continue;
+
+        if (!pair->value.is_external) {
+            stats->compile_time++;
+            stats->ir_bytes += pair->value.code.count * sizeof(ir_opcode_t);
+        }
+
+        if (pair->value.code.entries.data) array_delete(&pair->value.code);
+
+        hashmap_remove(&ir->functions, pair->key);
+    }
+
+    hashmap_delete(&reached);
+    if (work.data) stack_delete(&work);
+    profiler_func_end();
+}
@@ -0,0 +1,366 @@
+#include "backend.h"
+#include "list.h"
+#include "talloc.h"
+#include "strings.h"
+#include "profiler.h"
+#include "platform.h"
+
+// only what we write, layouts are from System V ABI, x86-64 supplement
+
+#define ELF_BASE_ADDRESS 0x400000
+#define ELF_PAGE_SIZE    0x1000
+
+enum {
+    ELF_ET_REL  = 1,
+    ELF_ET_EXEC = 2,
+    ELF_EM_X86_64 = 62,
+
+    ELF_PT_LOAD = 1,
+    ELF_PF_X = 1,
+    ELF_PF_W = 2,
+    ELF_PF_R = 4,
+
+    ELF_SHT_PROGBITS = 1,
+    ELF_SHT_SYMTAB   = 2,
+    ELF_SHT_STRTAB   = 3,
+    ELF_SHT_RELA     = 4,
+    ELF_SHT_NOBITS   = 8,
+
+    ELF_SHF_WRITE     = 0x1,
+    ELF_SHF_ALLOC     = 0x2,
+    ELF_SHF_EXECINSTR = 0x4,
+    ELF_SHF_INFO_LINK = 0x40,
+
+    ELF_STB_LOCAL  = 0,
+    ELF_STB_GLOBAL = 1,
+    ELF_STT_NOTYPE = 0,
+    ELF_STT_OBJECT = 1,
+    ELF_STT_FUNC   = 2,
+
+    ELF_R_X86_64_PC32  = 2,
+    ELF_R_X86_64_PLT32 = 4,
+};
+
+struct elf_header_t {
+    u8  ident[16];
+    u16 type;
+    u16 machine;
+    u32 version;
+    u64 entry;
+    u64 phoff;
+    u64 shoff;
+    u32 flags;
+    u16 ehsize;
+    u16 phentsize;
+    u16 phnum;
+    u16 shentsize;
+    u16 shnum;
+    u16 shstrndx;
+};
+
+struct elf_program_header_t {
+    u32 type;
+    u32 flags;
+    u64 offset;
+    u64 vaddr;
+    u64 paddr;
+    u64 filesz;
+    u64 memsz;
+    u64 align;
+};
+
+struct elf_section_header_t {
+    u32 name;
+    u32 type;
+    u64 flags;
+    u64 addr;
+    u64 offset;
+    u64 size;
+    u32 link;
+    u32 info;
+    u64 addralign;
+    u64 entsize;
+};
+
+struct elf_symbol_t {
+    u32 name;
+    u8  info;
+    u8  other;
+    u16 shndx;
+    u64 value;
+    u64 size;
+};
+
+struct elf_rela_t {
+    u64 offset;
+    u64 info;
+    s64 addend;
+};
+
+// sections of object file, x64_section_t maps on first ones
+enum {
+    ELF_SECTION_NULL,
+    ELF_SECTION_TEXT,
+    ELF_SECTION_DATA,
+    ELF_SECTION_BSS,
+    ELF_SECTION_RELA_TEXT,
+    ELF_SECTION_SYMTAB,
+    ELF_SECTION_STRTAB,
+    ELF_SECTION_SHSTRTAB,
+
+    ELF_SECTION_COUNT,
+};
+
+static inline u64 align_up(u64 value, u64 alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static u64 elf_append(list_t<u8> *output, void *data, u64 size) {
+    u64 index = output->count;
+
+    if (size == 0) return index;
+
+    list_allocate(output, size, &index);
+    list_fill(output, (u8*)data, size, index);
+    return index;
+}
+
+static void elf_pad(list_t<u8> *output, u64 alignment) {
+    u8 zero = 0;
+    while (output->count % alignment) list_add(output, &zero);
+}
+
+static u32 elf_add_string(list_t<u8> *table, string_t text) {
+    u32 offset = (u32)table->count;
+    u8  zero   = 0;
+
+    elf_append(table, text.data, text.size);
+    list_add(table, &zero);
+    return offset;
+}
+
+static elf_header_t elf_make_header(u16 type) {
+    elf_header_t header = {};
+
+    header.ident[0] = 0x7F;
+    header.ident[1] = 'E';
+    header.ident[2] = 'L';
+    header.ident[3] = 'F';
+    header.ident[4] = 2; // 64 bit
+    header.ident[5] = 1; // little endian
+    header.ident[6] = 1; // version
+
+    header.type      = type;
+    header.machine   = ELF_EM_X86_64;
+    header.version   = 1;
+    header.ehsize    = sizeof(elf_header_t);
+    header.phentsize = sizeof(elf_program_header_t);
+    header.shentsize = sizeof(elf_section_header_t);
+    return header;
+}
+
+b32 elf_write_object(x64_module_t *module, string_t filename) {
+    profiler_func_start();
+
+    list_t<u8> output = {};
+    list_t<u8> strtab = {};
+    list_t<u8> shstrtab = {};
+    list_t<elf_symbol_t> symbols = {};
+    list_t<elf_rela_t>   relas   = {};
+
+    list_create(&output,   4096, *default_allocator);
+    list_create(&strtab,   256,  *default_allocator);
+    list_create(&shstrtab, 64,   *default_allocator);
+    list_create(&symbols,  module->symbols.count + 1, *default_allocator);
+    list_create(&relas,    module->relocations.count + 1, *default_allocator);
+
+    // locals have to go before globals
+    u32 *elf_index = (u32*)mem_alloc(default_allocator, (module->symbols.count + 1) * sizeof(u32));
+    u32  first_global = 0;
+
+    elf_add_string(&strtab, {});
+
+    {
+        elf_symbol_t null_symbol = {};
+        list_add(&symbols, &null_symbol);
+    }
+
+    for (u32 pass = 0; pass < 2; pass++) {
+        if (pass == 1) first_global = (u32)symbols.count;
+
+        for (u64 i = 0; i < module->symbols.count; i++) {
+            x64_symbol_t *it = list_get(&module->symbols, i);
+
+            if ((b32)it->is_global != (pass == 1)) continue;
+
+            u8 type = ELF_STT_NOTYPE;
+            if (it->section == X64_SECTION_TEXT) type = ELF_STT_FUNC;
+            if (it->section == X64_SECTION_DATA || it->section == X64_SECTION_BSS) type = ELF_STT_OBJECT;
+
+            elf_symbol_t symbol = {};
+            symbol.name  = elf_add_string(&strtab, it->name);
+            symbol.info  = (u8)(((pass == 1 ? ELF_STB_GLOBAL : ELF_STB_LOCAL) << 4) | type);
+            symbol.shndx = (u16)it->section;
+            symbol.value = it->offset;
+
+            elf_index[i] = (u32)symbols.count;
+            list_add(&symbols, &symbol);
+        }
+    }
+
+    for (u64 i = 0; i < module->relocations.count; i++) {
+        x64_relocation_t it = module->relocations[i];
+
+        elf_rela_t rela = {};
+        rela.offset = it.offset;
+        rela.info   = ((u64)elf_index[it.symbol] << 32) | (it.is_call ? ELF_R_X86_64_PLT32 : ELF_R_X86_64_PC32);
+        rela.addend = it.addend;
+        list_add(&relas, &rela);
+    }
+
+    elf_section_header_t sections[ELF_SECTION_COUNT] = {};
+
+    const char *names[ELF_SECTION_COUNT] = { "", ".text", ".data", ".bss", ".rela.text", ".symtab", ".strtab", ".shstrtab" };
+
+    for (u64 i = 0; i < ELF_SECTION_COUNT; i++) {
+        sections[i].name = elf_add_string(&shstrtab, STRING(names[i]));
+    }
+
+    elf_header_t header = elf_make_header(ELF_ET_REL);
+    header.shnum    = ELF_SECTION_COUNT;
+    header.shstrndx = ELF_SECTION_SHSTRTAB;
+
+    elf_append(&output, &header, sizeof(header));
+
+    elf_pad(&output, 16);
+    sections[ELF_SECTION_TEXT].type      = ELF_SHT_PROGBITS;
+    sections[ELF_SECTION_TEXT].flags     = ELF_SHF_ALLOC | ELF_SHF_EXECINSTR;
+    sections[ELF_SECTION_TEXT].offset    = elf_append(&output, module->text.data, module->text.count);
+    sections[ELF_SECTION_TEXT].size      = module->text.count;
+    sections[ELF_SECTION_TEXT].addralign = 16;
+
+    elf_pad(&output, 8);
+    sections[ELF_SECTION_DATA].type      = ELF_SHT_PROGBITS;
+    sections[ELF_SECTION_DATA].flags     = ELF_SHF_ALLOC | ELF_SHF_WRITE;
+    sections[ELF_SECTION_DATA].offset    = elf_append(&output, module->data.data, module->data.count);
+    sections[ELF_SECTION_DATA].size      = module->data.count;
+    sections[ELF_SECTION_DATA].addralign = 8;
+
+    sections[ELF_SECTION_BSS].type      = ELF_SHT_NOBITS;
+    sections[ELF_SECTION_BSS].flags     = ELF_SHF_ALLOC | ELF_SHF_WRITE;
+    sections[ELF_SECTION_BSS].offset    = output.count;
+    sections[ELF_SECTION_BSS].size      = module->bss_size;
+    sections[ELF_SECTION_BSS].addralign = 16;
+
+    elf_pad(&output, 8);
+    sections[ELF_SECTION_RELA_TEXT].type      = ELF_SHT_RELA;
+    sections[ELF_SECTION_RELA_TEXT].flags     = ELF_SHF_INFO_LINK;
+    sections[ELF_SECTION_RELA_TEXT].offset    = elf_append(&output, relas.data, relas.count * sizeof(elf_rela_t));
+    sections[ELF_SECTION_RELA_TEXT].size      = relas.count * sizeof(elf_rela_t);
+    sections[ELF_SECTION_RELA_TEXT].link      = ELF_SECTION_SYMTAB;
+    sections[ELF_SECTION_RELA_TEXT].info      = ELF_SECTION_TEXT;
+    sections[ELF_SECTION_RELA_TEXT].addralign = 8;
+    sections[ELF_SECTION_RELA_TEXT].entsize   = sizeof(elf_rela_t);
+
+    sections[ELF_SECTION_SYMTAB].type      = ELF_SHT_SYMTAB;
+    sections[ELF_SECTION_SYMTAB].offset    = elf_append(&output, symbols.data, symbols.count * sizeof(elf_symbol_t));
+    sections[ELF_SECTION_SYMTAB].size      = symbols.count * sizeof(elf_symbol_t);
+    sections[ELF_SECTION_SYMTAB].link      = ELF_SECTION_STRTAB;
+    sections[ELF_SECTION_SYMTAB].info      = first_global;
+    sections[ELF_SECTION_SYMTAB].addralign = 8;
+    sections[ELF_SECTION_SYMTAB].entsize   = sizeof(elf_symbol_t);
+
+    sections[ELF_SECTION_STRTAB].type      = ELF_SHT_STRTAB;
+    sections[ELF_SECTION_STRTAB].offset    = elf_append(&output, strtab.data, strtab.count);
+    sections[ELF_SECTION_STRTAB].size      = strtab.count;
+    sections[ELF_SECTION_STRTAB].addralign = 1;
+
+    sections[ELF_SECTION_SHSTRTAB].type      = ELF_SHT_STRTAB;
+    sections[ELF_SECTION_SHSTRTAB].offset    = elf_append(&output, shstrtab.data, shstrtab.count);
+    sections[ELF_SECTION_SHSTRTAB].size      = shstrtab.count;
+    sections[ELF_SECTION_SHSTRTAB].addralign = 1;
+
+    elf_pad(&output, 8);
+    ((elf_header_t*)output.data)->shoff = elf_append(&output, sections, sizeof(sections));
+
+    b32 result = platform_write_file(filename, { output.count, output.data });
+
+    mem_free(default_allocator, (u8*)elf_index);
+    list_delete(&output);
+    list_delete(&strtab);
+    list_delete(&shstrtab);
+    list_delete(&symbols);
+    list_delete(&relas);
+
+    profiler_func_end();
+    return result;
+}
+
+// Static executable without section headers: text in the first read-execute
+// segment right after headers page, data and bss in the second one.
+b32 elf_write_executable(x64_module_t *module, string_t filename) {
+    profiler_func_start();
+
+    u64 *start = hashmap_get(&module->symbol_index, STRING("_start"));
+
+    if (start == NULL || list_get(&module->symbols, *start)->section != X64_SECTION_TEXT) {
+        log_error("Executable needs runtime with _start.");
+        profiler_func_end();
+        return false;
+    }
+
+    u64 text_offset = ELF_PAGE_SIZE;
+    u64 data_offset = align_up(text_offset + module->text.count, ELF_PAGE_SIZE);
+
+    u64 addresses[X64_SECTION_COUNT] = {};
+    addresses[X64_SECTION_TEXT] = ELF_BASE_ADDRESS + text_offset;
+    addresses[X64_SECTION_DATA] = ELF_BASE_ADDRESS + data_offset;
+    addresses[X64_SECTION_BSS]  = align_up(addresses[X64_SECTION_DATA] + module->data.count, 16);
+
+    list_t<u8> output = {};
+    list_create(&output, data_offset + module->data.count, *default_allocator);
+
+    elf_header_t header = elf_make_header(ELF_ET_EXEC);
+    header.entry = addresses[X64_SECTION_TEXT] + list_get(&module->symbols, *start)->offset;
+    header.phoff = sizeof(elf_header_t);
+    header.phnum = 2;
+
+    elf_program_header_t segments[2] = {};
+
+    segments[0].type   = ELF_PT_LOAD;
+    segments[0].flags  = ELF_PF_R | ELF_PF_X;
+    segments[0].offset = 0;
+    segments[0].vaddr  = ELF_BASE_ADDRESS;
+    segments[0].paddr  = ELF_BASE_ADDRESS;
+    segments[0].filesz = text_offset + module->text.count;
+    segments[0].memsz  = segments[0].filesz;
+    segments[0].align  = ELF_PAGE_SIZE;
+
+    segments[1].type   = ELF_PT_LOAD;
+    segments[1].flags  = ELF_PF_R | ELF_PF_W;
+    segments[1].offset = data_offset;
+    segments[1].vaddr  = addresses[X64_SECTION_DATA];
+    segments[1].paddr  = addresses[X64_SECTION_DATA];
+    segments[1].filesz = module->data.count;
+    segments[1].memsz  = addresses[X64_SECTION_BSS] + module->bss_size - addresses[X64_SECTION_DATA];
+    segments[1].align  = ELF_PAGE_SIZE;
+
+    elf_append(&output, &header,  sizeof(header));
+    elf_append(&output, segments, sizeof(segments));
+    elf_pad(&output, ELF_PAGE_SIZE);
+
+    u64 text = elf_append(&output, module->text.data, module->text.count);
+    b32 result = x64_link(module, output.data + text, addresses);
+
+    elf_pad(&output, ELF_PAGE_SIZE);
+    elf_append(&output, module->data.data, module->data.count);
+
+    if (result) {
+        result = platform_write_file(filename, { output.count, output.data })
+              && platform_set_executable(filename);
+    }
+
+    list_delete(&output);
+    profiler_func_end();
+    return result;
+}
@@ -8,6 +8,8 @@
 #include "talloc.h"
 #include "strings.h"
 #include "profiler.h"
+#include "platform.h"
+#include "scanner.h"
 #include <math.h>
 
 #define GLOBALS_OFFSET 0x20000000LL
@@ -17,19 +19,54 @@ struct memory_block_t {
     s64 start;
 };
 
+struct profile_frame_t {
+    u64 index; // into profile functions
+    f64 start;
+    f64 children;
+};
+
+// one dispatch of the interpreter, covers ir_count opcodes of IR starting at ir_index
+struct decoded_op_t {
+    u32 operation; // ir_codes_t or interop_fused_codes_t
+    u32 kind;      // binop or comparison inside of fused opcode
+    u32 ir_count;
+    u64 ir_index;
+
+    s64 operand;
+    s64 operand2;
+    u64 target;    // absolute index in decoded code, for jumps and calls
+};
+
+struct decoded_function_t {
+    string_t       name;
+    ir_function_t *func;
+    list_t<decoded_op_t> code;
+    u64 profile_index; // + 1, looked up on the first profiled call
+};
+
 struct interpreter_state_t {
     b32 had_error;
     b32 running;
     ir_t *ir;
     u64 ip;
     stack_t<u64> fp;
+    stack_t<u64> frame_size; // in slots, same as in SF_PUSH
     stack_t<u64> ip_stack;
     stack_t<s64> exec_stack;
-    stack_t<s64> data_stack;
+    stack_t<u8>  data_stack;
     stack_t<memory_block_t> allocations;
-    stack_t<ir_function_t*> curr_func;
+    stack_t<u64>            curr_func; // into functions
+    stack_t<string_t>       call_names;
+
+    list_t<decoded_function_t> functions;
+    hashmap_t<string_t, u64>   function_index;
+
+    interop_profile_t      *profile;
+    stack_t<profile_frame_t> frames;
 };
 
+static interop_profile_t *current_profile;
+
 #define UNOP(irop, val) case irop: {\
     s64 a = stack_pop(&state->exec_stack);\
     stack_push(&state->exec_stack, val);\
@@ -48,93 +85,752 @@ struct interpreter_state_t {
     else        stack_push(&state->exec_stack, (s64) 0);\
 } break;
 
+// exec stack keeps floats as their f64 bits
+static inline f64 as_float(s64 bits) {
+    f64 value = 0;
+    mem_copy((u8*)&value, (u8*)&bits, sizeof(value));
+    return value;
+}
+
+static inline s64 as_bits(f64 value) {
+    s64 bits = 0;
+    mem_copy((u8*)&bits, (u8*)&value, sizeof(bits));
+    return bits;
+}
+
+// cvttsd2si gives INT64_MIN for NaN and everything out of range, so do we
+static inline s64 float_to_int(f64 value) {
+    if (value >= -9223372036854775808.0 && value < 9223372036854775808.0) return (s64)value;
+    return INT64_MIN;
+}
+
+#define FUNOP(irop, val) case irop: {\
+    f64 a = as_float(stack_pop(&state->exec_stack));\
+    stack_push(&state->exec_stack, val);\
+} break;
+
+#define FBINOP(irop, val) case irop: {\
+    f64 a = as_float(stack_pop(&state->exec_stack));\
+    f64 b = as_float(stack_pop(&state->exec_stack));\
+    stack_push(&state->exec_stack, val);\
+} break;
+
+#define SLOT_SIZE ((s64)sizeof(s64))
+
+#define LOADOP(irop, type) case irop: {\
+    s64 addr = stack_pop(&state->exec_stack);\
+    u64 val  = 0;\
+    if (read_memory(state, addr, sizeof(type), &val)) stack_push(&state->exec_stack, (s64)(type)val);\
+    else access_violation(state, op, addr);\
+} break;
+
+#define STOREOP(irop, type) case irop: {\
+    s64 addr = stack_pop(&state->exec_stack);\
+    s64 val  = stack_pop(&state->exec_stack);\
+    if (!write_memory(state, addr, sizeof(type), (u64)val)) access_violation(state, op, addr);\
+} break;
+
+// all sizes and addresses here are in bytes,
+// the IR counts allocations in 8 byte slots
+
 static inline s64 allocate_memory(interpreter_state_t *state, s64 size) {
-    UNUSED(size);
+    stack_t<u8> *data = &state->data_stack;
+    stack_create_if_needed(data);
 
     memory_block_t block = {};
-    block.start = state->data_stack.index;
+    block.start = data->index;
     block.size  = size;
 
-    for (s64 i = 0; i < size; i++) {
-        stack_push(&state->data_stack, (s64) 0);
+    if (size < 0 || (u64)size > INTEROP_DATA_STACK_SIZE - data->index) {
+        log_error(string_format(get_temporary_allocator(), STRING("Interpreter data stack overflow, %d bytes don't fit"), size));
+        state->running   = false;
+        state->had_error = true;
+        return block.start;
+    }
+
+    // grow once for the whole block and zero it in one go
+    while (data->index + size > data->current_size) {
+        if (!stack_grow(data)) {
+            log_error(STRING("Interpreter ran out of memory for the data stack"));
+            state->running   = false;
+            state->had_error = true;
+            return block.start;
+        }
     }
 
+    mem_set(data->data + data->index, 0, size);
+    data->index += size;
+
     stack_push(&state->allocations, block);
-    return state->data_stack.index - 1;
+    return block.start;
 }
 
+// drops the top size bytes together with every block inside of them
 static inline void free_memory(interpreter_state_t *state, s64 size) {
-    while (size > 0) {
-        memory_block_t block = stack_pop(&state->allocations);
-        state->data_stack.index = block.start;
-        size -= block.size;
+    u64 start = (u64)size < state->data_stack.index ? state->data_stack.index - size : 0;
+
+    while (state->allocations.index > 0 && (u64)state->allocations.data[state->allocations.index - 1].start >= start) {
+        state->allocations.index--;
     }
+
+    state->data_stack.index = start;
 }
 
-static inline s64 get_variable_address(interpreter_state_t *state, s64 address) {
-    address = stack_peek(&state->fp) + address;
+// locals live at rbp - offset * 8 in native code, here the frame grows up,
+// so slots are mirrored inside of it and arrays still go to higher addresses
+static inline s64 get_variable_address(interpreter_state_t *state, s64 offset) {
+    return (s64)stack_peek(&state->fp) + ((s64)stack_peek(&state->frame_size) - offset) * SLOT_SIZE;
+}
 
-    for (u64 i = 0; i < state->allocations.index; i++) {
-        memory_block_t block = state->allocations[i];
+static inline b32 read_memory(interpreter_state_t *state, s64 address, u64 size, u64 *value) {
+    *value = 0;
 
-        s64 stop_address = block.start + (block.size - 1);
-        if (address >= block.start && address <= stop_address) {
-            return block.start;
+    if (address >= GLOBALS_OFFSET) {
+        address -= GLOBALS_OFFSET;
+
+        for (u64 i = 0; i < size; ) {
+            s64 *slot = array_get(&state->ir->globals, (u64)(address + i) / SLOT_SIZE);
+            if (slot == NULL) return false;
+
+            u64 shift = ((u64)(address + i) % SLOT_SIZE);
+            u64 count = MIN(size - i, SLOT_SIZE - shift);
+
+            mem_copy((u8*)value + i, (u8*)slot + shift, count);
+            i += count;
         }
+
+        return true;
     }
 
-    assert(false);
-    return -1;
+    if (address < 0 || (u64)address + size > state->data_stack.index) {
+        return false;
+    }
+
+    mem_copy((u8*)value, state->data_stack.data + address, size);
+    return true;
+}
+
+static inline b32 write_memory(interpreter_state_t *state, s64 address, u64 size, u64 value) {
+    if (address >= GLOBALS_OFFSET) {
+        address -= GLOBALS_OFFSET;
+
+        for (u64 i = 0; i < size; ) {
+            s64 *slot = array_get(&state->ir->globals, (u64)(address + i) / SLOT_SIZE);
+            if (slot == NULL) return false;
+
+            u64 shift = ((u64)(address + i) % SLOT_SIZE);
+            u64 count = MIN(size - i, SLOT_SIZE - shift);
+
+            mem_copy((u8*)slot + shift, (u8*)&value + i, count);
+            i += count;
+        }
+
+        return true;
+    }
+
+    if (address < 0 || (u64)address + size > state->data_stack.index) {
+        return false;
+    }
+
+    mem_copy(state->data_stack.data + address, (u8*)&value, size);
+    return true;
 }
 
-static inline s64 get_variable(interpreter_state_t *state, s64 address) {
-    return state->data_stack.data[address];
+// ------ vectors, lane by lane on a copy of the stack entries
+
+#define VECTOR_MAX_ENTRIES 4
+
+// loader rejects other sizes, clamped so a bad operand can't leave the buffers
+static inline u64 vector_entries(u64 vector) {
+    u64 entries = ir_vector_entries(vector);
+    assert(entries <= VECTOR_MAX_ENTRIES);
+    return entries <= VECTOR_MAX_ENTRIES ? entries : VECTOR_MAX_ENTRIES;
 }
 
-static inline void set_variable(interpreter_state_t *state, s64 address, s64 value) {
-    state->data_stack.data[address] = value;
+static inline void pop_vector(interpreter_state_t *state, u64 entries, s64 *vector) {
+    assert(entries <= VECTOR_MAX_ENTRIES);
+    for (u64 i = entries; i > 0; i--) vector[i - 1] = stack_pop(&state->exec_stack);
 }
 
-static inline b32 push_function(interpreter_state_t *state, string_t string) {
-    ir_function_t *func = hashmap_get(&state->ir->functions, string);
+static inline void push_vector(interpreter_state_t *state, u64 entries, s64 *vector) {
+    assert(entries <= VECTOR_MAX_ENTRIES);
+    for (u64 i = 0; i < entries; i++) stack_push(&state->exec_stack, vector[i]);
+}
 
-#ifdef VERBOSE
-    log_update_color();
-    log_write(string_format(get_temporary_allocator(), STRING(" Calling: %s\n"), string));
-#endif
+// a is the top of the stack, result goes to b. Integer lanes wrap around,
+// comparisons write masks of type M with the same size as the lane
+template<typename T, typename M>
+static void vector_lanes(u64 operation, u64 size, s64 *a, s64 *b) {
+    T x[32], y[32];
+    M mask[32];
 
-    if (func->is_external) {
-        // actually call it here
+    mem_copy((u8*)x, (u8*)a, size);
+    mem_copy((u8*)y, (u8*)b, size);
 
-        if (string_compare(string, STRING("putchar")) == 0) {
-            string_t str = {};
+    b32 is_float = (T)0.5 != 0;
+    u64 count    = size / sizeof(T);
 
-            s64 value = stack_pop(&state->exec_stack);
-            str.size = 1;
-            str.data = (u8*)&value;
+    for (u64 i = 0; i < count; i++) {
+        switch (operation) {
+            case IR_VADD: y[i] = is_float ? x[i] + y[i] : (T)((u64)x[i] + (u64)y[i]); break;
+            case IR_VSUB: y[i] = is_float ? x[i] - y[i] : (T)((u64)x[i] - (u64)y[i]); break;
+            case IR_VMUL: y[i] = is_float ? x[i] * y[i] : (T)((u64)x[i] * (u64)y[i]); break;
+            case IR_VDIV: y[i] = is_float || y[i] != 0 ? x[i] / y[i] : 0;             break;
 
-            putchar((char)value);
-        } else if (string_compare(string, STRING("debug_break")) == 0) {
-            debug_break();
-        } else if (string_compare(string, STRING("getchar")) == 0) {
-            stack_push(&state->exec_stack, (s64)getchar());
+            case IR_VCMP_EQ:  mask[i] = x[i] == y[i] ? (M)~(M)0 : 0; break;
+            case IR_VCMP_NEQ: mask[i] = x[i] != y[i] ? (M)~(M)0 : 0; break;
+            case IR_VCMP_LT:  mask[i] = x[i] <  y[i] ? (M)~(M)0 : 0; break;
+            case IR_VCMP_GT:  mask[i] = x[i] >  y[i] ? (M)~(M)0 : 0; break;
+            case IR_VCMP_LTE: mask[i] = x[i] <= y[i] ? (M)~(M)0 : 0; break;
+            case IR_VCMP_GTE: mask[i] = x[i] >= y[i] ? (M)~(M)0 : 0; break;
         }
+    }
+
+    if (operation >= IR_VCMP_EQ && operation <= IR_VCMP_GTE) mem_copy((u8*)b, (u8*)mask, size);
+    else                                                     mem_copy((u8*)b, (u8*)y,    size);
+}
+
+static void vector_binary(interpreter_state_t *state, u64 operation, u64 vector) {
+    s64 a[VECTOR_MAX_ENTRIES], b[VECTOR_MAX_ENTRIES];
+
+    u64 entries = vector_entries(vector);
+    u64 size    = entries * SLOT_SIZE;
+
+    pop_vector(state, entries, a);
+    pop_vector(state, entries, b);
+
+    switch (operation) {
+        case IR_VAND: for (u64 i = 0; i < entries; i++) b[i] &= a[i]; break;
+        case IR_VOR:  for (u64 i = 0; i < entries; i++) b[i] |= a[i]; break;
+        case IR_VXOR: for (u64 i = 0; i < entries; i++) b[i] ^= a[i]; break;
+
+        default: switch (IR_VECTOR_LANE(vector)) {
+            case IR_LANE_U8:  vector_lanes<u8,  u8> (operation, size, a, b); break;
+            case IR_LANE_S8:  vector_lanes<s8,  u8> (operation, size, a, b); break;
+            case IR_LANE_U16: vector_lanes<u16, u16>(operation, size, a, b); break;
+            case IR_LANE_S16: vector_lanes<s16, u16>(operation, size, a, b); break;
+            case IR_LANE_U32: vector_lanes<u32, u32>(operation, size, a, b); break;
+            case IR_LANE_S32: vector_lanes<s32, u32>(operation, size, a, b); break;
+            case IR_LANE_U64: vector_lanes<u64, u64>(operation, size, a, b); break;
+            case IR_LANE_S64: vector_lanes<s64, u64>(operation, size, a, b); break;
+            case IR_LANE_F32: vector_lanes<f32, u32>(operation, size, a, b); break;
+            case IR_LANE_F64: vector_lanes<f64, u64>(operation, size, a, b); break;
+        } break;
+    }
+
+    push_vector(state, entries, b);
+}
+
+static void vector_splat(interpreter_state_t *state, u64 vector) {
+    s64 value = stack_pop(&state->exec_stack);
+    s64 entries[VECTOR_MAX_ENTRIES];
+
+    u64 lane  = IR_VECTOR_LANE(vector);
+    u64 size  = lane <= IR_LANE_F64 ? ir_lane_size(lane) : SLOT_SIZE;
+    u64 count = vector_entries(vector);
+
+    assert(lane <= IR_LANE_F64);
+
+    if (lane == IR_LANE_F32) {
+        f32 narrow = (f32)as_float(value);
+        u32 bits   = 0;
+        mem_copy((u8*)&bits, (u8*)&narrow, sizeof(bits));
+        value = bits;
+    }
+
+    for (u64 i = 0; i < count * SLOT_SIZE; i += size) {
+        mem_copy((u8*)entries + i, (u8*)&value, size);
+    }
+
+    push_vector(state, count, entries);
+}
 
+// ------ intrinsics
 
+// data stack is one block, so its ranges are accessed directly, the rest goes
+// through read_memory and write_memory
+static inline u8 *data_range(interpreter_state_t *state, s64 address, s64 size) {
+    if (address < 0 || address >= GLOBALS_OFFSET || size > GLOBALS_OFFSET || (u64)(address + size) > state->data_stack.index) return NULL;
+    return state->data_stack.data + address;
+}
+
+static b32 fill_memory(interpreter_state_t *state, s64 address, u64 value, u64 lane, s64 count) {
+    if (count <= 0) return true;
+
+    u64 size = ir_lane_size(lane);
+
+    if (lane == IR_LANE_F32) {
+        f32 narrow = (f32)as_float((s64)value);
+        u32 bits   = 0;
+        mem_copy((u8*)&bits, (u8*)&narrow, sizeof(bits));
+        value = bits;
+    }
+
+    u8 *data = count <= GLOBALS_OFFSET ? data_range(state, address, count * (s64)size) : NULL;
+
+    if (data) {
+        for (s64 i = 0; i < count; i++) mem_copy(data + i * size, (u8*)&value, size);
         return true;
     }
 
-    stack_push(&state->curr_func, func);
-    return false;
+    for (s64 i = 0; i < count; i++) {
+        if (!write_memory(state, address + i * (s64)size, size, value)) return false;
+    }
+
+    return true;
+}
+
+// backwards when destination is above source, so overlapping ranges work for both copies
+static b32 move_memory(interpreter_state_t *state, s64 destination, s64 source, s64 size) {
+    if (size <= 0) return true;
+
+    b32 forward = destination < source;
+    u8 *to      = data_range(state, destination, size);
+    u8 *from    = data_range(state, source, size);
+
+    if (to && from) {
+        for (s64 i = 0; i < size; i++) {
+            s64 k = forward ? i : size - 1 - i;
+            to[k] = from[k];
+        }
+
+        return true;
+    }
+
+    for (s64 i = 0; i < size; i++) {
+        s64 k    = forward ? i : size - 1 - i;
+        u64 byte = 0;
+
+        if (!read_memory(state, source + k, 1, &byte) || !write_memory(state, destination + k, 1, byte)) return false;
+    }
+
+    return true;
+}
+
+// value cut to the lane, extended back like a load of it
+static inline s64 extend_lane(u64 value, u64 lane) {
+    switch (lane) {
+        case IR_LANE_U8:  return (s64)(u8)value;
+        case IR_LANE_S8:  return (s64)(s8)value;
+        case IR_LANE_U16: return (s64)(u16)value;
+        case IR_LANE_S16: return (s64)(s16)value;
+        case IR_LANE_U32: return (s64)(u32)value;
+        case IR_LANE_S32: return (s64)(s32)value;
+        default:          return (s64)value;
+    }
+}
+
+// rotations take the amount modulo width of the lane, like rol and ror
+static s64 bit_operation(u64 operation, u64 lane, u64 value, s64 amount) {
+    u64 bits = ir_lane_size(lane) * 8;
+    u64 mask = bits == 64 ? ~0ull : (1ull << bits) - 1;
+    s64 count = 0;
+
+    value &= mask;
+
+    switch (operation) {
+        case IR_POPCOUNT:
+            for (; value; value &= value - 1) count++;
+            return count;
+        case IR_CLZ:
+            while ((u64)count < bits && !((value >> (bits - 1 - count)) & 1)) count++;
+            return count;
+        case IR_CTZ:
+            while ((u64)count < bits && !((value >> count) & 1)) count++;
+            return count;
+
+        case IR_BSWAP: {
+            u64 result = 0;
+
+            for (u64 i = 0; i < bits; i += 8) {
+                result |= ((value >> i) & 0xFF) << (bits - 8 - i);
+            }
+
+            return extend_lane(result, lane);
+        }
+
+        case IR_ROTL:
+        case IR_ROTR: {
+            u64 shift = (u64)amount & (bits - 1);
+            if (operation == IR_ROTR) shift = (bits - shift) & (bits - 1);
+
+            u64 result = shift ? (value << shift) | (value >> (bits - shift)) : value;
+            return extend_lane(result & mask, lane);
+        }
+    }
+
+    return 0;
+}
+
+static inline decoded_function_t *current_function(interpreter_state_t *state) {
+    return list_get(&state->functions, stack_peek(&state->curr_func));
+}
+
+// errors are reported on the first IR opcode that was fused into op
+static inline ir_opcode_t get_source_op(interpreter_state_t *state, decoded_op_t *op) {
+    return current_function(state)->func->code[op->ir_index];
+}
+
+static inline void access_violation(interpreter_state_t *state, decoded_op_t *op, s64 address) {
+    ir_opcode_t source = get_source_op(state, op);
+    print_ir_opcode(source);
+    log_error_token(string_format(get_temporary_allocator(), STRING("Access violation, address: %d"), address), source.info);
+    state->running = false;
+    state->had_error = true;
+}
+
+static inline void call_external(interpreter_state_t *state, string_t string) {
+    if (string_compare(string, STRING("putchar")) == 0) {
+        s64 value = stack_pop(&state->exec_stack);
+        putchar((char)value);
+    } else if (string_compare(string, STRING("debug_break")) == 0) {
+        debug_break();
+    } else if (string_compare(string, STRING("getchar")) == 0) {
+        stack_push(&state->exec_stack, (s64)getchar());
+    }
 }
 
 static inline void pop_function(interpreter_state_t *state) {
     stack_pop(&state->curr_func);
+    stack_pop(&state->call_names);
+}
+
+// ------ decoding
+
+static inline b32 is_fusable_binop(u64 operation) {
+    return (operation >= IR_ADD && operation <= IR_MOD)
+        || (operation >= IR_BIT_AND && operation <= IR_BIT_XOR)
+        || operation == IR_SHIFT_LEFT || operation == IR_SHIFT_RIGHT
+        || (operation >= IR_CMP_EQ && operation <= IR_CMP_GTE);
+}
+
+static inline b32 is_compare(u64 operation) {
+    return operation >= IR_CMP_EQ && operation <= IR_CMP_GTE;
+}
+
+static inline b32 is_jump(u64 operation) {
+    switch (operation) {
+        case IR_JUMP:
+        case IR_JUMP_IF:
+        case IR_JUMP_IF_NOT:
+        case INTEROP_CMP_JUMP_IF_NOT:
+        case INTEROP_STACK_IMM_CMP_JUMP_IF_NOT:
+        case INTEROP_JUMP_IF_NOT_OR_POP:
+        case INTEROP_JUMP_IF_OR_POP:
+            return true;
+    }
+
+    return false;
+}
+
+// a is the top of the stack, same as in BINOP
+static inline s64 binary_op(u64 operation, s64 a, s64 b) {
+    switch (operation) {
+        case IR_ADD:         return a + b;
+        case IR_SUB:         return a - b;
+        case IR_MUL:         return a * b;
+        case IR_DIV:         return b != 0 ? a / b : 0;
+        case IR_MOD:         return b != 0 ? a % b : 0;
+        case IR_BIT_AND:     return a & b;
+        case IR_BIT_OR:      return a | b;
+        case IR_BIT_XOR:     return a ^ b;
+        case IR_SHIFT_LEFT:  return a << b;
+        case IR_SHIFT_RIGHT: return a >> b;
+        case IR_CMP_EQ:      return a == b;
+        case IR_CMP_NEQ:     return a != b;
+        case IR_CMP_LT:      return a < b;
+        case IR_CMP_GT:      return a > b;
+        case IR_CMP_LTE:     return a <= b;
+        case IR_CMP_GTE:     return a >= b;
+    }
+
+    assert(false);
+    return 0;
+}
+
+// matches longest sequence first, no opcode except the first one
+// can be a jump target, otherwise jumping into the middle would be lost
+static u32 fuse_opcodes(ir_opcode_t *code, u8 *is_target, u64 count, u64 i, decoded_op_t *out) {
+    u64 left = count - i;
+
+    #define FREE_AT(n) (left > (n) && !is_target[i + (n)])
+    #define OP_AT(n)   (code[i + (n)].operation)
+
+    if (OP_AT(0) == IR_PUSH_SIGN && FREE_AT(1) && OP_AT(1) == IR_PUSH_STACK) {
+        if (FREE_AT(2) && is_compare(OP_AT(2)) && FREE_AT(3) && OP_AT(3) == IR_JUMP_IF_NOT) {
+            out->operation = INTEROP_STACK_IMM_CMP_JUMP_IF_NOT;
+            out->kind      = (u32)OP_AT(2);
+            out->operand   = code[i + 1].s_operand;
+            out->operand2  = code[i].s_operand;
+            out->target    = i + 4 + code[i + 3].s_operand;
+            return 4;
+        }
+
+        if (FREE_AT(2) && is_fusable_binop(OP_AT(2))) {
+            out->operation = INTEROP_STACK_IMM_OP;
+            out->kind      = (u32)OP_AT(2);
+            out->operand   = code[i + 1].s_operand;
+            out->operand2  = code[i].s_operand;
+            return 3;
+        }
+
+        out->operation = INTEROP_PUSH_SIGN_STACK;
+        out->operand   = code[i + 1].s_operand;
+        out->operand2  = code[i].s_operand;
+        return 2;
+    }
+
+    if (OP_AT(0) == IR_PUSH_SIGN && FREE_AT(1) && is_fusable_binop(OP_AT(1))) {
+        out->operation = INTEROP_IMM_OP;
+        out->kind      = (u32)OP_AT(1);
+        out->operand   = code[i].s_operand;
+        return 2;
+    }
+
+    if (OP_AT(0) == IR_PUSH_SEA && FREE_AT(1) && (OP_AT(1) == IR_LOAD || OP_AT(1) == IR_STORE)) {
+        out->operation = OP_AT(1) == IR_LOAD ? INTEROP_LOAD_STACK : INTEROP_STORE_STACK;
+        out->operand   = code[i].s_operand;
+        return 2;
+    }
+
+    if (is_compare(OP_AT(0)) && FREE_AT(1) && OP_AT(1) == IR_JUMP_IF_NOT) {
+        out->operation = INTEROP_CMP_JUMP_IF_NOT;
+        out->kind      = (u32)OP_AT(0);
+        out->target    = i + 2 + code[i + 1].s_operand;
+        return 2;
+    }
+
+    if (OP_AT(0) == IR_CLONE && FREE_AT(1) && (OP_AT(1) == IR_JUMP_IF || OP_AT(1) == IR_JUMP_IF_NOT)
+                             && FREE_AT(2) && OP_AT(2) == IR_POP) {
+        out->operation = OP_AT(1) == IR_JUMP_IF ? INTEROP_JUMP_IF_OR_POP : INTEROP_JUMP_IF_NOT_OR_POP;
+        out->target    = i + 2 + code[i + 1].s_operand;
+        return 3;
+    }
+
+    #undef FREE_AT
+    #undef OP_AT
+
+    out->operation = (u32)code[i].operation;
+    return 1;
+}
+
+static void decode_function(decoded_function_t *decoded) {
+    ir_function_t *func = decoded->func;
+    u64 count = func->code.count;
+
+    list_create(&decoded->code, count + 1, *default_allocator);
+
+    // array_t is chunked, flat copy makes both passes cheap
+    ir_opcode_t *code      = (ir_opcode_t*)mem_alloc(default_allocator, (count + 1) * sizeof(ir_opcode_t));
+    u8          *is_target = (u8*)         mem_alloc(default_allocator, count + 1);
+    u64         *mapping   = (u64*)        mem_alloc(default_allocator, (count + 1) * sizeof(u64));
+
+    mem_set(is_target, 0, count + 1);
+
+    for (u64 i = 0; i < count; i++) {
+        code[i] = func->code[i];
+
+        u64 operation = code[i].operation;
+        if (operation == IR_JUMP || operation == IR_JUMP_IF || operation == IR_JUMP_IF_NOT) {
+            s64 target = (s64)i + 1 + code[i].s_operand;
+            if (target >= 0 && target <= (s64)count) is_target[target] = true;
+        }
+    }
+
+    for (u64 i = 0; i < count; ) {
+        decoded_op_t op = {};
+        op.ir_index = i;
+        op.operand  = code[i].s_operand;
+
+        if (code[i].operation == IR_JUMP || code[i].operation == IR_JUMP_IF || code[i].operation == IR_JUMP_IF_NOT) {
+            op.target = i + 1 + code[i].s_operand;
+        }
+
+        op.ir_count = fuse_opcodes(code, is_target, count, i, &op);
+
+        mapping[i] = decoded->code.count;
+        list_add(&decoded->code, &op);
+        i += op.ir_count;
+    }
+
+    // falling off the end, or jumping right after the last opcode
+    decoded_op_t end = {};
+    end.operation = IR_INVALID;
+    end.ir_index  = count ? count - 1 : 0;
+
+    mapping[count] = decoded->code.count;
+    list_add(&decoded->code, &end);
+
+    for (u64 i = 0; i < decoded->code.count; i++) {
+        decoded_op_t *op = list_get(&decoded->code, i);
+
+        if (!is_jump(op->operation)) continue;
+
+        // broken offsets are turned into the end marker
+        op->target = op->target <= count ? mapping[op->target] : mapping[count];
+    }
+
+    mem_free(default_allocator, (u8*)code);
+    mem_free(default_allocator, is_target);
+    mem_free(default_allocator, (u8*)mapping);
+}
+
+// functions are decoded on their first call, index is stable for the whole interop call
+static b32 get_decoded_function(interpreter_state_t *state, string_t name, u64 *index) {
+    u64 *found = hashmap_get(&state->function_index, name);
+
+    if (found) {
+        *index = *found;
+        return true;
+    }
+
+    ir_function_t *func = hashmap_get(&state->ir->functions, name);
+    if (func == NULL) return false;
+
+    decoded_function_t decoded = {};
+    decoded.name = name;
+    decoded.func = func;
+
+    if (!func->is_external) {
+        decode_function(&decoded);
+    }
+
+    *index = state->functions.count;
+    list_add(&state->functions, &decoded);
+    hashmap_add(&state->function_index, name, index);
+    return true;
+}
+
+// ------ profiling
+
+static u64 get_function_profile(interop_profile_t *profile, string_t name, ir_function_t *func) {
+    u64 *found = hashmap_get(&profile->function_index, name);
+
+    if (found) return *found;
+
+    interop_function_profile_t entry = {};
+    entry.name       = name;
+    entry.code_count = func->code.count;
+    entry.hits       = (u64*)mem_alloc(default_allocator, (entry.code_count + 1) * sizeof(u64));
+    entry.taken      = (u64*)mem_alloc(default_allocator, (entry.code_count + 1) * sizeof(u64));
+    mem_set((u8*)entry.hits,  0, (entry.code_count + 1) * sizeof(u64));
+    mem_set((u8*)entry.taken, 0, (entry.code_count + 1) * sizeof(u64));
+
+    u64 index = profile->functions.count;
+    list_add(&profile->functions, &entry);
+    hashmap_add(&profile->function_index, name, &index);
+    return index;
 }
 
-static inline void execute_ir_opcode(interpreter_state_t *state, ir_opcode_t op) {
-    switch (op.operation) {
-        case IR_NOP: break;
+static inline void profile_enter(interpreter_state_t *state, decoded_function_t *callee) {
+    if (!state->profile || !state->profile->collect) return;
+
+    if (callee->profile_index == 0) {
+        callee->profile_index = get_function_profile(state->profile, callee->name, callee->func) + 1;
+    }
+
+    profile_frame_t frame = {};
+    frame.index = callee->profile_index - 1;
+    frame.start = debug_get_time();
+
+    interop_function_profile_t *entry = list_get(&state->profile->functions, frame.index);
+    entry->calls++;
+    entry->active++;
+
+    stack_push(&state->frames, frame);
+}
+
+static inline void profile_leave(interpreter_state_t *state) {
+    if (!state->profile || !state->profile->collect) return;
+    if (state->frames.index == 0) return;
+
+    profile_frame_t frame = stack_pop(&state->frames);
+    f64 elapsed = debug_get_time() - frame.start;
+
+    interop_function_profile_t *entry = list_get(&state->profile->functions, frame.index);
+    entry->self += elapsed - frame.children;
+    entry->active--;
+
+    if (entry->active == 0) {
+        entry->inclusive += elapsed;
+    }
+
+    if (state->frames.index > 0) {
+        state->frames.data[state->frames.index - 1].children += elapsed;
+    }
+}
+
+static inline void profile_step(interpreter_state_t *state, decoded_op_t *op) {
+    interop_profile_t *profile = state->profile;
+
+    if (profile->collect && op->operation < INTEROP_OPCODE_COUNT) {
+        profile->opcodes[op->operation]++;
+        profile->dispatches++;
+
+        // hits stay in IR opcodes, so fusion doesn't change them
+        if (state->frames.index > 0) {
+            interop_function_profile_t *entry = list_get(&profile->functions, state->frames.data[state->frames.index - 1].index);
+            entry->steps += op->ir_count;
+
+            for (u64 i = op->ir_index; i < op->ir_index + op->ir_count && i < entry->code_count; i++) {
+                entry->hits[i]++;
+            }
+        }
+    }
+}
+
+// after the opcode, conditional jump went to its target
+static inline void profile_branch(interpreter_state_t *state, decoded_op_t *op) {
+    if (!state->profile->collect || state->frames.index == 0) return;
+
+    u64 jump = op->ir_index + op->ir_count - 1;
+
+    switch (op->operation) {
+        case IR_JUMP_IF:
+        case IR_JUMP_IF_NOT:
+        case INTEROP_CMP_JUMP_IF_NOT:
+        case INTEROP_STACK_IMM_CMP_JUMP_IF_NOT:
+            break;
+
+        case INTEROP_JUMP_IF_NOT_OR_POP:
+        case INTEROP_JUMP_IF_OR_POP:
+            jump = op->ir_index + 1;
+            break;
+
+        default:
+            return;
+    }
+
+    if (state->ip != op->target) return;
+
+    interop_function_profile_t *entry = list_get(&state->profile->functions, state->frames.data[state->frames.index - 1].index);
+    if (jump < entry->code_count) entry->taken[jump]++;
+}
+
+static void step_limit_reached(interpreter_state_t *state, decoded_op_t *op) {
+    log_error_token(string_format(get_temporary_allocator(), STRING("Interpreter step limit of %u reached, probably endless loop"), state->profile->step_limit), get_source_op(state, op).info);
+
+    log_push_color(INFO_COLOR);
+    log_write("call stack:\n");
+
+    for (u64 i = state->call_names.index; i > 0; i--) {
+        log_write(string_format(get_temporary_allocator(), STRING("    %s\n"), state->call_names[i - 1]));
+    }
+
+    log_pop_color();
+
+    state->running   = false;
+    state->had_error = true;
+}
+
+void interop_set_profile(interop_profile_t *profile) {
+    current_profile = profile;
+}
+
+static inline void execute_ir_opcode(interpreter_state_t *state, decoded_op_t *op) {
+    switch (op->operation) {
+        case IR_NOP:   break;
+        case IR_ALIGN: break;
 
         BINOP   (IR_ADD, a + b);
         BINOP   (IR_SUB, a - b);
@@ -159,44 +855,70 @@ static inline void execute_ir_opcode(interpreter_state_t *state, ir_opcode_t op)
             
         UNOP (IR_LOG_NOT, (s64)(!a));
 
+        FBINOP(IR_FADD, as_bits(a + b));
+        FBINOP(IR_FSUB, as_bits(a - b));
+        FBINOP(IR_FMUL, as_bits(a * b));
+        FBINOP(IR_FDIV, as_bits(a / b));
+        FUNOP (IR_FNEG, as_bits(-a));
+
+        FBINOP(IR_FCMP_EQ,  (s64)(a == b));
+        FBINOP(IR_FCMP_NEQ, (s64)(a != b));
+        FBINOP(IR_FCMP_LT,  (s64)(a < b));
+        FBINOP(IR_FCMP_GT,  (s64)(a > b));
+        FBINOP(IR_FCMP_LTE, (s64)(a <= b));
+        FBINOP(IR_FCMP_GTE, (s64)(a >= b));
+
+        UNOP  (IR_INT_TO_FLOAT, as_bits((f64)a));
+        FUNOP (IR_FLOAT_TO_INT, float_to_int(a));
+        FUNOP (IR_ROUND_F32,    as_bits((f64)(f32)a));
+
         case IR_STACK_FRAME_PUSH: 
             stack_push(&state->fp, state->data_stack.index); 
+            stack_push(&state->frame_size, (u64)op->operand);
+            if (op->operand) allocate_memory(state, op->operand * SLOT_SIZE);
             break;
         case IR_STACK_FRAME_POP: 
         {
                 u64 fp = stack_pop(&state->fp);
+                stack_pop(&state->frame_size);
                 free_memory(state, state->data_stack.index - fp);
         } break;
 
         case IR_SETUP_GLOBAL: 
         {
             s64 val   = stack_pop(&state->exec_stack);
-            s64 *addr = array_get(&state->ir->globals, op.u_operand);
+            s64 *addr = array_get(&state->ir->globals, (u64)op->operand);
             if (addr) *addr = val;
         } break;
 
         case IR_PUSH_SIGN: {
-            stack_push(&state->exec_stack, op.s_operand); 
+            stack_push(&state->exec_stack, op->operand); 
         } break;
 
         case IR_PUSH_UNSIGN: {
-            stack_push(&state->exec_stack, op.s_operand);
+            stack_push(&state->exec_stack, op->operand);
         } break;
 
         case IR_PUSH_STACK: {
-            stack_push(&state->exec_stack, get_variable(state, get_variable_address(state, (op.s_operand - 1)))); 
+            s64 addr = get_variable_address(state, op->operand);
+            u64 val  = 0;
+            if (read_memory(state, addr, SLOT_SIZE, &val)) stack_push(&state->exec_stack, (s64)val);
+            else access_violation(state, op, addr);
         } break;
 
         case IR_PUSH_SEA: {
-            stack_push(&state->exec_stack, (s64)get_variable_address(state, (op.s_operand - 1)));
+            stack_push(&state->exec_stack, get_variable_address(state, op->operand));
         } break;
 
         case IR_PUSH_GLOBAL: {
-            stack_push(&state->exec_stack, op.s_operand); 
+            s64 addr = GLOBALS_OFFSET + op->operand * SLOT_SIZE;
+            u64 val  = 0;
+            if (read_memory(state, addr, SLOT_SIZE, &val)) stack_push(&state->exec_stack, (s64)val);
+            else access_violation(state, op, addr);
         } break;
 
         case IR_PUSH_GEA: {
-            stack_push(&state->exec_stack, GLOBALS_OFFSET + (op.s_operand << 3)); 
+            stack_push(&state->exec_stack, (s64)(GLOBALS_OFFSET + op->operand * SLOT_SIZE)); 
         } break;
 
         case IR_POP: {
@@ -210,67 +932,149 @@ static inline void execute_ir_opcode(interpreter_state_t *state, ir_opcode_t op)
         } break;
             
         case IR_ALLOC: {
-            s64 addr = allocate_memory(state, op.s_operand);
+            s64 addr = allocate_memory(state, op->operand * SLOT_SIZE);
             stack_push(&state->exec_stack, addr);
         } break;
             
         case IR_FREE: {
-            free_memory(state, op.s_operand);
+            free_memory(state, op->operand * SLOT_SIZE);
         } break;
-            
-        case IR_LOAD: {
+
+        LOADOP (IR_LOAD,    s64);
+        LOADOP (IR_LOAD8S,  s8);
+        LOADOP (IR_LOAD8U,  u8);
+        LOADOP (IR_LOAD16S, s16);
+        LOADOP (IR_LOAD16U, u16);
+        LOADOP (IR_LOAD32S, s32);
+        LOADOP (IR_LOAD32U, u32);
+
+        STOREOP(IR_STORE,   s64);
+        STOREOP(IR_STORE8,  u8);
+        STOREOP(IR_STORE16, u16);
+        STOREOP(IR_STORE32, u32);
+
+        case IR_LOADF32: {
             s64 addr = stack_pop(&state->exec_stack);
+            u64 val  = 0;
+            f32 value = 0;
+            if (read_memory(state, addr, sizeof(f32), &val)) {
+                u32 bits = (u32)val;
+                mem_copy((u8*)&value, (u8*)&bits, sizeof(value));
+                stack_push(&state->exec_stack, as_bits((f64)value));
+            } else access_violation(state, op, addr);
+        } break;
 
-            if (addr >= GLOBALS_OFFSET) {
-                addr -= GLOBALS_OFFSET;
-                stack_push(&state->exec_stack, *array_get(&state->ir->globals, addr));
-            } else if ((u64)addr < state->data_stack.index) {
-                s64 val  = get_variable(state, addr);
-                stack_push(&state->exec_stack, val);
-            } else {
-                print_ir_opcode(op);
-                log_error_token(string_format(get_temporary_allocator(), STRING("Access violation, address: %d"), addr), op.info);
-                state->running = false;
-                state->had_error = true;
+        case IR_STOREF32: {
+            s64 addr  = stack_pop(&state->exec_stack);
+            f32 value = (f32)as_float(stack_pop(&state->exec_stack));
+            u32 bits  = 0;
+            mem_copy((u8*)&bits, (u8*)&value, sizeof(bits));
+            if (!write_memory(state, addr, sizeof(f32), (u64)bits)) access_violation(state, op, addr);
+        } break;
+
+        case IR_VLOAD: {
+            s64 addr = stack_pop(&state->exec_stack);
+            s64 entries[VECTOR_MAX_ENTRIES];
+            u64 count = vector_entries(op->operand);
+            b32 valid = true;
+
+            for (u64 i = 0; i < count; i++) {
+                valid &= read_memory(state, addr + i * SLOT_SIZE, SLOT_SIZE, (u64*)&entries[i]);
             }
+
+            if (valid) push_vector(state, count, entries);
+            else       access_violation(state, op, addr);
         } break;
-            
-        case IR_STORE: {
+
+        case IR_VSTORE: {
             s64 addr = stack_pop(&state->exec_stack);
-            s64 val  = stack_pop(&state->exec_stack);
+            s64 entries[VECTOR_MAX_ENTRIES];
+            u64 count = vector_entries(op->operand);
 
-            if (addr >= GLOBALS_OFFSET) {
-                addr -= GLOBALS_OFFSET;
-                stack_push(&state->exec_stack, *array_get(&state->ir->globals, addr));
-            } else if ((u64)addr < state->data_stack.index) {
-                set_variable(state, addr, val);
-            } else {
-                print_ir_opcode(op);
-                log_error_token(string_format(get_temporary_allocator(), STRING("Access violation, address: %d"), addr), op.info);
-                state->running = false;
-                state->had_error = true;
+            pop_vector(state, count, entries);
+
+            b32 valid = true;
+
+            for (u64 i = 0; i < count; i++) {
+                valid &= write_memory(state, addr + i * SLOT_SIZE, SLOT_SIZE, (u64)entries[i]);
             }
+
+            if (!valid) access_violation(state, op, addr);
+        } break;
+
+        case IR_VSPLAT:
+            vector_splat(state, op->operand);
+            break;
+
+        case IR_VADD:
+        case IR_VSUB:
+        case IR_VMUL:
+        case IR_VDIV:
+        case IR_VAND:
+        case IR_VOR:
+        case IR_VXOR:
+        case IR_VCMP_EQ:
+        case IR_VCMP_NEQ:
+        case IR_VCMP_LT:
+        case IR_VCMP_GT:
+        case IR_VCMP_LTE:
+        case IR_VCMP_GTE:
+            vector_binary(state, op->operation, op->operand);
+            break;
+
+        case IR_MEM_FILL: {
+            s64 addr  = stack_pop(&state->exec_stack);
+            s64 value = stack_pop(&state->exec_stack);
+            s64 count = stack_pop(&state->exec_stack);
+
+            if (!fill_memory(state, addr, (u64)value, (u64)op->operand, count)) access_violation(state, op, addr);
+        } break;
+
+        case IR_MEM_COPY:
+        case IR_MEM_MOVE: {
+            s64 destination = stack_pop(&state->exec_stack);
+            s64 source      = stack_pop(&state->exec_stack);
+            s64 size        = stack_pop(&state->exec_stack);
+
+            if (!move_memory(state, destination, source, size)) access_violation(state, op, destination);
+        } break;
+
+        case IR_POPCOUNT:
+        case IR_CLZ:
+        case IR_CTZ:
+        case IR_BSWAP: {
+            s64 value = stack_pop(&state->exec_stack);
+            stack_push(&state->exec_stack, bit_operation(op->operation, (u64)op->operand, (u64)value, 0));
+        } break;
+
+        case IR_ROTL:
+        case IR_ROTR: {
+            s64 value  = stack_pop(&state->exec_stack);
+            s64 amount = stack_pop(&state->exec_stack);
+            stack_push(&state->exec_stack, bit_operation(op->operation, (u64)op->operand, (u64)value, amount));
         } break;
 
         case IR_JUMP: {
-            state->ip += op.s_operand;
+            state->ip = op->target;
         } break;
             
         case IR_JUMP_IF: {
             s64 cond = stack_pop(&state->exec_stack);
             if (cond) {
-                state->ip += op.s_operand;
+                state->ip = op->target;
             }
         } break;
             
         case IR_JUMP_IF_NOT: {
             s64 cond = stack_pop(&state->exec_stack);
             if (!cond) {
-                state->ip += op.s_operand;
+                state->ip = op->target;
             }
         } break;
 
         case IR_RET: {
+            profile_leave(state);
+
             if (state->ip_stack.index == 0) {
                 state->running = false;
             } else {
@@ -281,10 +1085,100 @@ static inline void execute_ir_opcode(interpreter_state_t *state, ir_opcode_t op)
         } break;
 
         case IR_CALL: {
-            if (!push_function(state, op.string)) {
-                stack_push(&state->ip_stack, state->ip);
-                state->ip = 0;
+            // callee is looked up once per call site, target keeps its index + 1
+            if (op->target == 0) {
+                u64 index = 0;
+                if (!get_decoded_function(state, get_source_op(state, op).string, &index)) {
+                    log_error(string_format(get_temporary_allocator(), STRING("Couldn't find function to interpret: %s"), get_source_op(state, op).string));
+                    state->running = false;
+                    state->had_error = true;
+                    break;
+                }
+                op->target = index + 1;
+            }
+
+            decoded_function_t *callee = list_get(&state->functions, op->target - 1);
+
+#ifdef VERBOSE
+            log_update_color();
+            log_write(string_format(get_temporary_allocator(), STRING(" Calling: %s\n"), callee->name));
+#endif
+
+            if (callee->func->is_external) {
+                call_external(state, callee->name);
+                break;
             }
+
+            stack_push(&state->ip_stack, state->ip);
+            stack_push(&state->curr_func, op->target - 1);
+            stack_push(&state->call_names, callee->name);
+            state->ip = 0;
+            profile_enter(state, callee);
+        } break;
+
+        // ------ fused
+
+        case INTEROP_PUSH_SIGN_STACK: {
+            stack_push(&state->exec_stack, op->operand2);
+
+            s64 addr = get_variable_address(state, op->operand);
+            u64 val  = 0;
+            if (read_memory(state, addr, SLOT_SIZE, &val)) stack_push(&state->exec_stack, (s64)val);
+            else access_violation(state, op, addr);
+        } break;
+
+        case INTEROP_IMM_OP: {
+            s64 b = stack_pop(&state->exec_stack);
+            stack_push(&state->exec_stack, binary_op(op->kind, op->operand, b));
+        } break;
+
+        case INTEROP_STACK_IMM_OP: {
+            s64 addr = get_variable_address(state, op->operand);
+            u64 val  = 0;
+            if (read_memory(state, addr, SLOT_SIZE, &val)) stack_push(&state->exec_stack, binary_op(op->kind, (s64)val, op->operand2));
+            else access_violation(state, op, addr);
+        } break;
+
+        case INTEROP_LOAD_STACK: {
+            s64 addr = get_variable_address(state, op->operand);
+            u64 val  = 0;
+            if (read_memory(state, addr, SLOT_SIZE, &val)) stack_push(&state->exec_stack, (s64)val);
+            else access_violation(state, op, addr);
+        } break;
+
+        case INTEROP_STORE_STACK: {
+            s64 addr = get_variable_address(state, op->operand);
+            s64 val  = stack_pop(&state->exec_stack);
+            if (!write_memory(state, addr, SLOT_SIZE, (u64)val)) access_violation(state, op, addr);
+        } break;
+
+        case INTEROP_CMP_JUMP_IF_NOT: {
+            s64 a = stack_pop(&state->exec_stack);
+            s64 b = stack_pop(&state->exec_stack);
+            if (!binary_op(op->kind, a, b)) {
+                state->ip = op->target;
+            }
+        } break;
+
+        case INTEROP_STACK_IMM_CMP_JUMP_IF_NOT: {
+            s64 addr = get_variable_address(state, op->operand);
+            u64 val  = 0;
+            if (!read_memory(state, addr, SLOT_SIZE, &val)) {
+                access_violation(state, op, addr);
+            } else if (!binary_op(op->kind, (s64)val, op->operand2)) {
+                state->ip = op->target;
+            }
+        } break;
+
+        // value stays for the rest of && and || only when we jump
+        case INTEROP_JUMP_IF_NOT_OR_POP: {
+            if (!stack_peek(&state->exec_stack)) state->ip = op->target;
+            else                                 stack_pop(&state->exec_stack);
+        } break;
+
+        case INTEROP_JUMP_IF_OR_POP: {
+            if (stack_peek(&state->exec_stack)) state->ip = op->target;
+            else                                stack_pop(&state->exec_stack);
         } break;
 
         case IR_BRK: {
@@ -301,34 +1195,102 @@ static inline void execute_ir_opcode(interpreter_state_t *state, ir_opcode_t op)
             
         default:
             log_error("Unknown IR opcode.");
-            print_ir_opcode(op);
+            print_ir_opcode(get_source_op(state, op));
             state->running = false;
             state->had_error = true;
             break;
     }
 }
 
-b32 interop_func(ir_t *ir, string_t func_name) {
+b32 interop_call(ir_t *ir, string_t func_name, s64 *args, u64 arg_count, s64 *result) {
     profiler_func_start();
     interpreter_state_t state = {};
 
     state.running = true;
     state.ir = ir;
     ir_function_t *func = ir->functions[func_name];
-    assert(func);
-    stack_push(&state.curr_func, func);
 
-    u64 i = 0;
+    if (func == NULL || func->is_external) {
+        log_error(string_format(get_temporary_allocator(), STRING("Couldn't find function to interpret: %s"), func_name));
+        profiler_func_end();
+        return false;
+    }
+
+    list_create(&state.functions, 16, *default_allocator);
+    hashmap_create(&state.function_index, 16, NULL, NULL);
+
+    u64 index = 0;
+    get_decoded_function(&state, func_name, &index);
+
+    stack_push(&state.curr_func, index);
+    stack_push(&state.call_names, func_name);
+
+    state.profile = current_profile;
+    profile_enter(&state, list_get(&state.functions, index));
+
+    // first argument should be on top, same as in AST_SEPARATION
+    for (u64 j = arg_count; j > 0; j--) {
+        stack_push(&state.exec_stack, args[j - 1]);
+    }
+
+    // decoded code of a function never moves, functions list itself can
+    u64 depth = 0;
+    decoded_op_t *code = NULL;
+
     while (state.running) {
-        if (i != state.curr_func.index) {
-            i = state.curr_func.index;
-            func = stack_peek(&state.curr_func);
+        if (depth != state.curr_func.index) {
+            depth = state.curr_func.index;
+            code  = current_function(&state)->code.data;
+        }
+        decoded_op_t *op = code + state.ip++;
+
+        if (state.profile) {
+            state.profile->steps += op->ir_count;
+
+            if (state.profile->step_limit && state.profile->steps > state.profile->step_limit) {
+                step_limit_reached(&state, op);
+                break;
+            }
+
+            profile_step(&state, op);
+            execute_ir_opcode(&state, op);
+            profile_branch(&state, op);
+            continue;
         }
-        ir_opcode_t op = func->code[state.ip++];
 
         execute_ir_opcode(&state, op);
     }
 
+    while (state.frames.index > 0) {
+        profile_leave(&state);
+    }
+
+    if (result != NULL) {
+        *result = state.exec_stack.index > 0 ? stack_peek(&state.exec_stack) : 0;
+    }
+
+    for (u64 j = 0; j < state.functions.count; j++) {
+        decoded_function_t *decoded = list_get(&state.functions, j);
+        if (decoded->code.data) list_delete(&decoded->code);
+    }
+
+    list_delete(&state.functions);
+    hashmap_delete(&state.function_index);
+
+    if (state.fp.data)          stack_delete(&state.fp);
+    if (state.frame_size.data)  stack_delete(&state.frame_size);
+    if (state.ip_stack.data)    stack_delete(&state.ip_stack);
+    if (state.exec_stack.data)  stack_delete(&state.exec_stack);
+    if (state.data_stack.data)  stack_delete(&state.data_stack);
+    if (state.allocations.data) stack_delete(&state.allocations);
+    if (state.curr_func.data)   stack_delete(&state.curr_func);
+    if (state.call_names.data)  stack_delete(&state.call_names);
+    if (state.frames.data)      stack_delete(&state.frames);
+
     profiler_func_end();
     return !state.had_error;
 }
+
+b32 interop_func(ir_t *ir, string_t func_name) {
+    return interop_call(ir, func_name, NULL, 0, NULL);
+}
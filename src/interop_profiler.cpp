@@ -0,0 +1,292 @@
+#include "interop.h"
+
+#include "ir.h"
+#include "scanner.h"
+
+#include "list.h"
+#include "array.h"
+#include "hashmap.h"
+#include "sorter.h"
+#include "sink.h"
+
+#include "allocator.h"
+#include "talloc.h"
+#include "strings.h"
+#include "platform.h"
+
+#define PROFILE_TABLE_LINES 20
+
+struct line_key_t {
+    scanner_t *from;
+    u64        line;
+};
+
+struct line_hits_t {
+    string_t filename;
+    u64      line;
+    u64      hits;
+};
+
+struct opcode_hits_t {
+    u64 operation;
+    u64 hits;
+};
+
+static COMP_PROC(compare_opcodes) {
+    UNUSED(size);
+    opcode_hits_t *va = (opcode_hits_t*)a;
+    opcode_hits_t *vb = (opcode_hits_t*)b;
+
+    if (va->hits < vb->hits) return 1;
+    if (va->hits > vb->hits) return -1;
+
+    if (va->operation < vb->operation) return -1;
+    if (va->operation > vb->operation) return 1;
+    return 0;
+}
+
+static COMP_PROC(compare_functions) {
+    UNUSED(size);
+    interop_function_profile_t *va = (interop_function_profile_t*)a;
+    interop_function_profile_t *vb = (interop_function_profile_t*)b;
+
+    if (va->self < vb->self) return 1;
+    if (va->self > vb->self) return -1;
+
+    // same time, tables don't depend on hashmap order
+    return string_compare(va->name, vb->name);
+}
+
+static COMP_PROC(compare_lines) {
+    UNUSED(size);
+    line_hits_t *va = (line_hits_t*)a;
+    line_hits_t *vb = (line_hits_t*)b;
+
+    if (va->hits < vb->hits) return 1;
+    if (va->hits > vb->hits) return -1;
+
+    s32 order = string_compare(va->filename, vb->filename);
+    if (order != 0) return order;
+
+    if (va->line < vb->line) return -1;
+    if (va->line > vb->line) return 1;
+    return 0;
+}
+
+// opcode hits are per function, here they are merged by source line
+static list_t<line_hits_t> collect_lines(ir_t *ir, interop_profile_t *profile) {
+    list_t<line_hits_t> lines = {};
+    list_create(&lines, 64, *default_allocator);
+
+    hashmap_t<line_key_t, u64> index = {};
+    hashmap_create(&index, 64, NULL, NULL);
+
+    for (u64 i = 0; i < profile->functions.count; i++) {
+        interop_function_profile_t *entry = list_get(&profile->functions, i);
+        ir_function_t *func = hashmap_get(&ir->functions, entry->name);
+
+        if (func == NULL || func->code.count != entry->code_count) continue;
+
+        for (u64 j = 0; j < entry->code_count; j++) {
+            if (entry->hits[j] == 0) continue;
+
+            ir_opcode_t op = func->code[j];
+            if (op.info.from == NULL) continue;
+
+            line_key_t key = {};
+            key.from = op.info.from;
+            key.line = op.info.l0;
+
+            u64 *found = hashmap_get(&index, key);
+
+            if (found) {
+                list_get(&lines, *found)->hits += entry->hits[j];
+                continue;
+            }
+
+            line_hits_t line = {};
+            line.filename = op.info.from->filename;
+            line.line     = op.info.l0 + 1;
+            line.hits     = entry->hits[j];
+
+            u64 position = lines.count;
+            list_add(&lines, &line);
+            hashmap_add(&index, key, &position);
+        }
+    }
+
+    hashmap_delete(&index);
+    return lines;
+}
+
+const char *interop_code_to_string(u64 operation) {
+    switch (operation) {
+        case INTEROP_PUSH_SIGN_STACK:           return "PUSH_SIGN_STACK";
+        case INTEROP_IMM_OP:                    return "IMM_OP";
+        case INTEROP_STACK_IMM_OP:              return "STACK_IMM_OP";
+        case INTEROP_LOAD_STACK:                return "LOAD_STACK";
+        case INTEROP_STORE_STACK:               return "STORE_STACK";
+        case INTEROP_CMP_JUMP_IF_NOT:           return "CMP_JUMP_IF_NOT";
+        case INTEROP_STACK_IMM_CMP_JUMP_IF_NOT: return "STACK_IMM_CMP_JUMP_IF_NOT";
+        case INTEROP_JUMP_IF_NOT_OR_POP:        return "JUMP_IF_NOT_OR_POP";
+        case INTEROP_JUMP_IF_OR_POP:            return "JUMP_IF_OR_POP";
+    }
+
+    return ir_code_to_string(operation);
+}
+
+static list_t<opcode_hits_t> collect_opcodes(interop_profile_t *profile) {
+    list_t<opcode_hits_t> opcodes = {};
+    list_create(&opcodes, INTEROP_OPCODE_COUNT, *default_allocator);
+
+    for (u64 i = 0; i < INTEROP_OPCODE_COUNT; i++) {
+        if (profile->opcodes[i] == 0) continue;
+
+        opcode_hits_t hits = { i, profile->opcodes[i] };
+        list_add(&opcodes, &hits);
+    }
+
+    return opcodes;
+}
+
+void interop_profile_print(ir_t *ir, interop_profile_t *profile) {
+    if (!profile->collect) return;
+
+    list_t<opcode_hits_t> opcodes = collect_opcodes(profile);
+    list_t<line_hits_t>   lines   = collect_lines(ir, profile);
+
+    list_t<interop_function_profile_t> functions = list_clone(&profile->functions);
+
+    if (opcodes.count)   sort_array(opcodes.data,   opcodes.count,   compare_opcodes);
+    if (lines.count)     sort_array(lines.data,     lines.count,     compare_lines);
+    if (functions.count) sort_array(functions.data, functions.count, compare_functions);
+
+    u64 total = profile->dispatches ? profile->dispatches : 1;
+
+    log_push_color(INFO_COLOR);
+    log_update_color();
+
+    fprintf(stderr, "Interpreter profile: %llu steps in %llu dispatches\n", (unsigned long long)profile->steps, (unsigned long long)profile->dispatches);
+
+    fprintf(stderr, "\n%-26s %14s %7s\n", "opcode", "count", "%");
+    for (u64 i = 0; i < opcodes.count; i++) {
+        opcode_hits_t *it = list_get(&opcodes, i);
+        fprintf(stderr, "%-26s %14llu %6.2f%%\n", interop_code_to_string(it->operation), (unsigned long long)it->hits, 100.0 * (f64)it->hits / (f64)total);
+    }
+
+    fprintf(stderr, "\n%-32s %10s %14s %12s %12s\n", "function", "calls", "steps", "incl ms", "self ms");
+    for (u64 i = 0; i < functions.count; i++) {
+        interop_function_profile_t *it = list_get(&functions, i);
+        fprintf(stderr, "%-32.*s %10llu %14llu %12.3f %12.3f\n", (int)it->name.size, it->name.data,
+                (unsigned long long)it->calls, (unsigned long long)it->steps, it->inclusive * 1000.0, it->self * 1000.0);
+    }
+
+    fprintf(stderr, "\n%-40s %14s\n", "line", "hits");
+    for (u64 i = 0; i < lines.count && i < PROFILE_TABLE_LINES; i++) {
+        line_hits_t *it = list_get(&lines, i);
+        string_t location = string_format(get_temporary_allocator(), STRING("%s:%u"), it->filename, it->line);
+        fprintf(stderr, "%-40.*s %14llu\n", (int)location.size, location.data, (unsigned long long)it->hits);
+    }
+
+    log_pop_color();
+
+    if (opcodes.data)   list_delete(&opcodes);
+    if (lines.data)     list_delete(&lines);
+    if (functions.data) list_delete(&functions);
+}
+
+static void json_write(sink_t *output, string_t text) {
+    sink_write(output, text.data, text.size);
+}
+
+// names and filenames go straight to the output, runs without escapes are
+// written at once, control characters become \u00XX
+static void json_write_string(sink_t *output, string_t text) {
+    static const char digits[] = "0123456789abcdef";
+
+    u64 run = 0;
+
+    for (u64 i = 0; i < text.size; i++) {
+        u8 c = text.data[i];
+
+        if (c >= 0x20 && c != '\\' && c != '"') continue;
+
+        sink_write(output, text.data + run, i - run);
+        run = i + 1;
+
+        if (c < 0x20) {
+            u8 escape[] = { '\\', 'u', '0', '0', (u8)digits[c >> 4], (u8)digits[c & 0xF] };
+            sink_write(output, escape, sizeof(escape));
+        } else {
+            u8 escape[] = { '\\', c };
+            sink_write(output, escape, sizeof(escape));
+        }
+    }
+
+    sink_write(output, text.data + run, text.size - run);
+}
+
+b32 interop_profile_write_json(ir_t *ir, interop_profile_t *profile, string_t filename) {
+    if (!profile->collect) return false;
+
+    allocator_t *talloc = get_temporary_allocator();
+
+    sink_t output = {};
+
+    if (!sink_open(&output, filename)) {
+        sink_close(&output);
+        return false;
+    }
+
+    list_t<opcode_hits_t> opcodes = collect_opcodes(profile);
+    list_t<line_hits_t>   lines   = collect_lines(ir, profile);
+
+    json_write(&output, string_format(talloc, STRING("{\"steps\":%u,\"dispatches\":%u,\"step_limit\":%u,\"opcodes\":["), profile->steps, profile->dispatches, profile->step_limit));
+
+    for (u64 i = 0; i < opcodes.count; i++) {
+        opcode_hits_t *it = list_get(&opcodes, i);
+        json_write(&output, string_format(talloc, STRING("%s{\"opcode\":\"%s\",\"count\":%u}"),
+                    i ? STRING(",") : STRING(""), STRING(interop_code_to_string(it->operation)), it->hits));
+    }
+
+    json_write(&output, STRING("],\"functions\":["));
+
+    // times are in nanoseconds, same as in compiler profile
+    for (u64 i = 0; i < profile->functions.count; i++) {
+        interop_function_profile_t *it = list_get(&profile->functions, i);
+
+        json_write(&output, i ? STRING(",{\"name\":\"") : STRING("{\"name\":\""));
+        json_write_string(&output, it->name);
+        json_write(&output, string_format(talloc, STRING("\",\"calls\":%u,\"steps\":%u,\"inclusive_ns\":%u,\"self_ns\":%u}"),
+                    it->calls, it->steps, (u64)(it->inclusive * 1000000000.0), (u64)(it->self * 1000000000.0)));
+    }
+
+    json_write(&output, STRING("],\"lines\":["));
+
+    for (u64 i = 0; i < lines.count; i++) {
+        line_hits_t *it = list_get(&lines, i);
+
+        json_write(&output, i ? STRING(",{\"file\":\"") : STRING("{\"file\":\""));
+        json_write_string(&output, it->filename);
+        json_write(&output, string_format(talloc, STRING("\",\"line\":%u,\"hits\":%u}"), it->line, it->hits));
+    }
+
+    json_write(&output, STRING("]}\n"));
+
+    b32 result = sink_close(&output);
+
+    if (opcodes.data) list_delete(&opcodes);
+    if (lines.data)   list_delete(&lines);
+    return result;
+}
+
+void interop_profile_delete(interop_profile_t *profile) {
+    for (u64 i = 0; i < profile->functions.count; i++) {
+        mem_free(default_allocator, list_get(&profile->functions, i)->hits);
+        mem_free(default_allocator, list_get(&profile->functions, i)->taken);
+    }
+
+    if (profile->functions.data)         list_delete(&profile->functions);
+    if (profile->function_index.entries) hashmap_delete(&profile->function_index);
+    *profile = {};
+}
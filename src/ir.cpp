@@ -8,21 +8,18 @@
 #include "arena.h"
 
 #include "profiler.h"
+#include "sorter.h"
+#include "jobs.h"
 
 #include "strings.h"
 #include "memctl.h"
 
-#define EXPR_CASE(cs, tok) case cs: {\
-            ir_expression_t rhs = compile_expression(state, node->right, shadow);\
-            ir_expression_t lhs = compile_expression(state, node->left,  shadow);\
-            UNUSED(rhs);\
-            expr = lhs;\
-            emit_op(state, tok, node->token, 0);\
-            } break;
+#define EXPR_CASE(cs, tok, ftok, vtok) case cs: expr = compile_binary(state, node, shadow, tok, ftok, vtok); break;
 
 #define EXPR_UN_CASE(cs, tok) case cs: {\
             ir_expression_t lhs = compile_expression(state, node->left,  shadow);\
             expr = lhs;\
+            check_scalar(state, lhs, node->token);\
             emit_op(state, tok, node->token, 0);\
             } break;
 
@@ -31,11 +28,18 @@ struct ir_state_t {
     compiler_t *compiler;
     ir_t ir;
     ir_function_t *current_function;
+    string_t       current_function_name;
     stack_t<ir_opcode_t*> continue_stmt;
     stack_t<ir_opcode_t*> break_stmt;
     stack_t<ast_node_t*>  reverse;
     stack_t<hashmap_t<string_t, scope_entry_t>*> search_scopes;
     list_t<hashmap_t<string_t, scope_entry_t>>   local_scopes;
+
+    // self tail calls of current function, see compile_return
+    b32 tail_calls;
+    u64 tail_entry;     // first parameter store
+    u64 tail_operation; // IR_ADD or IR_MUL of accumulator, IR_NOP without it
+    u64 tail_slot;
 };
 
 // ------ //
@@ -58,6 +62,17 @@ const char* ir_code_to_string(u64 code) {
         case IR_FREE:        return "FREE";
         case IR_LOAD:        return "LOAD";
         case IR_STORE:       return "STORE";
+        case IR_LOAD8S:      return "LOAD8S";
+        case IR_LOAD8U:      return "LOAD8U";
+        case IR_LOAD16S:     return "LOAD16S";
+        case IR_LOAD16U:     return "LOAD16U";
+        case IR_LOAD32S:     return "LOAD32S";
+        case IR_LOAD32U:     return "LOAD32U";
+        case IR_STORE8:      return "STORE8";
+        case IR_STORE16:     return "STORE16";
+        case IR_STORE32:     return "STORE32";
+        case IR_LOADF32:     return "LOADF32";
+        case IR_STOREF32:    return "STOREF32";
         case IR_ADD:         return "ADD";
         case IR_SUB:         return "SUB";
         case IR_MUL:         return "MUL";
@@ -77,11 +92,51 @@ const char* ir_code_to_string(u64 code) {
         case IR_CMP_LTE:     return "CMP_LTE";
         case IR_CMP_GTE:     return "CMP_GTE";
         case IR_LOG_NOT:     return "LOG_NOT";
+        case IR_FADD:        return "FADD";
+        case IR_FSUB:        return "FSUB";
+        case IR_FMUL:        return "FMUL";
+        case IR_FDIV:        return "FDIV";
+        case IR_FNEG:        return "FNEG";
+        case IR_FCMP_EQ:     return "FCMP_EQ";
+        case IR_FCMP_NEQ:    return "FCMP_NEQ";
+        case IR_FCMP_LT:     return "FCMP_LT";
+        case IR_FCMP_GT:     return "FCMP_GT";
+        case IR_FCMP_LTE:    return "FCMP_LTE";
+        case IR_FCMP_GTE:    return "FCMP_GTE";
+        case IR_INT_TO_FLOAT: return "INT_TO_FLOAT";
+        case IR_FLOAT_TO_INT: return "FLOAT_TO_INT";
+        case IR_ROUND_F32:    return "ROUND_F32";
+        case IR_VLOAD:       return "VLOAD";
+        case IR_VSTORE:      return "VSTORE";
+        case IR_VSPLAT:      return "VSPLAT";
+        case IR_VADD:        return "VADD";
+        case IR_VSUB:        return "VSUB";
+        case IR_VMUL:        return "VMUL";
+        case IR_VDIV:        return "VDIV";
+        case IR_VAND:        return "VAND";
+        case IR_VOR:         return "VOR";
+        case IR_VXOR:        return "VXOR";
+        case IR_VCMP_EQ:     return "VCMP_EQ";
+        case IR_VCMP_NEQ:    return "VCMP_NEQ";
+        case IR_VCMP_LT:     return "VCMP_LT";
+        case IR_VCMP_GT:     return "VCMP_GT";
+        case IR_VCMP_LTE:    return "VCMP_LTE";
+        case IR_VCMP_GTE:    return "VCMP_GTE";
+        case IR_MEM_FILL:    return "MEM_FILL";
+        case IR_MEM_COPY:    return "MEM_COPY";
+        case IR_MEM_MOVE:    return "MEM_MOVE";
+        case IR_POPCOUNT:    return "POPCOUNT";
+        case IR_CLZ:         return "CLZ";
+        case IR_CTZ:         return "CTZ";
+        case IR_BSWAP:       return "BSWAP";
+        case IR_ROTL:        return "ROTL";
+        case IR_ROTR:        return "ROTR";
         case IR_JUMP:        return "JUMP";
         case IR_JUMP_IF:     return "JUMP_IF";
         case IR_JUMP_IF_NOT: return "JUMP_IF_NOT";
         case IR_RET:         return "RET";
         case IR_CALL:        return "CALL";
+        case IR_ALIGN:       return "ALIGN";
         case IR_BRK:         return "BRK";
         case IR_INVALID:     return "INVALID";
         default:             return "UNKNOWN_OP";
@@ -94,6 +149,37 @@ void print_ir_opcode(ir_opcode_t op) {
     fprintf(stdout, "[IR] | %-14s | %lld\n", op_name, (long long) op.s_operand);
 }
 
+b32 ir_is_load(u64 operation) {
+    switch (operation) {
+        case IR_LOAD:
+        case IR_LOAD8S:
+        case IR_LOAD8U:
+        case IR_LOAD16S:
+        case IR_LOAD16U:
+        case IR_LOAD32S:
+        case IR_LOAD32U:
+        case IR_LOADF32:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+u64 ir_load_to_store(u64 operation) {
+    switch (operation) {
+        case IR_LOAD:    return IR_STORE;
+        case IR_LOAD8S:  return IR_STORE8;
+        case IR_LOAD8U:  return IR_STORE8;
+        case IR_LOAD16S: return IR_STORE16;
+        case IR_LOAD16U: return IR_STORE16;
+        case IR_LOAD32S: return IR_STORE32;
+        case IR_LOAD32U: return IR_STORE32;
+        case IR_LOADF32: return IR_STOREF32;
+        default:         return IR_INVALID;
+    }
+}
+
 string_t get_ir_opcode_info(ir_opcode_t op) {
     const char* op_name = ir_code_to_string(op.operation);
     
@@ -139,7 +225,7 @@ ir_opcode_t *emit_op(ir_state_t *state, u64 op, token_t debug, string_t data) {
 
 // ------ // 
 
-u64 compile_statement(ir_state_t *state, ast_node_t *node, u64 alloc_count);
+void compile_statement(ir_state_t *state, ast_node_t *node);
 
 scope_entry_t *search_identifier(ir_state_t *state, string_t key, string_t shadow) {
     b32 shadowed = false;
@@ -196,6 +282,635 @@ struct ir_expression_t {
     stack_t<hashmap_t<string_t, scope_entry_t>*> search_info;
 };
 
+// memory behind pointers and arrays is packed by the element type,
+// named variables still take one 8 byte slot each, vectors 2 or 4
+u64 get_type_size(type_info_t type) {
+    if (type.pointer_depth > 0) return 8;
+    if (type.lanes > 0)         return type.size;
+
+    switch (type.type) {
+        case TYPE_u8:  case TYPE_s8:  case TYPE_b8:  return 1;
+        case TYPE_u16: case TYPE_s16:                return 2;
+        case TYPE_u32: case TYPE_s32: case TYPE_b32: return 4;
+        case TYPE_f32:                               return 4;
+        default: return 8;
+    }
+}
+
+u64 get_load_op(type_info_t type) {
+    if (type.pointer_depth > 0) return IR_LOAD;
+
+    switch (type.type) {
+        case TYPE_s8:  return IR_LOAD8S;
+        case TYPE_u8:  return IR_LOAD8U;
+        case TYPE_b8:  return IR_LOAD8U;
+        case TYPE_s16: return IR_LOAD16S;
+        case TYPE_u16: return IR_LOAD16U;
+        case TYPE_s32: return IR_LOAD32S;
+        case TYPE_u32: return IR_LOAD32U;
+        case TYPE_b32: return IR_LOAD32U;
+        case TYPE_f32: return IR_LOADF32;
+        default:       return IR_LOAD;
+    }
+}
+
+// arguments of comptime calls, only literals and arithmetic on them
+b32 fold_constant(ast_node_t *node, s64 *output) {
+    s64 lhs = 0, rhs = 0;
+
+    switch (node->type) {
+        case AST_PRIMARY: switch (node->token.type) {
+            case TOKEN_CONST_INT: *output = (s64)node->token.data.const_int; return true;
+            case TOK_TRUE:        *output = 1; return true;
+            case TOK_FALSE:       *output = 0; return true;
+            default:              return false;
+        }
+
+        case AST_UNARY_NEGATE: if (!fold_constant(node->left, &lhs)) return false; *output = -lhs; return true;
+        case AST_UNARY_INVERT: if (!fold_constant(node->left, &lhs)) return false; *output = ~lhs; return true;
+        case AST_UNARY_NOT:    if (!fold_constant(node->left, &lhs)) return false; *output = !lhs; return true;
+
+        case AST_BIN_CAST: return fold_constant(node->right, output);
+
+        default: break;
+    }
+
+    if (node->left == NULL || node->right == NULL)  return false;
+    if (!fold_constant(node->left,  &lhs))          return false;
+    if (!fold_constant(node->right, &rhs))          return false;
+
+    switch (node->type) {
+        case AST_BIN_ADD:        *output = lhs + rhs;  return true;
+        case AST_BIN_SUB:        *output = lhs - rhs;  return true;
+        case AST_BIN_MUL:        *output = lhs * rhs;  return true;
+        case AST_BIN_DIV:        if (rhs == 0) return false; *output = lhs / rhs; return true;
+        case AST_BIN_MOD:        if (rhs == 0) return false; *output = lhs % rhs; return true;
+        case AST_BIN_BIT_XOR:    *output = lhs ^ rhs;  return true;
+        case AST_BIN_BIT_OR:     *output = lhs | rhs;  return true;
+        case AST_BIN_BIT_AND:    *output = lhs & rhs;  return true;
+        case AST_BIN_BIT_LSHIFT: *output = lhs << rhs; return true;
+        case AST_BIN_BIT_RSHIFT: *output = lhs >> rhs; return true;
+        case AST_BIN_GR:         *output = lhs >  rhs; return true;
+        case AST_BIN_LS:         *output = lhs <  rhs; return true;
+        case AST_BIN_GEQ:        *output = lhs >= rhs; return true;
+        case AST_BIN_LEQ:        *output = lhs <= rhs; return true;
+        case AST_BIN_EQ:         *output = lhs == rhs; return true;
+        case AST_BIN_NEQ:        *output = lhs != rhs; return true;
+        case AST_BIN_LOG_OR:     *output = lhs || rhs; return true;
+        case AST_BIN_LOG_AND:    *output = lhs && rhs; return true;
+        default:                 return false;
+    }
+}
+
+void compile_comptime_call(ir_state_t *state, ast_node_t *node, ir_expression_t *expr) {
+    ast_node_t *call = node->left;
+    scope_entry_t *entry = search_identifier(state, call->left->token.data.string, {});
+
+    if (entry->type != ENTRY_FUNC || entry->is_external) {
+        log_error_token("comptime can only call functions defined in program", call->left->token);
+        state->ir.is_valid = false;
+        return;
+    }
+
+    if (entry->return_typenames.count != 1) {
+        log_error_token("comptime function should return exactly one value", call->left->token);
+        state->ir.is_valid = false;
+        return;
+    }
+
+    ir_comptime_call_t pending = {};
+    pending.function = state->current_function_name;
+    pending.callee   = call->left->token.data.string;
+
+    //                     def -> type -> params
+    u64 param_count = entry->node->left->left->child_count;
+
+    ast_node_t *args = call->right;
+    ast_node_t *next = args;
+    u64 arg_count = 1;
+
+    if (args->type == AST_EMPTY) {
+        arg_count = 0;
+    } else if (args->type == AST_SEPARATION) {
+        arg_count = args->child_count;
+        next      = args->list_start;
+    }
+
+    if (arg_count != param_count) {
+        log_error_token("Wrong amount of arguments in comptime call", call->token);
+        state->ir.is_valid = false;
+        return;
+    }
+
+    for (u64 i = 0; i < arg_count; i++) {
+        if (!fold_constant(next, &pending.args[i])) {
+            log_error_token("Arguments of comptime call should be constant", next->token);
+            state->ir.is_valid = false;
+            return;
+        }
+
+        next = next->list_next;
+    }
+
+    pending.arg_count = arg_count;
+    pending.op        = emit_op(state, IR_PUSH_SIGN, node->token, 0);
+
+    list_add(&state->ir.comptime_calls, &pending);
+
+    expr->type = entry->return_typenames[0];
+}
+
+// ------ vectors
+
+// lanes of vectors and elements of intrinsics, pointers are u64
+static u64 get_lane(type_info_t type) {
+    if (type.pointer_depth > 0) return IR_LANE_U64;
+
+    switch (type.type) {
+        case TYPE_u8:  case TYPE_b8:  return IR_LANE_U8;
+        case TYPE_s8:                 return IR_LANE_S8;
+        case TYPE_u16:                return IR_LANE_U16;
+        case TYPE_s16:                return IR_LANE_S16;
+        case TYPE_u32: case TYPE_b32: return IR_LANE_U32;
+        case TYPE_s32:                return IR_LANE_S32;
+        case TYPE_s64:                return IR_LANE_S64;
+        case TYPE_f32:                return IR_LANE_F32;
+        case TYPE_f64:                return IR_LANE_F64;
+        default:                      return IR_LANE_U64;
+    }
+}
+
+static u64 get_vector_operand(type_info_t type) {
+    return IR_VECTOR(get_lane(type), type.size);
+}
+
+static type_info_t get_lane_type(type_info_t type) {
+    type.size /= type.lanes;
+    type.lanes = 0;
+    return type;
+}
+
+static b32 same_vector_type(type_info_t lhs, type_info_t rhs) {
+    return is_vector_info(lhs) && is_vector_info(rhs) && lhs.type == rhs.type && lhs.size == rhs.size;
+}
+
+static void check_scalar(ir_state_t *state, ir_expression_t expr, token_t token) {
+    if (!is_vector_info(expr.type)) return;
+
+    log_error_token("Operator can't be used with vectors", token);
+    state->ir.is_valid = false;
+}
+
+static ir_opcode_t *emit_load(ir_state_t *state, type_info_t type, token_t token) {
+    if (is_vector_info(type)) {
+        return emit_op(state, IR_VLOAD, token, get_vector_operand(type));
+    }
+
+    return emit_op(state, get_load_op(type), token, 0);
+}
+
+// ------ floating point
+
+// f32 and f64 are both f64 on the exec stack and in 8 byte slots of named
+// variables, f32 is rounded whenever a value is converted to it, so slots
+// hold the same value as memory behind pointers and arrays
+static inline b32 is_float_type(type_info_t type) {
+    return type.pointer_depth == 0 && !type.is_array && (type.type == TYPE_f32 || type.type == TYPE_f64);
+}
+
+static type_info_t get_node_type(ast_node_t *node) {
+    type_info_t type = {};
+
+    while (node->type == AST_PTR_TYPE) {
+        type.pointer_depth++;
+        node = node->left;
+    }
+
+    if (node->type == AST_STD_TYPE || node->type == AST_VOID_TYPE) {
+        set_std_info(node->token.type, &type);
+    } else {
+        type.type_name = node->token.data.string;
+    }
+
+    return type;
+}
+
+static type_info_t get_call_type(ir_state_t *state, ast_node_t *call) {
+    type_info_t type = {};
+
+    if (call->left->type != AST_PRIMARY || call->left->token.type != TOKEN_IDENT) return type;
+
+    scope_entry_t *entry = search_identifier(state, call->left->token.data.string, {});
+
+    if (entry->type == ENTRY_FUNC && entry->return_typenames.count > 0) {
+        type = entry->return_typenames[0];
+    }
+
+    return type;
+}
+
+// same rule as in analyzer, declarations of the same name win over intrinsics
+static u64 get_intrinsic_call(ir_state_t *state, ast_node_t *node) {
+    if (node->type != AST_FUNC_CALL || node->left->type != AST_PRIMARY || node->left->token.type != TOKEN_IDENT) return INTRINSIC_NONE;
+
+    string_t name      = node->left->token.data.string;
+    u64      intrinsic = get_intrinsic(name);
+
+    if (intrinsic == INTRINSIC_NONE) return INTRINSIC_NONE;
+
+    for (u64 i = 0; i < state->search_scopes.index; i++) {
+        if (hashmap_contains(state->search_scopes.data[i], name)) return INTRINSIC_NONE;
+    }
+
+    return intrinsic;
+}
+
+// type of expression without compiling it, operands of binary operations are
+// compiled right to left, so left one has to be known to convert right one
+static type_info_t get_expression_type(ir_state_t *state, ast_node_t *node, string_t shadow) {
+    type_info_t type = {};
+
+    switch (node->type) {
+        case AST_PRIMARY: switch (node->token.type) {
+            case TOKEN_CONST_FP:  set_std_info(TOK_F64, &type);    break;
+            case TOKEN_CONST_INT: set_std_info(TOK_U64, &type);    break;
+            case TOK_TRUE:
+            case TOK_FALSE:       set_std_info(TOK_BOOL32, &type); break;
+            case TOKEN_IDENT:     type = search_identifier(state, node->token.data.string, shadow)->info; break;
+        } break;
+
+        case AST_UNARY_NEGATE:
+        case AST_UNARY_INVERT:
+        case AST_BIN_ASSIGN:
+            return get_expression_type(state, node->left, shadow);
+
+        case AST_UNARY_REF:
+            type = get_expression_type(state, node->left, shadow);
+            type.pointer_depth++;
+            break;
+
+        case AST_UNARY_DEREF:
+            type = get_expression_type(state, node->left, shadow);
+            if (type.pointer_depth) type.pointer_depth--;
+            break;
+
+        case AST_ARRAY_ACCESS:
+            type = get_expression_type(state, node->left, shadow);
+
+            if (is_vector_info(type))                          type = get_lane_type(type);
+            else if (type.is_array || type.pointer_depth == 0) type.is_array = false;
+            else                                               type.pointer_depth--;
+            break;
+
+        case AST_BIN_CAST:
+            return get_node_type(node->left);
+
+        case AST_FUNC_CALL:
+            // counts are s64, bit operations keep type of the value, memory ones give nothing
+            switch (get_intrinsic_call(state, node)) {
+                case INTRINSIC_NONE:
+                    return get_call_type(state, node);
+
+                case INTRINSIC_POPCOUNT:
+                case INTRINSIC_CLZ:
+                case INTRINSIC_CTZ:
+                    set_std_info(TOK_S64, &type);
+                    break;
+
+                case INTRINSIC_BSWAP:
+                case INTRINSIC_ROTL:
+                case INTRINSIC_ROTR:
+                    return get_expression_type(state, node->right->type == AST_SEPARATION ? node->right->list_start : node->right, shadow);
+            }
+            break;
+        case AST_UNARY_COMPTIME:
+            return get_call_type(state, node->left);
+
+        case AST_BIN_ADD:
+        case AST_BIN_SUB:
+        case AST_BIN_MUL:
+        case AST_BIN_DIV:
+        case AST_BIN_MOD:
+        case AST_BIN_BIT_AND:
+        case AST_BIN_BIT_OR:
+        case AST_BIN_BIT_XOR: {
+            type_info_t rhs = get_expression_type(state, node->right, shadow);
+            type = get_expression_type(state, node->left, shadow);
+
+            if (is_vector_info(type)) break;
+            if (is_vector_info(rhs) || (is_float_type(rhs) && !is_float_type(type))) type = rhs;
+        } break;
+
+        // vector comparisons give masks of the same type
+        case AST_BIN_GR:
+        case AST_BIN_LS:
+        case AST_BIN_GEQ:
+        case AST_BIN_LEQ:
+        case AST_BIN_EQ:
+        case AST_BIN_NEQ: {
+            type_info_t rhs = get_expression_type(state, node->right, shadow);
+            type = get_expression_type(state, node->left, shadow);
+
+            if (is_vector_info(type)) break;
+            if (is_vector_info(rhs))  return rhs;
+
+            type = {};
+            set_std_info(TOK_BOOL32, &type);
+        } break;
+
+        case AST_BIN_LOG_OR:
+        case AST_BIN_LOG_AND:
+        case AST_UNARY_NOT:
+            set_std_info(TOK_BOOL32, &type);
+            break;
+
+        default:
+            if (node->left) return get_expression_type(state, node->left, shadow);
+            break;
+    }
+
+    return type;
+}
+
+// value on top of the stack goes from one type to the other,
+// only float <-> integer changes the bits, scalars are splatted to vectors
+static void convert_value(ir_state_t *state, token_t token, type_info_t from, type_info_t to) {
+    if (is_vector_info(from) || is_vector_info(to)) {
+        if (is_vector_info(from) && is_vector_info(to)) {
+            if (same_vector_type(from, to)) return;
+
+            log_error_token("Vectors of different types, use cast to reinterpret one.", token);
+            state->ir.is_valid = false;
+        } else if (is_vector_info(from)) {
+            log_error_token("Vector can't be used as a scalar value.", token);
+            state->ir.is_valid = false;
+        } else {
+            convert_value(state, token, from, get_lane_type(to));
+            emit_op(state, IR_VSPLAT, token, get_vector_operand(to));
+        }
+
+        return;
+    }
+
+    if (is_float_type(to) && !is_float_type(from)) {
+        emit_op(state, IR_INT_TO_FLOAT, token, 0);
+    } else if (!is_float_type(to) && is_float_type(from) && to.type != TYPE_UNKN) {
+        emit_op(state, IR_FLOAT_TO_INT, token, 0);
+    }
+
+    if (is_float_type(to) && to.type == TYPE_f32) {
+        emit_op(state, IR_ROUND_F32, token, 0);
+    }
+}
+
+ir_expression_t compile_expression(ir_state_t *state, ast_node_t *node, string_t shadow);
+
+// lane-wise a op b, scalar side is splatted, rhs is already on the stack
+static ir_expression_t compile_vector_binary(ir_state_t *state, ast_node_t *node, string_t shadow, ir_expression_t rhs, type_info_t lhs_type, u64 operation) {
+    type_info_t type = is_vector_info(lhs_type) ? lhs_type : rhs.type;
+
+    convert_value(state, node->token, rhs.type, type);
+
+    ir_expression_t lhs = compile_expression(state, node->left, shadow);
+    convert_value(state, node->token, lhs.type, type);
+
+    ir_expression_t expr = {};
+    expr.type = type;
+
+    u64 lane = IR_VECTOR_LANE(get_vector_operand(type));
+    b32 is_float = lane == IR_LANE_F32 || lane == IR_LANE_F64;
+
+    if (operation == IR_INVALID) {
+        log_error_token("Operator can't be used with vectors", node->token);
+        state->ir.is_valid = false;
+    } else if (operation == IR_VDIV && !is_float) {
+        log_error_token("Only vectors of floats can be divided", node->token);
+        state->ir.is_valid = false;
+    } else if (operation == IR_VMUL && !is_float && lane != IR_LANE_U16 && lane != IR_LANE_S16 && lane != IR_LANE_U32 && lane != IR_LANE_S32) {
+        log_error_token("Vectors of integers can be multiplied only with 16 or 32 bit lanes", node->token);
+        state->ir.is_valid = false;
+    }
+
+    emit_op(state, operation, node->token, get_vector_operand(type));
+    return expr;
+}
+
+// a op b, a is compiled last and ends up on top. When one side is float
+// the other one is converted and float_operation is used instead
+static ir_expression_t compile_binary(ir_state_t *state, ast_node_t *node, string_t shadow, u64 operation, u64 float_operation, u64 vector_operation) {
+    ir_expression_t rhs      = compile_expression(state, node->right, shadow);
+    type_info_t     lhs_type = get_expression_type(state, node->left, shadow);
+
+    if (is_vector_info(lhs_type) || is_vector_info(rhs.type)) {
+        return compile_vector_binary(state, node, shadow, rhs, lhs_type, vector_operation);
+    }
+
+    b32 is_float = is_float_type(lhs_type) || is_float_type(rhs.type);
+
+    if (is_float && float_operation == IR_INVALID) {
+        log_error_token("Operator can't be used with floating point values", node->token);
+        state->ir.is_valid = false;
+    }
+
+    type_info_t f64_type = {};
+    set_std_info(TOK_F64, &f64_type);
+
+    if (is_float) convert_value(state, node->token, rhs.type, f64_type);
+
+    ir_expression_t lhs = compile_expression(state, node->left, shadow);
+    ir_expression_t expr = lhs;
+
+    if (!is_float) {
+        emit_op(state, operation, node->token, 0);
+        return expr;
+    }
+
+    convert_value(state, node->token, lhs.type, f64_type);
+    emit_op(state, float_operation, node->token, 0);
+
+    expr.accessable = false;
+    expr.type       = is_float_type(lhs.type) ? lhs.type : rhs.type;
+
+    if (float_operation >= IR_FCMP_EQ && float_operation <= IR_FCMP_GTE) {
+        expr.type = {};
+        set_std_info(TOK_BOOL32, &expr.type);
+    }
+
+    return expr;
+}
+
+// arguments are pushed last to first, each converted to type of its parameter
+static void compile_arguments(ir_state_t *state, ast_node_t *call, string_t shadow) {
+    ast_node_t    *args   = call->right;
+    scope_entry_t *callee = NULL;
+
+    if (call->left->type == AST_PRIMARY && call->left->token.type == TOKEN_IDENT) {
+        callee = search_identifier(state, call->left->token.data.string, {});
+    }
+
+    u64 count = args->type == AST_SEPARATION ? args->child_count : 1;
+
+    if (callee == NULL || callee->type != ENTRY_FUNC || args->type == AST_EMPTY || count > MAX_COUNT_OF_PARAMS
+            || count != callee->node->left->left->child_count) {
+        compile_expression(state, args, shadow);
+        return;
+    }
+
+    ast_node_t  *nodes[MAX_COUNT_OF_PARAMS] = {};
+    type_info_t  types[MAX_COUNT_OF_PARAMS] = {};
+
+    //                       def -> type -> params
+    ast_node_t *param = callee->node->left->left->list_start;
+    ast_node_t *next  = args->type == AST_SEPARATION ? args->list_start : args;
+
+    for (u64 i = 0; i < count; i++) {
+        nodes[i] = next;
+        types[i] = hashmap_get(&callee->func_params, param->token.data.string)->info;
+
+        next  = next->list_next;
+        param = param->list_next;
+    }
+
+    for (u64 i = count; i > 0; i--) {
+        ir_expression_t value = compile_expression(state, nodes[i - 1], shadow);
+        convert_value(state, nodes[i - 1]->token, value.type, types[i - 1]);
+    }
+}
+
+// ------ intrinsics
+
+// element type behind pointer argument, arrays behind it are their elements
+static b32 get_pointee(ir_state_t *state, type_info_t type, token_t token, type_info_t *element) {
+    if (type.pointer_depth == 0) {
+        log_error_token("Intrinsic expects a pointer", token);
+        state->ir.is_valid = false;
+        return false;
+    }
+
+    *element = type;
+    element->pointer_depth--;
+    element->is_array = false;
+
+    if (element->pointer_depth == 0 && (element->type == TYPE_void || element->type == TYPE_UNKN) && element->lanes == 0) {
+        log_error_token("Intrinsic can't access elements of this type, cast the pointer", token);
+        state->ir.is_valid = false;
+        return false;
+    }
+
+    return true;
+}
+
+static b32 same_element_type(type_info_t lhs, type_info_t rhs) {
+    return lhs.type == rhs.type && lhs.pointer_depth == rhs.pointer_depth && lhs.lanes == rhs.lanes && lhs.size == rhs.size;
+}
+
+// arguments are compiled last to first, like the ones of calls, so address ends up on top
+static ir_expression_t compile_intrinsic(ir_state_t *state, ast_node_t *node, u64 intrinsic, string_t shadow) {
+    ir_expression_t expr  = {};
+    token_t         token = node->left->token;
+
+    ast_node_t *args[MAX_COUNT_OF_PARAMS] = {};
+    ast_node_t *next  = node->right->type == AST_SEPARATION ? node->right->list_start : node->right;
+    u64         count = node->right->type == AST_SEPARATION ? node->right->child_count : node->right->type == AST_EMPTY ? 0 : 1;
+
+    // analyzer reports wrong amount of arguments
+    if (count != get_intrinsic_params(intrinsic)) {
+        state->ir.is_valid = false;
+        return expr;
+    }
+
+    for (u64 i = 0; i < count; i++) {
+        args[i] = next;
+        next    = next->list_next;
+    }
+
+    type_info_t s64_type = {};
+    set_std_info(TOK_S64, &s64_type);
+
+    expr.type       = get_expression_type(state, node, shadow);
+    expr.accessable = false;
+
+    switch (intrinsic) {
+        case INTRINSIC_MEM_FILL: {
+            type_info_t element = {};
+            if (!get_pointee(state, get_expression_type(state, args[0], shadow), args[0]->token, &element)) break;
+
+            if (is_vector_info(element)) {
+                log_error_token("mem_fill can't fill vectors, use mem_copy", token);
+                state->ir.is_valid = false;
+                break;
+            }
+
+            ir_expression_t amount = compile_expression(state, args[2], shadow);
+            convert_value(state, args[2]->token, amount.type, s64_type);
+
+            ir_expression_t value = compile_expression(state, args[1], shadow);
+            convert_value(state, args[1]->token, value.type, element);
+
+            compile_expression(state, args[0], shadow);
+            emit_op(state, IR_MEM_FILL, token, get_lane(element));
+        } break;
+
+        case INTRINSIC_MEM_COPY:
+        case INTRINSIC_MEM_MOVE: {
+            type_info_t destination = {}, source = {};
+            if (!get_pointee(state, get_expression_type(state, args[0], shadow), args[0]->token, &destination)) break;
+            if (!get_pointee(state, get_expression_type(state, args[1], shadow), args[1]->token, &source))      break;
+
+            if (!same_element_type(destination, source)) {
+                log_error_token("Pointers of different types, cast one of them", token);
+                state->ir.is_valid = false;
+                break;
+            }
+
+            ir_expression_t amount = compile_expression(state, args[2], shadow);
+            convert_value(state, args[2]->token, amount.type, s64_type);
+
+            u64 size = get_type_size(destination);
+
+            if (size != 1) {
+                emit_op(state, IR_PUSH_UNSIGN, token, size);
+                emit_op(state, IR_MUL,         token, 0);
+            }
+
+            compile_expression(state, args[1], shadow);
+            compile_expression(state, args[0], shadow);
+            emit_op(state, intrinsic == INTRINSIC_MEM_COPY ? IR_MEM_COPY : IR_MEM_MOVE, token, 0);
+        } break;
+
+        default: {
+            type_info_t type = get_expression_type(state, args[0], shadow);
+
+            if (is_vector_info(type) || is_float_type(type) || type.pointer_depth > 0 || type.is_array || type.type == TYPE_UNKN || type.type == TYPE_void) {
+                log_error_token("Bit intrinsics take integer values", args[0]->token);
+                state->ir.is_valid = false;
+                break;
+            }
+
+            if (intrinsic == INTRINSIC_ROTL || intrinsic == INTRINSIC_ROTR) {
+                ir_expression_t amount = compile_expression(state, args[1], shadow);
+                convert_value(state, args[1]->token, amount.type, s64_type);
+            }
+
+            compile_expression(state, args[0], shadow);
+
+            u64 operation = IR_POPCOUNT;
+
+            switch (intrinsic) {
+                case INTRINSIC_CLZ:   operation = IR_CLZ;   break;
+                case INTRINSIC_CTZ:   operation = IR_CTZ;   break;
+                case INTRINSIC_BSWAP: operation = IR_BSWAP; break;
+                case INTRINSIC_ROTL:  operation = IR_ROTL;  break;
+                case INTRINSIC_ROTR:  operation = IR_ROTR;  break;
+            }
+
+            emit_op(state, operation, token, get_lane(type));
+        } break;
+    }
+
+    return expr;
+}
+
 ir_expression_t compile_expression(ir_state_t *state, ast_node_t *node, string_t shadow) {
     assert(state->current_function != NULL);
     UNUSED(state);
@@ -204,32 +919,67 @@ ir_expression_t compile_expression(ir_state_t *state, ast_node_t *node, string_t
     ir_expression_t expr = {};
 
     switch (node->type) {
-        EXPR_UN_CASE(AST_UNARY_INVERT, IR_BIT_NOT);
-        EXPR_UN_CASE(AST_UNARY_NEGATE, IR_NEG);
-        EXPR_UN_CASE(AST_UNARY_NOT,    IR_LOG_NOT);
-
-        EXPR_CASE(AST_BIN_GR,  IR_CMP_GT);
-        EXPR_CASE(AST_BIN_LS,  IR_CMP_LT);
-        EXPR_CASE(AST_BIN_GEQ, IR_CMP_GTE);
-        EXPR_CASE(AST_BIN_LEQ, IR_CMP_LTE);
-        EXPR_CASE(AST_BIN_EQ,  IR_CMP_EQ);
-        EXPR_CASE(AST_BIN_NEQ, IR_CMP_NEQ);
-        EXPR_CASE(AST_BIN_ADD, IR_ADD);
-        EXPR_CASE(AST_BIN_SUB, IR_SUB);
-        EXPR_CASE(AST_BIN_MUL, IR_MUL);
-        EXPR_CASE(AST_BIN_DIV, IR_DIV);
-        EXPR_CASE(AST_BIN_MOD, IR_MOD);
-        EXPR_CASE(AST_BIN_BIT_XOR, IR_BIT_XOR);
-        EXPR_CASE(AST_BIN_BIT_OR,  IR_BIT_OR);
-        EXPR_CASE(AST_BIN_BIT_AND, IR_BIT_AND);
-        EXPR_CASE(AST_BIN_BIT_LSHIFT, IR_SHIFT_LEFT);
-        EXPR_CASE(AST_BIN_BIT_RSHIFT, IR_SHIFT_RIGHT);
+        EXPR_UN_CASE(AST_UNARY_NOT, IR_LOG_NOT);
+
+        EXPR_CASE(AST_BIN_GR,  IR_CMP_GT,  IR_FCMP_GT,  IR_VCMP_GT);
+        EXPR_CASE(AST_BIN_LS,  IR_CMP_LT,  IR_FCMP_LT,  IR_VCMP_LT);
+        EXPR_CASE(AST_BIN_GEQ, IR_CMP_GTE, IR_FCMP_GTE, IR_VCMP_GTE);
+        EXPR_CASE(AST_BIN_LEQ, IR_CMP_LTE, IR_FCMP_LTE, IR_VCMP_LTE);
+        EXPR_CASE(AST_BIN_EQ,  IR_CMP_EQ,  IR_FCMP_EQ,  IR_VCMP_EQ);
+        EXPR_CASE(AST_BIN_NEQ, IR_CMP_NEQ, IR_FCMP_NEQ, IR_VCMP_NEQ);
+        EXPR_CASE(AST_BIN_ADD, IR_ADD, IR_FADD, IR_VADD);
+        EXPR_CASE(AST_BIN_SUB, IR_SUB, IR_FSUB, IR_VSUB);
+        EXPR_CASE(AST_BIN_MUL, IR_MUL, IR_FMUL, IR_VMUL);
+        EXPR_CASE(AST_BIN_DIV, IR_DIV, IR_FDIV, IR_VDIV);
+        EXPR_CASE(AST_BIN_MOD, IR_MOD, IR_INVALID, IR_INVALID);
+        EXPR_CASE(AST_BIN_BIT_XOR, IR_BIT_XOR, IR_INVALID, IR_VXOR);
+        EXPR_CASE(AST_BIN_BIT_OR,  IR_BIT_OR,  IR_INVALID, IR_VOR);
+        EXPR_CASE(AST_BIN_BIT_AND, IR_BIT_AND, IR_INVALID, IR_VAND);
+        EXPR_CASE(AST_BIN_BIT_LSHIFT, IR_SHIFT_LEFT,  IR_INVALID, IR_INVALID);
+        EXPR_CASE(AST_BIN_BIT_RSHIFT, IR_SHIFT_RIGHT, IR_INVALID, IR_INVALID);
+
+        // vectors: 0 - v for integers, sign bit flipped for floats
+        case AST_UNARY_NEGATE:
+            expr = compile_expression(state, node->left, shadow);
+
+            if (is_vector_info(expr.type)) {
+                u64 vector = get_vector_operand(expr.type);
+                u64 lane   = IR_VECTOR_LANE(vector);
+
+                if (lane == IR_LANE_F32 || lane == IR_LANE_F64) {
+                    emit_op(state, IR_PUSH_UNSIGN, node->token, 0)->f_operand = -0.0;
+                    emit_op(state, IR_VSPLAT,      node->token, vector);
+                    emit_op(state, IR_VXOR,        node->token, vector);
+                } else {
+                    emit_op(state, IR_PUSH_SIGN, node->token, 0);
+                    emit_op(state, IR_VSPLAT,    node->token, vector);
+                    emit_op(state, IR_VSUB,      node->token, vector);
+                }
+
+                expr.accessable = false;
+            } else {
+                emit_op(state, is_float_type(expr.type) ? IR_FNEG : IR_NEG, node->token, 0);
+            }
+            break;
+
+        case AST_UNARY_INVERT:
+            expr = compile_expression(state, node->left, shadow);
+
+            if (is_vector_info(expr.type)) {
+                emit_op(state, IR_PUSH_SIGN, node->token, -1, 0);
+                emit_op(state, IR_VSPLAT,    node->token, get_vector_operand(expr.type));
+                emit_op(state, IR_VXOR,      node->token, get_vector_operand(expr.type));
+                expr.accessable = false;
+            } else {
+                emit_op(state, IR_BIT_NOT, node->token, 0);
+            }
+            break;
 
         case AST_PRIMARY: switch (node->token.type)
             {
                 case TOKEN_CONST_FP:
-                    log_error("AST_PRIMARY:TOKEN_IDENT compilation TODO");
-                    emit_op(state, IR_INVALID, node->token, 0);
+                    emit_op(state, IR_PUSH_UNSIGN, node->token, 0)->f_operand = node->token.data.const_double;
+                    set_std_info(TOK_F64, &expr.type);
                     break;
                 case TOKEN_CONST_INT:
                     emit_op(state, IR_PUSH_SIGN, node->token, (s64)node->token.data.const_int);
@@ -254,6 +1004,12 @@ ir_expression_t compile_expression(ir_state_t *state, ast_node_t *node, string_t
                         expr.accessable = true;
                         expr.offset     = entry->offset;
 
+                        if (is_vector_info(entry->info)) {
+                            emit_op(state, entry->on_stack ? IR_PUSH_SEA : IR_PUSH_GEA, node->token, expr.offset)->string = node->token.data.string;
+                            expr.emmited_op = emit_load(state, entry->info, node->token);
+                            break;
+                        }
+
                         if (entry->on_stack) {
                             expr.emmited_op = emit_op(state, IR_PUSH_STACK,  node->token, expr.offset);
                         } else {
@@ -287,8 +1043,9 @@ ir_expression_t compile_expression(ir_state_t *state, ast_node_t *node, string_t
                     expr.emmited_op->operation = IR_PUSH_GEA;
                 } else if (expr.emmited_op->operation == IR_PUSH_STACK) {
                     expr.emmited_op->operation = IR_PUSH_SEA;
-                } else if (expr.emmited_op->operation == IR_LOAD) {
+                } else if (ir_is_load(expr.emmited_op->operation) || expr.emmited_op->operation == IR_VLOAD) {
                     expr.emmited_op->operation = IR_NOP;
+                    expr.emmited_op->u_operand = 0;
                 } else {
                     expr.emmited_op->operation = IR_INVALID;
                 }
@@ -300,11 +1057,16 @@ ir_expression_t compile_expression(ir_state_t *state, ast_node_t *node, string_t
         case AST_UNARY_DEREF: {
             ir_expression_t value = compile_expression(state, node->left, shadow);
 
+            expr.type = value.type;
+
             if (value.type.pointer_depth == 0) {
                 log_warning_token("Trying to dereference non-pointer variable.", node->left->token);
+                expr.type = {};
+            } else {
+                expr.type.pointer_depth--;
             }
 
-            expr.emmited_op = emit_op(state, IR_LOAD, node->token, 0);
+            expr.emmited_op = emit_load(state, expr.type, node->token);
             expr.accessable = true;
         } break;
 
@@ -312,6 +1074,7 @@ ir_expression_t compile_expression(ir_state_t *state, ast_node_t *node, string_t
         case AST_BIN_LOG_OR: 
         {
             expr = compile_expression(state, node->left,  shadow);
+            check_scalar(state, expr, node->token);
 
             emit_op(state, IR_CLONE, node->token, 0);
             ir_opcode_t *end = emit_op(state, IR_JUMP_IF, node->token, 0);
@@ -324,6 +1087,7 @@ ir_expression_t compile_expression(ir_state_t *state, ast_node_t *node, string_t
         case AST_BIN_LOG_AND:
         {
             expr = compile_expression(state, node->left,  shadow);
+            check_scalar(state, expr, node->token);
 
             emit_op(state, IR_CLONE, node->token, 0);
             ir_opcode_t *end = emit_op(state, IR_JUMP_IF_NOT, node->token, 0);
@@ -334,20 +1098,42 @@ ir_expression_t compile_expression(ir_state_t *state, ast_node_t *node, string_t
             end->s_operand = state->current_function->code.count - 1 - end->index;
         } break;
 
-        case AST_BIN_CAST:
-            // @todo
-            //
-            // log_error("AST_BIN_CAST compilation TODO");
-            expr = compile_expression(state, node->right, shadow);
-            // compile_expression(state, node->left);
-            // emit_op(state, IR_INVALID, node->token, 0);
+        case AST_BIN_CAST: {
+            ir_expression_t value = compile_expression(state, node->right, shadow);
+
+            expr.type = get_node_type(node->left);
+
+            // vectors of the same size keep their bits
+            if (is_vector_info(value.type) && is_vector_info(expr.type)) {
+                if (value.type.size != expr.type.size) {
+                    log_error_token("Cant cast vectors of different sizes", node->token);
+                    state->ir.is_valid = false;
+                }
+                break;
+            }
+
+            convert_value(state, node->token, value.type, expr.type);
+        } break;
+
+        case AST_UNARY_COMPTIME:
+            compile_comptime_call(state, node, &expr);
             break;
 
-        case AST_FUNC_CALL:
-            compile_expression(state, node->right, shadow);
+        case AST_FUNC_CALL: {
+            u64 intrinsic = get_intrinsic_call(state, node);
+
+            if (intrinsic != INTRINSIC_NONE) {
+                expr = compile_intrinsic(state, node, intrinsic, shadow);
+                break;
+            }
+
+            compile_arguments(state, node, shadow);
             expr = compile_expression(state, node->left, shadow);
             expr.emmited_op->operation = IR_CALL;
-            break;
+
+            expr.type       = get_call_type(state, node);
+            expr.accessable = false;
+        } break;
 
         case AST_MEMBER_ACCESS:
             log_error("Structs TODO:");
@@ -388,41 +1174,56 @@ ir_expression_t compile_expression(ir_state_t *state, ast_node_t *node, string_t
             break;
 
         case AST_ARRAY_ACCESS: // @todo finish
-
-            // loading offset
-            compile_expression(state, node->right, shadow);
-            // @todo arithmetics based on type
-            
-            // multiply by * because we are using type s64 everywhere (and it breaks interop rn) 
-            emit_op(state, IR_PUSH_SIGN, node->left->token, 8);
-            emit_op(state, IR_MUL, node->left->token, 0);
-
+        {
             // get base address
             expr = compile_expression(state, node->left, shadow);
 
+            type_info_t element = expr.type;
+
             if (!expr.accessable) {
                 log_error_token("Cant get address of unknown variable", node->left->token);
                 state->ir.is_valid = false;
-            } else {
-                if (expr.type.pointer_depth == 0) {
-                    if (expr.emmited_op->operation == IR_PUSH_GLOBAL) {
-                        expr.emmited_op->operation = IR_PUSH_GEA;
-                    } else if (expr.emmited_op->operation == IR_PUSH_STACK) {
-                        expr.emmited_op->operation = IR_PUSH_SEA;
-                    } else {
-                        expr.emmited_op->operation = IR_INVALID;
-                    }
+            } else if (is_vector_info(expr.type)) {
+                // lanes are read and written in memory of the vector
+                element = get_lane_type(expr.type);
+
+                if (node->right->type == AST_PRIMARY && node->right->token.type == TOKEN_CONST_INT && node->right->token.data.const_int >= expr.type.lanes) {
+                    log_error_token("Lane index is out of range of the vector", node->right->token);
+                    state->ir.is_valid = false;
                 }
+
+                expr.emmited_op->operation = IR_NOP;
+                expr.emmited_op->u_operand = 0;
+            } else if (expr.type.is_array || expr.type.pointer_depth == 0) {
+                element.is_array = false;
+
+                if (expr.emmited_op->operation == IR_PUSH_GLOBAL) {
+                    expr.emmited_op->operation = IR_PUSH_GEA;
+                } else if (expr.emmited_op->operation == IR_PUSH_STACK) {
+                    expr.emmited_op->operation = IR_PUSH_SEA;
+                } else {
+                    expr.emmited_op->operation = IR_INVALID;
+                }
+            } else {
+                element.pointer_depth--;
             }
 
-            expr.type.pointer_depth++;
+            // loading offset, scaled by the element size
+            compile_expression(state, node->right, shadow);
+            emit_op(state, IR_PUSH_SIGN, node->left->token, get_type_size(element));
+            emit_op(state, IR_MUL, node->left->token, 0);
+
             // add offset to address
             emit_op(state, IR_ADD, node->left->token, 0);
-            expr.emmited_op = emit_op(state, IR_LOAD, node->left->token, 0);
-            break;
 
-        case AST_BIN_ASSIGN:
-            compile_expression(state, node->right, shadow);
+            expr.type       = element;
+            expr.emmited_op = emit_load(state, element, node->left->token);
+        } break;
+
+        case AST_BIN_ASSIGN: {
+            ir_expression_t value = compile_expression(state, node->right, shadow);
+            convert_value(state, node->token, value.type, get_expression_type(state, node->left, shadow));
+
             expr = compile_expression(state, node->left, shadow);
 
             if (!expr.accessable) {
@@ -433,10 +1234,13 @@ ir_expression_t compile_expression(ir_state_t *state, ast_node_t *node, string_t
                     expr.emmited_op->operation = IR_PUSH_GEA;
                 } else if (expr.emmited_op->operation == IR_PUSH_STACK) {
                     expr.emmited_op->operation = IR_PUSH_SEA;
-                } else if (expr.emmited_op->operation == IR_LOAD) {
-                    expr.emmited_op->operation = IR_STORE;
+                } else if (ir_is_load(expr.emmited_op->operation)) {
+                    expr.emmited_op->operation = ir_load_to_store(expr.emmited_op->operation);
                     expr.emmited_op->u_operand = 0;
                     break;
+                } else if (expr.emmited_op->operation == IR_VLOAD) {
+                    expr.emmited_op->operation = IR_VSTORE;
+                    break;
                 } else {
                     expr.emmited_op->operation = IR_INVALID;
                     break;
@@ -444,7 +1248,7 @@ ir_expression_t compile_expression(ir_state_t *state, ast_node_t *node, string_t
 
                 emit_op(state, IR_STORE, node->left->token, 0);
             }
-            break;
+        } break;
 
         case AST_BIN_SWAP:
             {
@@ -462,9 +1266,13 @@ ir_expression_t compile_expression(ir_state_t *state, ast_node_t *node, string_t
                             expr.emmited_op->operation = IR_PUSH_GEA;
                         } else if (expr.emmited_op->operation == IR_PUSH_STACK) {
                             expr.emmited_op->operation = IR_PUSH_SEA;
-                        } else if (expr.emmited_op->operation == IR_LOAD) {
-                            expr.emmited_op->operation = IR_STORE;
+                        } else if (ir_is_load(expr.emmited_op->operation)) {
+                            expr.emmited_op->operation = ir_load_to_store(expr.emmited_op->operation);
                             break;
+                        } else if (expr.emmited_op->operation == IR_VLOAD) {
+                            expr.emmited_op->operation = IR_VSTORE;
+                            next = next->list_next;
+                            continue;
                         } else {
                             expr.emmited_op->operation = IR_INVALID;
                         }
@@ -508,43 +1316,53 @@ ir_expression_t compile_expression(ir_state_t *state, ast_node_t *node, string_t
     return expr;
 }
 
-void compile_block(ir_state_t *state, ast_node_t *node, b32 frame_pointer_free = false) {
+// slots of a block are reused by the next one, frame is as big as the deepest nesting
+void compile_block(ir_state_t *state, ast_node_t *node) {
     hashmap_t<string_t, scope_entry_t> *block = array_get(&state->compiler->scopes, node->scope_index);
     stack_push(&state->search_scopes, block);
     u64 si = state->current_function->stack_index;
 
     ast_node_t *stmt = node->list_start;
 
-    u64 alloc_count = 0;
     for (u64 i = 0; i < node->child_count; i++) {
-        alloc_count += compile_statement(state, stmt, alloc_count);
+        compile_statement(state, stmt);
         
         if (stmt->list_next) {
             stmt = stmt->list_next;
         }
     }
 
-    if (alloc_count && !frame_pointer_free) {
-        emit_op(state, IR_FREE, stmt->token, alloc_count);
-    }
-
     state->current_function->stack_index = si;
     stack_pop(&state->search_scopes);
 }
 
+// every local gets a fixed slot, address is rbp - offset * 8
+static u64 reserve_stack_slots(ir_state_t *state, u64 size) {
+    ir_function_t *func = state->current_function;
+
+    func->stack_index += size;
+    func->frame_size   = MAX(func->frame_size, func->stack_index);
+    return func->stack_index;
+}
+
 u64 compile_variable(ir_state_t *state, ast_node_t *node, b32 is_global = false) {
     assert(state->current_function != NULL);
 
     scope_entry_t *entry = search_identifier(state, node->token.data.string, {});
 
+    b32 is_vector = is_vector_info(entry->info);
+
     if (entry->expr) {
         ir_expression_t expr = compile_expression(state, entry->expr, node->token.data.string);
-        UNUSED(expr);
+        convert_value(state, node->token, expr.type, entry->info);
     } else {
         emit_op(state, IR_PUSH_UNSIGN, node->token, 0);
+        if (is_vector) emit_op(state, IR_VSPLAT, node->token, get_vector_operand(entry->info));
     }
 
-    u64 size = 1;
+    // vector takes a slot per 8 bytes, last one is on top of the stack
+    u64 entries = entry->info.lanes > 0 ? entry->info.size / 8 : 1;
+    u64 size    = entries;
 
     if (entry->info.is_array) { 
         size *= 100 * 100;
@@ -554,13 +1372,19 @@ u64 compile_variable(ir_state_t *state, ast_node_t *node, b32 is_global = false)
         entry->offset   = state->current_function->global_index;
         state->current_function->global_index += size;
         entry->on_stack = false;
-        emit_op(state, IR_SETUP_GLOBAL, node->token, entry->offset);
+
+        if (is_vector) {
+            for (u64 i = entries; i > 0; i--) emit_op(state, IR_SETUP_GLOBAL, node->token, entry->offset + i - 1);
+        } else {
+            emit_op(state, IR_SETUP_GLOBAL, node->token, entry->offset);
+        }
     } else {
-        state->current_function->stack_index += size;
-        entry->offset   = state->current_function->stack_index;
+        entry->offset   = reserve_stack_slots(state, size);
         entry->on_stack = true;
-        emit_op(state, IR_ALLOC, node->token, size);
-        emit_op(state, IR_STORE, node->token, 0);
+        emit_op(state, IR_PUSH_SEA, node->token, entry->offset);
+
+        if (is_vector) emit_op(state, IR_VSTORE, node->token, get_vector_operand(entry->info));
+        else           emit_op(state, IR_STORE,  node->token, 0);
     }
 
     return size;
@@ -580,12 +1404,181 @@ u64 compile_mul_variables(ir_state_t *state, ast_node_t *node, b32 is_global = f
     return alloc_count;
 }
 
-u64 compile_statement(ir_state_t *state, ast_node_t *node, u64 alloc_count = 0) {
+// ------ tail calls
+
+// pointer to a local could outlive the frame that is reused by tail call
+static b32 takes_address(ast_node_t *node) {
+    if (node == NULL) return false;
+    if (node->type == AST_UNARY_REF) return true;
+
+    if (takes_address(node->left) || takes_address(node->center) || takes_address(node->right)) return true;
+
+    ast_node_t *next = node->list_start;
+
+    for (u64 i = 0; i < node->child_count && next; i++) {
+        if (takes_address(next)) return true;
+        next = next->list_next;
+    }
+
+    return false;
+}
+
+// by name only, scopes of the body aren't known yet, compile_return checks again
+static b32 calls_by_name(ast_node_t *node, string_t name) {
+    return node->type == AST_FUNC_CALL && node->left->type == AST_PRIMARY && node->left->token.type == TOKEN_IDENT
+        && string_compare(node->left->token.data.string, name) == 0;
+}
+
+// return values are separated, tail call returns only one
+static ast_node_t *single_return_value(ast_node_t *node) {
+    ast_node_t *expr = node->left;
+
+    if (expr == NULL || expr->type != AST_SEPARATION) return expr;
+    return expr->child_count == 1 ? expr->list_start : NULL;
+}
+
+// first return a + f(...) or a * f(...) of function f
+static u64 find_accumulator(ast_node_t *node, string_t name) {
+    if (node == NULL) return IR_NOP;
+
+    if (node->type == AST_RET_STMT && single_return_value(node)) {
+        ast_node_t *expr = single_return_value(node);
+
+        if (expr->type == AST_BIN_ADD || expr->type == AST_BIN_MUL) {
+            if (calls_by_name(expr->left, name) || calls_by_name(expr->right, name)) {
+                return expr->type == AST_BIN_ADD ? IR_ADD : IR_MUL;
+            }
+        }
+    }
+
+    ast_node_t *children[] = { node->left, node->center, node->right };
+
+    for (u64 i = 0; i < 3; i++) {
+        u64 operation = find_accumulator(children[i], name);
+        if (operation != IR_NOP) return operation;
+    }
+
+    ast_node_t *next = node->list_start;
+
+    for (u64 i = 0; i < node->child_count && next; i++) {
+        u64 operation = find_accumulator(next, name);
+        if (operation != IR_NOP) return operation;
+
+        next = next->list_next;
+    }
+
+    return IR_NOP;
+}
+
+static b32 is_self_call(ir_state_t *state, ast_node_t *node) {
+    if (!calls_by_name(node, state->current_function_name)) return false;
+
+    scope_entry_t *callee = search_identifier(state, node->left->token.data.string, {});
+    return callee && callee->node == state->current_function->entry->node;
+}
+
+// reads only locals of the frame, can't trap, so it can be computed before the call
+static b32 is_frame_expression(ir_state_t *state, ast_node_t *node) {
     switch (node->type) {
-        case AST_BIN_UNKN_DEF:  return compile_variable(state, node); break;
-        case AST_UNARY_VAR_DEF: return compile_variable(state, node); break;
-        case AST_BIN_MULT_DEF:  return compile_mul_variables(state, node); break;
-        case AST_TERN_MULT_DEF: return compile_mul_variables(state, node); break;
+        case AST_PRIMARY:
+            if (node->token.type == TOKEN_CONST_INT || node->token.type == TOK_TRUE || node->token.type == TOK_FALSE) return true;
+
+            if (node->token.type == TOKEN_IDENT) {
+                scope_entry_t *entry = search_identifier(state, node->token.data.string, {});
+                return entry && entry->type == ENTRY_VAR && entry->on_stack && !entry->info.is_array && !is_float_type(entry->info);
+            }
+
+            return false;
+
+        case AST_UNARY_NEGATE:
+        case AST_UNARY_INVERT:
+        case AST_UNARY_NOT:
+            return is_frame_expression(state, node->left);
+
+        case AST_BIN_CAST:
+            return is_frame_expression(state, node->right);
+
+        case AST_BIN_ADD:
+        case AST_BIN_SUB:
+        case AST_BIN_MUL:
+        case AST_BIN_BIT_XOR:
+        case AST_BIN_BIT_OR:
+        case AST_BIN_BIT_AND:
+        case AST_BIN_BIT_LSHIFT:
+        case AST_BIN_BIT_RSHIFT:
+        case AST_BIN_GR:
+        case AST_BIN_LS:
+        case AST_BIN_GEQ:
+        case AST_BIN_LEQ:
+        case AST_BIN_EQ:
+        case AST_BIN_NEQ:
+            return is_frame_expression(state, node->left) && is_frame_expression(state, node->right);
+
+        default:
+            return false;
+    }
+}
+
+static void emit_tail_jump(ir_state_t *state, token_t token) {
+    u64 at = state->current_function->code.count;
+    emit_op(state, IR_JUMP, token, (s64)state->tail_entry - (s64)(at + 1), 0);
+}
+
+// return f(...) of the function itself pushes arguments and jumps back to
+// parameter stores, frame is reused. return a + f(...) and a * f(...) also
+// add a into accumulator that every other return applies to its value
+static void compile_return(ir_state_t *state, ast_node_t *node) {
+    ast_node_t *expr = single_return_value(node);
+
+    if (state->tail_calls && expr && is_self_call(state, expr)) {
+        compile_arguments(state, expr, {});
+        emit_tail_jump(state, node->token);
+        return;
+    }
+
+    u64 operation = state->tail_operation;
+
+    if (operation != IR_NOP && expr && (expr->type == AST_BIN_ADD ? IR_ADD : expr->type == AST_BIN_MUL ? IR_MUL : IR_NOP) == operation) {
+        ast_node_t *call  = is_self_call(state, expr->right) ? expr->right : expr->left;
+        ast_node_t *value = call == expr->right ? expr->left : expr->right;
+
+        if (is_self_call(state, call) && is_frame_expression(state, value)) {
+            compile_expression(state, value, {});
+            emit_op(state, IR_PUSH_STACK, node->token, state->tail_slot);
+            emit_op(state, operation,     node->token, 0);
+            emit_op(state, IR_PUSH_SEA,   node->token, state->tail_slot);
+            emit_op(state, IR_STORE,      node->token, 0);
+
+            compile_arguments(state, call, {});
+            emit_tail_jump(state, node->token);
+            return;
+        }
+    }
+
+    list_t<type_info_t> *returns = &state->current_function->entry->return_typenames;
+
+    if (expr && returns->count == 1) {
+        ir_expression_t value = compile_expression(state, expr, {});
+        convert_value(state, node->token, value.type, (*returns)[0]);
+    } else {
+        compile_expression(state, node->left, {});
+    }
+
+    if (operation != IR_NOP) {
+        emit_op(state, IR_PUSH_STACK, node->token, state->tail_slot);
+        emit_op(state, operation,     node->token, 0);
+    }
+
+    emit_op(state, IR_STACK_FRAME_POP, node->token, 0);
+    emit_op(state, IR_RET, node->token, 0);
+}
+
+void compile_statement(ir_state_t *state, ast_node_t *node) {
+    switch (node->type) {
+        case AST_BIN_UNKN_DEF:  compile_variable(state, node); break;
+        case AST_UNARY_VAR_DEF: compile_variable(state, node); break;
+        case AST_BIN_MULT_DEF:  compile_mul_variables(state, node); break;
+        case AST_TERN_MULT_DEF: compile_mul_variables(state, node); break;
 
         case AST_BLOCK_IMPERATIVE: compile_block(state, node); break;
 
@@ -639,22 +1632,15 @@ u64 compile_statement(ir_state_t *state, ast_node_t *node, u64 alloc_count = 0)
             }
             break;
         case AST_RET_STMT: 
-            {
-                compile_expression(state, node->left, {});
-                if (alloc_count) emit_op(state, IR_FREE, node->token, alloc_count);
-                emit_op(state, IR_STACK_FRAME_POP, node->token, 0);
-                emit_op(state, IR_RET, node->token, 0);
-            }
+            compile_return(state, node);
             break;
         case AST_BREAK_STMT: 
             {
-                if (alloc_count) emit_op(state, IR_FREE, node->token, alloc_count);
                 stack_push(&state->break_stmt, emit_op(state, IR_JUMP, node->token, 0)); // jump outa loop
             }
             break;
         case AST_CONTINUE_STMT:
             {
-                if (alloc_count) emit_op(state, IR_FREE, node->token, alloc_count);
                 stack_push(&state->continue_stmt, emit_op(state, IR_JUMP, node->token, 0)); // jump to start of loop
             }
             break;
@@ -663,8 +1649,6 @@ u64 compile_statement(ir_state_t *state, ast_node_t *node, u64 alloc_count = 0)
             compile_expression(state, node, {});
             break;
     }
-
-    return 0;
 }
 
 void compile_function(ir_state_t *state, string_t key, scope_entry_t *entry) {
@@ -672,13 +1656,12 @@ void compile_function(ir_state_t *state, string_t key, scope_entry_t *entry) {
 
     assert(state->current_function == NULL);
 
-    {
-        ir_function_t func = {};
-        hashmap_add(&state->ir.functions, key, &func);
-    }
-
+    // entry is added by compile_program, map doesn't change while workers run
     state->current_function = hashmap_get(&state->ir.functions, key);
+    assert(state->current_function != NULL);
+
     state->current_function->entry = entry;
+    state->current_function_name   = key;
 
     if (entry->is_external) {
         state->current_function->is_external = true;
@@ -689,13 +1672,43 @@ void compile_function(ir_state_t *state, string_t key, scope_entry_t *entry) {
 
     array_create(&state->current_function->code, 8, state->ir.code);
 
+    state->current_function->register_returns = entry->return_typenames.count == 1;
+
     stack_push(&state->search_scopes, &entry->func_params);
     {
-        emit_op(state, IR_STACK_FRAME_PUSH, entry->node->token, 0);
+        // frame size is known only after the body, see reserve_stack_slots
+        ir_opcode_t *frame = emit_op(state, IR_STACK_FRAME_PUSH, entry->node->token, 0);
         //                      def -> type -> params
         ast_node_t *node = entry->node->left->left;
         ast_node_t *next = node->list_start;
 
+        // tail call pushes every argument, so there are no stack arguments
+        // under the frame that it would have to replace
+        state->tail_calls     = node->child_count <= IR_REGISTER_ARGS && !takes_address(entry->expr);
+        state->tail_operation = IR_NOP;
+
+        for (u64 i = 0; i < node->child_count && state->tail_calls; i++) {
+            state->tail_calls = !search_identifier(state, next->token.data.string, {})->info.is_array;
+            next = next->list_next;
+        }
+
+        next = node->list_start;
+
+        // float sums would be reassociated
+        if (state->tail_calls && entry->return_typenames.count == 1 && !is_float_type(entry->return_typenames[0])) {
+            state->tail_operation = find_accumulator(entry->expr, key);
+        }
+
+        if (state->tail_operation != IR_NOP) {
+            state->tail_slot = reserve_stack_slots(state, 1);
+
+            emit_op(state, IR_PUSH_SIGN, entry->node->token, state->tail_operation == IR_MUL ? 1 : 0);
+            emit_op(state, IR_PUSH_SEA,  entry->node->token, state->tail_slot);
+            emit_op(state, IR_STORE,     entry->node->token, 0);
+        }
+
+        state->tail_entry = state->current_function->code.count;
+
         for (u64 i = 0; i < node->child_count; i++) {
             scope_entry_t *entry = search_identifier(state, next->token.data.string, {});
 
@@ -704,18 +1717,19 @@ void compile_function(ir_state_t *state, string_t key, scope_entry_t *entry) {
             if (entry->info.is_array) { 
                 size *= 100 * 100;
                 // entry->info.pointer_depth += 1;
+            } else if (state->current_function->register_args == i && i < IR_REGISTER_ARGS) {
+                state->current_function->register_args++;
             }
 
-            state->current_function->stack_index += size;
-            entry->offset   = state->current_function->stack_index;
+            entry->offset   = reserve_stack_slots(state, size);
             entry->on_stack = true;
 
-            emit_op(state, IR_ALLOC, node->token, size); 
-            emit_op(state, IR_STORE, next->token, 0);
+            emit_op(state, IR_PUSH_SEA, node->token, entry->offset);
+            emit_op(state, IR_STORE,    next->token, 0);
             next = next->list_next;
         }
 
-        compile_block(state, entry->expr, true);
+        compile_block(state, entry->expr);
 
         if (entry->return_typenames.count == 0) {
             emit_op(state, IR_STACK_FRAME_POP, node->token, 0);
@@ -723,6 +1737,8 @@ void compile_function(ir_state_t *state, string_t key, scope_entry_t *entry) {
         } else {
             emit_op(state, IR_INVALID, entry->node->token, 0);
         }
+
+        frame->u_operand = state->current_function->frame_size;
     }
     stack_pop(&state->search_scopes);
     state->current_function = NULL;
@@ -738,7 +1754,8 @@ void compile_globals(ir_state_t *state) {
         hashmap_add(&state->ir.functions, key, &func);
     }
 
-    state->current_function = hashmap_get(&state->ir.functions, key);
+    state->current_function      = hashmap_get(&state->ir.functions, key);
+    state->current_function_name = key;
 
     array_create(&state->current_function->code, 8, state->ir.code);
     {
@@ -776,6 +1793,35 @@ void compile_globals(ir_state_t *state) {
     state->current_function = NULL;
 }
 
+struct ir_job_t {
+    string_t       key;
+    scope_entry_t *entry;
+
+    list_t<ir_comptime_call_t> comptime_calls;
+};
+
+// functions are compiled in parallel, every worker has its own state with
+// own arena, comptime calls are kept per function and merged in job order
+struct ir_jobs_t {
+    ir_job_t  *jobs;
+    ir_state_t workers[JOBS_MAX_WORKERS];
+};
+
+static COMP_PROC(compare_jobs) {
+    UNUSED(size);
+    return string_compare(((ir_job_t*)a)->key, ((ir_job_t*)b)->key);
+}
+
+static void compile_function_job(void *data, u64 index, u64 worker) {
+    ir_jobs_t  *jobs  = (ir_jobs_t*)data;
+    ir_job_t   *job   = jobs->jobs + index;
+    ir_state_t *state = jobs->workers + worker;
+
+    state->ir.comptime_calls = {};
+    compile_function(state, job->key, job->entry);
+    job->comptime_calls = state->ir.comptime_calls;
+}
+
 ir_t compile_program(compiler_t *compiler) {
     profiler_func_start();
     UNUSED(compiler);
@@ -796,7 +1842,10 @@ ir_t compile_program(compiler_t *compiler) {
     // compiling globals
     compile_globals(&state);
 
-    // compiling code, functions
+    // compiling code, functions, in order of names so output doesn't depend on scheduling
+    list_t<ir_job_t> jobs = {};
+    list_create(&jobs, 64, *default_allocator);
+
     for (u64 i = 0; i < scope->capacity; i++) {
         kv_pair_t<string_t, scope_entry_t> *pair = scope->entries + i;
     
@@ -809,9 +1858,67 @@ ir_t compile_program(compiler_t *compiler) {
 
         assert(pair->value.stmt->type == AST_BIN_UNKN_DEF);
         assert(pair->value.type == ENTRY_FUNC);
-        compile_function(&state, pair->key, &pair->value);
+
+        if (!pair->value.reachable) continue;
+
+        ir_job_t job = {};
+        job.key   = pair->key;
+        job.entry = &pair->value;
+        list_add(&jobs, &job);
+    }
+
+    if (jobs.count) sort_array(jobs.data, jobs.count, compare_jobs);
+
+    for (u64 i = 0; i < jobs.count; i++) {
+        ir_function_t func = {};
+        hashmap_add(&state.ir.functions, jobs[i].key, &func);
+    }
+
+    ir_jobs_t *work = (ir_jobs_t*)mem_alloc(default_allocator, sizeof(ir_jobs_t));
+    work->jobs = jobs.data;
+
+    u64 worker_count = jobs_worker_count(jobs.count);
+
+    for (u64 i = 0; i < worker_count; i++) {
+        ir_state_t *worker = work->workers + i;
+
+        worker->compiler     = compiler;
+        worker->ir.functions = state.ir.functions;
+        worker->ir.is_valid  = true;
+        worker->ir.code      = state.ir.code;
+
+        if (i > 0) {
+            worker->ir.code = create_arena_allocator(1024 * sizeof(ir_opcode_t));
+            list_add(&state.ir.worker_code, &worker->ir.code);
+        }
+
+        stack_push(&worker->search_scopes, scope);
+    }
+
+    jobs_run(jobs.count, worker_count, compile_function_job, work);
+
+    for (u64 i = 0; i < worker_count; i++) {
+        ir_state_t *worker = work->workers + i;
+
+        state.ir.is_valid = state.ir.is_valid && worker->ir.is_valid;
+
+        stack_delete(&worker->search_scopes);
+        if (worker->continue_stmt.data) stack_delete(&worker->continue_stmt);
+        if (worker->break_stmt.data)    stack_delete(&worker->break_stmt);
+    }
+
+    for (u64 i = 0; i < jobs.count; i++) {
+        list_t<ir_comptime_call_t> *calls = &list_get(&jobs, i)->comptime_calls;
+
+        for (u64 j = 0; j < calls->count; j++) {
+            list_add(&state.ir.comptime_calls, list_get(calls, j));
+        }
+
+        if (calls->data) list_delete(calls);
     }
 
+    mem_free(default_allocator, work);
+    list_delete(&jobs);
     stack_delete(&state.search_scopes);
 
     profiler_func_end();
@@ -0,0 +1,178 @@
+#include "jit.h"
+
+#include "backend.h"
+
+#include "list.h"
+#include "hashmap.h"
+
+#include "memctl.h"
+#include "strings.h"
+#include "profiler.h"
+#include "platform.h"
+#include "talloc.h"
+
+#include <stdio.h>
+
+#define JIT_PAGE_SIZE 0x1000
+
+typedef s64 (*jit_enter_t)(s64 *exec_stack, void *function, u64 *exec_count);
+
+static s64 jit_putchar(s64 value) {
+    putchar((char)value);
+    return 0;
+}
+
+static s64 jit_getchar(s64 value) {
+    UNUSED(value);
+    fflush(stdout); // prompt has to be seen before input is read
+    return (s64)getchar();
+}
+
+static s64 jit_debug_break(s64 value) {
+    UNUSED(value);
+    debug_break();
+    return 0;
+}
+
+struct jit_run_t {
+    jit_enter_t entry;
+    void       *callee;
+    s64        *exec_stack;
+    u64         exec_count;
+    s64         value;
+};
+
+static void jit_run(void *data) {
+    jit_run_t *run = (jit_run_t*)data;
+    run->value = run->entry(run->exec_stack, run->callee, &run->exec_count);
+}
+
+static inline u64 jit_align(u64 value, u64 alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static x64_symbol_t *jit_find_symbol(x64_module_t *module, string_t name) {
+    u64 *index = hashmap_get(&module->symbol_index, name);
+
+    if (index == NULL) return NULL;
+
+    x64_symbol_t *symbol = list_get(&module->symbols, *index);
+    return symbol->section == X64_SECTION_NONE ? NULL : symbol;
+}
+
+b32 jit_is_supported(void) {
+#if defined(__x86_64__) && !defined(_WIN32)
+    return true;
+#else
+    return false;
+#endif
+}
+
+b32 jit_call(ir_t *ir, string_t func_name, s64 *result) {
+    profiler_func_start();
+
+    ir_function_t *func = ir->functions[func_name];
+
+    if (func == NULL || func->is_external) {
+        log_error(string_format(get_temporary_allocator(), STRING("Couldn't find function to run: %s"), func_name));
+        profiler_func_end();
+        return false;
+    }
+
+    x64_module_t module = x64_compile_program(ir, X64_RUNTIME_HOST);
+
+    if (!module.is_valid) {
+        x64_module_delete(&module);
+        profiler_func_end();
+        return false;
+    }
+
+    // text, data and bss go into one mapping, so every rel32 is in range
+    u64 text_size = jit_align(module.text.count, JIT_PAGE_SIZE);
+    u64 data_size = jit_align(module.data.count, 16);
+    u64 size      = jit_align(text_size + data_size + module.bss_size, JIT_PAGE_SIZE);
+
+    u8 *memory = (u8*)platform_alloc_pages(size);
+
+    if (memory == NULL) {
+        log_error(STRING("Couldn't allocate memory for generated code"));
+        x64_module_delete(&module);
+        profiler_func_end();
+        return false;
+    }
+
+    u64 addresses[X64_SECTION_COUNT] = {};
+    addresses[X64_SECTION_TEXT] = (u64)memory;
+    addresses[X64_SECTION_DATA] = (u64)memory + text_size;
+    addresses[X64_SECTION_BSS]  = (u64)memory + text_size + data_size;
+
+    mem_copy(memory, module.text.data, module.text.count);
+    if (module.data.count) {
+        mem_copy(memory + text_size, module.data.data, module.data.count);
+    }
+
+    x64_symbol_t *table    = jit_find_symbol(&module, STRING("__jit_host_functions"));
+    x64_symbol_t *enter    = jit_find_symbol(&module, STRING("__jit_enter"));
+    x64_symbol_t *function = jit_find_symbol(&module, func_name);
+    x64_symbol_t *globals  = jit_find_symbol(&module, STRING("global_variables"));
+
+    assert(table && enter && function && globals);
+
+    s64 (*host[X64_HOST_FUNCTION_COUNT])(s64) = {};
+    host[X64_HOST_PUTCHAR]     = jit_putchar;
+    host[X64_HOST_GETCHAR]     = jit_getchar;
+    host[X64_HOST_DEBUG_BREAK] = jit_debug_break;
+
+    mem_copy((u8*)(addresses[table->section] + table->offset), (u8*)host, sizeof(host));
+
+    b32 status = x64_link(&module, memory, addresses);
+
+    if (status && !platform_protect_executable(memory, text_size)) {
+        log_error(STRING("Couldn't make generated code executable"));
+        status = false;
+    }
+
+    if (status) {
+        jit_run_t run  = {};
+        run.exec_stack = (s64*)platform_alloc_pages(JIT_EXEC_STACK_SIZE * sizeof(s64));
+
+        if (run.exec_stack == NULL) {
+            log_error(STRING("Couldn't allocate exec stack for generated code"));
+            status = false;
+        } else {
+            run.entry  = (jit_enter_t)(addresses[enter->section] + enter->offset);
+            run.callee = (void*)(addresses[function->section] + function->offset);
+
+            // faults stop the run like access violations stop the interpreter,
+            // globals are kept as they were before the call
+            u32 signal = platform_run_guarded(jit_run, &run);
+
+            if (signal) {
+                log_error(string_format(get_temporary_allocator(), STRING("Generated code of %s stopped by signal %u"), func_name, (u64)signal));
+                status = false;
+            }
+
+            if (status && result != NULL) {
+                if (func->register_returns) {
+                    *result = run.value;
+                } else {
+                    *result = run.exec_count > 0 ? run.exec_stack[run.exec_count - 1] : 0;
+                }
+            }
+
+            fflush(stdout);
+            platform_free_pages(run.exec_stack, JIT_EXEC_STACK_SIZE * sizeof(s64));
+
+            u8 *values = (u8*)(addresses[globals->section] + globals->offset);
+            for (u64 i = 0; status && i < ir->globals.count; i++) {
+                mem_copy((u8*)array_get(&ir->globals, i), values + i * sizeof(s64), sizeof(s64));
+            }
+        }
+    }
+
+    platform_free_pages(memory, size);
+    x64_module_delete(&module);
+
+    profiler_func_end();
+    return status;
+}
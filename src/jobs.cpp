@@ -0,0 +1,72 @@
+#include "jobs.h"
+
+#include "platform.h"
+#include "talloc.h"
+#include "logger.h"
+
+struct jobs_state_t {
+    job_proc_t *proc;
+    void       *data;
+    u64         job_count;
+
+    volatile u64 next;
+};
+
+struct jobs_worker_t {
+    jobs_state_t *state;
+    u64           index;
+};
+
+static void jobs_work(jobs_state_t *state, u64 worker) {
+    for (;;) {
+        u64 job = platform_atomic_increment(&state->next);
+        if (job >= state->job_count) break;
+
+        state->proc(state->data, job, worker);
+    }
+}
+
+static void jobs_thread(void *data) {
+    jobs_worker_t *worker = (jobs_worker_t*)data;
+
+    temp_thread_begin();
+    log_push_color(255, 255, 255);
+
+    jobs_work(worker->state, worker->index);
+
+    temp_thread_end();
+}
+
+u64 jobs_worker_count(u64 job_count) {
+    u64 count = compiler_config.jobs ? compiler_config.jobs : platform_processor_count();
+
+    count = MIN(count, JOBS_MAX_WORKERS);
+    count = MIN(count, job_count);
+
+    return MAX(count, 1);
+}
+
+void jobs_run(u64 job_count, u64 worker_count, job_proc_t *proc, void *data) {
+    assert(worker_count > 0 && worker_count <= JOBS_MAX_WORKERS);
+
+    jobs_state_t state = {};
+    state.proc      = proc;
+    state.data      = data;
+    state.job_count = job_count;
+
+    jobs_worker_t workers[JOBS_MAX_WORKERS] = {};
+    u64           threads[JOBS_MAX_WORKERS] = {};
+
+    for (u64 i = 1; i < worker_count; i++) {
+        workers[i].state = &state;
+        workers[i].index = i;
+        threads[i] = platform_thread_start(jobs_thread, workers + i);
+    }
+
+    // jobs of workers that failed to start are picked up by the rest
+    jobs_work(&state, 0);
+
+    for (u64 i = 1; i < worker_count; i++) {
+        if (threads[i]) platform_thread_join(threads[i]);
+    }
+}
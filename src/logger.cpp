@@ -6,9 +6,10 @@
 
 #define LOGGER_COLOR_STACK_SIZE 256
 
-static b32 update_requested;
-static u32 current_index;
-static u32 stack[LOGGER_COLOR_STACK_SIZE];
+// per thread, so workers can log without touching colors of main thread
+static thread_local b32 update_requested;
+static thread_local u32 current_index;
+static thread_local u32 stack[LOGGER_COLOR_STACK_SIZE];
 
 void log_push_color(u8 r, u8 g, u8 b) {
     stack[current_index] = r | (g << 8) | (b << 16);
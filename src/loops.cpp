@@ -0,0 +1,1221 @@
+#include "loops.h"
+
+#include "ir.h"
+
+#include "list.h"
+#include "array.h"
+#include "hashmap.h"
+
+#include "allocator.h"
+#include "talloc.h"
+#include "strings.h"
+#include "profiler.h"
+
+// opcode while function is rewritten, jumps point to ids, see pgo.cpp
+struct loop_op_t {
+    ir_opcode_t op;
+    u64 id;
+    u64 target;
+};
+
+struct loop_block_t {
+    u64 start; // positions, [start, end)
+    u64 end;
+    u64 successors[2];
+    u64 successor_count;
+};
+
+// what a call can write, together with everything it calls
+struct loop_summary_t {
+    b32  indirect; // stores through computed addresses
+    u64 *globals;  // bitset
+};
+
+struct loop_program_t {
+    ir_t *ir;
+    u64   words;   // of globals bitset
+    u64  *escaped; // globals whose address is used for something else than load or store
+    hashmap_t<string_t, loop_summary_t> summaries;
+};
+
+struct loop_function_t {
+    loop_program_t   *program;
+    ir_function_t    *func;
+    list_t<loop_op_t> ops;
+    u64 end;
+    u64 next_id;
+
+    u64 slot_count;    // before optimisation, new slots are never address taken
+    b8 *address_taken;
+
+    // rebuilt after every change
+    list_t<loop_block_t> blocks;
+    u64 *block_of;     // by position
+    u64 *position;     // by id
+    u64 *predecessors; // flat, predecessor_start by block
+    u64 *predecessor_start;
+    u64 *dominators;   // bitset of blocks by block
+    u64  words;
+    b8  *reachable;
+};
+
+struct loop_t {
+    u64 header; // block
+    u64 size;   // opcodes
+    b8 *body;   // by block
+};
+
+enum loop_value_kind_t {
+    LOOP_VARIANT,
+    LOOP_INVARIANT,
+    LOOP_LINEAR,   // invariant part + scale * induction variable
+};
+
+// value on the exec stack during scan of a block, computed by opcodes [start, end]
+struct loop_value_t {
+    s64 start;     // -1 when it comes from before the block
+    u64 end;
+    u32 kind;
+    b8  leaf;      // single push, not worth a local
+    b8  constant;  // invariant with known value
+    b8  exact;     // linear with known constant part
+    s64 value;     // of constant, or constant part of linear
+    s64 scale;
+};
+
+struct loop_candidate_t {
+    u64 start; // positions, inclusive
+    u64 end;
+    s64 scale;
+    u64 slot;
+};
+
+struct loop_scan_t {
+    loop_function_t *state;
+    b8  *written;  // slots stored in loop
+    u64 *globals;  // written in loop
+    u64  iv;       // slot of induction variable, 0 while hoisting
+
+    list_t<loop_value_t>     values;
+    list_t<loop_candidate_t> candidates;
+
+    u64 iv_writes;
+    u64 iv_store;  // position of the only store
+    s64 iv_step;
+    b32 iv_valid;
+};
+
+static inline b32 is_jump(u64 operation) {
+    return operation == IR_JUMP || operation == IR_JUMP_IF || operation == IR_JUMP_IF_NOT;
+}
+
+static inline b32 is_store(u64 operation) {
+    return operation == IR_STORE || operation == IR_STORE8 || operation == IR_STORE16 || operation == IR_STORE32 || operation == IR_STOREF32;
+}
+
+static inline b32 writes_memory(u64 operation) {
+    return operation == IR_VSTORE || operation == IR_MEM_FILL || operation == IR_MEM_COPY || operation == IR_MEM_MOVE;
+}
+
+static inline b32 ends_block(u64 operation) {
+    return is_jump(operation) || operation == IR_RET || operation == IR_INVALID;
+}
+
+static inline void bit_set(u64 *bits, u64 index) { bits[index / 64] |= 1ull << (index % 64); }
+static inline b32  bit_get(u64 *bits, u64 index) { return (bits[index / 64] >> (index % 64)) & 1; }
+
+static u64 *bits_alloc(u64 words) {
+    u64 *bits = (u64*)mem_alloc(default_allocator, words * sizeof(u64));
+    mem_set((u8*)bits, 0, words * sizeof(u64));
+    return bits;
+}
+
+// ------ what functions write
+
+static void summarize_program(loop_program_t *program) {
+    ir_t *ir = program->ir;
+
+    program->words   = ir->globals.count / 64 + 1;
+    program->escaped = bits_alloc(program->words);
+
+    hashmap_create(&program->summaries, 64, NULL, NULL);
+
+    for (u64 i = 0; i < ir->functions.capacity; i++) {
+        kv_pair_t<string_t, ir_function_t> *pair = ir->functions.entries + i;
+
+        if (!pair->occupied || pair->deleted) continue;
+
+        loop_summary_t summary = {};
+        summary.globals = bits_alloc(program->words);
+
+        ir_function_t *func = &pair->value;
+        u64 previous = IR_NOP;
+
+        for (u64 j = 0; j < func->code.count; j++) {
+            ir_opcode_t op   = func->code[j];
+            u64         next = j + 1 < func->code.count ? func->code[j + 1].operation : IR_NOP;
+
+            if (op.operation == IR_PUSH_GEA) {
+                if (op.u_operand >= ir->globals.count) {
+                    summary.indirect = true;
+                } else if (is_store(next)) {
+                    bit_set(summary.globals, op.u_operand);
+                } else if (!ir_is_load(next)) {
+                    bit_set(program->escaped, op.u_operand);
+                }
+            }
+
+            // vector stores and intrinsics aren't tracked per slot
+            if ((is_store(op.operation) && previous != IR_PUSH_GEA && previous != IR_PUSH_SEA) || writes_memory(op.operation)) {
+                summary.indirect = true;
+            }
+
+            previous = op.operation;
+        }
+
+        hashmap_add(&program->summaries, pair->key, &summary);
+    }
+
+    b32 changed = true;
+
+    while (changed) {
+        changed = false;
+
+        for (u64 i = 0; i < ir->functions.capacity; i++) {
+            kv_pair_t<string_t, ir_function_t> *pair = ir->functions.entries + i;
+
+            if (!pair->occupied || pair->deleted) continue;
+
+            loop_summary_t *summary = hashmap_get(&program->summaries, pair->key);
+
+            for (u64 j = 0; j < pair->value.code.count; j++) {
+                ir_opcode_t op = pair->value.code[j];
+
+                if (op.operation != IR_CALL) continue;
+
+                loop_summary_t *callee = hashmap_get(&program->summaries, op.string);
+
+                if (callee == NULL) {
+                    changed |= !summary->indirect;
+                    summary->indirect = true;
+                    continue;
+                }
+
+                if (callee->indirect && !summary->indirect) {
+                    summary->indirect = true;
+                    changed = true;
+                }
+
+                for (u64 w = 0; w < program->words; w++) {
+                    u64 merged = summary->globals[w] | callee->globals[w];
+
+                    if (merged != summary->globals[w]) {
+                        summary->globals[w] = merged;
+                        changed = true;
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void delete_program(loop_program_t *program) {
+    for (u64 i = 0; i < program->summaries.capacity; i++) {
+        kv_pair_t<string_t, loop_summary_t> *pair = program->summaries.entries + i;
+
+        if (!pair->occupied || pair->deleted) continue;
+        mem_free(default_allocator, pair->value.globals);
+    }
+
+    hashmap_delete(&program->summaries);
+    mem_free(default_allocator, program->escaped);
+}
+
+// ------ control flow
+
+static void free_blocks(loop_function_t *state) {
+    if (state->blocks.data) list_delete(&state->blocks);
+
+    mem_free(default_allocator, state->block_of);
+    mem_free(default_allocator, state->position);
+    mem_free(default_allocator, state->predecessors);
+    mem_free(default_allocator, state->predecessor_start);
+    mem_free(default_allocator, state->dominators);
+    mem_free(default_allocator, state->reachable);
+
+    state->blocks = {};
+}
+
+static void build_blocks(loop_function_t *state) {
+    u64 count = state->ops.count;
+
+    state->position = (u64*)mem_alloc(default_allocator, (state->next_id + 1) * sizeof(u64));
+    mem_set((u8*)state->position, 0, (state->next_id + 1) * sizeof(u64));
+
+    for (u64 i = 0; i < count; i++) state->position[state->ops[i].id] = i;
+    state->position[state->end] = count;
+
+    b8 *leader = (b8*)mem_alloc(default_allocator, count + 1);
+    mem_set((u8*)leader, 0, count + 1);
+    leader[0] = true;
+
+    for (u64 i = 0; i < count; i++) {
+        loop_op_t *op = &state->ops[i];
+
+        if (is_jump(op->op.operation))   leader[state->position[op->target]] = true;
+        if (ends_block(op->op.operation)) leader[i + 1] = true;
+    }
+
+    state->block_of = (u64*)mem_alloc(default_allocator, (count + 1) * sizeof(u64));
+    list_create(&state->blocks, 16, *default_allocator);
+
+    for (u64 i = 0; i < count; i++) {
+        if (leader[i]) {
+            loop_block_t block = {};
+            block.start = i;
+            list_add(&state->blocks, &block);
+        }
+
+        state->blocks[state->blocks.count - 1].end = i + 1;
+        state->block_of[i] = state->blocks.count - 1;
+    }
+
+    state->block_of[count] = state->blocks.count;
+    mem_free(default_allocator, leader);
+
+    u64 n = state->blocks.count;
+    u64 edges = 0;
+
+    for (u64 b = 0; b < n; b++) {
+        loop_block_t *block = &state->blocks[b];
+        loop_op_t    *last  = &state->ops[block->end - 1];
+
+        u64 operation = last->op.operation;
+
+        if (operation != IR_JUMP && operation != IR_RET && operation != IR_INVALID && block->end < count) {
+            block->successors[block->successor_count++] = b + 1;
+        }
+
+        if (is_jump(operation) && state->position[last->target] < count) {
+            block->successors[block->successor_count++] = state->block_of[state->position[last->target]];
+        }
+
+        edges += block->successor_count;
+    }
+
+    state->predecessor_start = (u64*)mem_alloc(default_allocator, (n + 1) * sizeof(u64));
+    state->predecessors      = (u64*)mem_alloc(default_allocator, (edges + 1) * sizeof(u64));
+    mem_set((u8*)state->predecessor_start, 0, (n + 1) * sizeof(u64));
+
+    for (u64 b = 0; b < n; b++) {
+        for (u64 s = 0; s < state->blocks[b].successor_count; s++) state->predecessor_start[state->blocks[b].successors[s] + 1]++;
+    }
+
+    for (u64 b = 0; b < n; b++) state->predecessor_start[b + 1] += state->predecessor_start[b];
+
+    u64 *fill = (u64*)mem_alloc(default_allocator, (n + 1) * sizeof(u64));
+    mem_copy((u8*)fill, (u8*)state->predecessor_start, (n + 1) * sizeof(u64));
+
+    for (u64 b = 0; b < n; b++) {
+        for (u64 s = 0; s < state->blocks[b].successor_count; s++) state->predecessors[fill[state->blocks[b].successors[s]]++] = b;
+    }
+
+    mem_free(default_allocator, fill);
+
+    // reachable from entry, then dominators by iteration over them
+    state->reachable = (b8*)mem_alloc(default_allocator, n + 1);
+    mem_set((u8*)state->reachable, 0, n + 1);
+
+    list_t<u64> work = {};
+    list_create(&work, n + 1, *default_allocator);
+
+    u64 entry = 0;
+    state->reachable[0] = true;
+    list_add(&work, &entry);
+
+    while (work.count > 0) {
+        u64 b = work[work.count - 1];
+        work.count--;
+
+        for (u64 s = 0; s < state->blocks[b].successor_count; s++) {
+            u64 next = state->blocks[b].successors[s];
+
+            if (state->reachable[next]) continue;
+
+            state->reachable[next] = true;
+            list_add(&work, &next);
+        }
+    }
+
+    list_delete(&work);
+
+    u64 words = n / 64 + 1;
+    state->words      = words;
+    state->dominators = (u64*)mem_alloc(default_allocator, n * words * sizeof(u64));
+
+    for (u64 b = 0; b < n; b++) {
+        u64 *dom = state->dominators + b * words;
+
+        for (u64 w = 0; w < words; w++) dom[w] = b == 0 ? 0 : ~0ull;
+        if (b == 0) bit_set(dom, 0);
+    }
+
+    u64 *next = bits_alloc(words);
+    b32 changed = true;
+
+    while (changed) {
+        changed = false;
+
+        for (u64 b = 1; b < n; b++) {
+            if (!state->reachable[b]) continue;
+
+            for (u64 w = 0; w < words; w++) next[w] = ~0ull;
+
+            for (u64 p = state->predecessor_start[b]; p < state->predecessor_start[b + 1]; p++) {
+                u64 from = state->predecessors[p];
+                if (!state->reachable[from]) continue;
+
+                for (u64 w = 0; w < words; w++) next[w] &= state->dominators[from * words + w];
+            }
+
+            bit_set(next, b);
+
+            u64 *dom = state->dominators + b * words;
+
+            for (u64 w = 0; w < words; w++) {
+                if (dom[w] != next[w]) {
+                    dom[w]  = next[w];
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    mem_free(default_allocator, next);
+}
+
+// natural loops, back edges to the same header are one loop
+static list_t<loop_t> find_loops(loop_function_t *state) {
+    list_t<loop_t> loops = {};
+    list_create(&loops, 8, *default_allocator);
+
+    u64 n = state->blocks.count;
+
+    for (u64 b = 0; b < n; b++) {
+        if (!state->reachable[b]) continue;
+
+        for (u64 s = 0; s < state->blocks[b].successor_count; s++) {
+            u64 header = state->blocks[b].successors[s];
+
+            if (!bit_get(state->dominators + b * state->words, header)) continue;
+
+            loop_t *loop = NULL;
+
+            for (u64 l = 0; l < loops.count; l++) {
+                if (loops[l].header == header) loop = &loops[l];
+            }
+
+            if (loop == NULL) {
+                loop_t created = {};
+                created.header = header;
+                created.body   = (b8*)mem_alloc(default_allocator, n);
+                mem_set((u8*)created.body, 0, n);
+                created.body[header] = true;
+
+                list_add(&loops, &created);
+                loop = &loops[loops.count - 1];
+            }
+
+            list_t<u64> work = {};
+            list_create(&work, 16, *default_allocator);
+
+            if (!loop->body[b]) {
+                loop->body[b] = true;
+                list_add(&work, &b);
+            }
+
+            while (work.count > 0) {
+                u64 block = work[work.count - 1];
+                work.count--;
+
+                for (u64 p = state->predecessor_start[block]; p < state->predecessor_start[block + 1]; p++) {
+                    u64 from = state->predecessors[p];
+
+                    if (loop->body[from] || !state->reachable[from]) continue;
+
+                    loop->body[from] = true;
+                    list_add(&work, &from);
+                }
+            }
+
+            list_delete(&work);
+        }
+    }
+
+    for (u64 l = 0; l < loops.count; l++) {
+        loops[l].size = 0;
+
+        for (u64 b = 0; b < n; b++) {
+            if (loops[l].body[b]) loops[l].size += state->blocks[b].end - state->blocks[b].start;
+        }
+    }
+
+    return loops;
+}
+
+// ------ scan of expressions
+
+static b32 slot_invariant(loop_scan_t *scan, u64 slot) {
+    loop_function_t *state = scan->state;
+
+    if (slot <= state->func->frame_size && scan->written[slot]) return false;
+    if (slot < state->slot_count && state->address_taken[slot]) return false;
+
+    return true;
+}
+
+static loop_value_t leaf_value(s64 start, u64 end, u32 kind) {
+    loop_value_t value = {};
+    value.start = start;
+    value.end   = end;
+    value.kind  = kind;
+    value.leaf  = true;
+    return value;
+}
+
+static loop_value_t read_slot(loop_scan_t *scan, u64 slot, u64 start, u64 end) {
+    if (scan->iv && slot == scan->iv) {
+        loop_value_t value = leaf_value((s64)start, end, LOOP_LINEAR);
+        value.scale = 1;
+        value.exact = true;
+        return value;
+    }
+
+    return leaf_value((s64)start, end, slot_invariant(scan, slot) ? LOOP_INVARIANT : LOOP_VARIANT);
+}
+
+static void push_value(loop_scan_t *scan, loop_value_t value) {
+    list_add(&scan->values, &value);
+}
+
+static loop_value_t pop_value(loop_scan_t *scan) {
+    if (scan->values.count == 0) return leaf_value(-1, 0, LOOP_VARIANT);
+    scan->values.count--;
+    return scan->values.data[scan->values.count];
+}
+
+// value leaves the expression it was part of, the biggest ones get a local
+static void consume(loop_scan_t *scan, loop_value_t value) {
+    if (value.start < 0 || value.leaf) return;
+
+    b32 hoist  = !scan->iv && value.kind == LOOP_INVARIANT && !value.constant;
+    b32 reduce =  scan->iv && value.kind == LOOP_LINEAR    && value.scale != 0;
+
+    if (!hoist && !reduce) return;
+
+    loop_candidate_t candidate = {};
+    candidate.start = (u64)value.start;
+    candidate.end   = value.end;
+    candidate.scale = value.scale;
+
+    list_add(&scan->candidates, &candidate);
+}
+
+static void consume_all(loop_scan_t *scan) {
+    while (scan->values.count > 0) consume(scan, pop_value(scan));
+}
+
+static void binary(loop_scan_t *scan, u64 operation, u64 position) {
+    loop_value_t a = pop_value(scan); // top
+    loop_value_t b = pop_value(scan);
+
+    loop_value_t result = {};
+    result.start = a.start >= 0 && b.start >= 0 ? b.start : -1;
+    result.end   = position;
+    result.kind  = LOOP_VARIANT;
+
+    b32 known = result.start >= 0 && a.kind != LOOP_VARIANT && b.kind != LOOP_VARIANT;
+
+    if (known && a.kind == LOOP_INVARIANT && b.kind == LOOP_INVARIANT) {
+        // hoisted code runs before the loop checks anything, it can't trap
+        b32 safe = (operation != IR_DIV && operation != IR_MOD) || (b.constant && b.value != 0 && b.value != -1);
+
+        if (safe) {
+            result.kind     = LOOP_INVARIANT;
+            result.constant = a.constant && b.constant;
+
+            switch (operation) {
+                case IR_ADD: result.value = (s64)((u64)a.value + (u64)b.value); break;
+                case IR_SUB: result.value = (s64)((u64)a.value - (u64)b.value); break;
+                case IR_MUL: result.value = (s64)((u64)a.value * (u64)b.value); break;
+                default:     result.constant = false; break;
+            }
+        }
+    } else if (known) {
+        // one of them is linear, invariant part of the other one is its constant
+        s64 a_scale = a.kind == LOOP_LINEAR ? a.scale : 0;
+        s64 b_scale = b.kind == LOOP_LINEAR ? b.scale : 0;
+        b32 a_exact = a.kind == LOOP_LINEAR ? a.exact : a.constant;
+        b32 b_exact = b.kind == LOOP_LINEAR ? b.exact : b.constant;
+
+        result.kind  = LOOP_LINEAR;
+        result.exact = a_exact && b_exact;
+
+        switch (operation) {
+            case IR_ADD:
+                result.scale = a_scale + b_scale;
+                result.value = (s64)((u64)a.value + (u64)b.value);
+                break;
+
+            case IR_SUB:
+                result.scale = a_scale - b_scale;
+                result.value = (s64)((u64)a.value - (u64)b.value);
+                break;
+
+            case IR_MUL:
+                if (a.kind == LOOP_LINEAR && b.constant) {
+                    result.scale = a_scale * b.value;
+                    result.value = (s64)((u64)a.value * (u64)b.value);
+                } else if (b.kind == LOOP_LINEAR && a.constant) {
+                    result.scale = b_scale * a.value;
+                    result.value = (s64)((u64)b.value * (u64)a.value);
+                } else {
+                    result.kind = LOOP_VARIANT;
+                }
+                break;
+
+            case IR_SHIFT_LEFT:
+                if (a.kind == LOOP_LINEAR && b.constant && b.value >= 0 && b.value < 32) {
+                    result.scale = a_scale * ((s64)1 << b.value);
+                    result.value = (s64)((u64)a.value << b.value);
+                } else {
+                    result.kind = LOOP_VARIANT;
+                }
+                break;
+
+            default:
+                result.kind = LOOP_VARIANT;
+                break;
+        }
+    }
+
+    if (result.kind == LOOP_VARIANT) {
+        consume(scan, a);
+        consume(scan, b);
+    }
+
+    push_value(scan, result);
+}
+
+static void unary(loop_scan_t *scan, u64 operation, u64 position) {
+    loop_value_t a = pop_value(scan);
+
+    loop_value_t result = a;
+    result.end  = position;
+    result.leaf = false;
+
+    if (a.start < 0 || a.kind == LOOP_VARIANT) {
+        result.kind = LOOP_VARIANT;
+    } else if (operation == IR_NEG) {
+        result.scale = -a.scale;
+        result.value = (s64)(0 - (u64)a.value);
+    } else if (a.kind == LOOP_INVARIANT) {
+        result.constant = false;
+    } else {
+        result.kind = LOOP_VARIANT;
+    }
+
+    if (result.kind == LOOP_VARIANT) consume(scan, a);
+    push_value(scan, result);
+}
+
+static void scan_block(loop_scan_t *scan, loop_block_t *block) {
+    loop_function_t *state = scan->state;
+    scan->values.count = 0;
+
+    for (u64 p = block->start; p < block->end; p++) {
+        ir_opcode_t op   = state->ops[p].op;
+        u64         next = p + 1 < block->end ? state->ops[p + 1].op.operation : IR_NOP;
+
+        switch (op.operation) {
+            case IR_NOP:
+            case IR_ALIGN:
+                break;
+
+            case IR_PUSH_SIGN:
+            case IR_PUSH_UNSIGN: {
+                loop_value_t value = leaf_value((s64)p, p, LOOP_INVARIANT);
+                value.constant = true;
+                value.value    = op.s_operand;
+                push_value(scan, value);
+            } break;
+
+            case IR_PUSH_STACK:
+                push_value(scan, read_slot(scan, op.u_operand, p, p));
+                break;
+
+            case IR_PUSH_GLOBAL:
+                push_value(scan, leaf_value((s64)p, p, bit_get(scan->globals, op.u_operand) ? LOOP_VARIANT : LOOP_INVARIANT));
+                break;
+
+            case IR_PUSH_SEA:
+                if (next == IR_LOAD) {
+                    push_value(scan, read_slot(scan, op.u_operand, p, p + 1));
+                    p++;
+                } else if (is_store(next)) {
+                    loop_value_t value = pop_value(scan);
+
+                    if (scan->iv && op.u_operand == scan->iv) {
+                        // i = i + c, the only write of induction variable stays as it is
+                        if (next == IR_STORE && value.kind == LOOP_LINEAR && value.scale == 1 && value.exact) {
+                            scan->iv_store = p + 1;
+                            scan->iv_step  = value.value;
+                        } else {
+                            scan->iv_valid = false;
+                        }
+                    } else {
+                        consume(scan, value);
+                    }
+
+                    p++;
+                } else {
+                    push_value(scan, leaf_value((s64)p, p, LOOP_INVARIANT));
+                }
+                break;
+
+            case IR_PUSH_GEA:
+                if (next == IR_LOAD) {
+                    u32 kind = op.u_operand < scan->state->program->ir->globals.count && !bit_get(scan->globals, op.u_operand) ? LOOP_INVARIANT : LOOP_VARIANT;
+
+                    push_value(scan, leaf_value((s64)p, p + 1, kind));
+                    p++;
+                } else if (is_store(next)) {
+                    consume(scan, pop_value(scan));
+                    p++;
+                } else {
+                    push_value(scan, leaf_value((s64)p, p, LOOP_INVARIANT));
+                }
+                break;
+
+            case IR_ADD:
+            case IR_SUB:
+            case IR_MUL:
+            case IR_DIV:
+            case IR_MOD:
+            case IR_BIT_AND:
+            case IR_BIT_OR:
+            case IR_BIT_XOR:
+            case IR_SHIFT_LEFT:
+            case IR_SHIFT_RIGHT:
+            case IR_CMP_EQ:
+            case IR_CMP_NEQ:
+            case IR_CMP_LT:
+            case IR_CMP_GT:
+            case IR_CMP_LTE:
+            case IR_CMP_GTE:
+                binary(scan, op.operation, p);
+                break;
+
+            case IR_NEG:
+            case IR_BIT_NOT:
+            case IR_LOG_NOT:
+                unary(scan, op.operation, p);
+                break;
+
+            case IR_LOAD:
+            case IR_LOAD8S:
+            case IR_LOAD8U:
+            case IR_LOAD16S:
+            case IR_LOAD16U:
+            case IR_LOAD32S:
+            case IR_LOAD32U:
+                consume(scan, pop_value(scan));
+                push_value(scan, leaf_value(-1, p, LOOP_VARIANT));
+                break;
+
+            case IR_STORE:
+            case IR_STORE8:
+            case IR_STORE16:
+            case IR_STORE32:
+                consume(scan, pop_value(scan));
+                consume(scan, pop_value(scan));
+                break;
+
+            case IR_POP:
+            case IR_JUMP_IF:
+            case IR_JUMP_IF_NOT:
+                consume(scan, pop_value(scan));
+                break;
+
+            case IR_CLONE:
+                consume(scan, pop_value(scan));
+                push_value(scan, leaf_value(-1, p, LOOP_VARIANT));
+                push_value(scan, leaf_value(-1, p, LOOP_VARIANT));
+                break;
+
+            // calls and the rest take whatever they need, values below them
+            // can't be joined with anything after anyway
+            default:
+                consume_all(scan);
+                break;
+        }
+    }
+}
+
+static void scan_loop(loop_scan_t *scan, loop_t *loop) {
+    loop_function_t *state = scan->state;
+
+    for (u64 b = 0; b < state->blocks.count; b++) {
+        if (loop->body[b]) scan_block(scan, &state->blocks[b]);
+    }
+}
+
+// slots and globals that loop can write, with everything it calls
+static void collect_writes(loop_scan_t *scan, loop_t *loop) {
+    loop_function_t *state   = scan->state;
+    loop_program_t  *program = state->program;
+
+    b32 indirect = false;
+
+    for (u64 b = 0; b < state->blocks.count; b++) {
+        if (!loop->body[b]) continue;
+
+        loop_block_t *block = &state->blocks[b];
+
+        for (u64 p = block->start; p < block->end; p++) {
+            ir_opcode_t op       = state->ops[p].op;
+            u64         next     = p + 1 < block->end ? state->ops[p + 1].op.operation : IR_NOP;
+            u64         previous = p > block->start   ? state->ops[p - 1].op.operation : IR_NOP;
+
+            if (op.operation == IR_PUSH_SEA && is_store(next) && op.u_operand <= state->func->frame_size) {
+                scan->written[op.u_operand] = true;
+            }
+
+            if (op.operation == IR_PUSH_GEA && is_store(next)) {
+                if (op.u_operand < program->ir->globals.count) bit_set(scan->globals, op.u_operand);
+                else indirect = true;
+            }
+
+            if ((is_store(op.operation) && previous != IR_PUSH_GEA && previous != IR_PUSH_SEA) || writes_memory(op.operation)) {
+                indirect = true;
+            }
+
+            if (op.operation == IR_CALL) {
+                loop_summary_t *callee = hashmap_get(&program->summaries, op.string);
+
+                if (callee == NULL) {
+                    indirect = true;
+                    continue;
+                }
+
+                indirect |= callee->indirect;
+
+                for (u64 w = 0; w < program->words; w++) scan->globals[w] |= callee->globals[w];
+            }
+        }
+    }
+
+    if (indirect) {
+        for (u64 w = 0; w < program->words; w++) scan->globals[w] |= program->escaped[w];
+    }
+}
+
+// ------ rewriting
+
+static b32 same_expression(loop_function_t *state, loop_candidate_t *a, loop_candidate_t *b) {
+    if (a->end - a->start != b->end - b->start || a->scale != b->scale) return false;
+
+    for (u64 i = 0; i <= a->end - a->start; i++) {
+        ir_opcode_t x = state->ops[a->start + i].op;
+        ir_opcode_t y = state->ops[b->start + i].op;
+
+        if (x.operation != y.operation || x.u_operand != y.u_operand) return false;
+    }
+
+    return true;
+}
+
+static loop_op_t new_op(loop_function_t *state, u64 operation, u64 operand, token_t info) {
+    loop_op_t op = {};
+    op.op.operation = operation;
+    op.op.u_operand = operand;
+    op.op.info      = info;
+    op.id           = state->next_id++;
+    return op;
+}
+
+// candidates get locals computed in front of header, linear ones also grow
+// after the store of induction variable. Returns count of new locals
+static u64 rewrite_loop(loop_function_t *state, loop_t *loop, list_t<loop_candidate_t> *candidates, loop_scan_t *scan) {
+    u64 slots = 0;
+
+    for (u64 i = 0; i < candidates->count; i++) {
+        loop_candidate_t *candidate = &(*candidates)[i];
+        candidate->slot = 0;
+
+        for (u64 j = 0; j < i; j++) {
+            if ((*candidates)[j].slot && same_expression(state, candidate, &(*candidates)[j])) {
+                candidate->slot = (*candidates)[j].slot;
+                break;
+            }
+        }
+
+        if (candidate->slot == 0 && slots < LOOPS_MAX_SLOTS) {
+            candidate->slot = ++state->func->frame_size;
+            slots++;
+        }
+    }
+
+    if (slots == 0) return 0;
+
+    u64 count  = state->ops.count;
+    u64 header = state->blocks[loop->header].start;
+
+    // by position, slot + 1 when a candidate starts there
+    u64 *replaced = (u64*)mem_alloc(default_allocator, (count + 1) * sizeof(u64));
+    mem_set((u8*)replaced, 0, (count + 1) * sizeof(u64));
+
+    list_t<loop_op_t> preheader = {};
+    list_create(&preheader, 32, *default_allocator);
+
+    for (u64 i = 0; i < candidates->count; i++) {
+        loop_candidate_t *candidate = &(*candidates)[i];
+
+        if (candidate->slot == 0) continue;
+
+        replaced[candidate->start] = i + 1;
+
+        b32 first = true;
+        for (u64 j = 0; j < i; j++) first &= (*candidates)[j].slot != candidate->slot;
+
+        if (!first) continue;
+
+        token_t info = state->ops[candidate->start].op.info;
+
+        for (u64 p = candidate->start; p <= candidate->end; p++) {
+            loop_op_t op = state->ops[p];
+            op.id = state->next_id++;
+            list_add(&preheader, &op);
+        }
+
+        loop_op_t address = new_op(state, IR_PUSH_SEA, candidate->slot, info);
+        loop_op_t store   = new_op(state, IR_STORE, 0, info);
+
+        list_add(&preheader, &address);
+        list_add(&preheader, &store);
+    }
+
+    u64 entry = preheader[0].id;
+
+    list_t<loop_op_t> ops = {};
+    list_create(&ops, count + preheader.count + 16, *default_allocator);
+
+    for (u64 p = 0; p < count; p++) {
+        if (p == header) {
+            for (u64 i = 0; i < preheader.count; i++) list_add(&ops, &preheader[i]);
+        }
+
+        if (replaced[p]) {
+            loop_candidate_t *candidate = &(*candidates)[replaced[p] - 1];
+
+            loop_op_t load = new_op(state, IR_PUSH_STACK, candidate->slot, state->ops[p].op.info);
+            load.id = state->ops[p].id;
+
+            list_add(&ops, &load);
+            p = candidate->end;
+            continue;
+        }
+
+        loop_op_t op = state->ops[p];
+
+        // code before the loop enters through preheader, back edges don't
+        if (is_jump(op.op.operation) && op.target == state->ops[header].id && !loop->body[state->block_of[p]]) {
+            op.target = entry;
+        }
+
+        list_add(&ops, &op);
+
+        if (scan->iv && p == scan->iv_store) {
+            for (u64 i = 0; i < candidates->count; i++) {
+                loop_candidate_t *candidate = &(*candidates)[i];
+
+                b32 first = candidate->slot != 0;
+                for (u64 j = 0; j < i && first; j++) first = (*candidates)[j].slot != candidate->slot;
+
+                if (!first) continue;
+
+                token_t info = op.op.info;
+                loop_op_t step    = new_op(state, IR_PUSH_SIGN,  (u64)(candidate->scale * scan->iv_step), info);
+                loop_op_t load    = new_op(state, IR_PUSH_STACK, candidate->slot, info);
+                loop_op_t add     = new_op(state, IR_ADD,        0, info);
+                loop_op_t address = new_op(state, IR_PUSH_SEA,   candidate->slot, info);
+                loop_op_t store   = new_op(state, IR_STORE,      0, info);
+
+                list_add(&ops, &step);
+                list_add(&ops, &load);
+                list_add(&ops, &add);
+                list_add(&ops, &address);
+                list_add(&ops, &store);
+            }
+        }
+    }
+
+    list_delete(&preheader);
+    list_delete(&state->ops);
+    state->ops = ops;
+
+    state->ops[0].op.u_operand = state->func->frame_size;
+
+    mem_free(default_allocator, replaced);
+    return slots;
+}
+
+// code in front of header runs only when loop is entered
+static b32 has_preheader_place(loop_function_t *state, loop_t *loop) {
+    u64 header = state->blocks[loop->header].start;
+
+    if (header == 0) return false;
+
+    u64 before = state->block_of[header - 1];
+    u64 last   = state->ops[header - 1].op.operation;
+
+    return !loop->body[before] || last == IR_JUMP || last == IR_RET || last == IR_INVALID;
+}
+
+static u64 hoist_invariants(loop_function_t *state, loop_t *loop) {
+    loop_scan_t scan = {};
+    scan.state   = state;
+    scan.written = (b8*)mem_alloc(default_allocator, state->func->frame_size + 1);
+    scan.globals = bits_alloc(state->program->words);
+    mem_set((u8*)scan.written, 0, state->func->frame_size + 1);
+
+    list_create(&scan.values,     16, *default_allocator);
+    list_create(&scan.candidates, 16, *default_allocator);
+
+    collect_writes(&scan, loop);
+    scan_loop(&scan, loop);
+
+    u64 slots = rewrite_loop(state, loop, &scan.candidates, &scan);
+
+    list_delete(&scan.values);
+    list_delete(&scan.candidates);
+    mem_free(default_allocator, scan.written);
+    mem_free(default_allocator, scan.globals);
+    return slots;
+}
+
+static u64 reduce_strength(loop_function_t *state, loop_t *loop) {
+    loop_scan_t scan = {};
+    scan.state   = state;
+    scan.written = (b8*)mem_alloc(default_allocator, state->func->frame_size + 1);
+    scan.globals = bits_alloc(state->program->words);
+    mem_set((u8*)scan.written, 0, state->func->frame_size + 1);
+
+    list_create(&scan.values,     16, *default_allocator);
+    list_create(&scan.candidates, 16, *default_allocator);
+
+    collect_writes(&scan, loop);
+
+    // induction variable is a local written once in loop
+    u64 *writes = (u64*)mem_alloc(default_allocator, (state->func->frame_size + 1) * sizeof(u64));
+    mem_set((u8*)writes, 0, (state->func->frame_size + 1) * sizeof(u64));
+
+    for (u64 b = 0; b < state->blocks.count; b++) {
+        if (!loop->body[b]) continue;
+
+        for (u64 p = state->blocks[b].start; p + 1 < state->blocks[b].end; p++) {
+            ir_opcode_t op = state->ops[p].op;
+
+            if (op.operation == IR_PUSH_SEA && is_store(state->ops[p + 1].op.operation) && op.u_operand <= state->func->frame_size) {
+                writes[op.u_operand]++;
+            }
+        }
+    }
+
+    u64 slots = 0;
+
+    for (u64 slot = 1; slot <= state->func->frame_size && slots == 0; slot++) {
+        if (writes[slot] != 1) continue;
+        if (slot < state->slot_count && state->address_taken[slot]) continue;
+
+        scan.iv       = slot;
+        scan.iv_valid = true;
+        scan.iv_store = 0;
+        scan.values.count     = 0;
+        scan.candidates.count = 0;
+
+        scan_loop(&scan, loop);
+
+        if (!scan.iv_valid || scan.iv_store == 0 || scan.candidates.count == 0) continue;
+
+        slots = rewrite_loop(state, loop, &scan.candidates, &scan);
+    }
+
+    mem_free(default_allocator, writes);
+    list_delete(&scan.values);
+    list_delete(&scan.candidates);
+    mem_free(default_allocator, scan.written);
+    mem_free(default_allocator, scan.globals);
+    return slots;
+}
+
+static void code_from_function(loop_function_t *state, ir_function_t *func) {
+    u64 count = func->code.count;
+
+    state->func    = func;
+    state->end     = count;
+    state->next_id = count + 1;
+
+    list_create(&state->ops, count + 16, *default_allocator);
+
+    state->slot_count = func->frame_size + 1;
+
+    for (u64 i = 0; i < count; i++) {
+        loop_op_t op = {};
+        op.op = func->code[i];
+        op.id = i;
+
+        if (is_jump(op.op.operation)) {
+            op.target = (u64)((s64)i + 1 + op.op.s_operand);
+        }
+
+        if (op.op.operation == IR_PUSH_STACK || op.op.operation == IR_PUSH_SEA) {
+            state->slot_count = MAX(state->slot_count, op.op.u_operand + 1);
+        }
+
+        list_add(&state->ops, &op);
+    }
+
+    state->address_taken = (b8*)mem_alloc(default_allocator, state->slot_count);
+    mem_set((u8*)state->address_taken, 0, state->slot_count);
+
+    for (u64 i = 0; i < count; i++) {
+        ir_opcode_t op   = state->ops[i].op;
+        u64         next = i + 1 < count ? state->ops[i + 1].op.operation : IR_NOP;
+
+        if (op.operation == IR_PUSH_SEA && next != IR_LOAD && !is_store(next)) {
+            state->address_taken[op.u_operand] = true;
+        }
+    }
+}
+
+static void code_to_function(loop_function_t *state) {
+    u64 count = state->ops.count;
+
+    u64 *position = (u64*)mem_alloc(default_allocator, (state->next_id + 1) * sizeof(u64));
+    mem_set((u8*)position, 0, (state->next_id + 1) * sizeof(u64));
+
+    for (u64 i = 0; i < count; i++) position[state->ops[i].id] = i;
+    position[state->end] = count;
+
+    array_t<ir_opcode_t> result = {};
+    array_create(&result, count + 1, state->func->code.alloc);
+
+    for (u64 i = 0; i < count; i++) {
+        ir_opcode_t op = state->ops[i].op;
+        op.index = i;
+
+        if (is_jump(op.operation)) {
+            op.s_operand = (s64)position[state->ops[i].target] - (s64)(i + 1);
+        }
+
+        array_add(&result, op);
+    }
+
+    array_delete(&state->func->code);
+    state->func->code = result;
+
+    mem_free(default_allocator, position);
+}
+
+static void optimize_function(loop_program_t *program, ir_function_t *func, loops_stats_t *stats) {
+    loop_function_t state = {};
+    state.program = program;
+
+    code_from_function(&state, func);
+
+    // header id -> 1 when invariants are hoisted, 2 when done
+    hashmap_t<u64, u64> phases = {};
+    hashmap_create(&phases, 16, NULL, NULL);
+
+    b32 changed = false;
+
+    while (true) {
+        build_blocks(&state);
+        list_t<loop_t> loops = find_loops(&state);
+
+        loop_t *loop  = NULL;
+        u64     phase = 0;
+
+        for (u64 l = 0; l < loops.count; l++) {
+            u64 *found = hashmap_get(&phases, state.ops[state.blocks[loops[l].header].start].id);
+            u64  value = found ? *found : 0;
+
+            if (value >= 2) continue;
+
+            // innermost first, their preheaders become a part of outer loops
+            if (loop == NULL || loops[l].size < loop->size) {
+                loop  = &loops[l];
+                phase = value;
+            }
+        }
+
+        if (loop != NULL) {
+            u64 id = state.ops[state.blocks[loop->header].start].id;
+
+            if (!has_preheader_place(&state, loop)) {
+                phase = 2;
+            } else if (phase == 0) {
+                if (hashmap_get(&phases, id) == NULL) stats->loops++;
+
+                u64 slots = hoist_invariants(&state, loop);
+                stats->hoisted += slots;
+                changed |= slots > 0;
+                phase = 1;
+            } else {
+                u64 slots = reduce_strength(&state, loop);
+                stats->reduced += slots;
+                changed |= slots > 0;
+                phase = 2;
+            }
+
+            if (hashmap_get(&phases, id)) *hashmap_get(&phases, id) = phase;
+            else                          hashmap_add(&phases, id, &phase);
+        }
+
+        for (u64 l = 0; l < loops.count; l++) mem_free(default_allocator, loops[l].body);
+        list_delete(&loops);
+
+        free_blocks(&state);
+
+        if (loop == NULL) break;
+    }
+
+    if (changed) code_to_function(&state);
+
+    hashmap_delete(&phases);
+    list_delete(&state.ops);
+    mem_free(default_allocator, state.address_taken);
+}
+
+void loops_optimize(ir_t *ir, loops_stats_t *stats) {
+    profiler_func_start();
+
+    loop_program_t program = {};
+    program.ir = ir;
+
+    summarize_program(&program);
+
+    for (u64 i = 0; i < ir->functions.capacity; i++) {
+        kv_pair_t<string_t, ir_function_t> *pair = ir->functions.entries + i;
+
+        if (!pair->occupied || pair->deleted) continue;
+        if (pair->value.is_external || pair->value.code.count == 0) continue;
+        if (pair->value.code[0].operation != IR_STACK_FRAME_PUSH) continue;
+
+        optimize_function(&program, &pair->value, stats);
+    }
+
+    delete_program(&program);
+    profiler_func_end();
+}
@@ -5,6 +5,7 @@
 #include "arena.h"
 #include "strings.h"
 #include "sorter.h"
+#include "talloc.h"
 
 #include "compiler.h"
 #include "arg_parser.h"
@@ -50,6 +51,7 @@ void init(void) {
 void showhelp(void) {
     log_push_color(INFO_COLOR);
     log_write("usage: prog [options] [files]\n");
+    log_write("       prog run [file.slmbc] [interpreter options]\n");
     log_write("\n");
     log_write("options:\n");
     log_write("    --help\n");
@@ -58,9 +60,101 @@ void showhelp(void) {
     log_write("    --version\n");
     log_write("    --link-time\n");
     log_write("    --output [filename, no file extension]\n");
+    log_write("    --emit-bytecode [write interpretable module instead of executable]\n");
+    log_write("    --strip-debug   [no line info in module]\n");
+    log_write("    --comptime-cache [keep comptime results in <output>.slmcache between builds]\n");
+    log_write("    --debug-info=none|lines|full [source lines in assembly, default is lines]\n");
+    log_write("    --backend=nasm|x64|c [x64 writes linux executable without external tools, c builds <output>.c with cc -O2]\n");
+    log_write("    --target=win64|linux [what nasm backend writes for, default is this system]\n");
+    log_write("    --emit-object   [x64 backend writes ELF object instead of executable]\n");
+    log_write("    --run           [runs main as native code in memory, nothing is written]\n");
+    log_write("    --jobs=N        [threads for code generation, default is one per processor]\n");
+    log_write("    --profile-generate=file [runs main in interpreter and writes its branch and call counts]\n");
+    log_write("    --profile-use=file      [inlines hot calls, moves cold blocks away, aligns hot loops]\n");
+    log_write("\n");
+    log_write("interpreter options:\n");
+    log_write("    --interp-profile [print opcode, function and line counters]\n");
+    log_write("    --interp-profile-json [filename]\n");
+    log_write("    --interp-step-limit [count, stops endless compile time loops]\n");
     log_pop_color();
 }
 
+// returns true if argument was an interpreter option
+b32 parse_interpreter_option(argument_t arg, u64 *waiting) {
+    if (*waiting != ARG_UNKN) {
+        if (arg.type != ARG_UNKN) {
+            log_error(string_format(get_temporary_allocator(), STRING("Expected value for the option before '%s'"), arg.content));
+            *waiting = ARG_ERROR;
+            return true;
+        }
+
+        if (*waiting == ARG_INTERP_PROFILE_JSON) {
+            compiler_config.interp_profile_json = arg.content;
+        } else if (!parse_argument_number(arg.content, &compiler_config.interp_step_limit)) {
+            log_error(string_format(get_temporary_allocator(), STRING("Step limit should be a number, got '%s'"), arg.content));
+            *waiting = ARG_ERROR;
+            return true;
+        }
+
+        *waiting = ARG_UNKN;
+        return true;
+    }
+
+    switch (arg.type) {
+        case ARG_INTERP_PROFILE:
+            compiler_config.interp_profile = true;
+            return true;
+
+        case ARG_INTERP_PROFILE_JSON:
+        case ARG_INTERP_STEP_LIMIT:
+            *waiting = arg.type;
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+int run_module(int argc, char **argv) {
+    string_t module = {};
+    u64 waiting = ARG_UNKN;
+
+    for (u64 i = 2; i < (u64)argc; i++) {
+        argument_t arg = parse_argument(STRING(argv[i]));
+
+        if (parse_interpreter_option(arg, &waiting)) {
+            if (waiting == ARG_ERROR) return -1;
+            continue;
+        }
+
+        if (arg.type != ARG_UNKN || module.data != NULL) {
+            log_error(string_format(get_temporary_allocator(), STRING("Unexpected argument '%s'"), arg.content));
+            return -1;
+        }
+
+        module = arg.content;
+    }
+
+    if (waiting != ARG_UNKN) {
+        log_error("Not recieved value of the last option!");
+        return -1;
+    }
+
+    if (module.data == NULL) {
+        log_error("Expected module to run!");
+        return -1;
+    }
+
+    s64 exit_code = 0;
+
+    profiler_begin(STRING("PROF"));
+    b32 status = run_bytecode(module, &exit_code);
+    Profile_Data data = profiler_end();
+    profiler_data_delete(&data);
+
+    return status ? (int)exit_code : -1;
+}
+
 int main(int argc, char **argv) {
     init();
 
@@ -70,6 +164,12 @@ int main(int argc, char **argv) {
         return 0;
     }
 
+    if (string_compare(STRING(argv[1]), STRING("run")) == 0) {
+        int exit_code = run_module(argc, argv);
+        log_reset_color();
+        return exit_code;
+    }
+
     compiler_t state = create_compiler_instance(NULL);
     if (!state.valid) {
         log_error(STRING("Initialization of compiler is failed"));
@@ -84,11 +184,18 @@ int main(int argc, char **argv) {
     b32 status = true;
     b32 at_least_one_file_loaded = false;
     b32 wait_for_output_filename = false;
+    u64 wait_for_option = ARG_UNKN;
 
     profiler_push("Load and process");
     for (u64 i = 1; i < (u64)argc; i++) {
         argument_t arg = parse_argument(STRING(argv[i]));
 
+        if (parse_interpreter_option(arg, &wait_for_option)) {
+            if (wait_for_option == ARG_ERROR) status = false;
+            if (!status) break;
+            continue;
+        }
+
         switch (arg.type) {
             case ARG_ERROR:
                 status = false;
@@ -118,6 +225,78 @@ int main(int argc, char **argv) {
                 compiler_config.verbose = true;
                 break;
 
+            case ARG_EMIT_BYTECODE:
+                compiler_config.emit_bytecode = true;
+                break;
+
+            case ARG_STRIP_DEBUG:
+                compiler_config.strip_debug = true;
+                break;
+
+            case ARG_COMPTIME_CACHE:
+                compiler_config.comptime_cache = true;
+                break;
+
+            case ARG_DEBUG_INFO:
+                if (string_compare(arg.content, STRING("none")) == 0) {
+                    compiler_config.debug_info = DEBUG_INFO_NONE;
+                } else if (string_compare(arg.content, STRING("lines")) == 0) {
+                    compiler_config.debug_info = DEBUG_INFO_LINES;
+                } else if (string_compare(arg.content, STRING("full")) == 0) {
+                    compiler_config.debug_info = DEBUG_INFO_FULL;
+                } else {
+                    log_error(string_format(get_temporary_allocator(), STRING("Unknown debug info level '%s'"), arg.content));
+                    status = false;
+                }
+                break;
+
+            case ARG_BACKEND:
+                if (string_compare(arg.content, STRING("nasm")) == 0) {
+                    compiler_config.backend = BACKEND_NASM;
+                } else if (string_compare(arg.content, STRING("x64")) == 0) {
+                    compiler_config.backend = BACKEND_X64;
+                } else if (string_compare(arg.content, STRING("c")) == 0) {
+                    compiler_config.backend = BACKEND_C;
+                } else {
+                    log_error(string_format(get_temporary_allocator(), STRING("Unknown backend '%s'"), arg.content));
+                    status = false;
+                }
+                break;
+
+            case ARG_TARGET:
+                if (string_compare(arg.content, STRING("win64")) == 0) {
+                    compiler_config.target = TARGET_WIN64;
+                } else if (string_compare(arg.content, STRING("linux")) == 0) {
+                    compiler_config.target = TARGET_LINUX;
+                } else {
+                    log_error(string_format(get_temporary_allocator(), STRING("Unknown target '%s'"), arg.content));
+                    status = false;
+                }
+                break;
+
+            case ARG_EMIT_OBJECT:
+                compiler_config.emit_object = true;
+                break;
+
+            case ARG_RUN:
+                compiler_config.run = true;
+                break;
+
+            case ARG_JOBS:
+                if (!parse_argument_number(arg.content, &compiler_config.jobs)) {
+                    log_error(string_format(get_temporary_allocator(), STRING("Wrong number of jobs '%s'"), arg.content));
+                    status = false;
+                }
+                break;
+
+            case ARG_PROFILE_GENERATE:
+                compiler_config.profile_generate = arg.content;
+                break;
+
+            case ARG_PROFILE_USE:
+                compiler_config.profile_use = arg.content;
+                break;
+
             case ARG_OUTPUT_FILE_NAME:
                 wait_for_output_filename = true;
                 break;
@@ -128,7 +307,7 @@ int main(int argc, char **argv) {
                     wait_for_output_filename = false;
                     break;
                 } 
-                if (load_and_process_file(&state, arg.content)) {
+                if (load_and_process_file(&state, arg.content, false)) {
                     at_least_one_file_loaded = true;
                 } else {
                     status = false;
@@ -144,13 +323,16 @@ int main(int argc, char **argv) {
         if (wait_for_output_filename) {
             log_error("Not recieved output file name!");
             status = false;
+        } else if (wait_for_option != ARG_UNKN) {
+            log_error("Not recieved value of the last option!");
+            status = false;
         } else if (!at_least_one_file_loaded) {
             log_error("No files to compile!");
             status = false;
         }
     }
 
-    if (status) compile(&state);
+    if (status) status = compile(&state);
 
     Profile_Data data;
 
@@ -159,12 +341,12 @@ int main(int argc, char **argv) {
     data = profiler_end();
 //#endif
 
-    if (status) {
-        log_update_color();
-        visualize_profiler_state(data.block, 0);
-        profiler_data_delete(&data);
-    }
+    log_update_color();
+    visualize_profiler_state(data.block, 0);
+    profiler_data_delete(&data);
 
     log_reset_color();
-    return 0;
+
+    if (!status) return 1;
+    return compiler_config.run ? (int)state.exit_code : 0;
 }
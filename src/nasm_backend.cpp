@@ -4,25 +4,53 @@
 #include "talloc.h"
 #include "strings.h"
 #include "profiler.h"
+#include "sorter.h"
+#include "sink.h"
+#include "jobs.h"
+
+// Top of the exec stack is kept in registers while we are inside of a basic
+// block, entry i of the cache lives in cache_registers[(cache_base + i) % NASM_CACHE_SIZE].
+// Cache is written back before calls, returns, jumps and jump targets,
+// so every block starts and ends with the whole stack in memory.
+// Results of float ops stay in the xmm register paired with the entry,
+// they get to the general one only when something else reads them.
+#define NASM_CACHE_SIZE 3
+
+static const char *cache_registers[NASM_CACHE_SIZE]       = { "rsi", "rdi", "r8" };
+static const char *cache_float_registers[NASM_CACHE_SIZE] = { "xmm1", "xmm2", "xmm3" };
+
+// putchar buffer of linux runtime
+#define NASM_OUTPUT_BUFFER_SIZE KB(64)
+
+// Scalar locals that never have their address taken live in callee saved
+// registers, see nasm_allocate_registers. Function saves the ones it uses
+// right after its frame.
+#define NASM_LOCAL_REGISTERS 3
+
+static const char *local_registers[NASM_LOCAL_REGISTERS] = { "rbx", "r12", "r13" };
 
 struct nasm_state_t {
     ir_t       *ir;
-    list_t<u8> code;
+    sink_t     *output;
     ir_function_t    *func;
     stack_t<string_t> labels;
-};
 
-    // @todo @speed...
-void nasm_add_string(nasm_state_t *state, string_t data, u64 tab = 0) {
-    u64 i;
-    u8 *v;
+    u64 cache_base;
+    u64 cache_count;
+    b8  cache_float[NASM_CACHE_SIZE]; // by register, not by entry
+    b8 *jump_targets;
 
-    list_allocate(&state->code, tab * 4, &i);
-    v = list_get(&state->code, i);
-    mem_set(v, ' ', tab * 4);
+    scanner_t *line_from; // last %line directive, see nasm_insert_line
+    u64        line;
 
-    list_allocate(&state->code, data.size, &i);
-    list_fill(&state->code, data.data, data.size, i);
+    u64 slot_count;
+    s8 *slot_registers;  // index into local_registers, -1 when slot stays in memory
+    u64 saved_registers; // bit per local register used by function
+};
+
+void nasm_add_string(nasm_state_t *state, string_t data, u64 tab = 0) {
+    sink_fill(state->output, ' ', tab * 4);
+    sink_write(state->output, data.data, data.size);
 }
 
 inline void nasm_add_line(nasm_state_t *state, string_t data, u64 tab = 0) {
@@ -31,34 +59,236 @@ inline void nasm_add_line(nasm_state_t *state, string_t data, u64 tab = 0) {
 }
 
 
-#define INSERT_LINE() nasm_add_line(state, string_format(get_temporary_allocator(), STRING("%%line %u \"%s\""), op.info.l0, op.info.from->filename), 1)
-#define LOAD(reg)\
-                INSERT_LINE();\
-                nasm_add_line(state, STRING("dec r15"), 1);\
-                INSERT_LINE();\
-                nasm_add_line(state, STRING("mov " reg ", QWORD[r14 + r15 * 8]"), 1);
+// directive stays in effect for every next line, so it is repeated only when source line changes
+static void nasm_insert_line(nasm_state_t *state, ir_opcode_t op) {
+    if (compiler_config.debug_info == DEBUG_INFO_NONE) return;
+    if (op.info.from == NULL) return;
+    if (op.info.from == state->line_from && op.info.l0 == state->line) return;
 
-#define STORE(reg)\
-                INSERT_LINE();\
-                nasm_add_line(state, STRING("mov QWORD[r14 + r15 * 8], " reg), 1);\
-                INSERT_LINE();\
-                nasm_add_line(state, STRING("inc r15"), 1);
+    state->line_from = op.info.from;
+    state->line      = op.info.l0;
+
+    nasm_add_line(state, string_format(get_temporary_allocator(), STRING("%%line %u \"%s\""), op.info.l0, op.info.from->filename), 1);
+}
+
+#define INSERT_LINE() nasm_insert_line(state, op)
+
+static inline string_t cache_register(nasm_state_t *state, u64 index) {
+    return STRING(cache_registers[(state->cache_base + index) % NASM_CACHE_SIZE]);
+}
+
+static inline string_t cache_float_register(nasm_state_t *state, u64 index) {
+    return STRING(cache_float_registers[(state->cache_base + index) % NASM_CACHE_SIZE]);
+}
+
+static inline b8 *cache_is_float(nasm_state_t *state, u64 index) {
+    return state->cache_float + (state->cache_base + index) % NASM_CACHE_SIZE;
+}
+
+// writes cache entry to exec stack memory
+static void nasm_spill(nasm_state_t *state, ir_opcode_t op, u64 index, string_t memory) {
+    INSERT_LINE();
+
+    if (*cache_is_float(state, index)) {
+        nasm_add_line(state, string_format(get_temporary_allocator(), STRING("movsd %s, %s"), memory, cache_float_register(state, index)), 1);
+    } else {
+        nasm_add_line(state, string_format(get_temporary_allocator(), STRING("mov %s, %s"), memory, cache_register(state, index)), 1);
+    }
+
+    *cache_is_float(state, index) = false;
+}
+
+// float entry goes to its general register
+static void nasm_unfloat(nasm_state_t *state, ir_opcode_t op, u64 index) {
+    if (!*cache_is_float(state, index)) return;
+
+    INSERT_LINE();
+    nasm_add_line(state, string_format(get_temporary_allocator(), STRING("movq %s, %s"), cache_register(state, index), cache_float_register(state, index)), 1);
+
+    *cache_is_float(state, index) = false;
+}
+
+static void nasm_flush_cache(nasm_state_t *state, ir_opcode_t op) {
+    if (state->cache_count == 0) return;
+
+    for (u64 i = 0; i < state->cache_count; i++) {
+        nasm_spill(state, op, i, string_format(get_temporary_allocator(), STRING("QWORD[r14 + r15 * 8 + %u]"), i * 8));
+    }
+
+    INSERT_LINE();
+    nasm_add_line(state, string_format(get_temporary_allocator(), STRING("add r15, %u"), state->cache_count), 1);
+
+    state->cache_base  = 0;
+    state->cache_count = 0;
+}
+
+// when cache is full its bottom goes to memory
+static void nasm_make_room(nasm_state_t *state, ir_opcode_t op) {
+    if (state->cache_count < NASM_CACHE_SIZE) return;
+
+    nasm_spill(state, op, 0, STRING("QWORD[r14 + r15 * 8]"));
+    INSERT_LINE();
+    nasm_add_line(state, STRING("inc r15"), 1);
+
+    state->cache_base = (state->cache_base + 1) % NASM_CACHE_SIZE;
+    state->cache_count--;
+}
+
+// emits "instruction <new top>, operand"
+static void nasm_push(nasm_state_t *state, ir_opcode_t op, string_t instruction, string_t operand) {
+    nasm_make_room(state, op);
+
+    string_t reg = cache_register(state, state->cache_count);
+    *cache_is_float(state, state->cache_count) = false;
+    state->cache_count++;
+
+    if (string_compare(instruction, STRING("mov")) == 0 && string_compare(reg, operand) == 0) return;
+
+    INSERT_LINE();
+    nasm_add_line(state, string_format(get_temporary_allocator(), STRING("%s %s, %s"), instruction, reg, operand), 1);
+}
+
+// same as nasm_push, new top is in xmm register
+static void nasm_push_float(nasm_state_t *state, ir_opcode_t op, string_t instruction, string_t operand) {
+    nasm_make_room(state, op);
+
+    string_t reg = cache_float_register(state, state->cache_count);
+    *cache_is_float(state, state->cache_count) = true;
+    state->cache_count++;
+
+    if (string_compare(instruction, STRING("movapd")) == 0 && string_compare(reg, operand) == 0) return;
+
+    INSERT_LINE();
+    nasm_add_line(state, string_format(get_temporary_allocator(), STRING("%s %s, %s"), instruction, reg, operand), 1);
+}
+
+// returns register with the old top, it stays valid until next push
+static string_t nasm_pop_operand(nasm_state_t *state, ir_opcode_t op, string_t fallback) {
+    if (state->cache_count > 0) {
+        state->cache_count--;
+        nasm_unfloat(state, op, state->cache_count);
+        return cache_register(state, state->cache_count);
+    }
+
+    INSERT_LINE();
+    nasm_add_line(state, STRING("dec r15"), 1);
+    INSERT_LINE();
+    nasm_add_line(state, string_format(get_temporary_allocator(), STRING("mov %s, QWORD[r14 + r15 * 8]"), fallback), 1);
+    return fallback;
+}
+
+// same as nasm_pop_operand, but the old top is in xmm register
+static string_t nasm_pop_float(nasm_state_t *state, ir_opcode_t op, string_t fallback) {
+    if (state->cache_count > 0) {
+        state->cache_count--;
+        string_t reg = cache_float_register(state, state->cache_count);
+
+        if (!*cache_is_float(state, state->cache_count)) {
+            INSERT_LINE();
+            nasm_add_line(state, string_format(get_temporary_allocator(), STRING("movq %s, %s"), reg, cache_register(state, state->cache_count)), 1);
+        }
+
+        return reg;
+    }
+
+    INSERT_LINE();
+    nasm_add_line(state, STRING("dec r15"), 1);
+    INSERT_LINE();
+    nasm_add_line(state, string_format(get_temporary_allocator(), STRING("movsd %s, QWORD[r14 + r15 * 8]"), fallback), 1);
+    return fallback;
+}
+
+static void nasm_pop(nasm_state_t *state, ir_opcode_t op, string_t reg) {
+    string_t operand = nasm_pop_operand(state, op, reg);
+
+    if (string_compare(operand, reg) != 0) {
+        INSERT_LINE();
+        nasm_add_line(state, string_format(get_temporary_allocator(), STRING("mov %s, %s"), reg, operand), 1);
+    }
+}
+
+static const char *call_scratch[NASM_CACHE_SIZE] = { "rax", "rcx", "rdx" };
+
+// Register arguments are the top count entries of the stack, callee expects
+// them as its whole cache: first parameter (top) in cache_registers[count - 1].
+// Deeper entries go to memory, missing ones are loaded from it.
+static void nasm_prepare_call(nasm_state_t *state, ir_opcode_t op, u64 count) {
+    allocator_t *talloc = get_temporary_allocator();
+
+    if (state->cache_count > count) {
+        u64 spill = state->cache_count - count;
+
+        for (u64 i = 0; i < spill; i++) {
+            nasm_spill(state, op, i, string_format(talloc, STRING("QWORD[r14 + r15 * 8 + %u]"), i * 8));
+        }
+
+        INSERT_LINE();
+        nasm_add_line(state, string_format(talloc, STRING("add r15, %u"), spill), 1);
+
+        state->cache_base  = (state->cache_base + spill) % NASM_CACHE_SIZE;
+        state->cache_count = count;
+    }
+
+    // callee expects arguments in general registers
+    for (u64 i = 0; i < state->cache_count; i++) {
+        nasm_unfloat(state, op, i);
+    }
+
+    if (state->cache_base == 0 && state->cache_count == count) return;
+
+    u64 cached = state->cache_count;
+
+    // d is depth from the top, it ends up in cache_registers[count - 1 - d],
+    // single cached entry can go there directly since loads only fill the others
+    const char **scratch = cached > 1 ? call_scratch : cache_registers + count - 1;
+
+    for (u64 d = 0; d < cached; d++) {
+        INSERT_LINE();
+        nasm_add_line(state, string_format(talloc, STRING("mov %s, %s"), STRING(scratch[d]), cache_register(state, cached - 1 - d)), 1);
+    }
+
+    for (u64 d = cached; d < count; d++) {
+        INSERT_LINE();
+        nasm_add_line(state, string_format(talloc, STRING("mov %s, QWORD[r14 + r15 * 8 - %u]"), STRING(cache_registers[count - 1 - d]), (d - cached + 1) * 8), 1);
+    }
+
+    for (u64 d = 0; d < cached && scratch == call_scratch; d++) {
+        INSERT_LINE();
+        nasm_add_line(state, string_format(talloc, STRING("mov %s, %s"), STRING(cache_registers[count - 1 - d]), STRING(call_scratch[d])), 1);
+    }
+
+    if (count > cached) {
+        INSERT_LINE();
+        nasm_add_line(state, string_format(talloc, STRING("sub r15, %u"), count - cached), 1);
+    }
+
+    state->cache_base  = 0;
+    state->cache_count = count;
+}
+
+#define LOAD(reg)  nasm_pop(state, op, STRING(reg));
+#define STORE(reg) nasm_push(state, op, STRING("mov"), STRING(reg));
 
-#define BINOP(action)\
+#define POP_OPERAND(name, fallback) string_t name = nasm_pop_operand(state, op, STRING(fallback));
+#define POP_FLOAT(name, fallback)   string_t name = nasm_pop_float(state, op, STRING(fallback));
+
+#define BINOP(action) {\
                 LOAD("rax");\
-                LOAD("rbx");\
+                POP_OPERAND(b, "r9");\
                 INSERT_LINE();\
-                nasm_add_line(state, STRING(action" rax, rbx"), 1);\
-                STORE("rax");
+                nasm_add_line(state, string_format(talloc, STRING(action" rax, %s"), b), 1);\
+                STORE("rax");\
+            }
 
-#define DIVOP(result_reg)\
+#define DIVOP(result_reg) {\
                 LOAD("rax");\
                 INSERT_LINE();\
                 nasm_add_line(state, STRING("cqo"), 1);\
-                LOAD("rbx");\
+                POP_OPERAND(b, "r9");\
                 INSERT_LINE();\
-                nasm_add_line(state, STRING("idiv rbx"), 1);\
-                STORE(result_reg);
+                nasm_add_line(state, string_format(talloc, STRING("idiv %s"), b), 1);\
+                STORE(result_reg);\
+            }
 
 #define SHIFTOP(action)\
                 LOAD("rax");\
@@ -68,18 +298,714 @@ inline void nasm_add_line(nasm_state_t *state, string_t data, u64 tab = 0) {
                 STORE("rax");
 
 
-#define BINCMPOP(cmov)\
+#define BINCMPOP(cmov) {\
                 INSERT_LINE();\
                 nasm_add_line(state, STRING("xor rcx, rcx"), 1);\
-                LOAD("rax");\
-                LOAD("rbx");\
+                POP_OPERAND(a, "rax");\
+                POP_OPERAND(b, "r9");\
                 INSERT_LINE();\
-                nasm_add_line(state, STRING("cmp rax, rbx"), 1);\
+                nasm_add_line(state, string_format(talloc, STRING("cmp %s, %s"), a, b), 1);\
                 INSERT_LINE();\
                 nasm_add_line(state, STRING("mov rax, 1"), 1);\
                 INSERT_LINE();\
                 nasm_add_line(state, STRING(cmov" rcx, rax"), 1);\
-                STORE("rcx");
+                STORE("rcx");\
+            }
+
+#define SIZED_LOADOP(action) {\
+                POP_OPERAND(address, "r9");\
+                INSERT_LINE();\
+                nasm_add_line(state, string_format(talloc, STRING(action), address), 1);\
+                STORE("rax");\
+            }
+
+#define SIZED_STOREOP(action) {\
+                POP_OPERAND(address, "r9");\
+                LOAD("rax");\
+                INSERT_LINE();\
+                nasm_add_line(state, string_format(talloc, STRING(action), address), 1);\
+            }
+
+// a is computed in place, it is either free register of popped entry or xmm0
+#define FBINOP(action, commutative) {\
+                POP_FLOAT(a, "xmm0");\
+                POP_FLOAT(b, "xmm4");\
+                string_t result = a;\
+                INSERT_LINE();\
+                if (commutative && string_compare(b, cache_float_register(state, state->cache_count)) == 0) {\
+                    nasm_add_line(state, string_format(talloc, STRING(action" %s, %s"), b, a), 1);\
+                    result = b;\
+                } else {\
+                    nasm_add_line(state, string_format(talloc, STRING(action" %s, %s"), a, b), 1);\
+                }\
+                nasm_push_float(state, op, STRING("movapd"), result);\
+            }
+
+// ucomisd sets flags like unsigned compare and CF = ZF = PF = 1 when unordered,
+// a < b is done as b > a, so above and above or equal are false for NaN
+static string_t nasm_float_compare(nasm_state_t *state, ir_opcode_t op) {
+    POP_FLOAT(a, "xmm0");
+    POP_FLOAT(b, "xmm4");
+
+    if (op.operation == IR_FCMP_LT || op.operation == IR_FCMP_LTE) return string_format(get_temporary_allocator(), STRING("ucomisd %s, %s"), b, a);
+    return string_format(get_temporary_allocator(), STRING("ucomisd %s, %s"), a, b);
+}
+
+// ------ vectors, they live in exec stack memory, 128 bit ones are SSE, 256 bit ones AVX2
+
+// a is the top entries, lane-wise a op b goes into place of b
+static void nasm_vector_binary(nasm_state_t *state, ir_opcode_t op) {
+    allocator_t *talloc = get_temporary_allocator();
+    backend_vector_op_t select = {};
+
+    nasm_flush_cache(state, op);
+
+    // IR generation doesn't emit those
+    if (!backend_select_vector(op.operation, op.u_operand, &select)) {
+        assert(false);
+        INSERT_LINE();
+        nasm_add_line(state, STRING("ud2"), 1);
+        return;
+    }
+
+    u64 entries = ir_vector_entries(op.u_operand);
+    b32 wide    = entries == 4;
+    string_t r  = wide ? STRING("ymm") : STRING("xmm");
+
+    string_t imm = select.imm >= 0 ? string_format(talloc, STRING(", %u"), (u64)select.imm) : STRING("");
+    string_t dst = string_format(talloc, STRING("%s%u"), r, (u64)select.dst);
+    string_t src = string_format(talloc, STRING("%s%u"), r, (u64)select.src);
+
+    INSERT_LINE();
+    nasm_add_line(state, string_format(talloc, STRING("%s %s0, [r14 + r15 * 8 - %u]"), wide ? STRING("vmovdqu") : STRING("movdqu"), r, entries * 8), 1);
+    INSERT_LINE();
+    nasm_add_line(state, string_format(talloc, STRING("%s %s1, [r14 + r15 * 8 - %u]"), wide ? STRING("vmovdqu") : STRING("movdqu"), r, entries * 16), 1);
+
+    if (select.bias) {
+        INSERT_LINE();
+        nasm_add_line(state, string_format(talloc, STRING("mov rax, %u"), select.bias), 1);
+
+        if (wide) {
+            INSERT_LINE();
+            nasm_add_line(state, STRING("vmovq xmm2, rax"), 1);
+            INSERT_LINE();
+            nasm_add_line(state, STRING("vpbroadcastq ymm2, xmm2"), 1);
+            INSERT_LINE();
+            nasm_add_line(state, STRING("vpxor ymm0, ymm0, ymm2"), 1);
+            INSERT_LINE();
+            nasm_add_line(state, STRING("vpxor ymm1, ymm1, ymm2"), 1);
+        } else {
+            INSERT_LINE();
+            nasm_add_line(state, STRING("movq xmm2, rax"), 1);
+            INSERT_LINE();
+            nasm_add_line(state, STRING("punpcklqdq xmm2, xmm2"), 1);
+            INSERT_LINE();
+            nasm_add_line(state, STRING("pxor xmm0, xmm2"), 1);
+            INSERT_LINE();
+            nasm_add_line(state, STRING("pxor xmm1, xmm2"), 1);
+        }
+    }
+
+    INSERT_LINE();
+    if (wide) {
+        nasm_add_line(state, string_format(talloc, STRING("v%s %s, %s, %s%s"), STRING(select.name), dst, dst, src, imm), 1);
+    } else {
+        nasm_add_line(state, string_format(talloc, STRING("%s %s, %s%s"), STRING(select.name), dst, src, imm), 1);
+    }
+
+    if (select.invert) {
+        INSERT_LINE();
+        nasm_add_line(state, wide ? STRING("vpcmpeqd ymm3, ymm3, ymm3") : STRING("pcmpeqd xmm3, xmm3"), 1);
+        INSERT_LINE();
+        nasm_add_line(state, wide ? string_format(talloc, STRING("vpxor %s, %s, ymm3"), dst, dst) : string_format(talloc, STRING("pxor %s, xmm3"), dst), 1);
+    }
+
+    INSERT_LINE();
+    nasm_add_line(state, string_format(talloc, STRING("%s [r14 + r15 * 8 - %u], %s"), wide ? STRING("vmovdqu") : STRING("movdqu"), entries * 16, dst), 1);
+
+    if (wide) {
+        INSERT_LINE();
+        nasm_add_line(state, STRING("vzeroupper"), 1);
+    }
+
+    INSERT_LINE();
+    nasm_add_line(state, string_format(talloc, STRING("sub r15, %u"), entries), 1);
+}
+
+// copies vector between memory at the address and exec stack
+static void nasm_vector_move(nasm_state_t *state, ir_opcode_t op) {
+    allocator_t *talloc = get_temporary_allocator();
+
+    POP_OPERAND(address, "r9");
+    nasm_flush_cache(state, op);
+
+    u64 entries = ir_vector_entries(op.u_operand);
+    b32 wide    = entries == 4;
+
+    string_t move   = wide ? STRING("vmovdqu") : STRING("movdqu");
+    string_t r      = wide ? STRING("ymm0") : STRING("xmm0");
+    string_t memory = string_format(talloc, STRING("[%s]"), address);
+    string_t exec   = op.operation == IR_VLOAD ? STRING("[r14 + r15 * 8]") : string_format(talloc, STRING("[r14 + r15 * 8 - %u]"), entries * 8);
+
+    INSERT_LINE();
+    nasm_add_line(state, string_format(talloc, STRING("%s %s, %s"), move, r, op.operation == IR_VLOAD ? memory : exec), 1);
+    INSERT_LINE();
+    nasm_add_line(state, string_format(talloc, STRING("%s %s, %s"), move, op.operation == IR_VLOAD ? exec : memory, r), 1);
+
+    if (wide) {
+        INSERT_LINE();
+        nasm_add_line(state, STRING("vzeroupper"), 1);
+    }
+
+    INSERT_LINE();
+    nasm_add_line(state, string_format(talloc, STRING("%s r15, %u"), op.operation == IR_VLOAD ? STRING("add") : STRING("sub"), entries), 1);
+}
+
+// scalar on top becomes every lane of the vector
+static void nasm_vector_splat(nasm_state_t *state, ir_opcode_t op) {
+    allocator_t *talloc = get_temporary_allocator();
+
+    u64 lane = IR_VECTOR_LANE(op.u_operand);
+    u64 size = ir_lane_size(lane);
+
+    LOAD("rax");
+    nasm_flush_cache(state, op);
+
+    if (lane == IR_LANE_F32) {
+        INSERT_LINE();
+        nasm_add_line(state, STRING("movq xmm0, rax"), 1);
+        INSERT_LINE();
+        nasm_add_line(state, STRING("cvtsd2ss xmm0, xmm0"), 1);
+        INSERT_LINE();
+        nasm_add_line(state, STRING("movd eax, xmm0"), 1);
+    }
+
+    if (size < 8) {
+        static const char *extends[] = { "", "movzx eax, al", "movzx eax, ax", "", "mov eax, eax" };
+
+        INSERT_LINE();
+        nasm_add_line(state, STRING(extends[size]), 1);
+        INSERT_LINE();
+        nasm_add_line(state, string_format(talloc, STRING("mov rcx, %u"), backend_splat_multiplier(lane)), 1);
+        INSERT_LINE();
+        nasm_add_line(state, STRING("imul rax, rcx"), 1);
+    }
+
+    u64 entries = ir_vector_entries(op.u_operand);
+
+    for (u64 i = 0; i < entries; i++) {
+        INSERT_LINE();
+        nasm_add_line(state, string_format(talloc, STRING("mov QWORD[r14 + r15 * 8 + %u], rax"), i * 8), 1);
+    }
+
+    INSERT_LINE();
+    nasm_add_line(state, string_format(talloc, STRING("add r15, %u"), entries), 1);
+}
+
+// ------ intrinsics, string instructions run forward, direction flag is clear by ABI
+
+// operands are popped to scratch registers, rsi and rdi of string instructions are in the cache
+static void nasm_mem_intrinsic(nasm_state_t *state, ir_opcode_t op, u64 i) {
+    allocator_t *talloc = get_temporary_allocator();
+
+    LOAD("r9");  // address
+    LOAD("rax"); // value or source
+    LOAD("rdx"); // count or size
+    nasm_flush_cache(state, op);
+
+    INSERT_LINE();
+    nasm_add_line(state, STRING("mov rdi, r9"), 1);
+    INSERT_LINE();
+    nasm_add_line(state, STRING("mov rcx, rdx"), 1);
+
+    // counts below 1 do nothing
+    INSERT_LINE();
+    nasm_add_line(state, STRING("test rcx, rcx"), 1);
+    INSERT_LINE();
+    nasm_add_line(state, string_format(talloc, STRING("jle .IROP_%u_done"), i), 1);
+
+    if (op.operation == IR_MEM_FILL) {
+        static const char *stos[] = { "", "rep stosb", "rep stosw", "", "rep stosd", "", "", "", "rep stosq" };
+
+        if (op.u_operand == IR_LANE_F32) {
+            INSERT_LINE();
+            nasm_add_line(state, STRING("movq xmm0, rax"), 1);
+            INSERT_LINE();
+            nasm_add_line(state, STRING("cvtsd2ss xmm0, xmm0"), 1);
+            INSERT_LINE();
+            nasm_add_line(state, STRING("movd eax, xmm0"), 1);
+        }
+
+        INSERT_LINE();
+        nasm_add_line(state, STRING(stos[ir_lane_size(op.u_operand)]), 1);
+    } else {
+        INSERT_LINE();
+        nasm_add_line(state, STRING("mov rsi, rax"), 1);
+
+        // destination inside of the source range is copied backwards
+        if (op.operation == IR_MEM_MOVE) {
+            INSERT_LINE();
+            nasm_add_line(state, STRING("sub rax, rdi"), 1);
+            INSERT_LINE();
+            nasm_add_line(state, STRING("neg rax"), 1);
+            INSERT_LINE();
+            nasm_add_line(state, STRING("cmp rax, rcx"), 1);
+            INSERT_LINE();
+            nasm_add_line(state, string_format(talloc, STRING("jae .IROP_%u_forward"), i), 1);
+            INSERT_LINE();
+            nasm_add_line(state, STRING("lea rsi, [rsi + rcx - 1]"), 1);
+            INSERT_LINE();
+            nasm_add_line(state, STRING("lea rdi, [rdi + rcx - 1]"), 1);
+            INSERT_LINE();
+            nasm_add_line(state, STRING("std"), 1);
+            INSERT_LINE();
+            nasm_add_line(state, STRING("rep movsb"), 1);
+            INSERT_LINE();
+            nasm_add_line(state, STRING("cld"), 1);
+            INSERT_LINE();
+            nasm_add_line(state, string_format(talloc, STRING("jmp .IROP_%u_done"), i), 1);
+            nasm_add_line(state, string_format(talloc, STRING(".IROP_%u_forward:"), i), 0);
+        }
+
+        INSERT_LINE();
+        nasm_add_line(state, STRING("rep movsb"), 1);
+    }
+
+    nasm_add_line(state, string_format(talloc, STRING(".IROP_%u_done:"), i), 0);
+}
+
+// popcnt, lzcnt and tzcnt work on the value zero extended from its lane,
+// the rest is extended back like a load of the lane
+static void nasm_bit_operation(nasm_state_t *state, ir_opcode_t op) {
+    allocator_t *talloc = get_temporary_allocator();
+
+    static const char *extends[] = { "movzx eax, al", "movsx rax, al", "movzx eax, ax", "movsx rax, ax", "mov eax, eax", "movsxd rax, eax", "", "" };
+    static const char *values[]  = { "al", "ax", "", "eax", "", "", "", "rax" };
+
+    u64 lane = op.u_operand;
+    u64 size = ir_lane_size(lane);
+    u64 bits = size * 8;
+
+    string_t wide = size == 8 ? STRING("rax") : STRING("eax");
+
+    LOAD("rax");
+    if (op.operation == IR_ROTL || op.operation == IR_ROTR) LOAD("rcx");
+
+    if (size < 8) {
+        INSERT_LINE();
+        nasm_add_line(state, STRING(extends[lane & ~1ull]), 1);
+    }
+
+    switch (op.operation) {
+        case IR_POPCOUNT:
+            INSERT_LINE();
+            nasm_add_line(state, string_format(talloc, STRING("popcnt %s, %s"), wide, wide), 1);
+            break;
+        case IR_CLZ:
+            INSERT_LINE();
+            nasm_add_line(state, string_format(talloc, STRING("lzcnt %s, %s"), wide, wide), 1);
+
+            if (bits < 32) {
+                INSERT_LINE();
+                nasm_add_line(state, string_format(talloc, STRING("sub eax, %u"), 32 - bits), 1);
+            }
+            break;
+        case IR_CTZ:
+            if (bits < 32) {
+                INSERT_LINE();
+                nasm_add_line(state, string_format(talloc, STRING("or eax, %u"), 1ull << bits), 1);
+            }
+
+            INSERT_LINE();
+            nasm_add_line(state, string_format(talloc, STRING("tzcnt %s, %s"), wide, wide), 1);
+            break;
+
+        case IR_BSWAP:
+            if (size == 2) {
+                INSERT_LINE();
+                nasm_add_line(state, STRING("rol ax, 8"), 1);
+            } else if (size > 2) {
+                INSERT_LINE();
+                nasm_add_line(state, string_format(talloc, STRING("bswap %s"), wide), 1);
+            }
+            break;
+
+        case IR_ROTL:
+        case IR_ROTR:
+            INSERT_LINE();
+            nasm_add_line(state, string_format(talloc, STRING("%s %s, cl"), op.operation == IR_ROTL ? STRING("rol") : STRING("ror"), STRING(values[size - 1])), 1);
+            break;
+    }
+
+    if (size < 8 && (op.operation == IR_BSWAP || op.operation == IR_ROTL || op.operation == IR_ROTR)) {
+        INSERT_LINE();
+        nasm_add_line(state, STRING(extends[lane]), 1);
+    }
+
+    STORE("rax");
+}
+
+// ------ register allocation
+
+struct live_interval_t {
+    u64 slot;
+    u64 start;
+    u64 end;
+};
+
+static COMP_PROC(compare_intervals) {
+    UNUSED(size);
+    live_interval_t *va = (live_interval_t*)a;
+    live_interval_t *vb = (live_interval_t*)b;
+
+    if (va->start < vb->start) return -1;
+    if (va->start > vb->start) return 1;
+    return 0;
+}
+
+static inline b32 is_jump(u64 operation) {
+    return operation == IR_JUMP || operation == IR_JUMP_IF || operation == IR_JUMP_IF_NOT;
+}
+
+// equality of floats needs parity flag too, so only these go to a single jcc
+static inline b32 is_float_order(u64 operation) {
+    return operation == IR_FCMP_LT || operation == IR_FCMP_GT || operation == IR_FCMP_LTE || operation == IR_FCMP_GTE;
+}
+
+// PUSH_SEA that is only a way to read or write the slot, not to take its address
+static b32 is_direct_access(nasm_state_t *state, u64 i) {
+    if (i + 1 >= state->func->code.count || state->jump_targets[i + 1]) return false;
+
+    u64 next = state->func->code[i + 1].operation;
+    return next == IR_LOAD || next == IR_STORE;
+}
+
+static inline s8 get_slot_register(nasm_state_t *state, u64 slot) {
+    return slot < state->slot_count ? state->slot_registers[slot] : -1;
+}
+
+// Intervals are taken over IR order. Loops make every slot used inside of them
+// live for the whole loop, then slots go to registers by linear scan,
+// when there are no free registers the one that lives longest stays in memory.
+static void nasm_allocate_registers(nasm_state_t *state) {
+    u64 count = state->func->code.count;
+
+    state->slot_count      = 0;
+    state->saved_registers = 0;
+
+    for (u64 i = 0; i < count; i++) {
+        ir_opcode_t op = state->func->code[i];
+
+        if (op.operation == IR_PUSH_STACK || op.operation == IR_PUSH_SEA) {
+            state->slot_count = MAX(state->slot_count, op.u_operand + 1);
+        }
+    }
+
+    state->slot_registers = (s8*)mem_alloc(default_allocator, state->slot_count + 1);
+    mem_set((u8*)state->slot_registers, 0xFF, state->slot_count + 1);
+
+    if (state->slot_count == 0) return;
+
+    b8              *candidate = (b8*)mem_alloc(default_allocator, state->slot_count);
+    live_interval_t *intervals = (live_interval_t*)mem_alloc(default_allocator, state->slot_count * sizeof(live_interval_t));
+
+    for (u64 slot = 0; slot < state->slot_count; slot++) {
+        candidate[slot] = false;
+        intervals[slot] = { slot, count, 0 };
+    }
+
+    for (u64 i = 0; i < count; i++) {
+        ir_opcode_t op = state->func->code[i];
+
+        if (op.operation != IR_PUSH_STACK && op.operation != IR_PUSH_SEA) continue;
+
+        live_interval_t *it = intervals + op.u_operand;
+
+        if (it->start == count) candidate[op.u_operand] = true;
+
+        it->start = MIN(it->start, i);
+        it->end   = MAX(it->end,   i + 1);
+
+        if (op.operation == IR_PUSH_SEA && !is_direct_access(state, i)) {
+            candidate[op.u_operand] = false;
+        }
+    }
+
+    b32 changed = true;
+    while (changed) {
+        changed = false;
+
+        for (u64 j = 0; j < count; j++) {
+            ir_opcode_t op = state->func->code[j];
+
+            if (!is_jump(op.operation) || op.s_operand >= 0) continue;
+
+            u64 target = (u64)((s64)j + 1 + op.s_operand);
+
+            for (u64 slot = 0; slot < state->slot_count; slot++) {
+                live_interval_t *it = intervals + slot;
+
+                if (!candidate[slot] || it->start > j || it->end < target) continue;
+                if (it->start <= target && it->end >= j) continue;
+
+                it->start = MIN(it->start, target);
+                it->end   = MAX(it->end,   j);
+                changed   = true;
+            }
+        }
+    }
+
+    list_t<live_interval_t> order = {};
+    list_create(&order, state->slot_count, *default_allocator);
+
+    for (u64 slot = 0; slot < state->slot_count; slot++) {
+        if (candidate[slot]) list_add(&order, intervals + slot);
+    }
+
+    if (order.count) sort_array(order.data, order.count, compare_intervals);
+
+    live_interval_t active[NASM_LOCAL_REGISTERS] = {};
+    b32             in_use[NASM_LOCAL_REGISTERS] = {};
+
+    for (u64 i = 0; i < order.count; i++) {
+        live_interval_t current = order[i];
+
+        s64 free_register = -1;
+        s64 longest       = -1;
+
+        for (u64 r = 0; r < NASM_LOCAL_REGISTERS; r++) {
+            if (in_use[r] && active[r].end < current.start) in_use[r] = false;
+
+            if (!in_use[r]) {
+                if (free_register < 0) free_register = r;
+            } else if (longest < 0 || active[r].end > active[longest].end) {
+                longest = r;
+            }
+        }
+
+        if (free_register < 0) {
+            if (active[longest].end <= current.end) continue;
+
+            state->slot_registers[active[longest].slot] = -1;
+            free_register = longest;
+        }
+
+        active[free_register] = current;
+        in_use[free_register] = true;
+        state->slot_registers[current.slot] = (s8)free_register;
+    }
+
+    for (u64 slot = 0; slot < state->slot_count; slot++) {
+        if (state->slot_registers[slot] >= 0) state->saved_registers |= 1ull << state->slot_registers[slot];
+    }
+
+    list_delete(&order);
+    mem_free(default_allocator, (u8*)candidate);
+    mem_free(default_allocator, (u8*)intervals);
+}
+
+// callee saved registers go right after the frame
+static void nasm_save_registers(nasm_state_t *state, ir_opcode_t op, u64 frame, b32 restore) {
+    u64 index = 0;
+
+    for (u64 r = 0; r < NASM_LOCAL_REGISTERS; r++) {
+        if (!(state->saved_registers & (1ull << r))) continue;
+
+        index++;
+        INSERT_LINE();
+
+        if (restore) {
+            nasm_add_line(state, string_format(get_temporary_allocator(), STRING("mov %s, QWORD[rbp - %u * 8]"), STRING(local_registers[r]), frame + index), 1);
+        } else {
+            nasm_add_line(state, string_format(get_temporary_allocator(), STRING("mov QWORD[rbp - %u * 8], %s"), frame + index, STRING(local_registers[r])), 1);
+        }
+    }
+}
+
+static inline u64 count_saved_registers(nasm_state_t *state) {
+    u64 result = 0;
+
+    for (u64 r = 0; r < NASM_LOCAL_REGISTERS; r++) {
+        if (state->saved_registers & (1ull << r)) result++;
+    }
+
+    return result;
+}
+
+// condition codes of jcc that is taken when comparison is true
+static const char *branch_condition(u64 operation, b32 inverted) {
+    switch (operation) {
+        case IR_CMP_EQ:  return inverted ? "ne" : "e";
+        case IR_CMP_NEQ: return inverted ? "e"  : "ne";
+        case IR_CMP_LT:  return inverted ? "ge" : "l";
+        case IR_CMP_GT:  return inverted ? "le" : "g";
+        case IR_CMP_LTE: return inverted ? "g"  : "le";
+        case IR_CMP_GTE: return inverted ? "l"  : "ge";
+        case IR_LOG_NOT: return inverted ? "ne" : "e"; // value compared with 0
+
+        // operands of less ones are swapped, see nasm_float_compare
+        case IR_FCMP_LT:
+        case IR_FCMP_GT:  return inverted ? "be" : "a";
+        case IR_FCMP_LTE:
+        case IR_FCMP_GTE: return inverted ? "b"  : "ae";
+    }
+
+    assert(false);
+    return "mp";
+}
+
+// comparison or LOG_NOT that only feeds JUMP_IF(_NOT) becomes cmp + jcc,
+// 0/1 never gets to the stack
+static void nasm_compile_branch(nasm_state_t *state, ir_opcode_t op, ir_opcode_t jump, u64 target) {
+    allocator_t *talloc = get_temporary_allocator();
+    string_t compare = {};
+
+    if (op.operation == IR_LOG_NOT) {
+        POP_OPERAND(value, "rax");
+        compare = string_format(talloc, STRING("cmp %s, 0"), value);
+    } else if (is_float_order(op.operation)) {
+        compare = nasm_float_compare(state, op);
+    } else {
+        POP_OPERAND(a, "rax");
+        POP_OPERAND(b, "r9");
+        compare = string_format(talloc, STRING("cmp %s, %s"), a, b);
+    }
+
+    // flush changes flags, so compare goes after it
+    nasm_flush_cache(state, op);
+
+    INSERT_LINE();
+    nasm_add_line(state, compare, 1);
+    INSERT_LINE();
+    nasm_add_line(state, string_format(talloc, STRING("j%s .IROP_%u"), STRING(branch_condition(op.operation, jump.operation == IR_JUMP_IF_NOT)), target), 1);
+}
+
+// memory operand of backend_match_address, exec stack entries stay in cache
+// registers, the rest goes to rax (base), rcx (index) and rdx (stored value)
+static void nasm_compile_address(nasm_state_t *state, ir_opcode_t op, backend_address_t *address) {
+    allocator_t *talloc = get_temporary_allocator();
+
+    string_t base  = {};
+    string_t index = {};
+    string_t value = {};
+    s64      disp  = address->disp;
+
+    // index is on top, stored value below base
+    if (address->index == BACKEND_ADDRESS_STACK) index = nasm_pop_operand(state, op, STRING("rcx"));
+    if (address->base  == BACKEND_ADDRESS_STACK) base  = nasm_pop_operand(state, op, STRING("rax"));
+
+    if (address->access == IR_STORE) {
+        value = nasm_pop_operand(state, op, STRING("rdx"));
+    } else if (address->access == IR_STORE8 || address->access == IR_STORE16 || address->access == IR_STORE32) {
+        LOAD("rdx");
+    } else if (address->access == IR_STOREF32) {
+        value = nasm_pop_float(state, op, STRING("xmm0"));
+    }
+
+    switch (address->base) {
+        case BACKEND_ADDRESS_LOCAL:
+            if (get_slot_register(state, address->base_operand) >= 0) {
+                base = STRING(local_registers[get_slot_register(state, address->base_operand)]);
+                break;
+            }
+
+            INSERT_LINE();
+            nasm_add_line(state, string_format(talloc, STRING("mov rax, QWORD[rbp - %u * 8]"), address->base_operand), 1);
+            base = STRING("rax");
+            break;
+        case BACKEND_ADDRESS_GLOBAL:
+            INSERT_LINE();
+            nasm_add_line(state, string_format(talloc, STRING("mov rax, QWORD[global_variables + %u * 8]"), address->base_operand), 1);
+            base = STRING("rax");
+            break;
+        case BACKEND_ADDRESS_LOCAL_EA:
+            base  = STRING("rbp");
+            disp -= (s64)(address->base_operand * 8);
+            break;
+        case BACKEND_ADDRESS_GLOBAL_EA:
+            // rip relative operand has no index
+            if (address->index == BACKEND_ADDRESS_NONE) {
+                base  = STRING("global_variables");
+                disp += (s64)(address->base_operand * 8);
+                break;
+            }
+
+            INSERT_LINE();
+            nasm_add_line(state, string_format(talloc, STRING("lea rax, [global_variables + %u * 8]"), address->base_operand), 1);
+            base = STRING("rax");
+            break;
+    }
+
+    switch (address->index) {
+        case BACKEND_ADDRESS_LOCAL:
+            if (get_slot_register(state, address->index_operand) >= 0) {
+                index = STRING(local_registers[get_slot_register(state, address->index_operand)]);
+                break;
+            }
+
+            INSERT_LINE();
+            nasm_add_line(state, string_format(talloc, STRING("mov rcx, QWORD[rbp - %u * 8]"), address->index_operand), 1);
+            index = STRING("rcx");
+            break;
+        case BACKEND_ADDRESS_GLOBAL:
+            INSERT_LINE();
+            nasm_add_line(state, string_format(talloc, STRING("mov rcx, QWORD[global_variables + %u * 8]"), address->index_operand), 1);
+            index = STRING("rcx");
+            break;
+    }
+
+    string_t operand = {};
+
+    if (address->index != BACKEND_ADDRESS_NONE) {
+        operand = string_format(talloc, STRING("[%s + %s * %u + %d]"), base, index, address->scale, disp);
+    } else {
+        operand = string_format(talloc, STRING("[%s + %d]"), base, disp);
+    }
+
+    switch (address->access) {
+        case IR_NOP:
+            nasm_push(state, op, STRING("lea"), operand);
+            return;
+        case IR_LOAD:
+            nasm_push(state, op, STRING("mov"), string_format(talloc, STRING("QWORD%s"), operand));
+            return;
+
+        case IR_STORE:
+            INSERT_LINE();
+            nasm_add_line(state, string_format(talloc, STRING("mov QWORD%s, %s"), operand, value), 1);
+            return;
+        case IR_STORE8:
+            INSERT_LINE();
+            nasm_add_line(state, string_format(talloc, STRING("mov BYTE%s, dl"), operand), 1);
+            return;
+        case IR_STORE16:
+            INSERT_LINE();
+            nasm_add_line(state, string_format(talloc, STRING("mov WORD%s, dx"), operand), 1);
+            return;
+        case IR_STORE32:
+            INSERT_LINE();
+            nasm_add_line(state, string_format(talloc, STRING("mov DWORD%s, edx"), operand), 1);
+            return;
+
+        case IR_LOADF32:
+            nasm_push_float(state, op, STRING("cvtss2sd"), string_format(talloc, STRING("DWORD%s"), operand));
+            return;
+        case IR_STOREF32:
+            INSERT_LINE();
+            nasm_add_line(state, string_format(talloc, STRING("cvtsd2ss xmm0, %s"), value), 1);
+            INSERT_LINE();
+            nasm_add_line(state, string_format(talloc, STRING("movss DWORD%s, xmm0"), operand), 1);
+            return;
+    }
+
+    static const char *loads[] = {
+        "movsx rax, BYTE%s", "movzx rax, BYTE%s", "movsx rax, WORD%s", "movzx rax, WORD%s", "movsxd rax, DWORD%s", "mov eax, DWORD%s",
+    };
+
+    INSERT_LINE();
+    nasm_add_line(state, string_format(talloc, STRING(loads[address->access - IR_LOAD8S]), operand), 1);
+    STORE("rax");
+}
 
 void nasm_compile_func(string_t name, nasm_state_t *state) {
     profiler_func_start();
@@ -111,24 +1037,122 @@ void nasm_compile_func(string_t name, nasm_state_t *state) {
 
     allocator_t *talloc = get_temporary_allocator();
 
-    for (u64 i = 0; i < state->func->code.count; i++) {
+    u64 count = state->func->code.count;
+
+    state->line_from = NULL;
+
+    // register arguments are the cache we start with, see nasm_prepare_call
+    state->cache_base   = 0;
+    state->cache_count  = state->func->register_args;
+    mem_set((u8*)state->cache_float, 0, sizeof(state->cache_float));
+    state->jump_targets = (b8*)mem_alloc(default_allocator, count + 1);
+    mem_set((u8*)state->jump_targets, 0, count + 1);
+
+    for (u64 i = 0; i < count; i++) {
         ir_opcode_t op = state->func->code[i];
 
-        nasm_add_line(state, string_format(get_temporary_allocator(), STRING(".IROP_%u: ; %s"), i, get_ir_opcode_info(op)), 0);
+        if (!is_jump(op.operation)) continue;
+
+        s64 target = (s64)i + 1 + op.s_operand;
+        if (target >= 0 && target <= (s64)count) state->jump_targets[target] = true;
+    }
+
+    nasm_allocate_registers(state);
+    u64 frame = 0;
+
+    for (u64 i = 0; i < count; i++) {
+        ir_opcode_t op = state->func->code[i];
+
+        // join point, code that falls through here leaves its cache in memory
+        if (state->jump_targets[i]) {
+            nasm_flush_cache(state, op);
+        }
+
+        if (compiler_config.debug_info == DEBUG_INFO_FULL) {
+            nasm_add_line(state, string_format(get_temporary_allocator(), STRING(".IROP_%u: ; %s"), i, get_ir_opcode_info(op)), 0);
+        } else if (state->jump_targets[i]) {
+            nasm_add_line(state, string_format(get_temporary_allocator(), STRING(".IROP_%u:"), i), 0);
+        }
+
+        if (i + 1 < count && !state->jump_targets[i + 1]) {
+            ir_opcode_t next = state->func->code[i + 1];
+
+            b32 is_branch = next.operation == IR_JUMP_IF || next.operation == IR_JUMP_IF_NOT;
+            b32 is_test   = (op.operation >= IR_CMP_EQ && op.operation <= IR_CMP_GTE) || op.operation == IR_LOG_NOT || is_float_order(op.operation);
+
+            if (is_branch && is_test) {
+                nasm_compile_branch(state, op, next, (u64)((s64)i + 2 + next.s_operand));
+                i++;
+                continue;
+            }
+        }
+
+        // reads and writes of a local that lives in register
+        if (op.operation == IR_PUSH_SEA && get_slot_register(state, op.u_operand) >= 0) {
+            string_t reg  = STRING(local_registers[get_slot_register(state, op.u_operand)]);
+            u64      next = state->func->code[i + 1].operation;
+
+            if (next == IR_LOAD) {
+                nasm_push(state, op, STRING("mov"), reg);
+            } else {
+                POP_OPERAND(value, local_registers[get_slot_register(state, op.u_operand)]);
+
+                if (string_compare(value, reg) != 0) {
+                    INSERT_LINE();
+                    nasm_add_line(state, string_format(talloc, STRING("mov %s, %s"), reg, value), 1);
+                }
+            }
+
+            i++;
+            continue;
+        }
+
+        backend_address_t address = {};
+
+        if (backend_match_address(state->func, state->jump_targets, i, &address)) {
+            nasm_compile_address(state, op, &address);
+
+            i += address.count - 1;
+            continue;
+        }
 
         string_t t = {};
         switch (op.operation) {
             case IR_NOP:
                 nasm_add_line(state, STRING("nop"), 1);
                 break;
+            case IR_ALIGN:
+                nasm_flush_cache(state, op);
+                nasm_add_line(state, string_format(talloc, STRING("align %u"), op.u_operand), 1);
+                break;
             case IR_STACK_FRAME_PUSH:
                 INSERT_LINE();
                 nasm_add_line(state, STRING("push rbp"), 1);
                 INSERT_LINE();
                 nasm_add_line(state, STRING("mov rbp, rsp"), 1);
+
+                // whole frame at once, locals are at fixed rbp offsets
+                frame = op.u_operand;
+
+                if (((frame + count_saved_registers(state)) * 8) > PG(1)) {
+                    INSERT_LINE();
+                    t = string_format(talloc, STRING("mov rax, %u * 8"), frame + count_saved_registers(state));
+                    nasm_add_line(state, t, 1);
+                    INSERT_LINE();
+                    nasm_add_line(state, STRING("call __stack_probe"), 1);
+                    INSERT_LINE();
+                    nasm_add_line(state, STRING("sub rsp, rax"), 1);
+                } else if (frame + count_saved_registers(state)) {
+                    INSERT_LINE();
+                    t = string_format(talloc, STRING("sub rsp, %u * 8"), frame + count_saved_registers(state));
+                    nasm_add_line(state, t, 1);
+                }
+
+                nasm_save_registers(state, op, frame, false);
                 break;
 
             case IR_STACK_FRAME_POP:
+                nasm_save_registers(state, op, frame, true);
                 INSERT_LINE();
                 nasm_add_line(state, STRING("mov rsp, rbp"), 1);
                 INSERT_LINE();
@@ -136,43 +1160,31 @@ void nasm_compile_func(string_t name, nasm_state_t *state) {
                 break;
 
             case IR_PUSH_SIGN:
-                INSERT_LINE();
-                t = string_format(talloc, STRING("mov QWORD[r14 + r15 * 8], %u"), op.u_operand);
-                nasm_add_line(state, t, 1);
-                INSERT_LINE();
-                nasm_add_line(state, STRING("inc r15"), 1);
-                break;
             case IR_PUSH_UNSIGN:
-                INSERT_LINE();
-                t = string_format(talloc, STRING("mov QWORD[r14 + r15 * 8], %u"), op.u_operand);
-                nasm_add_line(state, t, 1);
-                INSERT_LINE();
-                nasm_add_line(state, STRING("inc r15"), 1);
+                t = string_format(talloc, STRING("%u"), op.u_operand);
+                nasm_push(state, op, STRING("mov"), t);
                 break;
             case IR_PUSH_STACK:
-                INSERT_LINE();
-                t = string_format(talloc, STRING("mov rax, QWORD[rbp - %u * 8]"), op.u_operand);
-                nasm_add_line(state, t, 1);
-                STORE("rax");
+                if (get_slot_register(state, op.u_operand) >= 0) {
+                    nasm_push(state, op, STRING("mov"), STRING(local_registers[get_slot_register(state, op.u_operand)]));
+                    break;
+                }
+
+                t = string_format(talloc, STRING("QWORD[rbp - %u * 8]"), op.u_operand);
+                nasm_push(state, op, STRING("mov"), t);
                 break;
             case IR_PUSH_SEA:
-                INSERT_LINE();
-                t = string_format(talloc, STRING("lea rax, QWORD[rbp - %u * 8]"), op.u_operand);
-                nasm_add_line(state, t, 1);
-                STORE("rax");
+                t = string_format(talloc, STRING("QWORD[rbp - %u * 8]"), op.u_operand);
+                nasm_push(state, op, STRING("lea"), t);
                 break;
 
             case IR_PUSH_GLOBAL:
-                INSERT_LINE();
-                t = string_format(talloc, STRING("mov rax, QWORD[global_variables + %u * 8]"), op.u_operand);
-                nasm_add_line(state, t, 1);
-                STORE("rax");
+                t = string_format(talloc, STRING("QWORD[global_variables + %u * 8]"), op.u_operand);
+                nasm_push(state, op, STRING("mov"), t);
                 break;
             case IR_PUSH_GEA:
-                INSERT_LINE();
-                t = string_format(talloc, STRING("lea rax, QWORD[global_variables + %u * 8]"), op.u_operand);
-                nasm_add_line(state, t, 1);
-                STORE("rax");
+                t = string_format(talloc, STRING("QWORD[global_variables + %u * 8]"), op.u_operand);
+                nasm_push(state, op, STRING("lea"), t);
                 break;
 
             case IR_POP:
@@ -254,24 +1266,129 @@ void nasm_compile_func(string_t name, nasm_state_t *state) {
                 STORE("rax");
                 break;
 
+            case IR_FADD: FBINOP("addsd", true);  break;
+            case IR_FSUB: FBINOP("subsd", false); break;
+            case IR_FMUL: FBINOP("mulsd", true);  break;
+            case IR_FDIV: FBINOP("divsd", false); break;
+
+            case IR_FNEG: {
+                POP_FLOAT(value, "xmm0");
+                INSERT_LINE();
+                nasm_add_line(state, STRING("mov rax, 0x8000000000000000"), 1);
+                INSERT_LINE();
+                nasm_add_line(state, STRING("movq xmm4, rax"), 1);
+                INSERT_LINE();
+                nasm_add_line(state, string_format(talloc, STRING("xorpd %s, xmm4"), value), 1);
+                nasm_push_float(state, op, STRING("movapd"), value);
+            } break;
+
+            case IR_FCMP_EQ:
+            case IR_FCMP_NEQ:
+            case IR_FCMP_LT:
+            case IR_FCMP_GT:
+            case IR_FCMP_LTE:
+            case IR_FCMP_GTE: {
+                static const char *sets[] = { "sete", "setne", "seta", "seta", "setae", "setae" };
+
+                t = nasm_float_compare(state, op);
+                INSERT_LINE();
+                nasm_add_line(state, t, 1);
+                INSERT_LINE();
+                nasm_add_line(state, string_format(talloc, STRING("%s al"), STRING(sets[op.operation - IR_FCMP_EQ])), 1);
+
+                // equal has to be ordered, not equal is true for unordered too
+                if (op.operation == IR_FCMP_EQ) {
+                    INSERT_LINE();
+                    nasm_add_line(state, STRING("setnp cl"), 1);
+                    INSERT_LINE();
+                    nasm_add_line(state, STRING("and al, cl"), 1);
+                } else if (op.operation == IR_FCMP_NEQ) {
+                    INSERT_LINE();
+                    nasm_add_line(state, STRING("setp cl"), 1);
+                    INSERT_LINE();
+                    nasm_add_line(state, STRING("or al, cl"), 1);
+                }
+
+                INSERT_LINE();
+                nasm_add_line(state, STRING("movzx rax, al"), 1);
+                STORE("rax");
+            } break;
+
+            case IR_INT_TO_FLOAT: {
+                POP_OPERAND(value, "rax");
+                nasm_push_float(state, op, STRING("cvtsi2sd"), value);
+            } break;
+            case IR_FLOAT_TO_INT: {
+                POP_FLOAT(value, "xmm0");
+                nasm_push(state, op, STRING("cvttsd2si"), value);
+            } break;
+            case IR_ROUND_F32: {
+                POP_FLOAT(value, "xmm0");
+                INSERT_LINE();
+                nasm_add_line(state, string_format(talloc, STRING("cvtsd2ss xmm0, %s"), value), 1);
+                nasm_push_float(state, op, STRING("cvtss2sd"), STRING("xmm0"));
+            } break;
+
+            case IR_VLOAD:
+            case IR_VSTORE:
+                nasm_vector_move(state, op);
+                break;
+            case IR_VSPLAT:
+                nasm_vector_splat(state, op);
+                break;
+
+            case IR_VADD:
+            case IR_VSUB:
+            case IR_VMUL:
+            case IR_VDIV:
+            case IR_VAND:
+            case IR_VOR:
+            case IR_VXOR:
+            case IR_VCMP_EQ:
+            case IR_VCMP_NEQ:
+            case IR_VCMP_LT:
+            case IR_VCMP_GT:
+            case IR_VCMP_LTE:
+            case IR_VCMP_GTE:
+                nasm_vector_binary(state, op);
+                break;
+
+            case IR_MEM_FILL:
+            case IR_MEM_COPY:
+            case IR_MEM_MOVE:
+                nasm_mem_intrinsic(state, op, i);
+                break;
+
+            case IR_POPCOUNT:
+            case IR_CLZ:
+            case IR_CTZ:
+            case IR_BSWAP:
+            case IR_ROTL:
+            case IR_ROTR:
+                nasm_bit_operation(state, op);
+                break;
+
             case IR_JUMP: 
+                nasm_flush_cache(state, op);
                 INSERT_LINE();
                 nasm_add_line(state, string_format(get_temporary_allocator(), STRING("jmp .IROP_%u"), (u64)((s64)i + 1 + op.s_operand)), 1);
                 break;
-            case IR_JUMP_IF: 
-                LOAD("rax");
+            case IR_JUMP_IF: {
+                POP_OPERAND(cond, "rax");
+                nasm_flush_cache(state, op);
                 INSERT_LINE();
-                nasm_add_line(state, STRING("cmp rax, 0"), 1);
+                nasm_add_line(state, string_format(talloc, STRING("cmp %s, 0"), cond), 1);
                 INSERT_LINE();
                 nasm_add_line(state, string_format(get_temporary_allocator(), STRING("jnz .IROP_%u"), (u64)((s64)i + 1 + op.s_operand)), 1);
-                break;
-            case IR_JUMP_IF_NOT: 
-                LOAD("rax");
+            } break;
+            case IR_JUMP_IF_NOT: {
+                POP_OPERAND(cond, "rax");
+                nasm_flush_cache(state, op);
                 INSERT_LINE();
-                nasm_add_line(state, STRING("cmp rax, 0"), 1);
+                nasm_add_line(state, string_format(talloc, STRING("cmp %s, 0"), cond), 1);
                 INSERT_LINE();
                 nasm_add_line(state, string_format(get_temporary_allocator(), STRING("jz .IROP_%u"), (u64)((s64)i + 1 + op.s_operand)), 1);
-                break;
+            } break;
 
             case IR_FREE:
                 INSERT_LINE();
@@ -279,26 +1396,70 @@ void nasm_compile_func(string_t name, nasm_state_t *state) {
                 nasm_add_line(state, t, 1);
                 break;
 
-            case IR_STORE:
-                LOAD("rbx"); // first... address
-                LOAD("rax");
+            case IR_STORE: {
+                POP_OPERAND(address, "r9"); // first... address
+                POP_OPERAND(value,   "rax");
                 INSERT_LINE();
-                nasm_add_line(state, STRING("mov QWORD[rbx], rax"), 1);
-                break;
-
-            case IR_LOAD:
-                LOAD("rbx");
+                nasm_add_line(state, string_format(talloc, STRING("mov QWORD[%s], %s"), address, value), 1);
+            } break;
+
+            case IR_LOAD: {
+                POP_OPERAND(address, "r9");
+                t = string_format(talloc, STRING("QWORD[%s]"), address);
+                nasm_push(state, op, STRING("mov"), t);
+            } break;
+
+            case IR_LOAD8S:  SIZED_LOADOP("movsx rax, BYTE[%s]");  break;
+            case IR_LOAD8U:  SIZED_LOADOP("movzx rax, BYTE[%s]");  break;
+            case IR_LOAD16S: SIZED_LOADOP("movsx rax, WORD[%s]");  break;
+            case IR_LOAD16U: SIZED_LOADOP("movzx rax, WORD[%s]");  break;
+            case IR_LOAD32S: SIZED_LOADOP("movsxd rax, DWORD[%s]"); break;
+            case IR_LOAD32U: SIZED_LOADOP("mov eax, DWORD[%s]");   break;
+
+            case IR_LOADF32: {
+                POP_OPERAND(address, "r9");
+                nasm_push_float(state, op, STRING("cvtss2sd"), string_format(talloc, STRING("DWORD[%s]"), address));
+            } break;
+            case IR_STOREF32: {
+                POP_OPERAND(address, "r9");
+                POP_FLOAT(value, "xmm0");
                 INSERT_LINE();
-                nasm_add_line(state, STRING("mov rax, QWORD[rbx]"), 1);
-                STORE("rax");
-                break;
+                nasm_add_line(state, string_format(talloc, STRING("cvtsd2ss xmm0, %s"), value), 1);
+                INSERT_LINE();
+                nasm_add_line(state, string_format(talloc, STRING("movss DWORD[%s], xmm0"), address), 1);
+            } break;
+
+            case IR_STORE8:  SIZED_STOREOP("mov BYTE[%s], al");   break;
+            case IR_STORE16: SIZED_STOREOP("mov WORD[%s], ax");   break;
+            case IR_STORE32: SIZED_STOREOP("mov DWORD[%s], eax"); break;
+
+            case IR_CALL: {
+                ir_function_t *callee = hashmap_get(&state->ir->functions, op.string);
+                u64 args = callee ? callee->register_args : 0;
+
+                if (args) {
+                    nasm_prepare_call(state, op, args);
+                } else {
+                    nasm_flush_cache(state, op);
+                }
 
-            case IR_CALL:
                 INSERT_LINE();
                 nasm_add_line(state, string_format(get_temporary_allocator(), STRING("call %s"), op.string), 1);
-                break;
+
+                state->cache_base  = 0;
+                state->cache_count = 0;
+
+                if (callee && callee->register_returns) {
+                    STORE("rax");
+                }
+            } break;
 
             case IR_RET:
+                if (state->func->register_returns) {
+                    LOAD("rax");
+                }
+
+                nasm_flush_cache(state, op);
                 INSERT_LINE();
                 nasm_add_line(state, STRING("ret"), 1);
                 break;
@@ -321,6 +1482,11 @@ void nasm_compile_func(string_t name, nasm_state_t *state) {
         }
     }
 
+    mem_free(default_allocator, (u8*)state->jump_targets);
+    mem_free(default_allocator, (u8*)state->slot_registers);
+    state->jump_targets   = NULL;
+    state->slot_registers = NULL;
+
     nasm_add_line(state, STRING("int3"), 1);
     nasm_add_line(state, STRING("int3"), 1);
     nasm_add_line(state, STRING("int3"), 1);
@@ -329,27 +1495,126 @@ void nasm_compile_func(string_t name, nasm_state_t *state) {
     profiler_func_end();
 }
 
-backend_t nasm_compile_program(ir_t *state) {
+// every function is written into own memory sink by a worker,
+// then copied into output in order of names
+struct nasm_job_t {
+    string_t       name;
+    ir_function_t *func;
+    list_t<u8>     text;
+};
+
+struct nasm_jobs_t {
+    ir_t       *ir;
+    nasm_job_t *jobs;
+};
+
+// putchar fills output_buffer, it is written when full, before reading and at exit,
+// so character at a time programs make a syscall per buffer instead of per character
+static void nasm_compile_linux_runtime(nasm_state_t *nasm) {
+    nasm_add_line(nasm, STRING("flush_output: ; keeps everything but rax, rcx, rdx, rsi, rdi, r11"));
+    nasm_add_line(nasm, STRING("lea rsi, [output_buffer]"), 1);
+    nasm_add_line(nasm, STRING("mov rdx, [output_count]"), 1);
+    nasm_add_line(nasm, STRING(".loop:"), 0);
+    nasm_add_line(nasm, STRING("test rdx, rdx"), 1);
+    nasm_add_line(nasm, STRING("jle .done"), 1);
+    nasm_add_line(nasm, STRING("mov rax, 1"), 1);
+    nasm_add_line(nasm, STRING("mov rdi, 1"), 1);
+    nasm_add_line(nasm, STRING("syscall"), 1);
+    nasm_add_line(nasm, STRING("test rax, rax"), 1);
+    nasm_add_line(nasm, STRING("jle .done"), 1);
+    nasm_add_line(nasm, STRING("add rsi, rax"), 1);
+    nasm_add_line(nasm, STRING("sub rdx, rax"), 1);
+    nasm_add_line(nasm, STRING("jmp .loop"), 1);
+    nasm_add_line(nasm, STRING(".done:"), 0);
+    nasm_add_line(nasm, STRING("mov QWORD[output_count], 0"), 1);
+    nasm_add_line(nasm, STRING("ret"), 1);
+    nasm_add_line(nasm, STRING(""));
+
+    nasm_add_line(nasm, STRING("getchar:"));
+    nasm_add_line(nasm, STRING("call flush_output"), 1);
+    nasm_add_line(nasm, STRING("xor rax, rax"), 1);
+    nasm_add_line(nasm, STRING("xor rdi, rdi"), 1);
+    nasm_add_line(nasm, STRING("lea rsi, [char_buffer]"), 1);
+    nasm_add_line(nasm, STRING("mov rdx, 1"), 1);
+    nasm_add_line(nasm, STRING("syscall"), 1);
+    nasm_add_line(nasm, STRING("cmp rax, 1"), 1);
+    nasm_add_line(nasm, STRING("mov rax, -1"), 1);
+    nasm_add_line(nasm, STRING("jne .done"), 1);
+    nasm_add_line(nasm, STRING("movzx rax, BYTE[char_buffer]"), 1);
+    nasm_add_line(nasm, STRING(".done:"), 0);
+    nasm_add_line(nasm, STRING("mov QWORD[r14 + r15 * 8], rax"), 1);
+    nasm_add_line(nasm, STRING("inc r15"), 1);
+    nasm_add_line(nasm, STRING("ret"), 1);
+    nasm_add_line(nasm, STRING(""));
+
+    nasm_add_line(nasm, STRING("putchar:"));
+    nasm_add_line(nasm, STRING("dec r15"), 1);
+    nasm_add_line(nasm, STRING("mov rax, QWORD[r14 + r15 * 8]"), 1);
+    nasm_add_line(nasm, STRING("mov rcx, [output_count]"), 1);
+    nasm_add_line(nasm, STRING("lea rdx, [output_buffer]"), 1);
+    nasm_add_line(nasm, STRING("mov BYTE[rdx + rcx], al"), 1);
+    nasm_add_line(nasm, STRING("inc rcx"), 1);
+    nasm_add_line(nasm, STRING("mov [output_count], rcx"), 1);
+    nasm_add_line(nasm, string_format(get_temporary_allocator(), STRING("cmp rcx, %u"), (u64)NASM_OUTPUT_BUFFER_SIZE), 1);
+    nasm_add_line(nasm, STRING("jb .done"), 1);
+    nasm_add_line(nasm, STRING("call flush_output"), 1);
+    nasm_add_line(nasm, STRING(".done:"), 0);
+    nasm_add_line(nasm, STRING("ret"), 1);
+    nasm_add_line(nasm, STRING(""));
+}
+
+static COMP_PROC(compare_nasm_jobs) {
+    UNUSED(size);
+    return string_compare(((nasm_job_t*)a)->name, ((nasm_job_t*)b)->name);
+}
+
+static void nasm_compile_job(void *data, u64 index, u64 worker) {
+    UNUSED(worker);
+    nasm_jobs_t *work = (nasm_jobs_t*)data;
+    nasm_job_t  *job  = work->jobs + index;
+
+    sink_t output = {};
+    sink_open_memory(&output, &job->text);
+
+    nasm_state_t state = {};
+    state.ir     = work->ir;
+    state.output = &output;
+    state.func   = job->func;
+
+    nasm_compile_func(job->name, &state);
+    sink_close(&output);
+}
+
+b32 nasm_compile_program(ir_t *state, sink_t *output) {
     profiler_func_start();
     nasm_state_t nasm = {};
 
-    nasm.ir = state;
-    list_create(&nasm.code, (u64) 1024, create_arena_allocator(PG(4)));
+    nasm.ir     = state;
+    nasm.output = output;
+
+    b32 is_linux = compiler_target() == TARGET_LINUX;
 
     { // header and RT   
         nasm_add_line(&nasm, STRING("; Created by bonmas14."));
         nasm_add_line(&nasm, STRING("; "));
         nasm_add_line(&nasm, STRING("; solum-compiler auto generated code"));
-        nasm_add_line(&nasm, STRING("; nasm-win-x64"));
+        nasm_add_line(&nasm, is_linux ? STRING("; nasm-linux-x64") : STRING("; nasm-win-x64"));
         nasm_add_line(&nasm, STRING(""));
         nasm_add_line(&nasm, STRING("default rel"));
         nasm_add_line(&nasm, STRING(""));
         nasm_add_line(&nasm, STRING("section .bss"));
         nasm_add_line(&nasm, STRING("exec_stack: resq 4096"));
-        nasm_add_line(&nasm, STRING("putchar_handle: resq 1"));
-        nasm_add_line(&nasm, STRING("getchar_handle: resq 1"));
-        nasm_add_line(&nasm, STRING("char_buffer:    resb 1000"));
-        nasm_add_line(&nasm, STRING("scratch_buffer: resq 100"));
+
+        if (is_linux) {
+            nasm_add_line(&nasm, STRING("char_buffer:   resb 1"));
+            nasm_add_line(&nasm, STRING("output_count:  resq 1"));
+            nasm_add_line(&nasm, string_format(get_temporary_allocator(), STRING("output_buffer: resb %u"), (u64)NASM_OUTPUT_BUFFER_SIZE));
+        } else {
+            nasm_add_line(&nasm, STRING("putchar_handle: resq 1"));
+            nasm_add_line(&nasm, STRING("getchar_handle: resq 1"));
+            nasm_add_line(&nasm, STRING("char_buffer:    resb 1000"));
+            nasm_add_line(&nasm, STRING("scratch_buffer: resq 100"));
+        }
         nasm_add_line(&nasm, STRING(""));
 
         nasm_add_line(&nasm, STRING("section .data"));
@@ -366,19 +1631,42 @@ backend_t nasm_compile_program(ir_t *state) {
 
         nasm_add_line(&nasm, STRING("section .text"));
         nasm_add_line(&nasm, STRING(""));
-        nasm_add_line(&nasm, STRING("global mainCRTStartup"));
-        nasm_add_line(&nasm, STRING("extern SetConsoleMode, GetStdHandle, ReadConsoleA, WriteConsoleA"));
-        nasm_add_line(&nasm, STRING(""));
-        nasm_add_line(&nasm, STRING("mainCRTStartup:"));
+
+        if (is_linux) {
+            nasm_add_line(&nasm, STRING("global _start"));
+            nasm_add_line(&nasm, STRING(""));
+            nasm_add_line(&nasm, STRING("_start:"));
+        } else {
+            nasm_add_line(&nasm, STRING("global mainCRTStartup"));
+            nasm_add_line(&nasm, STRING("extern SetConsoleMode, GetStdHandle, ReadConsoleA, WriteConsoleA"));
+            nasm_add_line(&nasm, STRING(""));
+            nasm_add_line(&nasm, STRING("mainCRTStartup:"));
+        }
 
         nasm_add_line(&nasm, STRING("lea r14, [exec_stack]"), 1);
         nasm_add_line(&nasm, STRING("xor r15, r15"), 1);
 
-        nasm_add_line(&nasm, STRING("call runtime_setup"), 1);
+        if (!is_linux) nasm_add_line(&nasm, STRING("call runtime_setup"), 1);
         nasm_add_line(&nasm, STRING("call main"), 1);
-        nasm_add_line(&nasm, STRING("dec r15"), 1);
-        nasm_add_line(&nasm, STRING("mov rax, QWORD[r14 + r15 * 8]"), 1);
-        nasm_add_line(&nasm, STRING("ret"), 1);
+
+        ir_function_t *main = hashmap_get(&state->functions, STRING("main"));
+
+        if (main == NULL || !main->register_returns) {
+            nasm_add_line(&nasm, STRING("dec r15"), 1);
+            nasm_add_line(&nasm, STRING("mov rax, QWORD[r14 + r15 * 8]"), 1);
+        }
+
+        // there is nobody to return to, exit code is the result of main
+        if (is_linux) {
+            nasm_add_line(&nasm, STRING("mov rbx, rax"), 1);
+            nasm_add_line(&nasm, STRING("call flush_output"), 1);
+            nasm_add_line(&nasm, STRING("mov rdi, rbx"), 1);
+            nasm_add_line(&nasm, STRING("mov rax, 60"), 1);
+            nasm_add_line(&nasm, STRING("syscall"), 1);
+        } else {
+            nasm_add_line(&nasm, STRING("ret"), 1);
+        }
+
         nasm_add_line(&nasm, STRING(""));
     }
 
@@ -404,87 +1692,91 @@ backend_t nasm_compile_program(ir_t *state) {
         nasm_add_line(&nasm, STRING(""));
     }
 
-    { // setup
-        nasm_add_line(&nasm, STRING("runtime_setup:"));
-        nasm_add_line(&nasm, STRING("push rbp"), 1);
-        nasm_add_line(&nasm, STRING("mov rbp, rsp"), 1);
-        nasm_add_line(&nasm, STRING("and rsp, -16"), 1);
-
-        nasm_add_line(&nasm, STRING("mov rcx, -11"), 1);
-        nasm_add_line(&nasm, STRING("sub rsp, 32"), 1);
-        nasm_add_line(&nasm, STRING("call GetStdHandle"), 1);
-        nasm_add_line(&nasm, STRING("add rsp, 32"), 1);
-
-        nasm_add_line(&nasm, STRING("mov [putchar_handle], rax"), 1);
-
-        nasm_add_line(&nasm, STRING("mov rcx, -10"), 1);
-        nasm_add_line(&nasm, STRING("sub rsp, 32"), 1);
-        nasm_add_line(&nasm, STRING("call GetStdHandle"), 1);
-        nasm_add_line(&nasm, STRING("add rsp, 32"), 1);
-
-        nasm_add_line(&nasm, STRING("mov [getchar_handle], rax"), 1);
-
-        nasm_add_line(&nasm, STRING("mov rcx, [getchar_handle]"), 1);
-        nasm_add_line(&nasm, STRING("mov rdx, 0x0009"), 1);
-        nasm_add_line(&nasm, STRING("sub rsp, 32"), 1);
-        nasm_add_line(&nasm, STRING("call SetConsoleMode"), 1);
-        nasm_add_line(&nasm, STRING("add rsp, 32"), 1);
-
-        nasm_add_line(&nasm, STRING("mov rsp, rbp"), 1);
-        nasm_add_line(&nasm, STRING("pop rbp"), 1);
-        nasm_add_line(&nasm, STRING("ret"), 1);
-        nasm_add_line(&nasm, STRING(""));
-    }
-    { // getchar
-        nasm_add_line(&nasm, STRING("getchar:"));
-
-        nasm_add_line(&nasm, STRING("push rbp"), 1);
-        nasm_add_line(&nasm, STRING("mov rbp, rsp"), 1);
-        nasm_add_line(&nasm, STRING("and rsp, -16"), 1);
-
-        nasm_add_line(&nasm, STRING("and rsp, -16"), 1);
-        nasm_add_line(&nasm, STRING("mov rcx, [getchar_handle]"), 1);
-        nasm_add_line(&nasm, STRING("lea rdx, [char_buffer]"), 1);
-        nasm_add_line(&nasm, STRING("mov r8, 1"), 1);
-        nasm_add_line(&nasm, STRING("lea r9, [scratch_buffer]"), 1);
-
-        nasm_add_line(&nasm, STRING("sub rsp, 0x30"), 1);
-        nasm_add_line(&nasm, STRING("mov QWORD[rsp + 32], 0x00"), 1);
-        nasm_add_line(&nasm, STRING("call ReadConsoleA"), 1);
-        nasm_add_line(&nasm, STRING("add rsp, 0x30"), 1);
-
-        nasm_add_line(&nasm, STRING("movzx rax, BYTE[char_buffer]"), 1);
-        nasm_add_line(&nasm, STRING("mov QWORD[r14 + r15 * 8], rax"), 1);
-        nasm_add_line(&nasm, STRING("inc r15"), 1);
-
-        nasm_add_line(&nasm, STRING("mov rsp, rbp"), 1);
-        nasm_add_line(&nasm, STRING("pop rbp"), 1);
-        nasm_add_line(&nasm, STRING("ret"), 1);
-        nasm_add_line(&nasm, STRING(""));
-    }
-    { // putchar
-        nasm_add_line(&nasm, STRING("putchar:"));
-        nasm_add_line(&nasm, STRING("push rbp"), 1);
-        nasm_add_line(&nasm, STRING("mov rbp, rsp"), 1);
-        nasm_add_line(&nasm, STRING("and rsp, -16"), 1);
-
-        nasm_add_line(&nasm, STRING("dec r15"), 1);
-        nasm_add_line(&nasm, STRING("mov rax, QWORD[r14 + r15 * 8]"), 1);
-        nasm_add_line(&nasm, STRING("mov QWORD[r14 + r15 * 8], 0"), 1);
-        nasm_add_line(&nasm, STRING("mov BYTE[char_buffer], al"), 1);
-
-        nasm_add_line(&nasm, STRING("mov rcx, [putchar_handle]"), 1);
-        nasm_add_line(&nasm, STRING("lea rdx, [char_buffer]"), 1);
-        nasm_add_line(&nasm, STRING("mov r8, 1"), 1);
-        nasm_add_line(&nasm, STRING("mov r9, 0 "), 1);
-        nasm_add_line(&nasm, STRING("push 0   "), 1);
-        nasm_add_line(&nasm, STRING("sub rsp, 32"), 1);
-        nasm_add_line(&nasm, STRING("call WriteConsoleA"), 1);
-        nasm_add_line(&nasm, STRING("add rsp, 32"), 1);
-        nasm_add_line(&nasm, STRING("mov rsp, rbp"), 1);
-        nasm_add_line(&nasm, STRING("pop rbp"), 1);
-        nasm_add_line(&nasm, STRING("ret"), 1);
-        nasm_add_line(&nasm, STRING(""));
+    if (is_linux) {
+        nasm_compile_linux_runtime(&nasm);
+    } else {
+        { // setup
+            nasm_add_line(&nasm, STRING("runtime_setup:"));
+            nasm_add_line(&nasm, STRING("push rbp"), 1);
+            nasm_add_line(&nasm, STRING("mov rbp, rsp"), 1);
+            nasm_add_line(&nasm, STRING("and rsp, -16"), 1);
+
+            nasm_add_line(&nasm, STRING("mov rcx, -11"), 1);
+            nasm_add_line(&nasm, STRING("sub rsp, 32"), 1);
+            nasm_add_line(&nasm, STRING("call GetStdHandle"), 1);
+            nasm_add_line(&nasm, STRING("add rsp, 32"), 1);
+
+            nasm_add_line(&nasm, STRING("mov [putchar_handle], rax"), 1);
+
+            nasm_add_line(&nasm, STRING("mov rcx, -10"), 1);
+            nasm_add_line(&nasm, STRING("sub rsp, 32"), 1);
+            nasm_add_line(&nasm, STRING("call GetStdHandle"), 1);
+            nasm_add_line(&nasm, STRING("add rsp, 32"), 1);
+
+            nasm_add_line(&nasm, STRING("mov [getchar_handle], rax"), 1);
+
+            nasm_add_line(&nasm, STRING("mov rcx, [getchar_handle]"), 1);
+            nasm_add_line(&nasm, STRING("mov rdx, 0x0009"), 1);
+            nasm_add_line(&nasm, STRING("sub rsp, 32"), 1);
+            nasm_add_line(&nasm, STRING("call SetConsoleMode"), 1);
+            nasm_add_line(&nasm, STRING("add rsp, 32"), 1);
+
+            nasm_add_line(&nasm, STRING("mov rsp, rbp"), 1);
+            nasm_add_line(&nasm, STRING("pop rbp"), 1);
+            nasm_add_line(&nasm, STRING("ret"), 1);
+            nasm_add_line(&nasm, STRING(""));
+        }
+        { // getchar
+            nasm_add_line(&nasm, STRING("getchar:"));
+
+            nasm_add_line(&nasm, STRING("push rbp"), 1);
+            nasm_add_line(&nasm, STRING("mov rbp, rsp"), 1);
+            nasm_add_line(&nasm, STRING("and rsp, -16"), 1);
+
+            nasm_add_line(&nasm, STRING("and rsp, -16"), 1);
+            nasm_add_line(&nasm, STRING("mov rcx, [getchar_handle]"), 1);
+            nasm_add_line(&nasm, STRING("lea rdx, [char_buffer]"), 1);
+            nasm_add_line(&nasm, STRING("mov r8, 1"), 1);
+            nasm_add_line(&nasm, STRING("lea r9, [scratch_buffer]"), 1);
+
+            nasm_add_line(&nasm, STRING("sub rsp, 0x30"), 1);
+            nasm_add_line(&nasm, STRING("mov QWORD[rsp + 32], 0x00"), 1);
+            nasm_add_line(&nasm, STRING("call ReadConsoleA"), 1);
+            nasm_add_line(&nasm, STRING("add rsp, 0x30"), 1);
+
+            nasm_add_line(&nasm, STRING("movzx rax, BYTE[char_buffer]"), 1);
+            nasm_add_line(&nasm, STRING("mov QWORD[r14 + r15 * 8], rax"), 1);
+            nasm_add_line(&nasm, STRING("inc r15"), 1);
+
+            nasm_add_line(&nasm, STRING("mov rsp, rbp"), 1);
+            nasm_add_line(&nasm, STRING("pop rbp"), 1);
+            nasm_add_line(&nasm, STRING("ret"), 1);
+            nasm_add_line(&nasm, STRING(""));
+        }
+        { // putchar
+            nasm_add_line(&nasm, STRING("putchar:"));
+            nasm_add_line(&nasm, STRING("push rbp"), 1);
+            nasm_add_line(&nasm, STRING("mov rbp, rsp"), 1);
+            nasm_add_line(&nasm, STRING("and rsp, -16"), 1);
+
+            nasm_add_line(&nasm, STRING("dec r15"), 1);
+            nasm_add_line(&nasm, STRING("mov rax, QWORD[r14 + r15 * 8]"), 1);
+            nasm_add_line(&nasm, STRING("mov QWORD[r14 + r15 * 8], 0"), 1);
+            nasm_add_line(&nasm, STRING("mov BYTE[char_buffer], al"), 1);
+
+            nasm_add_line(&nasm, STRING("mov rcx, [putchar_handle]"), 1);
+            nasm_add_line(&nasm, STRING("lea rdx, [char_buffer]"), 1);
+            nasm_add_line(&nasm, STRING("mov r8, 1"), 1);
+            nasm_add_line(&nasm, STRING("mov r9, 0 "), 1);
+            nasm_add_line(&nasm, STRING("push 0   "), 1);
+            nasm_add_line(&nasm, STRING("sub rsp, 32"), 1);
+            nasm_add_line(&nasm, STRING("call WriteConsoleA"), 1);
+            nasm_add_line(&nasm, STRING("add rsp, 32"), 1);
+            nasm_add_line(&nasm, STRING("mov rsp, rbp"), 1);
+            nasm_add_line(&nasm, STRING("pop rbp"), 1);
+            nasm_add_line(&nasm, STRING("ret"), 1);
+            nasm_add_line(&nasm, STRING(""));
+        }
     }
 
     { // debug break
@@ -496,6 +1788,10 @@ backend_t nasm_compile_program(ir_t *state) {
 
     b32 valid      = true;
     b32 found_main = false;
+
+    list_t<nasm_job_t> jobs = {};
+    list_create(&jobs, 64, *default_allocator);
+
     for (u64 i = 0; i < state->functions.capacity; i++) {
         kv_pair_t<string_t, ir_function_t> *pair = state->functions.entries + i;
 
@@ -510,14 +1806,36 @@ backend_t nasm_compile_program(ir_t *state) {
             }
         }
 
-        nasm.func = &pair->value;
-        nasm_compile_func(pair->key, &nasm);
+        nasm_job_t job = {};
+        job.name = pair->key;
+        job.func = &pair->value;
+        list_add(&jobs, &job);
+    }
+
+    if (jobs.count) sort_array(jobs.data, jobs.count, compare_nasm_jobs);
+
+    nasm_jobs_t work = {};
+    work.ir   = state;
+    work.jobs = jobs.data;
+
+    jobs_run(jobs.count, jobs_worker_count(jobs.count), nasm_compile_job, &work);
+
+    for (u64 i = 0; i < jobs.count; i++) {
+        list_t<u8> *text = &list_get(&jobs, i)->text;
+
+        if (!text->data) continue;
+
+        sink_write(output, text->data, text->count);
+        list_delete(text);
     }
 
+    list_delete(&jobs);
+
     if (!found_main) {
         log_error("Couldn't find main in code.");
+        valid = false;
     }
 
     profiler_func_end();
-    return {valid, nasm.code.alloc, nasm.code};
+    return valid;
 }
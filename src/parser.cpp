@@ -177,7 +177,8 @@ static bind_power_t get_prefix_bind_power(token_t token) {
         case '^':
         case '-': 
         case '~': 
-        case '!': return {0, 23};
+        case '!': 
+        case TOK_COMPTIME: return {0, 23};
 
         default:
             log_error_token("Bad prefix operator: ", token);
@@ -266,6 +267,8 @@ static u32 get_ast_type_based_on_prefix_token(token_t token) {
         case '!': return AST_UNARY_NOT;    break;
         case '~': return AST_UNARY_INVERT; break;
 
+        case TOK_COMPTIME: return AST_UNARY_COMPTIME; break;
+
         case TOK_CAST: return AST_BIN_CAST; break;
 
         default:
@@ -351,6 +354,7 @@ static ast_node_t parse_expression(parser_state_t *state, s16 min_bind_power = 0
         case '@':
         case '^':
         case '~':
+        case TOK_COMPTIME:
             {
                 result.token    = advance_token(state->scanner, state->strings);
                 result.type     = get_ast_type_based_on_prefix_token(left);
@@ -630,6 +634,13 @@ static ast_node_t parse_primary_type(parser_state_t *state) {
             result.type = AST_STD_TYPE;
             break;
 
+        case TOK_V16U8:  case TOK_V16S8:  case TOK_V8U16: case TOK_V8S16: case TOK_V4U32:
+        case TOK_V4S32:  case TOK_V2U64:  case TOK_V2S64: case TOK_V4F32: case TOK_V2F64:
+        case TOK_V32U8:  case TOK_V32S8:  case TOK_V16U16: case TOK_V16S16: case TOK_V8U32:
+        case TOK_V8S32:  case TOK_V4U64:  case TOK_V4S64: case TOK_V8F32: case TOK_V4F64:
+            result.type = AST_STD_TYPE;
+            break;
+
         case TOK_VOID:
             result.type = AST_VOID_TYPE;
             break;
@@ -1146,6 +1157,12 @@ static ast_node_t parse_enum_declaration(parser_state_t *state, token_t *name) {
                 return result;
 
             default:
+                if (type.token.type >= TOK_V16U8 && type.token.type <= TOK_V4F64) {
+                    log_error_token("cant use vector types in enum definition", type.token);
+                    result.type = AST_ERROR;
+                    profiler_func_end();
+                    return result;
+                }
                 break;
         }
     } else {
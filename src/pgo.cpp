@@ -0,0 +1,669 @@
+#include "pgo.h"
+
+#include "ir.h"
+#include "interop.h"
+
+#include "list.h"
+#include "array.h"
+#include "hashmap.h"
+
+#include "allocator.h"
+#include "talloc.h"
+#include "strings.h"
+#include "profiler.h"
+#include "platform.h"
+
+// opcode while function is rewritten, jumps point to ids instead of
+// offsets, so code can be moved and inserted without fixing them up
+struct pgo_op_t {
+    ir_opcode_t op;
+    u64 id;
+    u64 target;     // id, end of function has its own
+    u64 executions;
+    u64 taken;
+};
+
+struct pgo_code_t {
+    ir_function_t   *func;
+    list_t<pgo_op_t> ops;
+    u64 end;
+    u64 next_id;
+};
+
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME  0x100000001b3ull
+
+static u64 hash_bytes(u64 hash, void *data, u64 size) {
+    u8 *bytes = (u8*)data;
+
+    for (u64 i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+static u64 hash_function(ir_function_t *func) {
+    u64 hash = FNV_OFFSET;
+
+    hash = hash_bytes(hash, &func->code.count, sizeof(u64));
+
+    for (u64 i = 0; i < func->code.count; i++) {
+        ir_opcode_t op = func->code[i];
+
+        hash = hash_bytes(hash, &op.operation, sizeof(u64));
+        hash = hash_bytes(hash, &op.u_operand, sizeof(u64));
+
+        if (op.string.size) {
+            hash = hash_bytes(hash, op.string.data, op.string.size);
+        }
+    }
+
+    return hash;
+}
+
+static inline b32 is_jump(u64 operation) {
+    return operation == IR_JUMP || operation == IR_JUMP_IF || operation == IR_JUMP_IF_NOT;
+}
+
+static inline b32 falls_through(u64 operation) {
+    return operation != IR_JUMP && operation != IR_RET && operation != IR_INVALID;
+}
+
+b32 pgo_generate(ir_t *ir, string_t filename) {
+    profiler_func_start();
+
+    if (!hashmap_contains(&ir->functions, STRING("main"))) {
+        log_error("--profile-generate needs main function");
+        profiler_func_end();
+        return false;
+    }
+
+    interop_profile_t profile = {};
+    profile.collect    = true;
+    profile.step_limit = compiler_config.interp_step_limit;
+
+    s64 exit_code = 0;
+
+    interop_set_profile(&profile);
+    b32 finished = interop_call(ir, STRING("main"), NULL, 0, &exit_code);
+    interop_set_profile(NULL);
+
+    if (compiler_config.interp_profile) {
+        interop_profile_print(ir, &profile);
+    }
+
+    list_t<u8> output = {};
+    list_create(&output, 4096, *default_allocator);
+
+    pgo_file_header_t header = {};
+    header.magic   = PGO_MAGIC;
+    header.version = PGO_VERSION;
+
+    u64 index = 0;
+    list_allocate(&output, sizeof(header), &index);
+
+    for (u64 i = 0; i < profile.functions.count; i++) {
+        interop_function_profile_t *entry = list_get(&profile.functions, i);
+        ir_function_t *func = hashmap_get(&ir->functions, entry->name);
+
+        if (func == NULL || func->is_external || func->code.count != entry->code_count) continue;
+
+        pgo_file_function_t function = {};
+        function.hash       = hash_function(func);
+        function.name_size  = entry->name.size;
+        function.code_count = entry->code_count;
+
+        list_allocate(&output, sizeof(function), &index);
+        list_fill(&output, (u8*)&function, sizeof(function), index);
+
+        list_allocate(&output, entry->name.size, &index);
+        list_fill(&output, entry->name.data, entry->name.size, index);
+
+        for (u64 j = 0; j < entry->code_count; j++) {
+            pgo_counter_t counter = { entry->hits[j], entry->taken[j] };
+
+            list_allocate(&output, sizeof(counter), &index);
+            list_fill(&output, (u8*)&counter, sizeof(counter), index);
+        }
+
+        header.count++;
+    }
+
+    list_fill(&output, (u8*)&header, sizeof(header), 0);
+
+    b32 result = platform_write_file(filename, { output.count, output.data });
+
+    if (!result) {
+        log_error(string_format(get_temporary_allocator(), STRING("Couldn't write profile '%s'"), filename));
+    } else if (compiler_config.verbose) {
+        log_info(string_format(get_temporary_allocator(), STRING("pgo: %u opcodes of main in %u functions written to '%s'%s"),
+                    profile.steps, header.count, filename, finished ? STRING("") : STRING(", main didn't finish")));
+    }
+
+    list_delete(&output);
+    interop_profile_delete(&profile);
+
+    profiler_func_end();
+    return result;
+}
+
+static b32 read_bytes(string_t content, u64 *offset, void *output, u64 size) {
+    if (size > content.size - *offset) return false;
+
+    mem_copy((u8*)output, content.data + *offset, size);
+    *offset += size;
+    return true;
+}
+
+b32 pgo_load(ir_t *ir, string_t filename, pgo_profile_t *profile, pgo_stats_t *stats) {
+    profiler_func_start();
+
+    string_t content = {};
+
+    if (!platform_file_exists(filename) || !platform_read_file_into_string(filename, default_allocator, &content)) {
+        log_warning(string_format(get_temporary_allocator(), STRING("Couldn't read profile '%s', building without it"), filename));
+        profiler_func_end();
+        return false;
+    }
+
+    u64 offset = 0;
+    pgo_file_header_t header = {};
+
+    b32 valid = read_bytes(content, &offset, &header, sizeof(header))
+             && header.magic   == PGO_MAGIC
+             && header.version == PGO_VERSION;
+
+    for (u64 i = 0; valid && i < header.count; i++) {
+        pgo_file_function_t entry = {};
+
+        if (!read_bytes(content, &offset, &entry, sizeof(entry)) || entry.name_size > content.size - offset) {
+            valid = false;
+            break;
+        }
+
+        string_t name = { entry.name_size, content.data + offset };
+        offset += entry.name_size;
+
+        if (entry.code_count > (content.size - offset) / sizeof(pgo_counter_t)) {
+            valid = false;
+            break;
+        }
+
+        u64 size = entry.code_count * sizeof(pgo_counter_t);
+        ir_function_t *func = hashmap_get(&ir->functions, name);
+
+        if (func == NULL || func->is_external || func->code.count != entry.code_count || hash_function(func) != entry.hash) {
+            stats->stale++;
+            offset += size;
+            continue;
+        }
+
+        pgo_function_t function = {};
+        function.name       = string_copy(name, default_allocator);
+        function.hash       = entry.hash;
+        function.code_count = entry.code_count;
+        function.counters   = (pgo_counter_t*)mem_alloc(default_allocator, size + sizeof(pgo_counter_t));
+
+        read_bytes(content, &offset, function.counters, size);
+
+        u64 index = profile->functions.count;
+        list_add(&profile->functions, &function);
+        hashmap_add(&profile->function_index, function.name, &index);
+
+        stats->profiled++;
+    }
+
+    mem_free(default_allocator, content.data);
+
+    if (!valid) {
+        log_warning(string_format(get_temporary_allocator(), STRING("Ignoring old or broken profile '%s'"), filename));
+        pgo_delete(profile);
+        profiler_func_end();
+        return false;
+    }
+
+    if (stats->stale) {
+        log_warning(string_format(get_temporary_allocator(), STRING("%u functions changed since profile '%s' was written, they are built without it"),
+                    stats->stale, filename));
+    }
+
+    profiler_func_end();
+    return true;
+}
+
+void pgo_delete(pgo_profile_t *profile) {
+    for (u64 i = 0; i < profile->functions.count; i++) {
+        pgo_function_t *function = list_get(&profile->functions, i);
+
+        mem_free(default_allocator, function->name.data);
+        mem_free(default_allocator, function->counters);
+    }
+
+    if (profile->functions.data)         list_delete(&profile->functions);
+    if (profile->function_index.entries) hashmap_delete(&profile->function_index);
+
+    *profile = {};
+}
+
+static pgo_function_t *find_profile(pgo_profile_t *profile, string_t name) {
+    u64 *index = hashmap_get(&profile->function_index, name);
+    return index ? list_get(&profile->functions, *index) : NULL;
+}
+
+static void code_from_function(pgo_code_t *code, ir_function_t *func, pgo_function_t *counts) {
+    u64 count = func->code.count;
+
+    code->func    = func;
+    code->end     = count;
+    code->next_id = count + 1;
+
+    list_create(&code->ops, count + 16, *default_allocator);
+
+    for (u64 i = 0; i < count; i++) {
+        pgo_op_t op = {};
+        op.op = func->code[i];
+        op.id = i;
+
+        if (is_jump(op.op.operation)) {
+            op.target = (u64)((s64)i + 1 + op.op.s_operand);
+        }
+
+        if (counts) {
+            op.executions = counts->counters[i].executions;
+            op.taken      = counts->counters[i].taken;
+        }
+
+        list_add(&code->ops, &op);
+    }
+}
+
+// where every id is now, end of function included
+static u64 *code_positions(pgo_code_t *code) {
+    u64 *position = (u64*)mem_alloc(default_allocator, (code->next_id + 1) * sizeof(u64));
+    mem_set((u8*)position, 0, (code->next_id + 1) * sizeof(u64));
+
+    for (u64 i = 0; i < code->ops.count; i++) {
+        position[code->ops[i].id] = i;
+    }
+
+    position[code->end] = code->ops.count;
+    return position;
+}
+
+// small leaf functions, their frame becomes a part of caller's one
+static b32 can_inline(string_t name, ir_function_t *callee) {
+    if (callee == NULL || callee->is_external) return false;
+    if (string_compare(name, STRING("main")) == 0) return false;
+
+    if (callee->code.count == 0 || callee->code.count > PGO_INLINE_SIZE) return false;
+    if (callee->frame_size > PGO_INLINE_FRAME) return false;
+    if (callee->code[0].operation != IR_STACK_FRAME_PUSH) return false;
+
+    for (u64 i = 0; i < callee->code.count; i++) {
+        u64 operation = callee->code[i].operation;
+
+        if (operation == IR_CALL || operation == IR_ALLOC || operation == IR_FREE) return false;
+    }
+
+    return true;
+}
+
+static void inline_hot_calls(ir_t *ir, pgo_profile_t *profile, pgo_code_t *code, pgo_stats_t *stats) {
+    ir_function_t *func = code->func;
+    u64 count = code->ops.count;
+
+    if (count == 0 || code->ops[0].op.operation != IR_STACK_FRAME_PUSH) return;
+
+    b8 *chosen = (b8*)mem_alloc(default_allocator, count);
+    mem_set((u8*)chosen, 0, count);
+
+    // hottest sites first, until caller grew by PGO_INLINE_GROWTH
+    u64 growth = 0;
+    u64 sites  = 0;
+
+    while (true) {
+        u64 best = count;
+
+        for (u64 i = 0; i < count; i++) {
+            pgo_op_t *op = &code->ops[i];
+
+            if (chosen[i] || op->op.operation != IR_CALL || op->executions < PGO_HOT_COUNT) continue;
+            if (best < count && code->ops[best].executions >= op->executions) continue;
+
+            ir_function_t *callee = hashmap_get(&ir->functions, op->op.string);
+
+            if (!can_inline(op->op.string, callee) || callee == func) continue;
+            if (growth + callee->code.count > PGO_INLINE_GROWTH) continue;
+
+            best = i;
+        }
+
+        if (best == count) break;
+
+        chosen[best] = true;
+        growth += hashmap_get(&ir->functions, code->ops[best].op.string)->code.count;
+        sites++;
+    }
+
+    if (sites == 0) {
+        mem_free(default_allocator, chosen);
+        return;
+    }
+
+    list_t<pgo_op_t> ops = {};
+    list_create(&ops, count + growth, *default_allocator);
+
+    u64 base_frame = func->frame_size;
+    u64 extra      = 0;
+
+    for (u64 i = 0; i < count; i++) {
+        pgo_op_t site = code->ops[i];
+
+        if (!chosen[i]) {
+            list_add(&ops, &site);
+            continue;
+        }
+
+        ir_function_t  *callee = hashmap_get(&ir->functions, site.op.string);
+        pgo_function_t *counts = find_profile(profile, site.op.string);
+
+        u64 size    = callee->code.count;
+        u64 base    = code->next_id;
+        u64 cont    = i + 1 < count ? code->ops[i + 1].id : code->end;
+        u64 entries = counts ? counts->counters[0].executions : 0;
+
+        code->next_id += size;
+
+        // INVALID after the last return can't be reached, unless something jumps to it
+        b32 last_reached = size < 2 || callee->code[size - 2].operation != IR_RET;
+
+        for (u64 k = 0; k < size; k++) {
+            ir_opcode_t op = callee->code[k];
+
+            if (is_jump(op.operation) && (s64)k + 1 + op.s_operand == (s64)size - 1) last_reached = true;
+        }
+
+        for (u64 k = 0; k < size; k++) {
+            pgo_op_t op = {};
+            op.op = callee->code[k];
+            op.id = k == 0 ? site.id : base + k;
+
+            // counts of callee are over all of its callers
+            if (entries) {
+                op.executions = (u64)((f64)counts->counters[k].executions * site.executions / entries);
+                op.taken      = (u64)((f64)counts->counters[k].taken      * site.executions / entries);
+            }
+
+            switch (op.op.operation) {
+                case IR_STACK_FRAME_PUSH:
+                case IR_STACK_FRAME_POP:
+                    op.op.operation = IR_NOP;
+                    break;
+
+                case IR_RET:
+                    op.op.operation = IR_JUMP;
+                    op.target       = cont;
+                    break;
+
+                case IR_PUSH_STACK:
+                case IR_PUSH_SEA:
+                    op.op.u_operand += base_frame;
+                    break;
+
+                case IR_JUMP:
+                case IR_JUMP_IF:
+                case IR_JUMP_IF_NOT: {
+                    s64 target = (s64)k + 1 + op.op.s_operand;
+
+                    if      (target <= 0)           op.target = site.id;
+                    else if (target >= (s64)size)   op.target = cont;
+                    else                            op.target = base + (u64)target;
+                } break;
+
+                case IR_INVALID:
+                    if (k + 1 == size && !last_reached) op.op.operation = IR_NOP;
+                    break;
+
+                default: break;
+            }
+
+            list_add(&ops, &op);
+        }
+
+        extra = MAX(extra, callee->frame_size);
+        stats->inlined++;
+    }
+
+    // inlined calls never overlap, so they share slots after caller's own
+    func->frame_size += extra;
+    ops[0].op.u_operand = func->frame_size;
+
+    list_delete(&code->ops);
+    code->ops = ops;
+
+    mem_free(default_allocator, chosen);
+}
+
+// region a hot branch jumps over goes to the end of function, branch is
+// inverted to jump there and falls through into its old target
+static void move_cold_blocks(pgo_code_t *code, pgo_stats_t *stats) {
+    if (code->ops.count == 0 || falls_through(code->ops[code->ops.count - 1].op.operation)) return;
+
+    b32 moved = true;
+
+    while (moved) {
+        moved = false;
+
+        u64  count    = code->ops.count;
+        u64 *position = code_positions(code);
+
+        for (u64 i = 0; i < count && !moved; i++) {
+            pgo_op_t *branch = &code->ops[i];
+
+            if (branch->op.operation != IR_JUMP_IF && branch->op.operation != IR_JUMP_IF_NOT) continue;
+
+            u64 target = position[branch->target];
+            u64 fall   = branch->executions > branch->taken ? branch->executions - branch->taken : 0;
+
+            if (target <= i + 1) continue;
+            if (branch->taken < PGO_HOT_COUNT || fall * PGO_COLD_RATIO > branch->taken) continue;
+
+            // region is entered only by falling through the branch
+            b32 entered = false;
+
+            for (u64 j = 0; j < count && !entered; j++) {
+                if (j == i || (j > i && j < target) || !is_jump(code->ops[j].op.operation)) continue;
+
+                u64 to = position[code->ops[j].target];
+                entered = to > i && to < target;
+            }
+
+            if (entered) continue;
+
+            list_t<pgo_op_t> ops = {};
+            list_create(&ops, count + 1, *default_allocator);
+
+            for (u64 j = 0; j <= i; j++) list_add(&ops, &code->ops[j]);
+
+            pgo_op_t *inverted = &ops[i];
+            inverted->op.operation = inverted->op.operation == IR_JUMP_IF ? IR_JUMP_IF_NOT : IR_JUMP_IF;
+            inverted->target       = code->ops[i + 1].id;
+            inverted->taken        = fall;
+
+            for (u64 j = target; j < count;  j++) list_add(&ops, &code->ops[j]);
+            for (u64 j = i + 1;  j < target; j++) list_add(&ops, &code->ops[j]);
+
+            if (falls_through(code->ops[target - 1].op.operation)) {
+                pgo_op_t back = {};
+                back.op.operation = IR_JUMP;
+                back.op.info      = code->ops[target - 1].op.info;
+                back.id           = code->next_id++;
+                back.target       = target < count ? code->ops[target].id : code->end;
+                back.executions   = fall;
+
+                list_add(&ops, &back);
+            }
+
+            list_delete(&code->ops);
+            code->ops = ops;
+
+            stats->cold++;
+            moved = true;
+        }
+
+        mem_free(default_allocator, position);
+    }
+}
+
+// loops that run many iterations per entry, padding is executed once per entry
+static void align_hot_loops(pgo_code_t *code, pgo_stats_t *stats) {
+    u64  count    = code->ops.count;
+    u64 *position = code_positions(code);
+
+    b8 *heads = (b8*)mem_alloc(default_allocator, count + 1);
+    mem_set((u8*)heads, 0, count + 1);
+
+    u64 loops = 0;
+
+    for (u64 i = 0; i < count; i++) {
+        pgo_op_t *jump = &code->ops[i];
+
+        if (!is_jump(jump->op.operation)) continue;
+
+        u64 head = position[jump->target];
+        if (head > i || heads[head]) continue;
+
+        u64 back    = jump->op.operation == IR_JUMP ? jump->executions : jump->taken;
+        u64 entries = code->ops[head].executions > back ? code->ops[head].executions - back : 0;
+
+        if (back < PGO_HOT_COUNT || back < entries * PGO_LOOP_TRIPS) continue;
+
+        heads[head] = true;
+        loops++;
+    }
+
+    if (loops) {
+        list_t<pgo_op_t> ops = {};
+        list_create(&ops, count + loops, *default_allocator);
+
+        for (u64 i = 0; i < count; i++) {
+            if (heads[i]) {
+                pgo_op_t align = {};
+                align.op.operation = IR_ALIGN;
+                align.op.u_operand = PGO_LOOP_ALIGN;
+                align.op.info      = code->ops[i].op.info;
+                align.id           = code->next_id++;
+
+                list_add(&ops, &align);
+            }
+
+            list_add(&ops, &code->ops[i]);
+        }
+
+        list_delete(&code->ops);
+        code->ops = ops;
+
+        stats->aligned += loops;
+    }
+
+    mem_free(default_allocator, heads);
+    mem_free(default_allocator, position);
+}
+
+static void code_to_function(pgo_code_t *code) {
+    u64 count = code->ops.count;
+
+    // jumps to the next opcode are left from inlined returns
+    for (u64 i = 0; i < count; i++) {
+        pgo_op_t *op = &code->ops[i];
+
+        if (op->op.operation != IR_JUMP) continue;
+
+        u64 next = i + 1;
+        while (next < count && code->ops[next].op.operation == IR_NOP) next++;
+
+        if ((next < count ? code->ops[next].id : code->end) == op->target) {
+            op->op.operation = IR_NOP;
+        }
+    }
+
+    // nops are dropped, jumps to them go to the next opcode
+    u64 *position = (u64*)mem_alloc(default_allocator, (code->next_id + 1) * sizeof(u64));
+    mem_set((u8*)position, 0, (code->next_id + 1) * sizeof(u64));
+
+    u64 size = 0;
+
+    for (u64 i = 0; i < count; i++) {
+        position[code->ops[i].id] = size;
+        if (code->ops[i].op.operation != IR_NOP) size++;
+    }
+
+    position[code->end] = size;
+
+    array_t<ir_opcode_t> result = {};
+    array_create(&result, size + 1, code->func->code.alloc);
+
+    for (u64 i = 0; i < count; i++) {
+        ir_opcode_t op = code->ops[i].op;
+
+        if (op.operation == IR_NOP) continue;
+
+        op.index = result.count;
+
+        if (is_jump(op.operation)) {
+            op.s_operand = (s64)position[code->ops[i].target] - (s64)(op.index + 1);
+        }
+
+        array_add(&result, op);
+    }
+
+    array_delete(&code->func->code);
+    code->func->code = result;
+
+    list_delete(&code->ops);
+    mem_free(default_allocator, position);
+}
+
+void pgo_apply(ir_t *ir, pgo_profile_t *profile, pgo_stats_t *stats) {
+    profiler_func_start();
+
+    list_t<pgo_code_t> changed = {};
+
+    for (u64 i = 0; i < ir->functions.capacity; i++) {
+        kv_pair_t<string_t, ir_function_t> *pair = ir->functions.entries + i;
+
+        if (!pair->occupied) continue;
+        if (pair->deleted)   continue;
+        if (pair->value.is_external || pair->value.code.count == 0) continue;
+
+        pgo_function_t *counts = find_profile(profile, pair->key);
+        if (counts == NULL) continue;
+
+        u64 before = stats->inlined + stats->cold + stats->aligned;
+
+        pgo_code_t code = {};
+        code_from_function(&code, &pair->value, counts);
+
+        inline_hot_calls(ir, profile, &code, stats);
+        move_cold_blocks(&code, stats);
+        align_hot_loops(&code, stats);
+
+        if (before == stats->inlined + stats->cold + stats->aligned) {
+            list_delete(&code.ops);
+            continue;
+        }
+
+        list_add(&changed, &code);
+    }
+
+    // callees are inlined from IR, so it is replaced only when every function is done
+    for (u64 i = 0; i < changed.count; i++) {
+        code_to_function(list_get(&changed, i));
+    }
+
+    if (changed.data) list_delete(&changed);
+
+    profiler_func_end();
+}
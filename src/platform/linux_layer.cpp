@@ -1,5 +1,17 @@
 #include <stdio.h>
 #include <time.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <spawn.h>
+#include <pthread.h>
+#include <signal.h>
+#include <setjmp.h>
+
+extern char **environ;
 
 static time_t start_time = 0;
 
@@ -88,6 +100,49 @@ b32 platform_read_file_into_string(string_t filename, allocator_t *alloc, string
     return true;
 }
 
+b32 platform_map_file(string_t filename, string_t *output) {
+    profiler_func_start();
+    assert(output != NULL);
+    assert(filename.data != NULL);
+
+    int file = open(string_temp_to_c_string(filename), O_RDONLY);
+
+    if (file < 0) {
+        log_error("Could not open file.");
+        log_error(filename); 
+        profiler_func_end();
+        return false;
+    }
+
+    struct stat info = {};
+
+    if (fstat(file, &info) != 0 || info.st_size == 0) {
+        close(file);
+        profiler_func_end();
+        return false;
+    }
+
+    void *view = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+
+    if (view == MAP_FAILED) {
+        log_error("Could not map file.");
+        log_error(filename); 
+        profiler_func_end();
+        return false;
+    }
+
+    output->data = (u8*)view;
+    output->size = (u64)info.st_size;
+    profiler_func_end();
+    return true;
+}
+
+void platform_unmap_file(string_t mapping) {
+    if (mapping.data == NULL) return;
+    munmap(mapping.data, mapping.size);
+}
+
 b32 platform_write_file(string_t name, string_t content) {
     profiler_func_start();
     const char *filename = string_to_c_string(name, get_temporary_allocator());
@@ -107,8 +162,225 @@ b32 platform_write_file(string_t name, string_t content) {
     return true; // we dont check if write was corrupted...
 }
 
-u32 platform_run_process(string_t exec_name, string_t args) {
-    log_error("TODO: Run process on linux");
-    return -100;
+u64 platform_open_file_for_writing(string_t name) {
+    int file = open(string_temp_to_c_string(name), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (file < 0) {
+        log_error("Could not open file for writing.");
+        log_error(name);
+        return PLATFORM_INVALID_HANDLE;
+    }
+
+    return (u64)file;
+}
+
+b32 platform_write_handle(u64 handle, u8 *data, u64 size) {
+    while (size > 0) {
+        ssize_t written = write((int)handle, data, (size_t)size);
+
+        if (written < 0) return false;
+
+        data += written;
+        size -= (u64)written;
+    }
+
+    return true;
+}
+
+void platform_close_handle(u64 handle) {
+    if (handle == PLATFORM_INVALID_HANDLE) return;
+    close((int)handle);
+}
+
+void *platform_alloc_pages(u64 size) {
+    void *memory = mmap(NULL, (size_t)size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return memory == MAP_FAILED ? NULL : memory;
+}
+
+b32 platform_protect_executable(void *memory, u64 size) {
+    return mprotect(memory, (size_t)size, PROT_READ | PROT_EXEC) == 0;
+}
+
+void platform_free_pages(void *memory, u64 size) {
+    if (memory == NULL) return;
+    munmap(memory, (size_t)size);
+}
+
+#define LINUX_GUARD_STACK_SIZE (64 * 1024)
+
+static const int linux_guard_signals[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL };
+static thread_local sigjmp_buf *linux_guard_jump   = NULL;
+static thread_local u32         linux_guard_caught = 0;
+
+static void linux_guard_handler(int signal) {
+    linux_guard_caught = (u32)signal;
+    siglongjmp(*linux_guard_jump, 1);
+}
+
+u32 platform_run_guarded(void (*proc)(void *data), void *data) {
+    const u64 count = sizeof(linux_guard_signals) / sizeof(linux_guard_signals[0]);
+
+    // handler gets its own stack, so overflow of the guarded one is caught too
+    stack_t alt      = {};
+    stack_t previous = {};
+    alt.ss_sp   = platform_alloc_pages(LINUX_GUARD_STACK_SIZE);
+    alt.ss_size = LINUX_GUARD_STACK_SIZE;
+
+    if (alt.ss_sp == NULL || sigaltstack(&alt, &previous) != 0) {
+        platform_free_pages(alt.ss_sp, LINUX_GUARD_STACK_SIZE);
+        proc(data);
+        return 0;
+    }
+
+    struct sigaction action = {};
+    struct sigaction actions[count];
+
+    action.sa_handler = linux_guard_handler;
+    action.sa_flags   = SA_ONSTACK | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+
+    for (u64 i = 0; i < count; i++) sigaction(linux_guard_signals[i], &action, &actions[i]);
+
+    sigjmp_buf  jump;
+    sigjmp_buf *outer  = linux_guard_jump;
+    linux_guard_jump   = &jump;
+    linux_guard_caught = 0;
+
+    if (sigsetjmp(jump, 1) == 0) proc(data);
+
+    u32 caught       = linux_guard_caught;
+    linux_guard_jump = outer;
+
+    for (u64 i = 0; i < count; i++) sigaction(linux_guard_signals[i], &actions[i], NULL);
+
+    sigaltstack(&previous, NULL);
+    platform_free_pages(alt.ss_sp, LINUX_GUARD_STACK_SIZE);
+
+    return caught;
+}
+
+b32 platform_set_executable(string_t name) {
+    if (chmod(string_temp_to_c_string(name), 0755) != 0) {
+        log_error("Could not make file executable.");
+        log_error(name);
+        return false;
+    }
+
+    return true;
+}
+
+struct linux_thread_start_t {
+    platform_thread_proc_t *proc;
+    void *data;
+};
+
+static void *linux_thread_entry(void *data) {
+    linux_thread_start_t start = *(linux_thread_start_t*)data;
+    mem_free(default_allocator, data);
+
+    start.proc(start.data);
+    return NULL;
+}
+
+u64 platform_thread_start(platform_thread_proc_t *proc, void *data) {
+    linux_thread_start_t *start = (linux_thread_start_t*)mem_alloc(default_allocator, sizeof(linux_thread_start_t));
+    start->proc = proc;
+    start->data = data;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, linux_thread_entry, start) != 0) {
+        mem_free(default_allocator, start);
+        return 0;
+    }
+
+    return (u64)thread;
+}
+
+void platform_thread_join(u64 thread) {
+    pthread_join((pthread_t)thread, NULL);
+}
+
+u64 platform_processor_count(void) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (u64)count : 1;
+}
+
+u64 platform_atomic_increment(volatile u64 *value) {
+    return __atomic_fetch_add(value, 1, __ATOMIC_SEQ_CST);
+}
+
+u32 platform_run_process(string_t exec_name, string_t *args, u64 arg_count) {
+    profiler_func_start();
+    allocator_t *talloc = get_temporary_allocator();
+
+    char **argv = (char**)mem_alloc(talloc, (arg_count + 2) * sizeof(char*));
+
+    argv[0] = string_to_c_string(exec_name, talloc);
+
+    for (u64 i = 0; i < arg_count; i++) {
+        argv[i + 1] = string_to_c_string(args[i], talloc);
+    }
+
+    argv[arg_count + 1] = NULL;
+
+    // stdout and stderr of the child come back through one pipe
+    int output[2];
+    if (pipe(output) != 0) {
+        log_error(STRING("Couldn't create pipe."));
+        profiler_func_end();
+        return PLATFORM_PROCESS_FAILED;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addclose(&actions, output[0]);
+    posix_spawn_file_actions_adddup2(&actions, output[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, output[1], STDERR_FILENO);
+    posix_spawn_file_actions_addclose(&actions, output[1]);
+
+    pid_t pid = 0;
+    int status = posix_spawnp(&pid, argv[0], &actions, NULL, argv, environ);
+
+    posix_spawn_file_actions_destroy(&actions);
+    close(output[1]);
+
+    if (status != 0) {
+        close(output[0]);
+        log_error(string_format(talloc, STRING("Couldn't create process '%s'."), exec_name));
+        profiler_func_end();
+        return PLATFORM_PROCESS_FAILED;
+    }
+
+    u8 buffer[4096];
+    ssize_t size = 0;
+
+    while ((size = read(output[0], buffer, sizeof(buffer))) != 0) {
+        if (size < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        log_write({ (u64)size, buffer });
+    }
+
+    close(output[0]);
+
+    int exit_status = 0;
+    while (waitpid(pid, &exit_status, 0) < 0) {
+        if (errno != EINTR) {
+            log_error("Waiting failed");
+            profiler_func_end();
+            return PLATFORM_PROCESS_FAILED;
+        }
+    }
+
+    profiler_func_end();
+
+    if (WIFSIGNALED(exit_status)) {
+        log_error(string_format(talloc, STRING("Process '%s' was killed by signal %u."), exec_name, (u64)WTERMSIG(exit_status)));
+        return PLATFORM_PROCESS_SIGNALED + (u32)WTERMSIG(exit_status);
+    }
+
+    return WIFEXITED(exit_status) ? (u32)WEXITSTATUS(exit_status) : PLATFORM_PROCESS_FAILED;
 }
 
@@ -120,6 +120,70 @@ b32 platform_read_file_into_string(string_t name, allocator_t *alloc, string_t *
     return true;
 }
 
+b32 platform_map_file(string_t name, string_t *output) {
+    profiler_func_start();
+    assert(output != NULL);
+    assert(name.data != NULL);
+
+    if (name.size > MAX_PATH) {
+        profiler_func_end();
+        return false;
+    }
+
+    LPSTR filename = string_to_c_string(name, get_temporary_allocator());
+
+    HANDLE file = CreateFileA(filename, 
+            GENERIC_READ,
+            FILE_SHARE_READ,
+            NULL,
+            OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL, 
+            NULL);
+
+    if (file == INVALID_HANDLE_VALUE) {
+        log_error(STRING("Couldn't load file."));
+        profiler_func_end();
+        return false;
+    }
+
+    LARGE_INTEGER size = {};
+    GetFileSizeEx(file, &size);
+
+    if (size.QuadPart == 0) {
+        CloseHandle(file);
+        profiler_func_end();
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+
+    if (mapping == NULL) {
+        log_error(STRING("Couldn't map file."));
+        profiler_func_end();
+        return false;
+    }
+
+    void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+
+    if (view == NULL) {
+        log_error(STRING("Couldn't map view of file."));
+        profiler_func_end();
+        return false;
+    }
+
+    output->data = (u8*)view;
+    output->size = (u64)size.QuadPart;
+    profiler_func_end();
+    return true;
+}
+
+void platform_unmap_file(string_t mapping) {
+    if (mapping.data == NULL) return;
+    UnmapViewOfFile(mapping.data);
+}
+
 b32 platform_write_file(string_t name, string_t content) {
     profiler_func_start();
     assert(content.data != NULL);
@@ -172,15 +236,162 @@ b32 platform_write_file(string_t name, string_t content) {
     return true;
 }
 
-u32 platform_run_process(string_t exec_name, string_t args) {
+u64 platform_open_file_for_writing(string_t name) {
+    if (name.size > MAX_PATH) return PLATFORM_INVALID_HANDLE;
+
+    LPSTR filename = string_to_c_string(name, get_temporary_allocator());
+
+    HANDLE file = CreateFileA(filename, 
+            GENERIC_WRITE,
+            0,
+            NULL,
+            CREATE_ALWAYS,
+            FILE_ATTRIBUTE_NORMAL, 
+            NULL);
+
+    if (file == INVALID_HANDLE_VALUE) {
+        log_error(STRING("Couldn't open file for writing."));
+        return PLATFORM_INVALID_HANDLE;
+    }
+
+    return (u64)file;
+}
+
+b32 platform_write_handle(u64 handle, u8 *data, u64 size) {
+    while (size > 0) {
+        DWORD chunk   = size > 0x40000000 ? 0x40000000 : (DWORD)size;
+        DWORD written = 0;
+
+        if (!WriteFile((HANDLE)handle, (LPVOID)data, chunk, &written, NULL)) return false;
+
+        data += written;
+        size -= written;
+    }
+
+    return true;
+}
+
+void platform_close_handle(u64 handle) {
+    if (handle == PLATFORM_INVALID_HANDLE) return;
+    CloseHandle((HANDLE)handle);
+}
+
+void *platform_alloc_pages(u64 size) {
+    return VirtualAlloc(NULL, (SIZE_T)size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+}
+
+b32 platform_protect_executable(void *memory, u64 size) {
+    DWORD old = 0;
+    return VirtualProtect(memory, (SIZE_T)size, PAGE_EXECUTE_READ, &old) != 0;
+}
+
+void platform_free_pages(void *memory, u64 size) {
+    UNUSED(size);
+    if (memory == NULL) return;
+    VirtualFree(memory, 0, MEM_RELEASE);
+}
+
+// generated code isn't run on windows, see jit_is_supported
+u32 platform_run_guarded(void (*proc)(void *data), void *data) {
+    proc(data);
+    return 0;
+}
+
+b32 platform_set_executable(string_t name) {
+    UNUSED(name);
+    return true;
+}
+
+struct win32_thread_start_t {
+    platform_thread_proc_t *proc;
+    void *data;
+};
+
+static DWORD WINAPI win32_thread_entry(LPVOID data) {
+    win32_thread_start_t start = *(win32_thread_start_t*)data;
+    mem_free(default_allocator, data);
+
+    start.proc(start.data);
+    return 0;
+}
+
+u64 platform_thread_start(platform_thread_proc_t *proc, void *data) {
+    win32_thread_start_t *start = (win32_thread_start_t*)mem_alloc(default_allocator, sizeof(win32_thread_start_t));
+    start->proc = proc;
+    start->data = data;
+
+    HANDLE thread = CreateThread(NULL, 0, win32_thread_entry, start, 0, NULL);
+
+    if (thread == NULL) {
+        mem_free(default_allocator, start);
+        return 0;
+    }
+
+    return (u64)thread;
+}
+
+void platform_thread_join(u64 thread) {
+    WaitForSingleObject((HANDLE)thread, INFINITE);
+    CloseHandle((HANDLE)thread);
+}
+
+u64 platform_processor_count(void) {
+    SYSTEM_INFO info = {};
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (u64)info.dwNumberOfProcessors : 1;
+}
+
+u64 platform_atomic_increment(volatile u64 *value) {
+    return (u64)InterlockedIncrement64((volatile LONG64*)value) - 1;
+}
+
+// quotes argument the way CommandLineToArgvW splits it back:
+// backslashes are doubled only in front of a quote
+static string_t quote_argument(string_t arg, allocator_t *talloc) {
+    b32 plain = arg.size > 0;
+
+    for (u64 i = 0; i < arg.size; i++) {
+        if (arg.data[i] == ' ' || arg.data[i] == '\t' || arg.data[i] == '"') plain = false;
+    }
+
+    if (plain) return arg;
+
+    u8 *data = (u8*)mem_alloc(talloc, arg.size * 2 + 3);
+    u64 size = 0;
+
+    data[size++] = '"';
+
+    for (u64 i = 0; i < arg.size; i++) {
+        u64 slashes = 0;
+        while (i < arg.size && arg.data[i] == '\\') { slashes++; i++; }
+
+        // before a quote or the closing one every backslash is escaped
+        if (i == arg.size || arg.data[i] == '"') slashes *= 2;
+        for (u64 j = 0; j < slashes; j++) data[size++] = '\\';
+
+        if (i == arg.size) break;
+        if (arg.data[i] == '"') data[size++] = '\\';
+
+        data[size++] = arg.data[i];
+    }
+
+    data[size++] = '"';
+    return { size, data };
+}
+
+u32 platform_run_process(string_t exec_name, string_t *args, u64 arg_count) {
     PROCESS_INFORMATION info  = {};
     STARTUPINFOA startup_info = {};
     startup_info.cb = sizeof(STARTUPINFOA);
 
     allocator_t *talloc = get_temporary_allocator();
 
-    string_t command_line = string_concat(exec_name, STRING(" "), talloc);
-    command_line = string_concat(command_line, args, talloc);
+    string_t command_line = quote_argument(exec_name, talloc);
+
+    for (u64 i = 0; i < arg_count; i++) {
+        command_line = string_concat(command_line, STRING(" "), talloc);
+        command_line = string_concat(command_line, quote_argument(args[i], talloc), talloc);
+    }
 
     b32 status = CreateProcessA(
             NULL,
@@ -196,7 +407,7 @@ u32 platform_run_process(string_t exec_name, string_t args) {
 
     if (!status || info.hProcess == INVALID_HANDLE_VALUE) {
         log_error(STRING("Couldn't create process."));
-        return 10000;
+        return PLATFORM_PROCESS_FAILED;
     }
 
     DWORD result = WaitForSingleObject(info.hProcess, INFINITE);
@@ -210,8 +421,8 @@ u32 platform_run_process(string_t exec_name, string_t args) {
             log_error("!!!!!");
             break;
     }
-    DWORD exit_code = 0;
-    GetExitCodeProcess(info.hProcess, &exit_code);
+    DWORD exit_code = PLATFORM_PROCESS_FAILED;
+    if (result != WAIT_OBJECT_0 || !GetExitCodeProcess(info.hProcess, &exit_code)) exit_code = PLATFORM_PROCESS_FAILED;
     CloseHandle(info.hProcess);
     CloseHandle(info.hThread);
     return exit_code;
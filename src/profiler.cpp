@@ -17,7 +17,8 @@ struct Profiler_Context {
 };
 
 
-Profiler_Context profiler_ctx = {};
+// only thread that called profiler_begin records anything
+thread_local Profiler_Context profiler_ctx = {};
 
 void profiler_data_delete_impl(Profile_Data *data) {
     if (data->strings.data) {
@@ -0,0 +1,102 @@
+#include "sink.h"
+
+#include "allocator.h"
+#include "platform.h"
+#include "memctl.h"
+#include "logger.h"
+
+b32 sink_open(sink_t *sink, string_t filename) {
+    u64 handle = platform_open_file_for_writing(filename);
+
+    if (handle == PLATFORM_INVALID_HANDLE) {
+        *sink = {};
+        sink->handle = PLATFORM_INVALID_HANDLE;
+        sink->failed = true;
+        return false;
+    }
+
+    sink_open_handle(sink, handle);
+    return true;
+}
+
+void sink_open_handle(sink_t *sink, u64 handle) {
+    assert(default_allocator != NULL);
+
+    *sink = {};
+    sink->handle = handle;
+    sink->buffer = (u8*)mem_alloc(default_allocator, SINK_BUFFER_SIZE);
+}
+
+void sink_open_memory(sink_t *sink, list_t<u8> *memory) {
+    sink_open_handle(sink, PLATFORM_INVALID_HANDLE);
+    sink->memory = memory;
+}
+
+b32 sink_flush(sink_t *sink) {
+    if (sink->count == 0 || sink->failed) {
+        sink->count = 0;
+        return !sink->failed;
+    }
+
+    if (sink->memory) {
+        u64 index = 0;
+
+        list_allocate(sink->memory, sink->count, &index);
+        list_fill(sink->memory, sink->buffer, sink->count, index);
+        sink->written += sink->count;
+    } else if (!platform_write_handle(sink->handle, sink->buffer, sink->count)) {
+        sink->failed = true;
+    } else {
+        sink->written += sink->count;
+    }
+
+    sink->count = 0;
+    return !sink->failed;
+}
+
+void sink_write(sink_t *sink, u8 *data, u64 size) {
+    if (sink->failed) return;
+
+    while (size > 0) {
+        if (sink->count == SINK_BUFFER_SIZE && !sink_flush(sink)) return;
+
+        u64 space = SINK_BUFFER_SIZE - sink->count;
+        u64 chunk = size < space ? size : space;
+
+        mem_copy(sink->buffer + sink->count, data, chunk);
+        sink->count += chunk;
+
+        data += chunk;
+        size -= chunk;
+    }
+}
+
+void sink_fill(sink_t *sink, u8 value, u64 size) {
+    if (sink->failed) return;
+
+    while (size > 0) {
+        if (sink->count == SINK_BUFFER_SIZE && !sink_flush(sink)) return;
+
+        u64 space = SINK_BUFFER_SIZE - sink->count;
+        u64 chunk = size < space ? size : space;
+
+        mem_set(sink->buffer + sink->count, value, chunk);
+        sink->count += chunk;
+
+        size -= chunk;
+    }
+}
+
+b32 sink_close(sink_t *sink) {
+    if (sink->buffer) {
+        sink_flush(sink);
+        mem_free(default_allocator, sink->buffer);
+    }
+
+    platform_close_handle(sink->handle);
+
+    b32 result = !sink->failed;
+    *sink = {};
+    sink->handle = PLATFORM_INVALID_HANDLE;
+    return result;
+}
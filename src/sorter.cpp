@@ -52,57 +52,49 @@ void sort_swap(void *data, u32 size, u64 a, u64 b) {
 // start - in elements, inclusive
 // stop  - in elements, exclusive
 void quick_sort(void *data, u32 element_size, u64 start, u64 stop, compare_func_t *comp = std_comp_func) {
-    s64 size = stop - start;
-
-    if (size < 2) {
-        return;
-    }
-
-    if (size == 2) {
-        if (comp(element_size, ((u8*)data) + start * element_size, ((u8*)data) + (stop - 1) * element_size) > 0)
-            sort_swap(data, element_size, start, stop - 1);
-        return;
-    }     
-
-
-    // u64 pivot_index = start + (stop - start) / 2; // center
-    u64 pivot_index = stop-1; // center
-    u8* pivot = (u8*)mem_alloc(get_temporary_allocator(), element_size);
-    mem_copy(pivot, (u8*)data + pivot_index * element_size, element_size);
-
-    u64 begin_index = start;
-    u64 end_index = stop - 1;
-
-    while (begin_index < end_index) {
-        u8 *begin = ((u8*)data) + begin_index * element_size;
-        u8 *end   = ((u8*)data) + end_index * element_size;
-
-        if (comp(element_size, begin, pivot) < 0) {
-            begin_index++;
-            continue;
-        }
-
-        if (comp(element_size, end, pivot) > 0) {
-            end_index--;
-            continue;
+    u8 *base  = (u8*)data;
+    u8 *pivot = NULL;
+
+    while (stop - start > 2) {
+        // pivot is copied, elements equal to it are moved while partitioning
+        if (pivot == NULL) pivot = (u8*)mem_alloc(get_temporary_allocator(), element_size);
+        mem_copy(pivot, base + (start + (stop - start) / 2) * element_size, element_size);
+
+        // [start, less) < pivot, [less, i) == pivot, [greater, stop) > pivot,
+        // so runs of equal elements are done in one pass
+        u64 less    = start;
+        u64 greater = stop;
+        u64 i       = start;
+
+        while (i < greater) {
+            s32 order = comp(element_size, base + i * element_size, pivot);
+
+            if (order < 0) {
+                if (i != less) sort_swap(data, element_size, i, less);
+                less++;
+                i++;
+            } else if (order > 0) {
+                greater--;
+                if (i != greater) sort_swap(data, element_size, i, greater);
+            } else {
+                i++;
+            }
         }
 
-        if (comp(element_size, begin, end) == 0) {
-            begin_index++;
-            end_index--;
-            continue;
-        }
-
-        sort_swap(data, element_size, begin_index, end_index);
-        if (begin_index == pivot_index) {
-            pivot_index = end_index;
-        } else if (end_index == pivot_index) {
-            pivot_index = begin_index;
+        // smaller side is sorted by recursion, bigger one by the loop, depth stays O(log n)
+        if (less - start < stop - greater) {
+            quick_sort(data, element_size, start, less, comp);
+            start = greater;
+        } else {
+            quick_sort(data, element_size, greater, stop, comp);
+            stop = less;
         }
     }
 
-    quick_sort(data, element_size, start, pivot_index, comp);
-    quick_sort(data, element_size, pivot_index + 1, stop, comp);
+    if (stop - start == 2) {
+        if (comp(element_size, base + start * element_size, base + (stop - 1) * element_size) > 0)
+            sort_swap(data, element_size, start, stop - 1);
+    }
 }
 
 
@@ -143,6 +135,11 @@ void sorter_tests() {
         s32 expected[] = {1, 2, 2, 3, 3, 4};
         assert(sort_test_case(data, expected, sizeof(data) / sizeof(s32)));
     }
+    {
+        s32 data[]     = {2, 1, 3, 1, 3, 2};
+        s32 expected[] = {1, 1, 2, 2, 3, 3};
+        assert(sort_test_case(data, expected, sizeof(data) / sizeof(s32)));
+    }
     {
         s32 data[]     = {42};
         s32 expected[] = {42};
@@ -163,6 +160,11 @@ void sorter_tests() {
         s32 expected[] = {7, 7, 7, 7, 7};
         assert(sort_test_case(data, expected, sizeof(data) / sizeof(s32)));
     }
+    {
+        s32 data[]     = {1, 1, 2, 1, 0, 1, 1, 0, 1, 2, 1};
+        s32 expected[] = {0, 0, 1, 1, 1, 1, 1, 1, 1, 2, 2};
+        assert(sort_test_case(data, expected, sizeof(data) / sizeof(s32)));
+    }
     {
         s32 data[]     = {9, 3, 7, 1, 8, 2, 5, 4, 6, 0};
         s32 expected[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
@@ -1,10 +1,14 @@
 #include "talloc.h"
 #include "strings.h"
 
-struct {
+struct temp_data_t {
     u64 position;
     u8  data[TEMP_MEM_SIZE];
-} __talloc_data;
+};
+
+// main thread uses static block, workers get their own, see temp_thread_begin
+static temp_data_t __talloc_static;
+static thread_local temp_data_t *__talloc_data = &__talloc_static;
 
 allocator_t __talloc;
 
@@ -43,20 +47,20 @@ ALLOCATOR_PROC(temporary_allocator_proc) {
 
 // @todo : for all allocators
 b32 is_inside_of_temp_memory(void *p) {
-    return (p >= __talloc_data.data) && (p < (__talloc_data.data + TEMP_MEM_SIZE));
+    return (p >= __talloc_data->data) && (p < (__talloc_data->data + TEMP_MEM_SIZE));
 }
 
 allocator_t *get_temporary_allocator(void) {
     if (__talloc.data == NULL) {
         __talloc.proc = temporary_allocator_proc; 
-        __talloc.data = &__talloc_data;
+        __talloc.data = &__talloc_static;
     }
     return &__talloc;
 }
 
 void *temp_allocate(u64 size) {
-    assert(__talloc_data.data != NULL);
-    assert(TEMP_MEM_SIZE > __talloc_data.position);
+    assert(__talloc_data->data != NULL);
+    assert(TEMP_MEM_SIZE > __talloc_data->position);
 
     if (size > TEMP_MEM_SIZE) {
         log_error(STRING("Trying to allocate more memory than exists in __talloc_data."));
@@ -64,32 +68,43 @@ void *temp_allocate(u64 size) {
         return NULL;
     }
     
-    u64 new_position = __talloc_data.position  + size;
-    u8 *address      = __talloc_data.data + __talloc_data.position;
+    u64 new_position = __talloc_data->position  + size;
+    u8 *address      = __talloc_data->data + __talloc_data->position;
 
     if (new_position < TEMP_MEM_SIZE) {
         mem_set(address, 0, size);
-        __talloc_data.position = new_position;
+        __talloc_data->position = new_position;
         return address;
     }
 
     log_warning(STRING("__talloc_data wrapped."));
 
     if (new_position > TEMP_MEM_SIZE) {
-        __talloc_data.position = size;
+        __talloc_data->position = size;
     } else {
-        __talloc_data.position = 0;
+        __talloc_data->position = 0;
     }
     
     return address;
 }
 
+void temp_thread_begin(void) {
+    assert(__talloc_data == &__talloc_static);
+    __talloc_data = (temp_data_t*)mem_alloc(default_allocator, sizeof(temp_data_t));
+}
+
+void temp_thread_end(void) {
+    assert(__talloc_data != &__talloc_static);
+    mem_free(default_allocator, __talloc_data);
+    __talloc_data = &__talloc_static;
+}
+
 void temp_reset(void) {
-    assert(__talloc_data.data != NULL);
+    assert(__talloc_data->data != NULL);
     assert(TEMP_MEM_SIZE > 0);
-    assert(TEMP_MEM_SIZE > __talloc_data.position);
+    assert(TEMP_MEM_SIZE > __talloc_data->position);
 
-    __talloc_data.position = 0;
+    __talloc_data->position = 0;
 }
 
 void temp_tests(void) {
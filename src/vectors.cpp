@@ -0,0 +1,114 @@
+#include "backend.h"
+
+// per lane size: 8, 16, 32 and 64 bits
+static const char *add_names[] = { "paddb",   "paddw",   "paddd",   "paddq"   };
+static const char *sub_names[] = { "psubb",   "psubw",   "psubd",   "psubq"   };
+static const char *eq_names[]  = { "pcmpeqb", "pcmpeqw", "pcmpeqd", "pcmpeqq" };
+static const char *gt_names[]  = { "pcmpgtb", "pcmpgtw", "pcmpgtd", "pcmpgtq" };
+
+static const u32 add_codes[] = { 0x0FFC, 0x0FFD, 0x0FFE, 0x0FD4 };
+static const u32 sub_codes[] = { 0x0FF8, 0x0FF9, 0x0FFA, 0x0FFB };
+static const u32 eq_codes[]  = { 0x0F74, 0x0F75, 0x0F76, 0x0F3829 };
+static const u32 gt_codes[]  = { 0x0F64, 0x0F65, 0x0F66, 0x0F3837 };
+
+static const u64 sign_bits[] = { 0x8080808080808080ull, 0x8000800080008000ull, 0x8000000080000000ull, 0x8000000000000000ull };
+
+static inline void set(backend_vector_op_t *select, const char *name, u32 flags, u32 opcode) {
+    select->name   = name;
+    select->flags  = flags;
+    select->opcode = opcode;
+}
+
+// a < b is b > a, so operands are swapped for LT and GT of floats and LT of integers
+static inline void swap(backend_vector_op_t *select) {
+    select->dst = 1;
+    select->src = 0;
+}
+
+static b32 select_float(u64 operation, b32 is_double, backend_vector_op_t *select) {
+    u32 flags = is_double ? BACKEND_VECTOR_66 : 0;
+
+    switch (operation) {
+        case IR_VADD: set(select, is_double ? "addpd" : "addps", flags, 0x0F58); return true;
+        case IR_VSUB: set(select, is_double ? "subpd" : "subps", flags, 0x0F5C); return true;
+        case IR_VMUL: set(select, is_double ? "mulpd" : "mulps", flags, 0x0F59); return true;
+        case IR_VDIV: set(select, is_double ? "divpd" : "divps", flags, 0x0F5E); return true;
+    }
+
+    // ordered EQ, LT, LE and unordered NEQ, same as scalar comparisons
+    set(select, is_double ? "cmppd" : "cmpps", flags, 0x0FC2);
+
+    switch (operation) {
+        case IR_VCMP_EQ:  select->imm = 0; return true;
+        case IR_VCMP_NEQ: select->imm = 4; return true;
+        case IR_VCMP_LT:  select->imm = 1; return true;
+        case IR_VCMP_LTE: select->imm = 2; return true;
+        case IR_VCMP_GT:  select->imm = 1; swap(select); return true;
+        case IR_VCMP_GTE: select->imm = 2; swap(select); return true;
+    }
+
+    return false;
+}
+
+b32 backend_select_vector(u64 operation, u64 vector, backend_vector_op_t *select) {
+    *select = {};
+    select->dst = 0;
+    select->src = 1;
+    select->imm = -1;
+
+    u64 lane = IR_VECTOR_LANE(vector);
+
+    switch (operation) {
+        case IR_VAND: set(select, "pand", BACKEND_VECTOR_66, 0x0FDB); return true;
+        case IR_VOR:  set(select, "por",  BACKEND_VECTOR_66, 0x0FEB); return true;
+        case IR_VXOR: set(select, "pxor", BACKEND_VECTOR_66, 0x0FEF); return true;
+    }
+
+    if (lane == IR_LANE_F32 || lane == IR_LANE_F64) {
+        return select_float(operation, lane == IR_LANE_F64, select);
+    }
+
+    u64 size = lane / 2; // log2 of bytes
+
+    switch (operation) {
+        case IR_VADD: set(select, add_names[size], BACKEND_VECTOR_66, add_codes[size]); return true;
+        case IR_VSUB: set(select, sub_names[size], BACKEND_VECTOR_66, sub_codes[size]); return true;
+
+        case IR_VMUL:
+            if (size == 1) { set(select, "pmullw", BACKEND_VECTOR_66, 0x0FD5);   return true; }
+            if (size == 2) { set(select, "pmulld", BACKEND_VECTOR_66, 0x0F3840); return true; }
+            return false;
+
+        case IR_VDIV:
+            return false;
+
+        case IR_VCMP_EQ:
+        case IR_VCMP_NEQ:
+            set(select, eq_names[size], BACKEND_VECTOR_66, eq_codes[size]);
+            select->invert = operation == IR_VCMP_NEQ;
+            return true;
+    }
+
+    // only signed greater than exists, unsigned lanes get their sign bits flipped
+    set(select, gt_names[size], BACKEND_VECTOR_66, gt_codes[size]);
+
+    if (!ir_lane_is_signed(lane)) select->bias = sign_bits[size];
+
+    switch (operation) {
+        case IR_VCMP_GT:  return true;
+        case IR_VCMP_LT:  swap(select); return true;
+        case IR_VCMP_LTE: select->invert = true; return true;
+        case IR_VCMP_GTE: select->invert = true; swap(select); return true;
+    }
+
+    return false;
+}
+
+u64 backend_splat_multiplier(u64 lane) {
+    switch (ir_lane_size(lane)) {
+        case 1:  return 0x0101010101010101ull;
+        case 2:  return 0x0001000100010001ull;
+        case 4:  return 0x0000000100000001ull;
+        default: return 1;
+    }
+}
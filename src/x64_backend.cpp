@@ -0,0 +1,1457 @@
+#include "backend.h"
+#include "list.h"
+#include "hashmap.h"
+#include "talloc.h"
+#include "strings.h"
+#include "profiler.h"
+
+// Same conventions as nasm backend: exec stack is [r14 + r15 * 8], locals
+// are at rbp - offset * 8, register arguments and result follow ir_function_t.
+// Exec stack stays in memory here, only direct local access, compare + jump
+// and address computations (see backend_match_address) are folded.
+
+enum x64_register_t {
+    X64_RAX, X64_RCX, X64_RDX, X64_RBX, X64_RSP, X64_RBP, X64_RSI, X64_RDI,
+    X64_R8,  X64_R9,  X64_R10, X64_R11, X64_R12, X64_R13, X64_R14, X64_R15,
+
+    X64_NO_REGISTER,
+};
+
+enum x64_condition_t {
+    X64_CC_B  = 0x2,
+    X64_CC_AE = 0x3,
+    X64_CC_E  = 0x4,
+    X64_CC_NE = 0x5,
+    X64_CC_BE = 0x6,
+    X64_CC_A  = 0x7,
+    X64_CC_P  = 0xA,
+    X64_CC_NP = 0xB,
+    X64_CC_L  = 0xC,
+    X64_CC_GE = 0xD,
+    X64_CC_LE = 0xE,
+    X64_CC_G  = 0xF,
+};
+
+// argument k of a call is in argument_registers[register_args - 1 - k],
+// same registers as exec stack cache of nasm backend
+static const u8 argument_registers[IR_REGISTER_ARGS] = { X64_RSI, X64_RDI, X64_R8 };
+
+// putchar buffer of linux runtime
+#define X64_OUTPUT_BUFFER_SIZE KB(64)
+
+#define X64_W    0x1 // 64 bit operand
+#define X64_16   0x2 // 0x66 prefix
+#define X64_BYTE 0x4 // byte register, spl..dil need empty REX
+#define X64_F2   0x8 // scalar double prefix, reg is xmm register
+#define X64_F3   0x10 // scalar single prefix
+
+enum x64_operand_kind_t {
+    X64_OPERAND_REGISTER,
+    X64_OPERAND_MEMORY,
+    X64_OPERAND_SYMBOL, // rip relative
+};
+
+struct x64_operand_t {
+    u8  kind;
+    u8  base;
+    u8  index;
+    u8  scale;  // of index, 1, 2, 4 or 8
+    s32 disp;
+    u64 symbol;
+};
+
+struct x64_jump_t {
+    u64 offset; // of rel32
+    u64 target; // opcode index
+};
+
+struct x64_state_t {
+    ir_t         *ir;
+    x64_module_t *module;
+    list_t<u8>   *code;
+
+    ir_function_t     *func;
+    u64               *op_offsets;
+    list_t<x64_jump_t> jumps;
+
+    u64 global_variables;
+    u64 stack_probe;
+
+    b32 checked_division; // divisor 0 gives 0 like in interpreter, for code run by compiler
+};
+
+// ------ encoding
+
+static inline void x64_byte(x64_state_t *state, u8 value) {
+    list_add(state->code, &value);
+}
+
+static void x64_bytes(x64_state_t *state, void *data, u64 size) {
+    u64 index = 0;
+    list_allocate(state->code, size, &index);
+    list_fill(state->code, (u8*)data, size, index);
+}
+
+static inline void x64_u32(x64_state_t *state, u32 value) { x64_bytes(state, &value, sizeof(value)); }
+static inline void x64_u64(x64_state_t *state, u64 value) { x64_bytes(state, &value, sizeof(value)); }
+
+static inline x64_operand_t x64_reg(u8 reg) {
+    return { X64_OPERAND_REGISTER, reg, X64_NO_REGISTER, 1, 0, 0 };
+}
+
+static inline x64_operand_t x64_mem(u8 base, s64 disp) {
+    return { X64_OPERAND_MEMORY, base, X64_NO_REGISTER, 1, (s32)disp, 0 };
+}
+
+// exec stack entry, disp -8 is the top
+static inline x64_operand_t x64_exec(s64 disp) {
+    return { X64_OPERAND_MEMORY, X64_R14, X64_R15, 8, (s32)disp, 0 };
+}
+
+static inline x64_operand_t x64_local(u64 offset) {
+    return x64_mem(X64_RBP, -(s64)(offset * 8));
+}
+
+static inline x64_operand_t x64_symbol(u64 symbol, s64 disp) {
+    return { X64_OPERAND_SYMBOL, X64_NO_REGISTER, X64_NO_REGISTER, 1, (s32)disp, symbol };
+}
+
+static inline b32 fits_s8(s64 value)  { return value >= -128 && value <= 127; }
+static inline b32 fits_s32(s64 value) { return value >= INT32_MIN && value <= INT32_MAX; }
+
+static void x64_relocate(x64_state_t *state, u64 symbol, s64 addend, b32 is_call) {
+    x64_relocation_t relocation = { state->code->count, symbol, addend, is_call };
+    list_add(&state->module->relocations, &relocation);
+    x64_u32(state, 0);
+}
+
+// opcode is one byte, 0x0Fxx or 0x0F38xx, reg is register or /digit
+static void x64_encode(x64_state_t *state, u32 flags, u32 opcode, u8 reg, x64_operand_t rm) {
+    u8 rex = 0x40;
+
+    if (flags & X64_W) rex |= 0x08;
+    if (reg & 8)       rex |= 0x04;
+
+    if (rm.kind != X64_OPERAND_SYMBOL) {
+        if (rm.index != X64_NO_REGISTER && (rm.index & 8)) rex |= 0x02;
+        if (rm.base & 8) rex |= 0x01;
+    }
+
+    b32 byte_rex = (flags & X64_BYTE) && ((reg >= 4 && reg < 8) || (rm.kind == X64_OPERAND_REGISTER && rm.base >= 4 && rm.base < 8));
+
+    if (flags & X64_16) x64_byte(state, 0x66);
+    if (flags & X64_F2) x64_byte(state, 0xF2);
+    if (flags & X64_F3) x64_byte(state, 0xF3);
+    if (rex != 0x40 || byte_rex) x64_byte(state, rex);
+
+    if (opcode > 0xFFFF) x64_byte(state, (u8)(opcode >> 16));
+    if (opcode > 0xFF)   x64_byte(state, (u8)(opcode >> 8));
+    x64_byte(state, (u8)opcode);
+
+    u8 r = (u8)((reg & 7) << 3);
+
+    if (rm.kind == X64_OPERAND_REGISTER) {
+        x64_byte(state, 0xC0 | r | (rm.base & 7));
+        return;
+    }
+
+    if (rm.kind == X64_OPERAND_SYMBOL) {
+        x64_byte(state, 0x05 | r);
+        x64_relocate(state, rm.symbol, rm.disp - 4, false);
+        return;
+    }
+
+    b32 sib = rm.index != X64_NO_REGISTER || (rm.base & 7) == X64_RSP;
+    u8  mod = 0x80;
+
+    if (rm.disp == 0 && (rm.base & 7) != X64_RBP) mod = 0x00;
+    else if (fits_s8(rm.disp))                    mod = 0x40;
+
+    x64_byte(state, mod | r | (sib ? 0x04 : (rm.base & 7)));
+
+    if (sib) {
+        u8 sib_byte = 0x04 << 3; // no index
+
+        if (rm.index != X64_NO_REGISTER) {
+            u8 scale = rm.scale == 8 ? 3 : rm.scale == 4 ? 2 : rm.scale == 2 ? 1 : 0;
+            sib_byte = (u8)((scale << 6) | ((rm.index & 7) << 3));
+        }
+
+        x64_byte(state, sib_byte | (rm.base & 7));
+    }
+
+    if (mod == 0x40) x64_byte(state, (u8)(s8)rm.disp);
+    if (mod == 0x80) x64_u32(state, (u32)rm.disp);
+}
+
+static inline void x64_load(x64_state_t *state, u8 reg, x64_operand_t rm)  { x64_encode(state, X64_W, 0x8B, reg, rm); }
+static inline void x64_store(x64_state_t *state, x64_operand_t rm, u8 reg) { x64_encode(state, X64_W, 0x89, reg, rm); }
+static inline void x64_lea(x64_state_t *state, u8 reg, x64_operand_t rm)   { x64_encode(state, X64_W, 0x8D, reg, rm); }
+
+static void x64_mov_imm(x64_state_t *state, x64_operand_t rm, s64 value) {
+    if (fits_s32(value)) {
+        x64_encode(state, X64_W, 0xC7, 0, rm);
+        x64_u32(state, (u32)value);
+        return;
+    }
+
+    assert(rm.kind == X64_OPERAND_REGISTER);
+    x64_byte(state, 0x48 | ((rm.base & 8) ? 0x01 : 0x00));
+    x64_byte(state, 0xB8 | (rm.base & 7));
+    x64_u64(state, (u64)value);
+}
+
+// add /0, or /1, and /4, sub /5, xor /6, cmp /7
+static void x64_alu_imm(x64_state_t *state, u8 digit, x64_operand_t rm, s32 value) {
+    if (fits_s8(value)) {
+        x64_encode(state, X64_W, 0x83, digit, rm);
+        x64_byte(state, (u8)(s8)value);
+    } else {
+        x64_encode(state, X64_W, 0x81, digit, rm);
+        x64_u32(state, (u32)value);
+    }
+}
+
+static inline void x64_exec_grow(x64_state_t *state, s32 count) {
+    if      (count ==  1) x64_encode(state, X64_W, 0xFF, 0, x64_reg(X64_R15));
+    else if (count == -1) x64_encode(state, X64_W, 0xFF, 1, x64_reg(X64_R15));
+    else if (count)       x64_alu_imm(state, 0, x64_reg(X64_R15), count);
+}
+
+static inline void x64_push(x64_state_t *state, u8 reg) {
+    x64_store(state, x64_exec(0), reg);
+    x64_exec_grow(state, 1);
+}
+
+static inline void x64_pop(x64_state_t *state, u8 reg) {
+    x64_exec_grow(state, -1);
+    x64_load(state, reg, x64_exec(0));
+}
+
+static inline void x64_setcc(x64_state_t *state, u8 condition) {
+    x64_encode(state, 0, 0x0F90 | condition, 0, x64_reg(X64_RAX));
+    x64_encode(state, 0, 0x0FB6, X64_RAX, x64_reg(X64_RAX)); // movzx eax, al
+}
+
+static inline void x64_call(x64_state_t *state, u64 symbol) {
+    x64_byte(state, 0xE8);
+    x64_relocate(state, symbol, -4, true);
+}
+
+static inline void x64_syscall(x64_state_t *state) {
+    x64_byte(state, 0x0F);
+    x64_byte(state, 0x05);
+}
+
+// jumps inside of runtime code, returns offset of rel8 for x64_patch_short
+static u64 x64_short_jump(x64_state_t *state, u8 opcode) {
+    x64_byte(state, opcode);
+    x64_byte(state, 0);
+    return state->code->count - 1;
+}
+
+static void x64_patch_short(x64_state_t *state, u64 at, u64 target) {
+    s64 rel = (s64)target - (s64)(at + 1);
+    assert(fits_s8(rel));
+    *list_get(state->code, at) = (u8)(s8)rel;
+}
+
+static void x64_jump(x64_state_t *state, s32 condition, u64 target) {
+    if (condition < 0) {
+        x64_byte(state, 0xE9);
+    } else {
+        x64_byte(state, 0x0F);
+        x64_byte(state, (u8)(0x80 | condition));
+    }
+
+    x64_jump_t jump = { state->code->count, target };
+    list_add(&state->jumps, &jump);
+    x64_u32(state, 0);
+}
+
+// ------ symbols
+
+static u64 x64_get_symbol(x64_state_t *state, string_t name) {
+    u64 *found = hashmap_get(&state->module->symbol_index, name);
+    if (found) return *found;
+
+    x64_symbol_t symbol = {};
+    symbol.name    = name;
+    symbol.section = X64_SECTION_NONE;
+
+    u64 index = state->module->symbols.count;
+    list_add(&state->module->symbols, &symbol);
+    hashmap_add(&state->module->symbol_index, name, &index);
+    return index;
+}
+
+static u64 x64_define_symbol(x64_state_t *state, string_t name, u64 section, u64 offset) {
+    u64 index = x64_get_symbol(state, name);
+    x64_symbol_t *symbol = list_get(&state->module->symbols, index);
+
+    symbol->section = section;
+    symbol->offset  = offset;
+    return index;
+}
+
+// ------ code
+
+static u8 compare_condition(u64 operation) {
+    switch (operation) {
+        case IR_CMP_EQ:  return X64_CC_E;
+        case IR_CMP_NEQ: return X64_CC_NE;
+        case IR_CMP_LT:  return X64_CC_L;
+        case IR_CMP_GT:  return X64_CC_G;
+        case IR_CMP_LTE: return X64_CC_LE;
+        case IR_CMP_GTE: return X64_CC_GE;
+        case IR_LOG_NOT: return X64_CC_E;
+    }
+
+    assert(false);
+    return X64_CC_E;
+}
+
+static inline b32 is_compare(u64 operation) {
+    return operation >= IR_CMP_EQ && operation <= IR_CMP_GTE;
+}
+
+// only these can be negated by condition code, EQ and NEQ also need parity
+static inline b32 is_float_order(u64 operation) {
+    return operation == IR_FCMP_LT || operation == IR_FCMP_GT || operation == IR_FCMP_LTE || operation == IR_FCMP_GTE;
+}
+
+// rax = a (top), a op b goes into place of b
+static void x64_binary(x64_state_t *state, u32 opcode) {
+    x64_exec_grow(state, -1);
+    x64_load(state, X64_RAX, x64_exec(0));
+    x64_encode(state, X64_W, opcode, X64_RAX, x64_exec(-8));
+    x64_store(state, x64_exec(-8), X64_RAX);
+}
+
+// xmm registers are encoded with the same numbers, xmm0 is the only one we use
+#define X64_XMM0 0
+
+static inline void x64_load_float(x64_state_t *state, u8 xmm, x64_operand_t rm)  { x64_encode(state, X64_F2, 0x0F10, xmm, rm); } // movsd
+static inline void x64_store_float(x64_state_t *state, x64_operand_t rm, u8 xmm) { x64_encode(state, X64_F2, 0x0F11, xmm, rm); }
+
+// xmm0 = a (top), a op b goes into place of b
+static void x64_float_binary(x64_state_t *state, u32 opcode) {
+    x64_exec_grow(state, -1);
+    x64_load_float(state, X64_XMM0, x64_exec(0));
+    x64_encode(state, X64_F2, opcode, X64_XMM0, x64_exec(-8));
+    x64_store_float(state, x64_exec(-8), X64_XMM0);
+}
+
+// ucomisd sets flags like unsigned compare and CF = ZF = PF = 1 when unordered,
+// a < b is done as b > a, so A and AE are false for NaN
+static u8 x64_float_compare(x64_state_t *state, u64 operation, x64_operand_t a, x64_operand_t b) {
+    b32 swap = operation == IR_FCMP_LT || operation == IR_FCMP_LTE;
+
+    x64_load_float(state, X64_XMM0, swap ? b : a);
+    x64_encode(state, X64_16, 0x0F2E, X64_XMM0, swap ? a : b);
+
+    switch (operation) {
+        case IR_FCMP_EQ:  return X64_CC_E;
+        case IR_FCMP_NEQ: return X64_CC_NE;
+        case IR_FCMP_LT:
+        case IR_FCMP_GT:  return X64_CC_A;
+        default:          return X64_CC_AE;
+    }
+}
+
+// ------ vectors, 256 bit ones are done by halves
+
+#define X64_XMM1 1
+#define X64_XMM2 2 // sign bits of unsigned compares
+#define X64_XMM3 3 // all ones of inverted compares
+
+static inline void x64_load_vector(x64_state_t *state, u8 xmm, x64_operand_t rm)  { x64_encode(state, X64_F3, 0x0F6F, xmm, rm); } // movdqu
+static inline void x64_store_vector(x64_state_t *state, x64_operand_t rm, u8 xmm) { x64_encode(state, X64_F3, 0x0F7F, xmm, rm); }
+
+// a is the top entries, lane-wise a op b goes into place of b
+static void x64_vector_binary(x64_state_t *state, u64 operation, u64 vector) {
+    backend_vector_op_t select = {};
+
+    // IR generation doesn't emit those
+    if (!backend_select_vector(operation, vector, &select)) {
+        assert(false);
+        x64_byte(state, 0x0F);
+        x64_byte(state, 0x0B);
+        return;
+    }
+
+    s64 entries = (s64)ir_vector_entries(vector);
+    u32 flags   = select.flags & BACKEND_VECTOR_66 ? X64_16 : 0;
+
+    if (select.bias) {
+        x64_mov_imm(state, x64_reg(X64_RAX), (s64)select.bias);
+        x64_encode(state, X64_16 | X64_W, 0x0F6E, X64_XMM2, x64_reg(X64_RAX)); // movq
+        x64_encode(state, X64_16, 0x0F6C, X64_XMM2, x64_reg(X64_XMM2));        // punpcklqdq
+    }
+
+    if (select.invert) {
+        x64_encode(state, X64_16, 0x0F76, X64_XMM3, x64_reg(X64_XMM3)); // pcmpeqd
+    }
+
+    for (s64 half = 0; half < entries; half += 2) {
+        x64_operand_t a = x64_exec((half - entries) * 8);
+        x64_operand_t b = x64_exec((half - entries * 2) * 8);
+
+        x64_load_vector(state, X64_XMM0, a);
+        x64_load_vector(state, X64_XMM1, b);
+
+        if (select.bias) {
+            x64_encode(state, X64_16, 0x0FEF, X64_XMM0, x64_reg(X64_XMM2)); // pxor
+            x64_encode(state, X64_16, 0x0FEF, X64_XMM1, x64_reg(X64_XMM2));
+        }
+
+        x64_encode(state, flags, select.opcode, select.dst, x64_reg(select.src));
+        if (select.imm >= 0) x64_byte(state, (u8)select.imm);
+
+        if (select.invert) {
+            x64_encode(state, X64_16, 0x0FEF, select.dst, x64_reg(X64_XMM3));
+        }
+
+        x64_store_vector(state, b, select.dst);
+    }
+
+    x64_exec_grow(state, -(s32)entries);
+}
+
+// scalar on top becomes every lane of the vector
+static void x64_vector_splat(x64_state_t *state, u64 vector) {
+    u64 lane = IR_VECTOR_LANE(vector);
+    u64 size = ir_lane_size(lane);
+
+    x64_pop(state, X64_RAX);
+
+    if (lane == IR_LANE_F32) {
+        x64_encode(state, X64_16 | X64_W, 0x0F6E, X64_XMM0, x64_reg(X64_RAX)); // movq
+        x64_encode(state, X64_F2, 0x0F5A, X64_XMM0, x64_reg(X64_XMM0));         // cvtsd2ss
+        x64_encode(state, X64_16, 0x0F7E, X64_XMM0, x64_reg(X64_RAX));          // movd eax, xmm0
+    }
+
+    if (size == 1) x64_encode(state, 0, 0x0FB6, X64_RAX, x64_reg(X64_RAX)); // movzx eax, al
+    if (size == 2) x64_encode(state, 0, 0x0FB7, X64_RAX, x64_reg(X64_RAX)); // movzx eax, ax
+    if (size == 4) x64_encode(state, 0, 0x8B,   X64_RAX, x64_reg(X64_RAX)); // mov eax, eax
+
+    if (size < 8) {
+        x64_mov_imm(state, x64_reg(X64_RCX), (s64)backend_splat_multiplier(lane));
+        x64_encode(state, X64_W, 0x0FAF, X64_RAX, x64_reg(X64_RCX)); // imul
+    }
+
+    u64 entries = ir_vector_entries(vector);
+
+    for (u64 i = 0; i < entries; i++) x64_store(state, x64_exec((s64)i * 8), X64_RAX);
+    x64_exec_grow(state, (s32)entries);
+}
+
+// ------ intrinsics, string instructions run forward, direction flag is clear by ABI
+
+// counts below 1 do nothing
+static void x64_mem_fill(x64_state_t *state, u64 lane) {
+    u64 size = ir_lane_size(lane);
+
+    x64_pop(state, X64_RDI);
+    x64_pop(state, X64_RAX);
+    x64_pop(state, X64_RCX);
+
+    if (lane == IR_LANE_F32) {
+        x64_encode(state, X64_16 | X64_W, 0x0F6E, X64_XMM0, x64_reg(X64_RAX)); // movq
+        x64_encode(state, X64_F2, 0x0F5A, X64_XMM0, x64_reg(X64_XMM0));         // cvtsd2ss
+        x64_encode(state, X64_16, 0x0F7E, X64_XMM0, x64_reg(X64_RAX));          // movd eax, xmm0
+    }
+
+    x64_encode(state, X64_W, 0x85, X64_RCX, x64_reg(X64_RCX)); // test rcx, rcx
+    u64 empty = x64_short_jump(state, 0x7E);                   // jle
+
+    if (size == 2) x64_byte(state, 0x66);
+    x64_byte(state, 0xF3);                    // rep
+    if (size == 8) x64_byte(state, 0x48);
+    x64_byte(state, size == 1 ? 0xAA : 0xAB); // stos
+
+    x64_patch_short(state, empty, state->code->count);
+}
+
+// destination inside of the source range is copied backwards when they can overlap
+static void x64_mem_copy(x64_state_t *state, b32 overlap) {
+    x64_pop(state, X64_RDI);
+    x64_pop(state, X64_RSI);
+    x64_pop(state, X64_RCX);
+
+    x64_encode(state, X64_W, 0x85, X64_RCX, x64_reg(X64_RCX)); // test rcx, rcx
+    u64 empty = x64_short_jump(state, 0x7E);                   // jle
+    u64 done  = 0;
+
+    if (overlap) {
+        x64_encode(state, X64_W, 0x89, X64_RDI, x64_reg(X64_RAX)); // mov rax, rdi
+        x64_encode(state, X64_W, 0x29, X64_RSI, x64_reg(X64_RAX)); // sub rax, rsi
+        x64_encode(state, X64_W, 0x39, X64_RCX, x64_reg(X64_RAX)); // cmp rax, rcx
+        u64 forward = x64_short_jump(state, 0x73);                 // jae
+
+        x64_operand_t last = { X64_OPERAND_MEMORY, X64_RSI, X64_RCX, 1, -1, 0 };
+        x64_lea(state, X64_RSI, last);
+        last.base = X64_RDI;
+        x64_lea(state, X64_RDI, last);
+
+        x64_byte(state, 0xFD); // std
+        x64_byte(state, 0xF3); // rep movsb
+        x64_byte(state, 0xA4);
+        x64_byte(state, 0xFC); // cld
+        done = x64_short_jump(state, 0xEB);
+
+        x64_patch_short(state, forward, state->code->count);
+    }
+
+    x64_byte(state, 0xF3); // rep movsb
+    x64_byte(state, 0xA4);
+
+    x64_patch_short(state, empty, state->code->count);
+    if (overlap) x64_patch_short(state, done, state->code->count);
+}
+
+// rax extended like a load of the lane
+static void x64_extend(x64_state_t *state, u64 lane) {
+    switch (lane) {
+        case IR_LANE_U8:  x64_encode(state, 0,     0x0FB6, X64_RAX, x64_reg(X64_RAX)); break; // movzx eax, al
+        case IR_LANE_S8:  x64_encode(state, X64_W, 0x0FBE, X64_RAX, x64_reg(X64_RAX)); break; // movsx rax, al
+        case IR_LANE_U16: x64_encode(state, 0,     0x0FB7, X64_RAX, x64_reg(X64_RAX)); break;
+        case IR_LANE_S16: x64_encode(state, X64_W, 0x0FBF, X64_RAX, x64_reg(X64_RAX)); break;
+        case IR_LANE_U32: x64_encode(state, 0,     0x8B,   X64_RAX, x64_reg(X64_RAX)); break; // mov eax, eax
+        case IR_LANE_S32: x64_encode(state, X64_W, 0x63,   X64_RAX, x64_reg(X64_RAX)); break; // movsxd
+    }
+}
+
+// popcnt, lzcnt and tzcnt work on the value zero extended from its lane
+static void x64_bit_operation(x64_state_t *state, u64 operation, u64 lane) {
+    u64 size = ir_lane_size(lane);
+    u32 wide = size == 8 ? X64_W : 0;
+    u32 bits = (u32)size * 8;
+
+    x64_pop(state, X64_RAX);
+    if (operation == IR_ROTL || operation == IR_ROTR) x64_pop(state, X64_RCX);
+
+    x64_extend(state, lane & ~1ull);
+
+    switch (operation) {
+        case IR_POPCOUNT:
+            x64_encode(state, X64_F3 | wide, 0x0FB8, X64_RAX, x64_reg(X64_RAX));
+            break;
+        case IR_CLZ:
+            x64_encode(state, X64_F3 | wide, 0x0FBD, X64_RAX, x64_reg(X64_RAX));
+            if (bits < 32) x64_alu_imm(state, 5, x64_reg(X64_RAX), 32 - (s32)bits);
+            break;
+        case IR_CTZ:
+            if (bits < 32) x64_alu_imm(state, 1, x64_reg(X64_RAX), 1 << bits);
+            x64_encode(state, X64_F3 | wide, 0x0FBC, X64_RAX, x64_reg(X64_RAX));
+            break;
+
+        case IR_BSWAP:
+            if (size == 2) {
+                x64_encode(state, X64_16, 0xC1, 0, x64_reg(X64_RAX)); // rol ax, 8
+                x64_byte(state, 8);
+            } else if (size > 2) {
+                if (wide) x64_byte(state, 0x48);
+                x64_byte(state, 0x0F); // bswap eax, register is in the opcode
+                x64_byte(state, 0xC8);
+            }
+
+            x64_extend(state, lane);
+            break;
+
+        case IR_ROTL:
+        case IR_ROTR: {
+            u8 digit = operation == IR_ROTL ? 0 : 1;
+
+            if (size == 1) x64_encode(state, 0, 0xD2, digit, x64_reg(X64_RAX));
+            else           x64_encode(state, (size == 2 ? X64_16 : 0) | wide, 0xD3, digit, x64_reg(X64_RAX));
+
+            x64_extend(state, lane);
+        } break;
+    }
+
+    x64_push(state, X64_RAX);
+}
+
+// memory operand of backend_match_address, base goes to rax and index to rcx
+// unless they fit into the operand itself
+static void x64_compile_address(x64_state_t *state, backend_address_t *address) {
+    x64_operand_t operand = x64_mem(X64_RAX, address->disp);
+
+    switch (address->base) {
+        case BACKEND_ADDRESS_STACK:
+            x64_load(state, X64_RAX, x64_exec(-(s64)address->stack * 8));
+            break;
+        case BACKEND_ADDRESS_LOCAL:
+            x64_load(state, X64_RAX, x64_local(address->base_operand));
+            break;
+        case BACKEND_ADDRESS_GLOBAL:
+            x64_load(state, X64_RAX, x64_symbol(state->global_variables, (s64)address->base_operand * 8));
+            break;
+        case BACKEND_ADDRESS_LOCAL_EA:
+            operand = x64_mem(X64_RBP, address->disp - (s64)(address->base_operand * 8));
+            break;
+        case BACKEND_ADDRESS_GLOBAL_EA:
+            // rip relative operand has no index
+            if (address->index == BACKEND_ADDRESS_NONE) {
+                operand = x64_symbol(state->global_variables, (s64)address->base_operand * 8 + address->disp);
+            } else {
+                x64_lea(state, X64_RAX, x64_symbol(state->global_variables, (s64)address->base_operand * 8));
+            }
+            break;
+    }
+
+    switch (address->index) {
+        case BACKEND_ADDRESS_STACK:
+            x64_load(state, X64_RCX, x64_exec(-8));
+            break;
+        case BACKEND_ADDRESS_LOCAL:
+            x64_load(state, X64_RCX, x64_local(address->index_operand));
+            break;
+        case BACKEND_ADDRESS_GLOBAL:
+            x64_load(state, X64_RCX, x64_symbol(state->global_variables, (s64)address->index_operand * 8));
+            break;
+    }
+
+    if (address->index != BACKEND_ADDRESS_NONE) {
+        operand.index = X64_RCX;
+        operand.scale = (u8)address->scale;
+    }
+
+    // result takes place of the deepest entry, stored value is below it
+    s64 bottom = -(s64)address->stack * 8;
+
+    switch (address->access) {
+        case IR_NOP:
+            x64_lea(state, X64_RAX, operand);
+            break;
+        case IR_LOAD:
+            x64_load(state, X64_RAX, operand);
+            break;
+
+        case IR_LOAD8S:
+        case IR_LOAD8U:
+        case IR_LOAD16S:
+        case IR_LOAD16U:
+        case IR_LOAD32S:
+        case IR_LOAD32U: {
+            static const u32 loads[] = { 0x0FBE, 0x0FB6, 0x0FBF, 0x0FB7, 0x63, 0x8B };
+
+            u32 flags = address->access == IR_LOAD32U ? 0 : X64_W;
+            x64_encode(state, flags, loads[address->access - IR_LOAD8S], X64_RAX, operand);
+        } break;
+
+        case IR_LOADF32:
+            x64_encode(state, X64_F3, 0x0F5A, X64_XMM0, operand);               // cvtss2sd
+            x64_encode(state, X64_16 | X64_W, 0x0F7E, X64_XMM0, x64_reg(X64_RAX)); // movq rax, xmm0
+            break;
+
+        case IR_STOREF32:
+            x64_encode(state, X64_F2, 0x0F5A, X64_XMM0, x64_exec(bottom - 8)); // cvtsd2ss
+            x64_encode(state, X64_F3, 0x0F11, X64_XMM0, operand);              // movss
+            x64_exec_grow(state, -(s32)(address->stack + 1));
+            return;
+
+        default: {
+            u32 flags  = address->access == IR_STORE ? X64_W : address->access == IR_STORE16 ? X64_16 : 0;
+            u32 opcode = address->access == IR_STORE8 ? 0x88 : 0x89;
+
+            x64_load(state, X64_RDX, x64_exec(bottom - 8));
+            x64_encode(state, flags, opcode, X64_RDX, operand);
+            x64_exec_grow(state, -(s32)(address->stack + 1));
+        } return;
+    }
+
+    x64_store(state, x64_exec(bottom), X64_RAX);
+    x64_exec_grow(state, 1 - (s32)address->stack);
+}
+
+// multi byte nops, section itself is 16 aligned
+static void x64_align(x64_state_t *state, u64 alignment) {
+    static const u8 nops[][9] = {
+        { 0x90 },
+        { 0x66, 0x90 },
+        { 0x0F, 0x1F, 0x00 },
+        { 0x0F, 0x1F, 0x40, 0x00 },
+        { 0x0F, 0x1F, 0x44, 0x00, 0x00 },
+        { 0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00 },
+        { 0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00 },
+        { 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+        { 0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    };
+
+    if (alignment == 0 || alignment > 64) return;
+
+    u64 padding = (alignment - state->code->count % alignment) % alignment;
+
+    while (padding > 0) {
+        u64 size = padding > 9 ? 9 : padding;
+
+        for (u64 i = 0; i < size; i++) x64_byte(state, nops[size - 1][i]);
+        padding -= size;
+    }
+}
+
+static void x64_frame(x64_state_t *state, u64 frame) {
+    x64_byte(state, 0x55);                                // push rbp
+    x64_encode(state, X64_W, 0x89, X64_RSP, x64_reg(X64_RBP)); // mov rbp, rsp
+
+    if (frame * 8 > PG(1)) {
+        x64_mov_imm(state, x64_reg(X64_RAX), (s64)(frame * 8));
+        x64_call(state, state->stack_probe);
+        x64_encode(state, X64_W, 0x29, X64_RAX, x64_reg(X64_RSP)); // sub rsp, rax
+    } else if (frame) {
+        x64_alu_imm(state, 5, x64_reg(X64_RSP), (s32)(frame * 8));
+    }
+}
+
+static void x64_compile_func(x64_state_t *state, string_t name) {
+    ir_function_t *func = state->func;
+    u64 count = func->code.count;
+
+    x64_define_symbol(state, name, X64_SECTION_TEXT, state->code->count);
+
+    state->op_offsets = (u64*)mem_alloc(default_allocator, (count + 1) * sizeof(u64));
+    state->jumps.count = 0;
+
+    // pairs are folded only when nothing jumps between them
+    b8 *targets = (b8*)mem_alloc(default_allocator, count + 1);
+    mem_set((u8*)targets, 0, count + 1);
+
+    for (u64 i = 0; i < count; i++) {
+        u64 operation = func->code[i].operation;
+
+        if (operation != IR_JUMP && operation != IR_JUMP_IF && operation != IR_JUMP_IF_NOT) continue;
+
+        s64 target = (s64)i + 1 + func->code[i].s_operand;
+        if (target >= 0 && target <= (s64)count) targets[target] = true;
+    }
+
+    // callee takes register arguments back to exec stack, first one on top
+    for (u64 i = 0; i < func->register_args; i++) {
+        x64_store(state, x64_exec((s64)i * 8), argument_registers[i]);
+    }
+
+    x64_exec_grow(state, (s32)func->register_args);
+
+    for (u64 i = 0; i < count; i++) {
+        ir_opcode_t op = func->code[i];
+        state->op_offsets[i] = state->code->count;
+
+        ir_opcode_t next = i + 1 < count && !targets[i + 1] ? func->code[i + 1] : ir_opcode_t {};
+
+        if ((is_compare(op.operation) || op.operation == IR_LOG_NOT)
+                && (next.operation == IR_JUMP_IF || next.operation == IR_JUMP_IF_NOT)) {
+            u8 condition = compare_condition(op.operation);
+
+            if (op.operation == IR_LOG_NOT) {
+                x64_pop(state, X64_RAX);
+                x64_encode(state, X64_W, 0x85, X64_RAX, x64_reg(X64_RAX)); // test rax, rax
+            } else {
+                x64_exec_grow(state, -2);
+                x64_load(state, X64_RAX, x64_exec(8));
+                x64_encode(state, X64_W, 0x3B, X64_RAX, x64_exec(0));
+            }
+
+            // negated condition codes differ in the lowest bit
+            if (next.operation == IR_JUMP_IF_NOT) condition ^= 1;
+
+            state->op_offsets[i + 1] = state->code->count;
+            x64_jump(state, condition, (u64)((s64)i + 2 + next.s_operand));
+            i++;
+            continue;
+        }
+
+        if (is_float_order(op.operation) && (next.operation == IR_JUMP_IF || next.operation == IR_JUMP_IF_NOT)) {
+            x64_exec_grow(state, -2);
+            u8 condition = x64_float_compare(state, op.operation, x64_exec(8), x64_exec(0));
+
+            // not above and not above or equal include unordered
+            if (next.operation == IR_JUMP_IF_NOT) condition ^= 1;
+
+            state->op_offsets[i + 1] = state->code->count;
+            x64_jump(state, condition, (u64)((s64)i + 2 + next.s_operand));
+            i++;
+            continue;
+        }
+
+        if (op.operation == IR_PUSH_SEA && next.operation == IR_LOAD) {
+            x64_load(state, X64_RAX, x64_local(op.u_operand));
+            x64_push(state, X64_RAX);
+
+            state->op_offsets[i + 1] = state->code->count;
+            i++;
+            continue;
+        }
+
+        if (op.operation == IR_PUSH_SEA && next.operation == IR_STORE) {
+            x64_pop(state, X64_RAX);
+            x64_store(state, x64_local(op.u_operand), X64_RAX);
+
+            state->op_offsets[i + 1] = state->code->count;
+            i++;
+            continue;
+        }
+
+        backend_address_t address = {};
+
+        if (backend_match_address(func, targets, i, &address)) {
+            x64_compile_address(state, &address);
+
+            for (u64 j = 1; j < address.count; j++) state->op_offsets[i + j] = state->code->count;
+
+            i += address.count - 1;
+            continue;
+        }
+
+        switch (op.operation) {
+            case IR_NOP:
+                x64_byte(state, 0x90);
+                break;
+
+            case IR_ALIGN:
+                x64_align(state, op.u_operand);
+                break;
+
+            case IR_STACK_FRAME_PUSH:
+                x64_frame(state, op.u_operand);
+                break;
+            case IR_STACK_FRAME_POP:
+                x64_encode(state, X64_W, 0x89, X64_RBP, x64_reg(X64_RSP)); // mov rsp, rbp
+                x64_byte(state, 0x5D);                                    // pop rbp
+                break;
+
+            case IR_PUSH_SIGN:
+            case IR_PUSH_UNSIGN:
+                if (fits_s32(op.s_operand)) {
+                    x64_mov_imm(state, x64_exec(0), op.s_operand);
+                    x64_exec_grow(state, 1);
+                } else {
+                    x64_mov_imm(state, x64_reg(X64_RAX), op.s_operand);
+                    x64_push(state, X64_RAX);
+                }
+                break;
+
+            case IR_PUSH_STACK:
+                x64_load(state, X64_RAX, x64_local(op.u_operand));
+                x64_push(state, X64_RAX);
+                break;
+            case IR_PUSH_SEA:
+                x64_lea(state, X64_RAX, x64_local(op.u_operand));
+                x64_push(state, X64_RAX);
+                break;
+            case IR_PUSH_GLOBAL:
+                x64_load(state, X64_RAX, x64_symbol(state->global_variables, (s64)op.u_operand * 8));
+                x64_push(state, X64_RAX);
+                break;
+            case IR_PUSH_GEA:
+                x64_lea(state, X64_RAX, x64_symbol(state->global_variables, (s64)op.u_operand * 8));
+                x64_push(state, X64_RAX);
+                break;
+
+            case IR_SETUP_GLOBAL:
+                x64_pop(state, X64_RAX);
+                x64_store(state, x64_symbol(state->global_variables, (s64)op.u_operand * 8), X64_RAX);
+                break;
+
+            case IR_POP:
+                x64_exec_grow(state, -1);
+                break;
+            case IR_CLONE:
+                x64_load(state, X64_RAX, x64_exec(-8));
+                x64_push(state, X64_RAX);
+                break;
+
+            case IR_ALLOC:
+                x64_alu_imm(state, 5, x64_reg(X64_RSP), (s32)(op.u_operand * 8));
+                x64_mov_imm(state, x64_mem(X64_RSP, 0), 0);
+                x64_push(state, X64_RSP);
+                break;
+            case IR_FREE:
+                x64_alu_imm(state, 0, x64_reg(X64_RSP), (s32)(op.u_operand * 8));
+                break;
+
+            case IR_LOAD:
+                x64_load(state, X64_RAX, x64_exec(-8));
+                x64_load(state, X64_RAX, x64_mem(X64_RAX, 0));
+                x64_store(state, x64_exec(-8), X64_RAX);
+                break;
+            case IR_STORE:
+                x64_exec_grow(state, -2);
+                x64_load(state, X64_RCX, x64_exec(8));
+                x64_load(state, X64_RAX, x64_exec(0));
+                x64_store(state, x64_mem(X64_RCX, 0), X64_RAX);
+                break;
+
+            case IR_LOAD8S:
+            case IR_LOAD8U:
+            case IR_LOAD16S:
+            case IR_LOAD16U:
+            case IR_LOAD32S:
+            case IR_LOAD32U: {
+                static const u32 loads[] = { 0x0FBE, 0x0FB6, 0x0FBF, 0x0FB7, 0x63, 0x8B };
+
+                u32 flags = op.operation == IR_LOAD32U ? 0 : X64_W;
+
+                x64_load(state, X64_RCX, x64_exec(-8));
+                x64_encode(state, flags, loads[op.operation - IR_LOAD8S], X64_RAX, x64_mem(X64_RCX, 0));
+                x64_store(state, x64_exec(-8), X64_RAX);
+            } break;
+
+            case IR_STORE8:
+            case IR_STORE16:
+            case IR_STORE32: {
+                u32 flags  = op.operation == IR_STORE16 ? X64_16 : 0;
+                u32 opcode = op.operation == IR_STORE8  ? 0x88   : 0x89;
+
+                x64_exec_grow(state, -2);
+                x64_load(state, X64_RCX, x64_exec(8));
+                x64_load(state, X64_RAX, x64_exec(0));
+                x64_encode(state, flags, opcode, X64_RAX, x64_mem(X64_RCX, 0));
+            } break;
+
+            case IR_ADD:     x64_binary(state, 0x03);   break;
+            case IR_SUB:     x64_binary(state, 0x2B);   break;
+            case IR_MUL:     x64_binary(state, 0x0FAF); break;
+            case IR_BIT_AND: x64_binary(state, 0x23);   break;
+            case IR_BIT_OR:  x64_binary(state, 0x0B);   break;
+            case IR_BIT_XOR: x64_binary(state, 0x33);   break;
+
+            case IR_DIV:
+            case IR_MOD: {
+                x64_exec_grow(state, -1);
+                x64_load(state, X64_RAX, x64_exec(0));
+
+                // divisor stays in the result slot, which already holds 0
+                u64 zero = 0;
+                if (state->checked_division) {
+                    x64_alu_imm(state, 7, x64_exec(-8), 0); // cmp
+                    zero = x64_short_jump(state, 0x74);     // je
+                }
+
+                x64_byte(state, 0x48);
+                x64_byte(state, 0x99);                                // cqo
+                x64_encode(state, X64_W, 0xF7, 7, x64_exec(-8)); // idiv
+                x64_store(state, x64_exec(-8), op.operation == IR_DIV ? X64_RAX : X64_RDX);
+
+                if (state->checked_division) {
+                    x64_patch_short(state, zero, state->code->count);
+                }
+            } break;
+
+            case IR_SHIFT_LEFT:
+            case IR_SHIFT_RIGHT:
+                x64_exec_grow(state, -1);
+                x64_load(state, X64_RAX, x64_exec(0));
+                x64_load(state, X64_RCX, x64_exec(-8));
+                x64_encode(state, X64_W, 0xD3, op.operation == IR_SHIFT_LEFT ? 4 : 7, x64_reg(X64_RAX));
+                x64_store(state, x64_exec(-8), X64_RAX);
+                break;
+
+            case IR_NEG:     x64_encode(state, X64_W, 0xF7, 3, x64_exec(-8)); break;
+            case IR_BIT_NOT: x64_encode(state, X64_W, 0xF7, 2, x64_exec(-8)); break;
+
+            case IR_CMP_EQ:
+            case IR_CMP_NEQ:
+            case IR_CMP_LT:
+            case IR_CMP_GT:
+            case IR_CMP_LTE:
+            case IR_CMP_GTE:
+                x64_exec_grow(state, -1);
+                x64_load(state, X64_RCX, x64_exec(0));
+                x64_encode(state, X64_W, 0x3B, X64_RCX, x64_exec(-8));
+                x64_setcc(state, compare_condition(op.operation));
+                x64_store(state, x64_exec(-8), X64_RAX);
+                break;
+
+            case IR_LOG_NOT:
+                x64_alu_imm(state, 7, x64_exec(-8), 0);
+                x64_setcc(state, X64_CC_E);
+                x64_store(state, x64_exec(-8), X64_RAX);
+                break;
+
+            case IR_LOADF32:
+                x64_load(state, X64_RCX, x64_exec(-8));
+                x64_encode(state, X64_F3, 0x0F5A, X64_XMM0, x64_mem(X64_RCX, 0)); // cvtss2sd
+                x64_store_float(state, x64_exec(-8), X64_XMM0);
+                break;
+            case IR_STOREF32:
+                x64_exec_grow(state, -2);
+                x64_load(state, X64_RCX, x64_exec(8));
+                x64_encode(state, X64_F2, 0x0F5A, X64_XMM0, x64_exec(0));         // cvtsd2ss
+                x64_encode(state, X64_F3, 0x0F11, X64_XMM0, x64_mem(X64_RCX, 0)); // movss
+                break;
+
+            case IR_FADD: x64_float_binary(state, 0x0F58); break;
+            case IR_FSUB: x64_float_binary(state, 0x0F5C); break;
+            case IR_FMUL: x64_float_binary(state, 0x0F59); break;
+            case IR_FDIV: x64_float_binary(state, 0x0F5E); break;
+
+            case IR_FNEG:
+                x64_encode(state, X64_W, 0x0FBA, 7, x64_exec(-8)); // btc, sign bit
+                x64_byte(state, 63);
+                break;
+
+            case IR_FCMP_EQ:
+            case IR_FCMP_NEQ:
+            case IR_FCMP_LT:
+            case IR_FCMP_GT:
+            case IR_FCMP_LTE:
+            case IR_FCMP_GTE: {
+                x64_exec_grow(state, -1);
+                u8 condition = x64_float_compare(state, op.operation, x64_exec(0), x64_exec(-8));
+
+                x64_encode(state, 0, 0x0F90 | condition, 0, x64_reg(X64_RAX));
+
+                // equal has to be ordered, not equal is true for unordered too
+                if (op.operation == IR_FCMP_EQ || op.operation == IR_FCMP_NEQ) {
+                    b32 equal = op.operation == IR_FCMP_EQ;
+
+                    x64_encode(state, 0, 0x0F90 | (equal ? X64_CC_NP : X64_CC_P), 0, x64_reg(X64_RCX));
+                    x64_encode(state, 0, equal ? 0x20 : 0x08, X64_RCX, x64_reg(X64_RAX)); // and/or al, cl
+                }
+
+                x64_encode(state, 0, 0x0FB6, X64_RAX, x64_reg(X64_RAX)); // movzx eax, al
+                x64_store(state, x64_exec(-8), X64_RAX);
+            } break;
+
+            case IR_INT_TO_FLOAT:
+                x64_encode(state, X64_F2 | X64_W, 0x0F2A, X64_XMM0, x64_exec(-8)); // cvtsi2sd
+                x64_store_float(state, x64_exec(-8), X64_XMM0);
+                break;
+            case IR_FLOAT_TO_INT:
+                x64_encode(state, X64_F2 | X64_W, 0x0F2C, X64_RAX, x64_exec(-8)); // cvttsd2si
+                x64_store(state, x64_exec(-8), X64_RAX);
+                break;
+            case IR_ROUND_F32:
+                x64_encode(state, X64_F2, 0x0F5A, X64_XMM0, x64_exec(-8));      // cvtsd2ss
+                x64_encode(state, X64_F3, 0x0F5A, X64_XMM0, x64_reg(X64_XMM0)); // cvtss2sd
+                x64_store_float(state, x64_exec(-8), X64_XMM0);
+                break;
+
+            case IR_VLOAD: {
+                s64 entries = (s64)ir_vector_entries(op.u_operand);
+
+                x64_pop(state, X64_RCX);
+
+                for (s64 half = 0; half < entries; half += 2) {
+                    x64_load_vector(state, X64_XMM0, x64_mem(X64_RCX, half * 8));
+                    x64_store_vector(state, x64_exec(half * 8), X64_XMM0);
+                }
+
+                x64_exec_grow(state, (s32)entries);
+            } break;
+            case IR_VSTORE: {
+                s64 entries = (s64)ir_vector_entries(op.u_operand);
+
+                x64_exec_grow(state, -(s32)(entries + 1));
+                x64_load(state, X64_RCX, x64_exec(entries * 8));
+
+                for (s64 half = 0; half < entries; half += 2) {
+                    x64_load_vector(state, X64_XMM0, x64_exec(half * 8));
+                    x64_store_vector(state, x64_mem(X64_RCX, half * 8), X64_XMM0);
+                }
+            } break;
+
+            case IR_VSPLAT:
+                x64_vector_splat(state, op.u_operand);
+                break;
+
+            case IR_VADD:
+            case IR_VSUB:
+            case IR_VMUL:
+            case IR_VDIV:
+            case IR_VAND:
+            case IR_VOR:
+            case IR_VXOR:
+            case IR_VCMP_EQ:
+            case IR_VCMP_NEQ:
+            case IR_VCMP_LT:
+            case IR_VCMP_GT:
+            case IR_VCMP_LTE:
+            case IR_VCMP_GTE:
+                x64_vector_binary(state, op.operation, op.u_operand);
+                break;
+
+            case IR_MEM_FILL:
+                x64_mem_fill(state, op.u_operand);
+                break;
+            case IR_MEM_COPY:
+            case IR_MEM_MOVE:
+                x64_mem_copy(state, op.operation == IR_MEM_MOVE);
+                break;
+
+            case IR_POPCOUNT:
+            case IR_CLZ:
+            case IR_CTZ:
+            case IR_BSWAP:
+            case IR_ROTL:
+            case IR_ROTR:
+                x64_bit_operation(state, op.operation, op.u_operand);
+                break;
+
+            case IR_JUMP:
+                x64_jump(state, -1, (u64)((s64)i + 1 + op.s_operand));
+                break;
+            case IR_JUMP_IF:
+            case IR_JUMP_IF_NOT:
+                x64_pop(state, X64_RAX);
+                x64_encode(state, X64_W, 0x85, X64_RAX, x64_reg(X64_RAX));
+                x64_jump(state, op.operation == IR_JUMP_IF ? X64_CC_NE : X64_CC_E, (u64)((s64)i + 1 + op.s_operand));
+                break;
+
+            case IR_CALL: {
+                ir_function_t *callee = hashmap_get(&state->ir->functions, op.string);
+                u64 args = callee ? callee->register_args : 0;
+
+                for (u64 d = 0; d < args; d++) {
+                    x64_load(state, argument_registers[args - 1 - d], x64_exec(-(s64)(d + 1) * 8));
+                }
+
+                x64_exec_grow(state, -(s32)args);
+                x64_call(state, x64_get_symbol(state, op.string));
+
+                if (callee && callee->register_returns) {
+                    x64_push(state, X64_RAX);
+                }
+            } break;
+
+            case IR_RET:
+                if (func->register_returns) {
+                    x64_pop(state, X64_RAX);
+                }
+
+                x64_byte(state, 0xC3);
+                break;
+
+            case IR_BRK:
+                x64_byte(state, 0xCC);
+                break;
+
+            case IR_INVALID:
+                x64_byte(state, 0x0F);
+                x64_byte(state, 0x0B);
+                break;
+
+            default:
+                assert(false);
+                x64_byte(state, 0x0F);
+                x64_byte(state, 0x0B);
+                break;
+        }
+    }
+
+    state->op_offsets[count] = state->code->count;
+
+    for (u64 i = 0; i < state->jumps.count; i++) {
+        x64_jump_t jump = state->jumps[i];
+        assert(jump.target <= count);
+
+        s32 rel = (s32)((s64)state->op_offsets[jump.target] - (s64)(jump.offset + 4));
+        mem_copy(list_get(state->code, jump.offset), (u8*)&rel, sizeof(rel));
+    }
+
+    mem_free(default_allocator, (u8*)targets);
+    mem_free(default_allocator, (u8*)state->op_offsets);
+    state->op_offsets = NULL;
+}
+
+// rax = allocation size, touches every page down from rsp
+static void x64_compile_stack_probe(x64_state_t *state) {
+    state->stack_probe = x64_define_symbol(state, STRING("__stack_probe"), X64_SECTION_TEXT, state->code->count);
+
+    x64_encode(state, X64_W, 0x89, X64_RSP, x64_reg(X64_R10)); // mov r10, rsp
+    x64_encode(state, X64_W, 0x29, X64_RAX, x64_reg(X64_R10)); // sub r10, rax
+    x64_alu_imm(state, 4, x64_reg(X64_R10), -(s32)PG(1));      // and r10, -4096
+    x64_lea(state, X64_RCX, x64_mem(X64_RSP, -1));
+    x64_alu_imm(state, 4, x64_reg(X64_RCX), -(s32)PG(1));
+
+    u64 loop = state->code->count;
+    x64_encode(state, X64_W, 0x39, X64_R10, x64_reg(X64_RCX)); // cmp rcx, r10
+    u64 done = x64_short_jump(state, 0x72);                    // jb
+    x64_encode(state, 0, 0x85, X64_RCX, x64_mem(X64_RCX, 0));  // test [rcx], ecx
+    x64_alu_imm(state, 5, x64_reg(X64_RCX), PG(1));
+    x64_patch_short(state, x64_short_jump(state, 0xEB), loop);
+    x64_patch_short(state, done, state->code->count);
+    x64_byte(state, 0xC3);
+}
+
+// writes output_buffer, keeps everything but rax, rcx, rdx, rsi, rdi and r11
+static void x64_compile_flush_output(x64_state_t *state, u64 output_buffer, u64 output_count) {
+    x64_lea(state, X64_RSI, x64_symbol(output_buffer, 0));
+    x64_load(state, X64_RDX, x64_symbol(output_count, 0));
+
+    u64 loop = state->code->count;
+    x64_encode(state, X64_W, 0x85, X64_RDX, x64_reg(X64_RDX)); // test rdx, rdx
+    u64 empty = x64_short_jump(state, 0x7E);                   // jle
+    x64_mov_imm(state, x64_reg(X64_RAX), 1); // write
+    x64_mov_imm(state, x64_reg(X64_RDI), 1);
+    x64_syscall(state);
+    x64_encode(state, X64_W, 0x85, X64_RAX, x64_reg(X64_RAX)); // test rax, rax
+    u64 failed = x64_short_jump(state, 0x7E);                  // jle
+    x64_encode(state, X64_W, 0x01, X64_RAX, x64_reg(X64_RSI)); // add rsi, rax
+    x64_encode(state, X64_W, 0x29, X64_RAX, x64_reg(X64_RDX)); // sub rdx, rax
+    x64_patch_short(state, x64_short_jump(state, 0xEB), loop);
+
+    x64_patch_short(state, empty,  state->code->count);
+    x64_patch_short(state, failed, state->code->count);
+    x64_encode(state, X64_W, 0x31, X64_RAX, x64_reg(X64_RAX)); // rip relative operand can't have immediate after it
+    x64_store(state, x64_symbol(output_count, 0), X64_RAX);
+    x64_byte(state, 0xC3);
+}
+
+// raw syscalls, exit code is the result of main. putchar fills output_buffer,
+// it is written when full, before reading and at exit
+static void x64_compile_linux_runtime(x64_state_t *state) {
+    u64 exec_stack  = x64_define_symbol(state, STRING("exec_stack"),  X64_SECTION_BSS, state->module->bss_size);
+    state->module->bss_size += 4096 * 8;
+    u64 char_buffer = x64_define_symbol(state, STRING("char_buffer"), X64_SECTION_BSS, state->module->bss_size);
+    state->module->bss_size += 8;
+    u64 output_count  = x64_define_symbol(state, STRING("output_count"),  X64_SECTION_BSS, state->module->bss_size);
+    state->module->bss_size += 8;
+    u64 output_buffer = x64_define_symbol(state, STRING("output_buffer"), X64_SECTION_BSS, state->module->bss_size);
+    state->module->bss_size += X64_OUTPUT_BUFFER_SIZE;
+
+    u64 flush_output = x64_define_symbol(state, STRING("flush_output"), X64_SECTION_TEXT, state->code->count);
+    x64_compile_flush_output(state, output_buffer, output_count);
+
+    u64 start = x64_define_symbol(state, STRING("_start"), X64_SECTION_TEXT, state->code->count);
+    list_get(&state->module->symbols, start)->is_global = true;
+
+    ir_function_t *main = hashmap_get(&state->ir->functions, STRING("main"));
+
+    x64_lea(state, X64_R14, x64_symbol(exec_stack, 0));
+    x64_encode(state, X64_W, 0x31, X64_R15, x64_reg(X64_R15)); // xor r15, r15
+    x64_call(state, x64_get_symbol(state, STRING("main")));
+
+    if (main == NULL || !main->register_returns) {
+        x64_pop(state, X64_RAX);
+    }
+
+    x64_encode(state, X64_W, 0x89, X64_RAX, x64_reg(X64_RBX)); // flush keeps rbx
+    x64_call(state, flush_output);
+    x64_encode(state, X64_W, 0x89, X64_RBX, x64_reg(X64_RDI));
+    x64_mov_imm(state, x64_reg(X64_RAX), 60); // exit
+    x64_syscall(state);
+
+    x64_define_symbol(state, STRING("putchar"), X64_SECTION_TEXT, state->code->count);
+    x64_pop(state, X64_RAX);
+    x64_load(state, X64_RCX, x64_symbol(output_count, 0));
+    x64_lea(state, X64_RDX, x64_symbol(output_buffer, 0));
+    x64_encode(state, X64_W, 0x01, X64_RCX, x64_reg(X64_RDX)); // add rdx, rcx
+    x64_encode(state, 0, 0x88, X64_RAX, x64_mem(X64_RDX, 0));  // mov [rdx], al
+    x64_alu_imm(state, 0, x64_reg(X64_RCX), 1);
+    x64_store(state, x64_symbol(output_count, 0), X64_RCX);
+    x64_alu_imm(state, 7, x64_reg(X64_RCX), (s32)X64_OUTPUT_BUFFER_SIZE);
+    u64 room = x64_short_jump(state, 0x72); // jb
+    x64_call(state, flush_output);
+    x64_patch_short(state, room, state->code->count);
+    x64_byte(state, 0xC3);
+
+    x64_define_symbol(state, STRING("getchar"), X64_SECTION_TEXT, state->code->count);
+    x64_call(state, flush_output);
+    x64_encode(state, X64_W, 0x31, X64_RAX, x64_reg(X64_RAX)); // read
+    x64_encode(state, X64_W, 0x31, X64_RDI, x64_reg(X64_RDI));
+    x64_lea(state, X64_RSI, x64_symbol(char_buffer, 0));
+    x64_mov_imm(state, x64_reg(X64_RDX), 1);
+    x64_syscall(state);
+    x64_alu_imm(state, 7, x64_reg(X64_RAX), 1);
+    x64_mov_imm(state, x64_reg(X64_RAX), -1); // end of input
+    u64 failed = x64_short_jump(state, 0x75);  // jne
+    x64_encode(state, X64_W, 0x0FB6, X64_RAX, x64_symbol(char_buffer, 0));
+    x64_patch_short(state, failed, state->code->count);
+    x64_push(state, X64_RAX);
+    x64_byte(state, 0xC3);
+
+    x64_define_symbol(state, STRING("debug_break"), X64_SECTION_TEXT, state->code->count);
+    x64_byte(state, 0xCC);
+    x64_byte(state, 0xC3);
+}
+
+// System V host, external is "s64 f(s64)" behind a pointer in data
+static void x64_compile_host_call(x64_state_t *state, u64 table, u64 function) {
+    x64_byte(state, 0x55);                                     // push rbp
+    x64_encode(state, X64_W, 0x89, X64_RSP, x64_reg(X64_RBP)); // mov rbp, rsp
+    x64_alu_imm(state, 4, x64_reg(X64_RSP), -16);              // and rsp, -16
+    x64_encode(state, 0, 0xFF, 2, x64_symbol(table, (s64)function * 8)); // call [table + function]
+    x64_encode(state, X64_W, 0x89, X64_RBP, x64_reg(X64_RSP)); // mov rsp, rbp
+    x64_byte(state, 0x5D);                                     // pop rbp
+}
+
+static void x64_compile_host_runtime(x64_state_t *state) {
+    u64 table = x64_define_symbol(state, STRING("__jit_host_functions"), X64_SECTION_DATA, state->module->data.count);
+
+    for (u64 i = 0; i < X64_HOST_FUNCTION_COUNT; i++) {
+        u64 zero  = 0;
+        u64 index = 0;
+
+        list_allocate(&state->module->data, sizeof(zero), &index);
+        list_fill(&state->module->data, (u8*)&zero, sizeof(zero), index);
+    }
+
+    // s64 __jit_enter(s64 *exec_stack, void *function, u64 *exec_count), result is rax of function
+    x64_define_symbol(state, STRING("__jit_enter"), X64_SECTION_TEXT, state->code->count);
+
+    x64_byte(state, 0x53);       // push rbx
+    x64_byte(state, 0x55);       // push rbp
+    x64_byte(state, 0x41); x64_byte(state, 0x54); // push r12
+    x64_byte(state, 0x41); x64_byte(state, 0x55); // push r13
+    x64_byte(state, 0x41); x64_byte(state, 0x56); // push r14
+    x64_byte(state, 0x41); x64_byte(state, 0x57); // push r15
+    x64_byte(state, 0x52);       // push rdx
+
+    x64_encode(state, X64_W, 0x89, X64_RDI, x64_reg(X64_R14));
+    x64_load(state, X64_R15, x64_mem(X64_RDX, 0));
+    x64_encode(state, 0, 0xFF, 2, x64_reg(X64_RSI)); // call rsi
+
+    x64_byte(state, 0x5A);       // pop rdx
+    x64_store(state, x64_mem(X64_RDX, 0), X64_R15);
+
+    x64_byte(state, 0x41); x64_byte(state, 0x5F);
+    x64_byte(state, 0x41); x64_byte(state, 0x5E);
+    x64_byte(state, 0x41); x64_byte(state, 0x5D);
+    x64_byte(state, 0x41); x64_byte(state, 0x5C);
+    x64_byte(state, 0x5D);
+    x64_byte(state, 0x5B);
+    x64_byte(state, 0xC3);
+
+    x64_define_symbol(state, STRING("putchar"), X64_SECTION_TEXT, state->code->count);
+    x64_pop(state, X64_RDI);
+    x64_compile_host_call(state, table, X64_HOST_PUTCHAR);
+    x64_byte(state, 0xC3);
+
+    x64_define_symbol(state, STRING("getchar"), X64_SECTION_TEXT, state->code->count);
+    x64_compile_host_call(state, table, X64_HOST_GETCHAR);
+    x64_push(state, X64_RAX);
+    x64_byte(state, 0xC3);
+
+    x64_define_symbol(state, STRING("debug_break"), X64_SECTION_TEXT, state->code->count);
+    x64_compile_host_call(state, table, X64_HOST_DEBUG_BREAK);
+    x64_byte(state, 0xC3);
+}
+
+x64_module_t x64_compile_program(ir_t *ir, u64 runtime) {
+    profiler_func_start();
+
+    x64_module_t module = {};
+    list_create(&module.text,        1024, *default_allocator);
+    list_create(&module.data,        64,   *default_allocator);
+    list_create(&module.symbols,     64,   *default_allocator);
+    list_create(&module.relocations, 256,  *default_allocator);
+    hashmap_create(&module.symbol_index, 64, NULL, NULL);
+
+    x64_state_t state = {};
+    state.ir     = ir;
+    state.module = &module;
+    state.code   = &module.text;
+    state.checked_division = runtime == X64_RUNTIME_HOST;
+    list_create(&state.jumps, 64, *default_allocator);
+
+    state.global_variables = x64_define_symbol(&state, STRING("global_variables"), X64_SECTION_DATA, 0);
+
+    for (u64 i = 0; i < ir->globals.count; i++) {
+        s64 value = ir->globals[i];
+        u64 index = 0;
+
+        list_allocate(&module.data, sizeof(value), &index);
+        list_fill(&module.data, (u8*)&value, sizeof(value), index);
+    }
+
+    x64_compile_stack_probe(&state);
+
+    if (runtime == X64_RUNTIME_LINUX) {
+        x64_compile_linux_runtime(&state);
+    } else if (runtime == X64_RUNTIME_HOST) {
+        x64_compile_host_runtime(&state);
+    }
+
+    b32 valid      = true;
+    b32 found_main = false;
+
+    for (u64 i = 0; i < ir->functions.capacity; i++) {
+        kv_pair_t<string_t, ir_function_t> *pair = ir->functions.entries + i;
+
+        if (!pair->occupied) continue;
+        if (pair->deleted)   continue;
+
+        if (string_compare(pair->key, STRING("main")) == 0) {
+            found_main = true;
+            if (pair->value.entry && pair->value.entry->return_typenames.count < 1) {
+                log_error("main should return at least one argument!");
+                valid = false;
+            }
+        }
+
+        if (pair->value.is_external) continue;
+
+        state.func = &pair->value;
+        x64_compile_func(&state, pair->key);
+    }
+
+    // loaded modules can run any function
+    if (!found_main && runtime != X64_RUNTIME_HOST) {
+        log_error("Couldn't find main in code.");
+        valid = false;
+    }
+
+    if (found_main) {
+        list_get(&module.symbols, x64_get_symbol(&state, STRING("main")))->is_global = true;
+    }
+
+    for (u64 i = 0; i < module.symbols.count; i++) {
+        x64_symbol_t *symbol = list_get(&module.symbols, i);
+
+        if (symbol->section != X64_SECTION_NONE) continue;
+
+        symbol->is_global = true;
+
+        if (runtime != X64_RUNTIME_NONE) {
+            log_error(string_format(get_temporary_allocator(), STRING("Undefined symbol '%s'"), symbol->name));
+            valid = false;
+        }
+    }
+
+    list_delete(&state.jumps);
+
+    module.is_valid = valid;
+    profiler_func_end();
+    return module;
+}
+
+void x64_module_delete(x64_module_t *module) {
+    if (module->text.data)           list_delete(&module->text);
+    if (module->data.data)           list_delete(&module->data);
+    if (module->symbols.data)        list_delete(&module->symbols);
+    if (module->relocations.data)    list_delete(&module->relocations);
+    if (module->symbol_index.entries) hashmap_delete(&module->symbol_index);
+    *module = {};
+}
+
+b32 x64_link(x64_module_t *module, u8 *text, u64 addresses[X64_SECTION_COUNT]) {
+    b32 result = true;
+
+    for (u64 i = 0; i < module->relocations.count; i++) {
+        x64_relocation_t relocation = module->relocations[i];
+        x64_symbol_t    *symbol     = list_get(&module->symbols, relocation.symbol);
+
+        if (symbol->section == X64_SECTION_NONE) {
+            log_error(string_format(get_temporary_allocator(), STRING("Undefined symbol '%s'"), symbol->name));
+            result = false;
+            continue;
+        }
+
+        s64 place = (s64)(addresses[X64_SECTION_TEXT] + relocation.offset);
+        s64 value = (s64)(addresses[symbol->section] + symbol->offset) + relocation.addend - place;
+
+        if (!fits_s32(value)) {
+            log_error(string_format(get_temporary_allocator(), STRING("Symbol '%s' is out of rel32 range"), symbol->name));
+            result = false;
+            continue;
+        }
+
+        s32 rel = (s32)value;
+        mem_copy(text + relocation.offset, (u8*)&rel, sizeof(rel));
+    }
+
+    return result;
+}